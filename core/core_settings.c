@@ -27,8 +27,9 @@ enum settings_ram_profiles
     kRamProfileMinimal       = kRamProfileS1Memory,
 };
 
-#define DEFAULT_LIBS_PATH "libs/"
-#define DEFAULT_LOG_PATH  "log/"
+#define DEFAULT_LIBS_PATH       "libs/"
+#define DEFAULT_LOG_PATH        "log/"
+#define DEFAULT_METRICS_ADDRESS "127.0.0.1"
 
 static struct core_settings_s *settings = NULL;
 
@@ -289,6 +290,27 @@ static void parseMiscPartOfJson(cJSON *misc_obj)
         {
             settings->ram_profile = DEFAULT_RAM_PROFILE;
         }
+
+        // metrics are off unless a port is given, the endpoint is local by default
+        getIntFromJsonObjectOrDefault(&(settings->metrics_port), misc_obj, "metrics-port", 0);
+        getStringFromJsonObjectOrDefault(&(settings->metrics_address), misc_obj, "metrics-address",
+                                         DEFAULT_METRICS_ADDRESS);
+        if (settings->metrics_port < 0 || settings->metrics_port > 65535)
+        {
+            fprintf(stderr, "CoreSettings: metrics-port must be in range [0 - 65535]\n");
+            exit(1);
+        }
+
+        // how much one socket may read / accept before the worker moves on to the others, 0 keeps the default
+        getIntFromJsonObjectOrDefault(&(settings->read_budget_bytes), misc_obj, "read-budget-bytes", 0);
+        getIntFromJsonObjectOrDefault(&(settings->read_budget_reads), misc_obj, "read-budget-reads", 0);
+        getIntFromJsonObjectOrDefault(&(settings->accept_budget), misc_obj, "accept-budget", 0);
+        if (settings->read_budget_bytes < 0 || settings->read_budget_reads < 0 || settings->accept_budget < 0)
+        {
+            fprintf(stderr, "CoreSettings: read-budget-bytes, read-budget-reads and accept-budget can not be "
+                            "negative\n");
+            exit(1);
+        }
     }
     else
     {
@@ -27,6 +27,11 @@ struct core_settings_s
     int   workers_count;
     int   ram_profile;
     char *libs_path;
+    char *metrics_address;
+    int   metrics_port; // 0 means no metrics
+    int   read_budget_bytes; // per wakeup io limits of the loops, 0 means the eventloop default
+    int   read_budget_reads;
+    int   accept_budget;
 
     vec_config_path_t config_paths;
 };
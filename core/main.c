@@ -2,6 +2,7 @@
 #include "core_settings.h"
 #include "hbase.h"
 #include "loggers/core_logger.h"
+#include "managers/metrics_manager.h"
 #include "managers/node_manager.h"
 #include "managers/socket_manager.h"
 #include "os_helpers.h"
@@ -43,6 +44,10 @@ int main(void)
         .dns_logger_data     = (logger_construction_data_t){.log_file_path = getCoreSettings()->dns_log_file_fullpath,
                                                             .log_level     = getCoreSettings()->dns_log_level,
                                                             .log_console   = getCoreSettings()->dns_log_console},
+        .metrics             = getCoreSettings()->metrics_port > 0,
+        .read_budget_bytes   = (unsigned int) getCoreSettings()->read_budget_bytes,
+        .read_budget_reads   = (unsigned int) getCoreSettings()->read_budget_reads,
+        .accept_budget       = (unsigned int) getCoreSettings()->accept_budget,
     };
 
     // core logger is available after ww setup
@@ -75,5 +80,9 @@ int main(void)
     }
     LOGD("Core: starting workers ...");
     startSocketManager();
+    if (getCoreSettings()->metrics_port > 0)
+    {
+        startMetricsManager(getCoreSettings()->metrics_address, getCoreSettings()->metrics_port);
+    }
     runMainThread();
 }
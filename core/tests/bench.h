@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// monotonic clocks shared by the bench_* programs, seconds for throughput and microseconds for latency samples
+
+static inline double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + ((double) ts.tv_nsec / 1e9);
+}
+
+static inline uint64_t nowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000) + ((uint64_t) ts.tv_nsec / 1000);
+}
@@ -0,0 +1,138 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "hloop.h"
+#include "hsocket.h"
+#include "hthread.h"
+#include "loggers/network_logger.h"
+#include "managers/socket_manager.h"
+#include "ww.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+    tcp accept benchmark, accept thread vs per worker SO_REUSEPORT listeners
+
+    two acceptors are registered on the socket manager, one in the default mode (the accept thread
+    accepts and posts the socket to a worker) and one with reuse_port (every worker accepts on its
+    own socket), client threads open and reset connections to each port for a while, the server side
+    only counts and closes what it accepted
+
+    reports accepted connections/sec and how they were spread between the workers
+*/
+
+#define WORKERS        4
+#define CLIENT_THREADS 4
+#define PHASE_SECONDS  3
+#define PORT_THREAD    18431
+#define PORT_REUSE     18432
+
+static hloop_t     *bench_loops[WORKERS];
+static hthread_t    worker_threads[WORKERS];
+static atomic_ulong accepted[WORKERS];
+static atomic_bool  phase_running;
+static uint16_t     phase_port;
+
+static void onAccepted(hevent_t *ev)
+{
+    socket_accept_result_t *data = (socket_accept_result_t *) hevent_userdata(ev);
+    hio_attach(ev->loop, data->io);
+    atomic_fetch_add(&accepted[data->tid], 1);
+    hio_close(data->io);
+    destroySocketAcceptResult(data);
+}
+
+static HTHREAD_ROUTINE(workerThread)
+{
+    hloop_run((hloop_t *) userdata);
+    return 0;
+}
+
+static HTHREAD_ROUTINE(clientThread)
+{
+    (void) userdata;
+    sockaddr_u addr;
+    sockaddr_set_ipport(&addr, "127.0.0.1", phase_port);
+    while (atomic_load(&phase_running))
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        // reset on close, so the client side does not run out of ports in TIME_WAIT
+        so_linger(fd, 0);
+        if (connect(fd, &addr.sa, sockaddr_len(&addr)) == 0)
+        {
+            closesocket(fd);
+            continue;
+        }
+        closesocket(fd);
+    }
+    return 0;
+}
+
+static void runPhase(const char *name, uint16_t port)
+{
+    for (int i = 0; i < WORKERS; i++)
+    {
+        atomic_store(&accepted[i], 0);
+    }
+    phase_port = port;
+    atomic_store(&phase_running, true);
+
+    hthread_t clients[CLIENT_THREADS];
+    double    start = now();
+    for (int i = 0; i < CLIENT_THREADS; i++)
+    {
+        clients[i] = hthread_create(clientThread, NULL);
+    }
+    hv_sleep(PHASE_SECONDS);
+    atomic_store(&phase_running, false);
+    for (int i = 0; i < CLIENT_THREADS; i++)
+    {
+        hthread_join(clients[i]);
+    }
+    hv_msleep(100); // let the workers drain what is already accepted
+    double elapsed = now() - start;
+
+    unsigned long total = 0;
+    printf("%-14s per worker:", name);
+    for (int i = 0; i < WORKERS; i++)
+    {
+        unsigned long count = atomic_load(&accepted[i]);
+        total += count;
+        printf(" %lu", count);
+    }
+    printf("  conns/sec: %.0f\n", (double) total / elapsed);
+}
+
+int main(void)
+{
+    createNetworkLogger("bench_accept.log", false);
+    ram_profile   = kRamProfileM1Memory;
+    workers_count = WORKERS;
+    loops         = bench_loops;
+    buffer_pools  = malloc(sizeof(buffer_pool_t *) * WORKERS);
+    for (unsigned int i = 0; i < WORKERS; i++)
+    {
+        buffer_pools[i] = createSmallBufferPool();
+        loops[i]        = hloop_new(HLOOP_FLAG_AUTO_FREE, buffer_pools[i], (long) i);
+        worker_threads[i] = hthread_create(workerThread, loops[i]);
+    }
+
+    createSocketManager();
+    static tunnel_t        dummy_tunnel;
+    socket_filter_option_t option = {.host              = "127.0.0.1",
+                                     .protocol          = kSapTcp,
+                                     .multiport_backend = kMultiportBackendNothing,
+                                     .port_min          = PORT_THREAD,
+                                     .port_max          = PORT_THREAD};
+    registerSocketAcceptor(&dummy_tunnel, option, onAccepted);
+    option.port_min   = PORT_REUSE;
+    option.port_max   = PORT_REUSE;
+    option.reuse_port = true;
+    registerSocketAcceptor(&dummy_tunnel, option, onAccepted);
+    startSocketManager();
+    hv_msleep(200); // listeners are created asynchronously
+
+    runPhase("accept thread", PORT_THREAD);
+    runPhase("reuseport", PORT_REUSE);
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "ww.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+/*
+    buffer pool benchmark, heap mode vs slab mode
+
+    simulates bursts of 50k concurrent lines that each hold 1 buffer, the whole burst is released
+    and opened again, so the pool recharges and shrinks all the time
+
+    run `bench_buffer_pool heap` and `bench_buffer_pool slab` separately since peak rss is per process
+
+    after the bursts the pool stays almost idle for a few seconds with a trickle of traffic, the rss at the
+    end shows how much memory was really given back
+*/
+
+#define LINES  50000
+#define ROUNDS 40
+
+static long currentRssKB(void)
+{
+    long  pages = 0;
+    FILE *f     = fopen("/proc/self/statm", "r");
+    if (f)
+    {
+        if (fscanf(f, "%*s %ld", &pages) != 1)
+        {
+            pages = 0;
+        }
+        fclose(f);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+int main(int argc, char **argv)
+{
+    ram_profile = kRamProfileL2Memory;
+
+    const bool     slab = argc > 1 && strcmp(argv[1], "slab") == 0;
+    buffer_pool_t *pool = slab ? createSlabBufferPool() : createHeapBufferPool();
+
+    shift_buffer_t **lines = malloc(sizeof(shift_buffer_t *) * LINES);
+    size_t           ops   = 0;
+
+    double start = now();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        for (int i = 0; i < LINES; i++)
+        {
+            lines[i] = popBuffer(pool);
+            setLen(lines[i], 64);
+            memset(rawBufMut(lines[i]), (int) i, 64);
+        }
+        // release in a scattered order, like real connections closing
+        for (int i = 0; i < LINES; i++)
+        {
+            int j = (int) (((unsigned int) i * 7919U) % LINES);
+            if (lines[j])
+            {
+                reuseBuffer(pool, lines[j]);
+                lines[j] = NULL;
+            }
+        }
+        for (int i = 0; i < LINES; i++)
+        {
+            if (lines[i])
+            {
+                reuseBuffer(pool, lines[i]);
+                lines[i] = NULL;
+            }
+        }
+        ops += 2 * LINES;
+    }
+    double elapsed = now() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    // trickle traffic after the grace period of the slabs
+    sleep(6);
+    for (int r = 0; r < 64; r++)
+    {
+        for (int i = 0; i < 1024; i++)
+        {
+            lines[i] = popBuffer(pool);
+        }
+        for (int i = 0; i < 1024; i++)
+        {
+            reuseBuffer(pool, lines[i]);
+        }
+    }
+
+    printf("mode: %s\n", slab ? "slab" : "heap");
+    printf("pop+reuse ops/sec: %.0f\n", (double) ops / elapsed);
+    printf("peak rss: %ld KB\n", usage.ru_maxrss);
+    printf("rss after bursts: %ld KB\n", currentRssKB());
+
+    free(lines);
+    return 0;
+}
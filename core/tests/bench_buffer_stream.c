@@ -0,0 +1,135 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "buffer_stream.h"
+#include "shiftbuffer.h"
+#include "ww.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    buffer stream framing benchmark
+
+    a stream is fed CHUNK_SIZE buffers (what a tcp read hands over) that carry frames with a 4 byte length
+    header, every frame is taken out and handed on, for a few frame sizes
+
+        full read   what the framed tunnels used to do, read the whole stream into one buffer to look at the
+                    header, push it back, then bufferStreamRead the frame (merges the chunks it spans)
+        chunked     view the header, skip it and take the frame with bufferStreamReadChunk, the chunks are
+                    handed on as they are, only the one the frame ends in is sliced
+
+    reports MB/s of frame payload
+*/
+
+#define CHUNK_SIZE   (16 * 1024)
+#define HEADER_SIZE  4
+#define STREAM_BYTES (256UL * 1024 * 1024)
+
+static buffer_pool_t *pool;
+static unsigned long  sink;
+
+// writes the frames into chunks, carries the frame position over from the last chunk
+static shift_buffer_t *nextChunk(size_t frame_size, size_t *frame_pos)
+{
+    shift_buffer_t *buf = popBuffer(pool);
+    reserveBufSpace(buf, CHUNK_SIZE);
+    setLen(buf, CHUNK_SIZE);
+    uint8_t *p = rawBufMut(buf);
+    memset(p, 'w', CHUNK_SIZE);
+    for (size_t i = 0; i < CHUNK_SIZE;)
+    {
+        if (*frame_pos < HEADER_SIZE)
+        {
+            p[i] = (uint8_t) (frame_size >> (8 * (HEADER_SIZE - 1 - *frame_pos)));
+            *frame_pos += 1;
+            i += 1;
+            continue;
+        }
+        // skip the frame body, it is all 'w' already
+        const size_t left = HEADER_SIZE + frame_size - *frame_pos;
+        const size_t step = left < CHUNK_SIZE - i ? left : CHUNK_SIZE - i;
+        *frame_pos        = step == left ? 0 : *frame_pos + step;
+        i += step;
+    }
+    return buf;
+}
+
+static size_t frameLen(const uint8_t *header)
+{
+    return ((size_t) header[0] << 24) | ((size_t) header[1] << 16) | ((size_t) header[2] << 8) | header[3];
+}
+
+static void handOn(shift_buffer_t *buf)
+{
+    sink += bufLen(buf) + ((uint8_t *) rawBuf(buf))[0];
+    reuseBuffer(pool, buf);
+}
+
+static void drainFullRead(buffer_stream_t *bs)
+{
+    while (bufferStreamLen(bs) > HEADER_SIZE)
+    {
+        shift_buffer_t *all = bufferStreamFullRead(bs);
+        const size_t    len = frameLen(rawBuf(all));
+        bufferStreamPush(bs, all);
+        if (bufferStreamLen(bs) < HEADER_SIZE + len)
+        {
+            return;
+        }
+        shift_buffer_t *frame = bufferStreamRead(bs, HEADER_SIZE + len);
+        shiftr(frame, HEADER_SIZE);
+        handOn(frame);
+    }
+}
+
+static void drainChunked(buffer_stream_t *bs)
+{
+    while (bufferStreamLen(bs) > HEADER_SIZE)
+    {
+        uint8_t header[HEADER_SIZE];
+        bufferStreamViewBytesAt(bs, 0, header, HEADER_SIZE);
+        size_t len = frameLen(header);
+        if (bufferStreamLen(bs) < HEADER_SIZE + len)
+        {
+            return;
+        }
+        bufferStreamSkip(bs, HEADER_SIZE);
+        while (len > 0)
+        {
+            shift_buffer_t *piece = bufferStreamReadChunk(bs, len);
+            len -= bufLen(piece);
+            handOn(piece);
+        }
+    }
+}
+
+static double run(size_t frame_size, void (*drain)(buffer_stream_t *))
+{
+    buffer_stream_t *bs        = newBufferStream(pool);
+    size_t           frame_pos = 0;
+    const double     start     = now();
+    for (size_t fed = 0; fed < STREAM_BYTES; fed += CHUNK_SIZE)
+    {
+        bufferStreamPush(bs, nextChunk(frame_size, &frame_pos));
+        drain(bs);
+    }
+    const double elapsed = now() - start;
+    destroyBufferStream(bs);
+    return ((double) STREAM_BYTES * frame_size / (frame_size + HEADER_SIZE)) / elapsed / (1024 * 1024);
+}
+
+int main(void)
+{
+    ram_profile = kRamProfileM1Memory;
+
+    pool                       = createHeapBufferPool();
+    const size_t frame_sizes[] = {1024, 4096, 16384, 65536};
+    for (unsigned int i = 0; i < sizeof(frame_sizes) / sizeof(frame_sizes[0]); i++)
+    {
+        double full    = run(frame_sizes[i], drainFullRead);
+        double chunked = run(frame_sizes[i], drainChunked);
+        printf("frame: %-6zu  full read: %8.0f MB/s  chunked: %8.0f MB/s\n", frame_sizes[i], full, chunked);
+    }
+    printf("(%lu)\n", sink & 0x1);
+    return 0;
+}
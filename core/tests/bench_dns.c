@@ -0,0 +1,386 @@
+#include "async_dns.h"
+#include "bench.h"
+#include "buffer_pool.h"
+#include "hloop.h"
+#include "hthread.h"
+#include "loggers/dns_logger.h"
+#include "ww.h"
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    async dns resolver benchmark / test
+
+    a stand-in dns server runs on its own thread on 127.0.0.1 (random port) and answers by name:
+        slowN.test   A record after 200 ms
+        nx.test      nxdomain with a soa
+        v6only.test  only an AAAA record
+        spoof.test   a forged answer (same id, other question name, A 6.6.6.6) right before the real one
+        tc.test      the first answer is truncated (tc set, no records)
+        anything     A record 10.0.0.N, no AAAA
+
+    the worker loop resolves many lines at once while a 10 ms timer measures how long the loop was
+    stalled, the old resolveContextSync would block the loop for the whole 200 ms of every domain
+*/
+
+#define DOMAINS        50
+#define LINES_PER_NAME 20
+#define SERVER_DELAY   200 // ms
+
+enum phases
+{
+    kPhaseCold,
+    kPhaseCached,
+    kPhaseNegative,
+    kPhaseV6,
+    kPhaseSpoof,
+    kPhaseTruncated,
+    kPhaseDone
+};
+
+static hloop_t         *loop;
+static atomic_int       server_queries;
+static atomic_bool      server_stop;
+static int              server_fd;
+static sockaddr_u       server_addr;
+static socket_context_t lines[DOMAINS * LINES_PER_NAME];
+static dns_waiter_t    *waiters[DOMAINS * LINES_PER_NAME];
+static char             names[DOMAINS][32];
+static char             nx_name[] = "nx.test";
+static int              pending;
+static int              resolved;
+static int              failed;
+static int              phase;
+static int              failures;
+static uint64_t         last_tick_ms;
+static uint64_t         max_stall_ms;
+static double           phase_start;
+static int              phase_queries;
+static bool             truncated_sent;
+
+static void check(bool ok, const char *what)
+{
+    printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+    failures += ok ? 0 : 1;
+}
+
+/* ---------------- stand-in server ---------------- */
+
+typedef struct delayed_s
+{
+    double                  send_at;
+    unsigned char           msg[512];
+    int                     len;
+    struct sockaddr_storage peer;
+    socklen_t               peer_len;
+} delayed_t;
+
+static int buildAnswer(const unsigned char *q, int qlen, unsigned char *out, bool *slow, bool *spoof)
+{
+    char name[256] = {0};
+    int  pos       = 12;
+    int  npos      = 0;
+    while (pos < qlen && q[pos] != 0)
+    {
+        int l = q[pos++];
+        if (npos)
+        {
+            name[npos++] = '.';
+        }
+        memcpy(name + npos, q + pos, l);
+        npos += l;
+        pos += l;
+    }
+    pos += 1;
+    const int qtype = (q[pos] << 8) | q[pos + 1];
+    pos += 4;
+
+    memcpy(out, q, pos);
+    out[2] = 0x81; // qr, rd
+    out[3] = 0x80; // ra
+    out[6] = out[7] = out[8] = out[9] = out[10] = out[11] = 0;
+    *slow  = strncmp(name, "slow", 4) == 0;
+    *spoof = strcmp(name, "spoof.test") == 0;
+    if (strcmp(name, "tc.test") == 0 && ! truncated_sent)
+    {
+        truncated_sent = true;
+        out[2] |= 0x02;
+        return pos;
+    }
+
+    unsigned char rr[64];
+    int           rrlen = 0;
+    rr[0]               = 0xC0;
+    rr[1]               = 12;
+    if (strcmp(name, "nx.test") == 0)
+    {
+        out[3] |= 3;
+        out[9] = 1; // soa in authority, minimum 7
+        rrlen  = 2;
+        // type, class, ttl 60, rdlen, root mname, root rname, serial, refresh, retry, expire, minimum
+        const unsigned char soa[] = {0, 6, 0, 1, 0, 0, 0, 60, 0, 22, 0, 0, 0, 0, 0, 1, 0, 0,
+                                     0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 7};
+        memcpy(rr + rrlen, soa, sizeof(soa));
+        rrlen += (int) sizeof(soa);
+    }
+    else if (qtype == 28 && strcmp(name, "v6only.test") == 0)
+    {
+        out[7] = 1;
+        const unsigned char aaaa[] = {0, 28, 0, 1, 0, 0, 1, 44, 0, 16, 0, 0, 0, 0,
+                                      0, 0,  0, 0, 0, 0, 0, 0, 0, 0,  0, 1}; // ::1
+        memcpy(rr + 2, aaaa, sizeof(aaaa));
+        rrlen = 2 + (int) sizeof(aaaa);
+    }
+    else if (qtype == 1 && strcmp(name, "v6only.test") != 0)
+    {
+        out[7] = 1;
+        const unsigned char a[] = {0, 1, 0, 1, 0, 0, 1, 44, 0, 4, 10, 0, 0, (unsigned char) (npos & 0xFF)};
+        memcpy(rr + 2, a, sizeof(a));
+        rrlen = 2 + (int) sizeof(a);
+    }
+    memcpy(out + pos, rr, rrlen);
+    return pos + rrlen;
+}
+
+static HTHREAD_ROUTINE(serverThread)
+{
+    (void) userdata;
+    static delayed_t delayed[DOMAINS * 2];
+    int              delayed_count = 0;
+
+    while (! atomic_load(&server_stop))
+    {
+        struct pollfd pfd = {.fd = server_fd, .events = POLLIN};
+        poll(&pfd, 1, 5);
+
+        if (pfd.revents & POLLIN)
+        {
+            unsigned char q[512];
+            delayed_t     d = {.peer_len = sizeof(struct sockaddr_storage)};
+            int qlen = (int) recvfrom(server_fd, q, sizeof(q), 0, (struct sockaddr *) &d.peer, &d.peer_len);
+            if (qlen > 12)
+            {
+                atomic_fetch_add(&server_queries, 1);
+                bool slow  = false;
+                bool spoof = false;
+                d.len      = buildAnswer(q, qlen, d.msg, &slow, &spoof);
+                if (spoof)
+                {
+                    // what an off path attacker that guessed the id would send, for another name
+                    delayed_t forged = d;
+                    forged.msg[13]   = 'x';
+                    memset(forged.msg + forged.len - 4, 6, 4);
+                    sendto(server_fd, forged.msg, forged.len, 0, (struct sockaddr *) &forged.peer, forged.peer_len);
+                }
+                d.send_at = now() + (slow ? SERVER_DELAY / 1000.0 : 0);
+                delayed[delayed_count++] = d;
+            }
+        }
+        for (int i = 0; i < delayed_count; i++)
+        {
+            if (delayed[i].send_at <= now())
+            {
+                sendto(server_fd, delayed[i].msg, delayed[i].len, 0, (struct sockaddr *) &delayed[i].peer,
+                       delayed[i].peer_len);
+                delayed[i--] = delayed[--delayed_count];
+            }
+        }
+    }
+    return 0;
+}
+
+/* ---------------- resolver side ---------------- */
+
+static void startPhase(void);
+static void onResolved(socket_context_t *sctx, bool success, void *userdata);
+
+static void setLine(socket_context_t *sctx, char *name, enum domain_strategy strategy)
+{
+    *sctx = (socket_context_t){.address_type    = kSatDomainName,
+                               .domain          = name,
+                               .domain_len      = (unsigned int) strlen(name),
+                               .domain_constant = true,
+                               .domain_strategy = strategy};
+    sctx->address.sin.sin_port = htons(443);
+}
+
+static void finishPhase(void)
+{
+    const double elapsed = now() - phase_start;
+    switch (phase)
+    {
+    case kPhaseCold:
+        printf("cold: %d lines, %d domains in %.0f ms, server queries: %d, max loop stall: %lu ms\n",
+               DOMAINS * LINES_PER_NAME, DOMAINS, elapsed * 1000, atomic_load(&server_queries),
+               (unsigned long) max_stall_ms);
+        check(resolved == DOMAINS * LINES_PER_NAME, "every line resolved");
+        check(atomic_load(&server_queries) == DOMAINS, "one query per domain (waiters share it)");
+        check(max_stall_ms < SERVER_DELAY / 2, "loop kept running while resolving");
+        check(lines[0].address.sa.sa_family == AF_INET && ntohs(lines[0].address.sin.sin_port) == 443,
+              "port of the context kept");
+        break;
+    case kPhaseCached:
+        check(resolved == DOMAINS * LINES_PER_NAME, "second round served by the cache");
+        check(atomic_load(&server_queries) == DOMAINS, "no query for cached domains");
+        break;
+    case kPhaseNegative: {
+        check(failed == 1, "nxdomain failed");
+        // nxdomain covers both ip versions, the second look must be answered by the cache
+        const int queries = atomic_load(&server_queries);
+        setLine(&lines[0], nx_name, kDsPreferIpV6);
+        check(resolveContextAsync(&lines[0], 0, onResolved, NULL, &waiters[0]) == kDrsFailed &&
+                  atomic_load(&server_queries) == queries,
+              "nxdomain cached for both ip versions");
+        break;
+    }
+    case kPhaseV6:
+        check(resolved == 1 && lines[0].address.sa.sa_family == AF_INET6, "prefer v4 falls back to v6");
+        break;
+    case kPhaseSpoof:
+        check(resolved == 1 && ((const unsigned char *) &lines[0].address.sin.sin_addr)[0] == 10,
+              "answer for another question name ignored");
+        break;
+    case kPhaseTruncated:
+        check(resolved == 1 && atomic_load(&server_queries) - phase_queries == 2,
+              "truncated answer not cached, next attempt resolved");
+        break;
+    default:
+        break;
+    }
+    phase += 1;
+    startPhase();
+}
+
+static void onResolved(socket_context_t *sctx, bool success, void *userdata)
+{
+    (void) sctx;
+    waiters[(intptr_t) userdata] = NULL;
+    success ? resolved++ : failed++;
+    if (--pending == 0)
+    {
+        finishPhase();
+    }
+}
+
+static void resolveAll(int count)
+{
+    pending = count;
+    for (int i = 0; i < count; i++)
+    {
+        switch (resolveContextAsync(&lines[i], 0, onResolved, (void *) (intptr_t) i, &waiters[i]))
+        {
+        case kDrsResolved:
+            resolved++;
+            pending--;
+            break;
+        case kDrsFailed:
+            failed++;
+            pending--;
+            break;
+        case kDrsPending:
+            break;
+        }
+    }
+    if (pending == 0)
+    {
+        finishPhase();
+    }
+}
+
+static void startPhase(void)
+{
+    resolved      = 0;
+    failed        = 0;
+    phase_start   = now();
+    phase_queries = atomic_load(&server_queries);
+    switch (phase)
+    {
+    case kPhaseCold:
+    case kPhaseCached:
+        for (int i = 0; i < DOMAINS * LINES_PER_NAME; i++)
+        {
+            setLine(&lines[i], names[i % DOMAINS], kDsPreferIpV4);
+        }
+        resolveAll(DOMAINS * LINES_PER_NAME);
+        break;
+    case kPhaseNegative:
+        setLine(&lines[0], nx_name, kDsPreferIpV4);
+        resolveAll(1);
+        break;
+    case kPhaseV6: {
+        static char v6[] = "v6only.test";
+        setLine(&lines[0], v6, kDsPreferIpV4);
+        resolveAll(1);
+        break;
+    }
+    case kPhaseSpoof: {
+        static char spoof[] = "spoof.test";
+        setLine(&lines[0], spoof, kDsOnlyIpV4);
+        resolveAll(1);
+        break;
+    }
+    case kPhaseTruncated: {
+        static char tc[] = "tc.test";
+        setLine(&lines[0], tc, kDsOnlyIpV4);
+        resolveAll(1);
+        break;
+    }
+    default:
+        printf("%s\n", failures == 0 ? "all passed" : "some checks failed");
+        hloop_stop(loop);
+        break;
+    }
+}
+
+static void onTick(htimer_t *timer)
+{
+    (void) timer;
+    const uint64_t t = hloop_now_ms(loop);
+    if (last_tick_ms != 0 && t - last_tick_ms > max_stall_ms)
+    {
+        max_stall_ms = t - last_tick_ms;
+    }
+    last_tick_ms = t;
+}
+
+static void onStart(htimer_t *timer)
+{
+    (void) timer;
+    startPhase();
+}
+
+int main(void)
+{
+    server_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_set_ipport(&server_addr, "127.0.0.1", 0);
+    bind(server_fd, &server_addr.sa, sockaddr_len(&server_addr));
+    socklen_t len = sizeof(server_addr);
+    getsockname(server_fd, &server_addr.sa, &len);
+    hthread_t server = hthread_create(serverThread, NULL);
+
+    for (int i = 0; i < DOMAINS; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "slow%d.test", i);
+    }
+
+    createDnsLogger("bench_dns.log", false);
+    ram_profile      = kRamProfileM1Memory;
+    workers_count    = 1;
+    loop             = hloop_new(0, createSmallBufferPool(), 0);
+    loops            = &loop;
+    dns_resolvers    = malloc(sizeof(dns_resolver_t *));
+    dns_resolvers[0] = newDnsResolver(loop);
+    setDnsResolverServers(dns_resolvers[0], &server_addr, 1);
+
+    htimer_add(loop, onTick, 10, INFINITE);
+    htimer_add(loop, onStart, 50, 1);
+    hloop_run(loop);
+
+    atomic_store(&server_stop, true);
+    hthread_join(server);
+    destroyDnsResolver(dns_resolvers[0]);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,1024 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+    end to end benchmark harness
+
+    runs a built Waterwall binary with generated configs for the common chains over loopback and drives
+    them with its own load generator, the other end of every chain is an echo server of the harness (the sink)
+
+        tcp         TcpListener -> TcpConnector
+        tls         OpenSSLClient / OpenSSLServer pair
+        grpc        ProtoBufClient + Http2Client / Http2Server + ProtoBufServer pair
+        reality     RealityClient / RealityServer pair (the fallback site is a tls chain of the same instance)
+        halfduplex  HalfDuplexClient / HalfDuplexServer pair
+        reverse     ReverseServer / ReverseClient pair, joined with Bridges like examples/tunnel/reverse
+        udp         UdpListener -> UdpConnector
+
+    both sides of a pair run in one Waterwall process, their nodes are joined into one config (Waterwall runs only
+    the first config of core.json), for every chain it measures
+
+        latency     1 connection, MESSAGE_SIZE ping pong, p50 / p99 of the round trip
+        throughput  STREAMS connections stream to the echo and read it back, the echoed bytes count (gbps)
+        connect     CONNECT_THREADS threads open a connection, ping once and close it (connections per second)
+        rss         VmRSS / VmHWM of the Waterwall process after the load
+
+    and prints one json object per chain and line on stdout (the progress goes to stderr), so the output can be
+    appended to a file per commit and compared, --tag is copied into every line (for example the commit hash)
+
+        bench_e2e [--waterwall ./Waterwall] [--only tls] [--seconds 3] [--workers 1] [--base-port 23000]
+                  [--workdir bench_e2e_work] [--tag label]
+
+    tls and reality need the openssl command to create a self signed certificate, they are skipped without
+    it, the generated configs and the output of every run are kept in <workdir>/<chain>/
+
+    linux only, build it with the cmake option BUILD_BENCH_E2E (next to the Waterwall binary)
+*/
+
+#define MESSAGE_SIZE     64
+#define STREAMS          8
+#define STREAM_CHUNK     (64 * 1024)
+#define STREAM_WINDOW    (1024 * 1024)
+#define CONNECT_THREADS  4
+#define DATAGRAM_SIZE    1200
+#define DATAGRAM_WINDOW  32
+#define MAX_SAMPLES      (1 << 20)
+#define READY_TIMEOUT_MS 10000
+#define IO_TIMEOUT_MS    2000
+
+enum chain_ports
+{
+    kPortEntry,
+    kPortHop,
+    kPortSite,
+    kPortsPerChain = 10
+};
+
+typedef struct chain_s
+{
+    const char *name;
+    bool        udp;
+    bool        needs_cert;
+    // the nodes of each side, printf formats, %1$d entry port, %2$d hop port, %3$d fallback site port, %4$d sink
+    // port, %5$s cert dir
+    const char *nodes[3];
+
+} chain_t;
+
+typedef struct options_s
+{
+    const char  *waterwall;
+    const char  *only;
+    const char  *workdir;
+    const char  *tag;
+    unsigned int seconds;
+    unsigned int workers;
+    int          base_port;
+
+} options_t;
+
+typedef struct result_s
+{
+    bool     ok;
+    char     error[256];
+    double   gbps;
+    double   connections_per_sec;
+    uint64_t connect_errors;
+    double   latency_p50_us;
+    double   latency_p99_us;
+    uint64_t latency_samples;
+    uint64_t lost;
+    long     rss_kb;
+    long     peak_rss_kb;
+
+} result_t;
+
+typedef struct load_job_s
+{
+    int       port;
+    double    deadline;
+    uint64_t  count;
+    uint64_t  errors;
+    pthread_t thread;
+
+} load_job_t;
+
+static const chain_t kChains[] = {
+    {.name    = "tcp",
+     .nodes   = {"{\"name\":\"tcp_in\",\"type\":\"TcpListener\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%1$d,\"nodelay\":true},\"next\":\"tcp_out\"},"
+                 "{\"name\":\"tcp_out\",\"type\":\"TcpConnector\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%4$d,\"nodelay\":true}}"}},
+
+    {.name       = "tls",
+     .needs_cert = true,
+     .nodes      = {"{\"name\":\"c_in\",\"type\":\"TcpListener\","
+                    "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%1$d,\"nodelay\":true},\"next\":\"c_tls\"},"
+                    "{\"name\":\"c_tls\",\"type\":\"OpenSSLClient\","
+                    "\"settings\":{\"sni\":\"bench.local\",\"verify\":false,\"alpn\":\"http/1.1\"},\"next\":\"c_out\"},"
+                    "{\"name\":\"c_out\",\"type\":\"TcpConnector\","
+                    "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%2$d,\"nodelay\":true}}",
+
+                    "{\"name\":\"s_in\",\"type\":\"TcpListener\","
+                    "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%2$d,\"nodelay\":true},\"next\":\"s_tls\"},"
+                    "{\"name\":\"s_tls\",\"type\":\"OpenSSLServer\","
+                    "\"settings\":{\"cert-file\":\"%5$s/cert.pem\",\"key-file\":\"%5$s/key.pem\","
+                    "\"alpns\":[{\"value\":\"http/1.1\",\"next\":\"node->next\"}]},\"next\":\"s_out\"},"
+                    "{\"name\":\"s_out\",\"type\":\"TcpConnector\","
+                    "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%4$d,\"nodelay\":true}}"}},
+
+    {.name    = "grpc",
+     .nodes   = {"{\"name\":\"c_in\",\"type\":\"TcpListener\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%1$d,\"nodelay\":true},\"next\":\"c_pb\"},"
+                 "{\"name\":\"c_pb\",\"type\":\"ProtoBufClient\",\"settings\":{},\"next\":\"c_h2\"},"
+                 "{\"name\":\"c_h2\",\"type\":\"Http2Client\","
+                 "\"settings\":{\"host\":\"bench.local\",\"port\":%2$d,\"path\":\"/bench.Tunnel/Stream\","
+                 "\"scheme\":\"http\",\"content-type\":\"application/grpc\"},\"next\":\"c_out\"},"
+                 "{\"name\":\"c_out\",\"type\":\"TcpConnector\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%2$d,\"nodelay\":true}}",
+
+                 "{\"name\":\"s_in\",\"type\":\"TcpListener\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%2$d,\"nodelay\":true},\"next\":\"s_h2\"},"
+                 "{\"name\":\"s_h2\",\"type\":\"Http2Server\",\"settings\":{},\"next\":\"s_pb\"},"
+                 "{\"name\":\"s_pb\",\"type\":\"ProtoBufServer\",\"settings\":{},\"next\":\"s_out\"},"
+                 "{\"name\":\"s_out\",\"type\":\"TcpConnector\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%4$d,\"nodelay\":true}}"}},
+
+    {.name       = "reality",
+     .needs_cert = true,
+     .nodes      = {"{\"name\":\"c_in\",\"type\":\"TcpListener\","
+                    "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%1$d,\"nodelay\":true},\"next\":\"c_reality\"},"
+                    "{\"name\":\"c_reality\",\"type\":\"RealityClient\","
+                    "\"settings\":{\"sni\":\"bench.local\",\"password\":\"benchpassword\",\"verify\":false},"
+                    "\"next\":\"c_out\"},"
+                    "{\"name\":\"c_out\",\"type\":\"TcpConnector\","
+                    "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%2$d,\"nodelay\":true}}",
+
+                    "{\"name\":\"s_in\",\"type\":\"TcpListener\","
+                    "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%2$d,\"nodelay\":true},\"next\":\"s_reality\"},"
+                    "{\"name\":\"s_reality\",\"type\":\"RealityServer\","
+                    "\"settings\":{\"password\":\"benchpassword\",\"destination\":\"s_site_out\"},\"next\":\"s_out\"},"
+                    "{\"name\":\"s_site_out\",\"type\":\"TcpConnector\","
+                    "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%3$d,\"nodelay\":true}},"
+                    "{\"name\":\"s_out\",\"type\":\"TcpConnector\","
+                    "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%4$d,\"nodelay\":true}}",
+
+                    "{\"name\":\"site_in\",\"type\":\"TcpListener\","
+                    "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%3$d,\"nodelay\":true},\"next\":\"site_tls\"},"
+                    "{\"name\":\"site_tls\",\"type\":\"OpenSSLServer\","
+                    "\"settings\":{\"cert-file\":\"%5$s/cert.pem\",\"key-file\":\"%5$s/key.pem\"},"
+                    "\"next\":\"site_out\"},"
+                    "{\"name\":\"site_out\",\"type\":\"TcpConnector\","
+                    "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%4$d,\"nodelay\":true}}"}},
+
+    {.name    = "halfduplex",
+     .nodes   = {"{\"name\":\"c_in\",\"type\":\"TcpListener\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%1$d,\"nodelay\":true},\"next\":\"c_hd\"},"
+                 "{\"name\":\"c_hd\",\"type\":\"HalfDuplexClient\",\"settings\":{},\"next\":\"c_out\"},"
+                 "{\"name\":\"c_out\",\"type\":\"TcpConnector\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%2$d,\"nodelay\":true}}",
+
+                 "{\"name\":\"s_in\",\"type\":\"TcpListener\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%2$d,\"nodelay\":true},\"next\":\"s_hd\"},"
+                 "{\"name\":\"s_hd\",\"type\":\"HalfDuplexServer\",\"settings\":{},\"next\":\"s_out\"},"
+                 "{\"name\":\"s_out\",\"type\":\"TcpConnector\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%4$d,\"nodelay\":true}}"}},
+
+    {.name    = "reverse",
+     .nodes   = {"{\"name\":\"s_users_in\",\"type\":\"TcpListener\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%1$d,\"nodelay\":true},\"next\":\"s_bridge2\"},"
+                 "{\"name\":\"s_bridge2\",\"type\":\"Bridge\",\"settings\":{\"pair\":\"s_bridge1\"}},"
+                 "{\"name\":\"s_bridge1\",\"type\":\"Bridge\",\"settings\":{\"pair\":\"s_bridge2\"}},"
+                 "{\"name\":\"s_reverse\",\"type\":\"ReverseServer\",\"settings\":{},\"next\":\"s_bridge1\"},"
+                 "{\"name\":\"s_reverse_in\",\"type\":\"TcpListener\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%2$d,\"nodelay\":true},\"next\":\"s_reverse\"}",
+
+                 "{\"name\":\"c_out\",\"type\":\"TcpConnector\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%4$d,\"nodelay\":true}},"
+                 "{\"name\":\"c_bridge1\",\"type\":\"Bridge\",\"settings\":{\"pair\":\"c_bridge2\"},"
+                 "\"next\":\"c_out\"},"
+                 "{\"name\":\"c_bridge2\",\"type\":\"Bridge\",\"settings\":{\"pair\":\"c_bridge1\"},"
+                 "\"next\":\"c_reverse\"},"
+                 "{\"name\":\"c_reverse\",\"type\":\"ReverseClient\",\"settings\":{\"minimum-unused\":16},"
+                 "\"next\":\"c_to_server\"},"
+                 "{\"name\":\"c_to_server\",\"type\":\"TcpConnector\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%2$d,\"nodelay\":true}}"}},
+
+    {.name    = "udp",
+     .udp     = true,
+     .nodes   = {"{\"name\":\"udp_in\",\"type\":\"UdpListener\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%1$d},\"next\":\"udp_out\"},"
+                 "{\"name\":\"udp_out\",\"type\":\"UdpConnector\","
+                 "\"settings\":{\"address\":\"127.0.0.1\",\"port\":%4$d}}"}},
+};
+
+static atomic_bool sink_ready;
+static uint64_t    samples[MAX_SAMPLES];
+
+static struct sockaddr_in loopbackAddr(int port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons((uint16_t) port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return addr;
+}
+
+static void setIoTimeout(int fd, int ms)
+{
+    struct timeval tv = {.tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/*
+    the sink, a tcp echo on one epoll thread and an udp echo on another one
+*/
+
+typedef struct echo_con_s
+{
+    int    fd;
+    size_t pending_offset;
+    size_t pending_len;
+    char   buf[STREAM_CHUNK];
+
+} echo_con_t;
+
+static void echoClose(int epfd, echo_con_t *con)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, con->fd, NULL);
+    close(con->fd);
+    free(con);
+}
+
+static void echoWatch(int epfd, echo_con_t *con, uint32_t events)
+{
+    struct epoll_event ev = {.events = events, .data.ptr = con};
+    epoll_ctl(epfd, EPOLL_CTL_MOD, con->fd, &ev);
+}
+
+// writes what is pending, returns false if the connection is gone
+static bool echoFlush(int epfd, echo_con_t *con)
+{
+    while (con->pending_len > 0)
+    {
+        ssize_t n = send(con->fd, con->buf + con->pending_offset, con->pending_len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                echoWatch(epfd, con, EPOLLOUT);
+                return true;
+            }
+            return false;
+        }
+        con->pending_offset += (size_t) n;
+        con->pending_len -= (size_t) n;
+    }
+    echoWatch(epfd, con, EPOLLIN);
+    return true;
+}
+
+static void *tcpSinkThread(void *arg)
+{
+    const int port     = *(int *) arg;
+    const int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    const int yes      = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    struct sockaddr_in addr = loopbackAddr(port);
+    if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listener, 4096) != 0)
+    {
+        fprintf(stderr, "sink: could not listen on tcp port %d: %s\n", port, strerror(errno));
+        exit(1);
+    }
+    const int          epfd = epoll_create1(0);
+    struct epoll_event ev   = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev);
+    atomic_store(&sink_ready, true);
+
+    struct epoll_event events[256];
+    while (true)
+    {
+        int n = epoll_wait(epfd, events, 256, -1);
+        for (int i = 0; i < n; i++)
+        {
+            echo_con_t *con = events[i].data.ptr;
+            if (con == NULL)
+            {
+                int fd;
+                while ((fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+                {
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+                    echo_con_t *c = malloc(sizeof(echo_con_t));
+                    c->fd             = fd;
+                    c->pending_offset = 0;
+                    c->pending_len    = 0;
+                    struct epoll_event cev = {.events = EPOLLIN, .data.ptr = c};
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &cev);
+                }
+                continue;
+            }
+            if (con->pending_len > 0)
+            {
+                if (! echoFlush(epfd, con))
+                {
+                    echoClose(epfd, con);
+                }
+                continue;
+            }
+            ssize_t len = recv(con->fd, con->buf, sizeof(con->buf), 0);
+            if (len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+            {
+                echoClose(epfd, con);
+                continue;
+            }
+            if (len > 0)
+            {
+                con->pending_offset = 0;
+                con->pending_len    = (size_t) len;
+                if (! echoFlush(epfd, con))
+                {
+                    echoClose(epfd, con);
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+static void *udpSinkThread(void *arg)
+{
+    const int          port = *(int *) arg;
+    const int          fd   = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = loopbackAddr(port);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        fprintf(stderr, "sink: could not bind udp port %d: %s\n", port, strerror(errno));
+        exit(1);
+    }
+    char buf[65536];
+    while (true)
+    {
+        struct sockaddr_in peer;
+        socklen_t          peer_len = sizeof(peer);
+        ssize_t            n        = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *) &peer, &peer_len);
+        if (n > 0)
+        {
+            sendto(fd, buf, (size_t) n, 0, (struct sockaddr *) &peer, peer_len);
+        }
+    }
+    return NULL;
+}
+
+/*
+    load generator
+*/
+
+static int connectTcp(int port)
+{
+    const int          fd   = socket(AF_INET, SOCK_STREAM, 0);
+    const int          yes  = 1;
+    struct sockaddr_in addr = loopbackAddr(port);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    setIoTimeout(fd, IO_TIMEOUT_MS);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int connectUdp(int port)
+{
+    const int          fd   = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = loopbackAddr(port);
+    connect(fd, (struct sockaddr *) &addr, sizeof(addr));
+    return fd;
+}
+
+// a reset instead of a close, thousands of connections a second would run out of ports in TIME_WAIT
+static void closeReset(int fd)
+{
+    struct linger lg = {.l_onoff = 1, .l_linger = 0};
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    close(fd);
+}
+
+static bool sendAll(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        len -= (size_t) n;
+    }
+    return true;
+}
+
+static bool recvExact(int fd, char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = recv(fd, data, len, 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        len -= (size_t) n;
+    }
+    return true;
+}
+
+static bool pingTcp(int fd)
+{
+    char msg[MESSAGE_SIZE];
+    memset(msg, 'w', sizeof(msg));
+    return sendAll(fd, msg, sizeof(msg)) && recvExact(fd, msg, sizeof(msg));
+}
+
+static bool pingUdp(int fd, int timeout_ms)
+{
+    char msg[MESSAGE_SIZE];
+    memset(msg, 'w', sizeof(msg));
+    if (send(fd, msg, sizeof(msg), 0) != sizeof(msg))
+    {
+        return false;
+    }
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    return poll(&pfd, 1, timeout_ms) == 1 && recv(fd, msg, sizeof(msg), 0) == sizeof(msg);
+}
+
+static int cmpSamples(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static void measureLatency(const chain_t *chain, int port, double seconds, result_t *result)
+{
+    const int fd = chain->udp ? connectUdp(port) : connectTcp(port);
+    if (fd < 0)
+    {
+        snprintf(result->error, sizeof(result->error), "latency: could not connect");
+        return;
+    }
+    size_t       count    = 0;
+    const double deadline = now() + seconds;
+    while (count < MAX_SAMPLES && now() < deadline)
+    {
+        const double start = now();
+        if (chain->udp ? ! pingUdp(fd, 200) : ! pingTcp(fd))
+        {
+            if (! chain->udp)
+            {
+                snprintf(result->error, sizeof(result->error), "latency: the echo did not come back");
+                close(fd);
+                return;
+            }
+            result->lost += 1;
+            continue;
+        }
+        samples[count++] = (uint64_t) ((now() - start) * 1e9);
+    }
+    close(fd);
+    if (count == 0)
+    {
+        snprintf(result->error, sizeof(result->error), "latency: no echo came back");
+        return;
+    }
+    qsort(samples, count, sizeof(samples[0]), cmpSamples);
+    result->latency_samples = count;
+    result->latency_p50_us  = (double) samples[count / 2] / 1e3;
+    result->latency_p99_us  = (double) samples[(count * 99) / 100] / 1e3;
+}
+
+// streams to the echo while at most STREAM_WINDOW bytes are on the way, counts what came back
+static void *streamThread(void *arg)
+{
+    load_job_t *job = arg;
+    const int   fd  = connectTcp(job->port);
+    if (fd < 0)
+    {
+        job->errors += 1;
+        return NULL;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    static const char chunk[STREAM_CHUNK];
+    char             *buf      = malloc(STREAM_CHUNK);
+    uint64_t          sent     = 0;
+    uint64_t          received = 0;
+    while (now() < job->deadline)
+    {
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (sent - received < STREAM_WINDOW)
+        {
+            pfd.events |= POLLOUT;
+        }
+        if (poll(&pfd, 1, 100) <= 0)
+        {
+            continue;
+        }
+        if (pfd.revents & POLLOUT)
+        {
+            ssize_t n = send(fd, chunk, sizeof(chunk), MSG_NOSIGNAL);
+            if (n > 0)
+            {
+                sent += (uint64_t) n;
+            }
+        }
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            ssize_t n = recv(fd, buf, STREAM_CHUNK, 0);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+            {
+                job->errors += 1;
+                break;
+            }
+            if (n > 0)
+            {
+                received += (uint64_t) n;
+            }
+        }
+    }
+    job->count = received;
+    free(buf);
+    closeReset(fd);
+    return NULL;
+}
+
+static void *connectThread(void *arg)
+{
+    load_job_t *job = arg;
+    while (now() < job->deadline)
+    {
+        const int fd = connectTcp(job->port);
+        if (fd < 0)
+        {
+            job->errors += 1;
+            continue;
+        }
+        if (pingTcp(fd))
+        {
+            job->count += 1;
+        }
+        else
+        {
+            job->errors += 1;
+        }
+        closeReset(fd);
+    }
+    return NULL;
+}
+
+static uint64_t runJobs(void *(*routine)(void *), unsigned int threads, int port, double seconds, uint64_t *errors)
+{
+    load_job_t jobs[STREAMS > CONNECT_THREADS ? STREAMS : CONNECT_THREADS];
+    memset(jobs, 0, sizeof(jobs));
+    const double deadline = now() + seconds;
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        jobs[i].port     = port;
+        jobs[i].deadline = deadline;
+        pthread_create(&jobs[i].thread, NULL, routine, &jobs[i]);
+    }
+    uint64_t total = 0;
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        pthread_join(jobs[i].thread, NULL);
+        total += jobs[i].count;
+        *errors += jobs[i].errors;
+    }
+    return total;
+}
+
+// keeps DATAGRAM_WINDOW datagrams on the way, a window that does not come back in time counts as lost
+static void measureUdpThroughput(int port, double seconds, result_t *result)
+{
+    const int fd = connectUdp(port);
+    char      datagram[DATAGRAM_SIZE];
+    memset(datagram, 'w', sizeof(datagram));
+    uint64_t     received = 0;
+    unsigned int inflight = 0;
+    const double start    = now();
+    while (now() < start + seconds)
+    {
+        while (inflight < DATAGRAM_WINDOW && send(fd, datagram, sizeof(datagram), 0) == sizeof(datagram))
+        {
+            inflight++;
+        }
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (poll(&pfd, 1, 50) <= 0)
+        {
+            result->lost += inflight;
+            inflight = 0;
+            continue;
+        }
+        while (recv(fd, datagram, sizeof(datagram), MSG_DONTWAIT) > 0)
+        {
+            received += sizeof(datagram);
+            inflight -= inflight > 0 ? 1 : 0;
+        }
+    }
+    close(fd);
+    result->gbps = (double) received * 8 / (now() - start) / 1e9;
+}
+
+/*
+    the Waterwall process
+*/
+
+static bool writeFile(const char *dir, const char *name, const char *content)
+{
+    char path[2048];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        return false;
+    }
+    fputs(content, f);
+    fclose(f);
+    return true;
+}
+
+static bool writeChainFiles(const options_t *opts, const chain_t *chain, const char *dir, const char *cert_dir,
+                            int base)
+{
+    char config[16384];
+    int  len = snprintf(config, sizeof(config), "{\"name\":\"%s\",\"nodes\":[", chain->name);
+    for (int i = 0; i < 3 && chain->nodes[i] != NULL; i++)
+    {
+        len += snprintf(config + len, sizeof(config) - len, i == 0 ? "" : ",");
+        len += snprintf(config + len, sizeof(config) - len, chain->nodes[i], base + kPortEntry, base + kPortHop,
+                        base + kPortSite, opts->base_port, cert_dir);
+    }
+    snprintf(config + len, sizeof(config) - len, "]}\n");
+    if (! writeFile(dir, "config.json", config))
+    {
+        return false;
+    }
+
+    char core[1024];
+    snprintf(core, sizeof(core),
+             "{\n"
+             "    \"log\": {\n"
+             "        \"path\": \"log/\",\n"
+             "        \"core\": {\"loglevel\": \"WARN\", \"file\": \"core.log\", \"console\": true},\n"
+             "        \"network\": {\"loglevel\": \"WARN\", \"file\": \"network.log\", \"console\": true},\n"
+             "        \"dns\": {\"loglevel\": \"WARN\", \"file\": \"dns.log\", \"console\": true}\n"
+             "    },\n"
+             "    \"misc\": {\"workers\": %u, \"ram-profile\": \"server\", \"libs-path\": \"libs/\"},\n"
+             "    \"configs\": [\"config.json\"]\n"
+             "}\n",
+             opts->workers);
+    return writeFile(dir, "core.json", core);
+}
+
+static pid_t startWaterwall(const char *waterwall, const char *dir)
+{
+    pid_t pid = fork();
+    if (pid != 0)
+    {
+        return pid;
+    }
+    if (chdir(dir) != 0)
+    {
+        _exit(127);
+    }
+    int out = open("waterwall.out", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(out, STDOUT_FILENO);
+    dup2(out, STDERR_FILENO);
+    execl(waterwall, waterwall, (char *) NULL);
+    _exit(127);
+}
+
+static void stopWaterwall(pid_t pid)
+{
+    kill(pid, SIGTERM);
+    for (int i = 0; i < 50; i++)
+    {
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+        {
+            return;
+        }
+        usleep(100 * 1000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+static bool isRunning(pid_t pid)
+{
+    return waitpid(pid, NULL, WNOHANG) == 0;
+}
+
+// a full round trip through the chain, the pairs are only ready once their inner connections are up
+static bool waitReady(const chain_t *chain, int port, pid_t pid)
+{
+    const double deadline = now() + (READY_TIMEOUT_MS / 1000.0);
+    while (now() < deadline && isRunning(pid))
+    {
+        bool ok;
+        if (chain->udp)
+        {
+            const int fd = connectUdp(port);
+            ok           = pingUdp(fd, 300);
+            close(fd);
+        }
+        else
+        {
+            const int fd = connectTcp(port);
+            ok           = fd >= 0 && pingTcp(fd);
+            if (fd >= 0)
+            {
+                closeReset(fd);
+            }
+        }
+        if (ok)
+        {
+            return true;
+        }
+        usleep(100 * 1000);
+    }
+    return false;
+}
+
+static long readStatusKb(pid_t pid, const char *field)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int) pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        return -1;
+    }
+    char line[256];
+    long value = -1;
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (strncmp(line, field, strlen(field)) == 0)
+        {
+            value = strtol(line + strlen(field), NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+static void runChain(const options_t *opts, const chain_t *chain, int index, const char *cert_dir, result_t *result)
+{
+    char dir[1024];
+    snprintf(dir, sizeof(dir), "%s/%s", opts->workdir, chain->name);
+    mkdir(dir, 0755);
+
+    const int base = opts->base_port + (kPortsPerChain * (index + 1));
+    if (! writeChainFiles(opts, chain, dir, cert_dir, base))
+    {
+        snprintf(result->error, sizeof(result->error), "could not write the configs of %s to the workdir", chain->name);
+        return;
+    }
+    const pid_t pid = startWaterwall(opts->waterwall, dir);
+    if (pid < 0 || ! waitReady(chain, base + kPortEntry, pid))
+    {
+        snprintf(result->error, sizeof(result->error), "the chain did not come up, see %s/waterwall.out in the workdir",
+                 chain->name);
+        if (pid > 0)
+        {
+            stopWaterwall(pid);
+        }
+        return;
+    }
+
+    const double seconds = opts->seconds;
+    measureLatency(chain, base + kPortEntry, seconds, result);
+    if (result->error[0] == '\0')
+    {
+        if (chain->udp)
+        {
+            measureUdpThroughput(base + kPortEntry, seconds, result);
+        }
+        else
+        {
+            uint64_t     errors  = 0;
+            const double start   = now();
+            uint64_t     echoed  = runJobs(streamThread, STREAMS, base + kPortEntry, seconds, &errors);
+            result->gbps         = (double) echoed * 8 / (now() - start) / 1e9;
+            const double started = now();
+            uint64_t     opened  = runJobs(connectThread, CONNECT_THREADS, base + kPortEntry, seconds, &errors);
+            result->connections_per_sec = (double) opened / (now() - started);
+            result->connect_errors      = errors;
+        }
+        result->rss_kb      = readStatusKb(pid, "VmRSS:");
+        result->peak_rss_kb = readStatusKb(pid, "VmHWM:");
+        result->ok          = isRunning(pid);
+        if (! result->ok)
+        {
+            snprintf(result->error, sizeof(result->error),
+                     "Waterwall exited during the load, see %s/waterwall.out in the workdir", chain->name);
+        }
+    }
+    stopWaterwall(pid);
+}
+
+static void printJsonString(const char *value)
+{
+    putchar('"');
+    for (const char *p = value; *p != '\0'; p++)
+    {
+        if (*p == '"' || *p == '\\')
+        {
+            putchar('\\');
+        }
+        putchar((unsigned char) *p < 0x20 ? ' ' : *p);
+    }
+    putchar('"');
+}
+
+static void printResult(const options_t *opts, const chain_t *chain, const result_t *r)
+{
+    printf("{\"tag\":");
+    printJsonString(opts->tag);
+    printf(",\"chain\":\"%s\",\"ok\":%s,\"workers\":%u,\"seconds\":%u", chain->name, r->ok ? "true" : "false",
+           opts->workers, opts->seconds);
+    if (r->ok)
+    {
+        printf(",\"gbps\":%.3f,\"latency_p50_us\":%.1f,\"latency_p99_us\":%.1f,\"latency_samples\":%llu", r->gbps,
+               r->latency_p50_us, r->latency_p99_us, (unsigned long long) r->latency_samples);
+        if (chain->udp)
+        {
+            printf(",\"connections_per_sec\":null,\"lost\":%llu", (unsigned long long) r->lost);
+        }
+        else
+        {
+            printf(",\"connections_per_sec\":%.0f,\"connect_errors\":%llu", r->connections_per_sec,
+                   (unsigned long long) r->connect_errors);
+        }
+        printf(",\"rss_kb\":%ld,\"peak_rss_kb\":%ld", r->rss_kb, r->peak_rss_kb);
+    }
+    else
+    {
+        printf(",\"error\":");
+        printJsonString(r->error);
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+static bool createCertificate(const char *dir)
+{
+    char cmd[2048];
+    snprintf(cmd, sizeof(cmd),
+             "openssl req -x509 -newkey rsa:2048 -nodes -days 2 -subj /CN=bench.local -keyout '%s/key.pem' "
+             "-out '%s/cert.pem' >/dev/null 2>&1",
+             dir, dir);
+    return system(cmd) == 0;
+}
+
+static void usage(const char *self)
+{
+    fprintf(stderr,
+            "usage: %s [--waterwall ./Waterwall] [--only chain] [--seconds 3] [--workers 1] [--base-port 23000]\n"
+            "          [--workdir bench_e2e_work] [--tag label]\n",
+            self);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    options_t opts = {.waterwall = "./Waterwall",
+                      .only      = NULL,
+                      .workdir   = "bench_e2e_work",
+                      .tag       = "",
+                      .seconds   = 3,
+                      .workers   = 1,
+                      .base_port = 23000};
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            usage(argv[0]);
+        }
+        const char *value = argv[++i];
+        if (strcmp(argv[i - 1], "--waterwall") == 0)
+        {
+            opts.waterwall = value;
+        }
+        else if (strcmp(argv[i - 1], "--only") == 0)
+        {
+            opts.only = value;
+        }
+        else if (strcmp(argv[i - 1], "--workdir") == 0)
+        {
+            opts.workdir = value;
+        }
+        else if (strcmp(argv[i - 1], "--tag") == 0)
+        {
+            opts.tag = value;
+        }
+        else if (strcmp(argv[i - 1], "--seconds") == 0)
+        {
+            opts.seconds = (unsigned int) atoi(value);
+        }
+        else if (strcmp(argv[i - 1], "--workers") == 0)
+        {
+            opts.workers = (unsigned int) atoi(value);
+        }
+        else if (strcmp(argv[i - 1], "--base-port") == 0)
+        {
+            opts.base_port = atoi(value);
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+    if (opts.seconds == 0 || opts.workers == 0 || opts.base_port <= 0 || opts.base_port > 65000)
+    {
+        usage(argv[0]);
+    }
+
+    // the binary is started from the directory of each chain
+    char *waterwall = realpath(opts.waterwall, NULL);
+    if (waterwall == NULL || access(waterwall, X_OK) != 0)
+    {
+        fprintf(stderr, "could not find the Waterwall binary at %s (--waterwall)\n", opts.waterwall);
+        return 1;
+    }
+    opts.waterwall = waterwall;
+    mkdir(opts.workdir, 0755);
+    char *workdir = realpath(opts.workdir, NULL);
+    if (workdir == NULL)
+    {
+        fprintf(stderr, "could not create the work directory %s\n", opts.workdir);
+        return 1;
+    }
+    opts.workdir         = workdir;
+    const bool have_cert = createCertificate(workdir);
+    if (! have_cert)
+    {
+        fprintf(stderr, "could not create a certificate with the openssl command, skipping the chains that need it\n");
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    pthread_t tcp_sink;
+    pthread_t udp_sink;
+    pthread_create(&tcp_sink, NULL, tcpSinkThread, &opts.base_port);
+    pthread_create(&udp_sink, NULL, udpSinkThread, &opts.base_port);
+    while (! atomic_load(&sink_ready))
+    {
+        usleep(1000);
+    }
+
+    int failures = 0;
+    for (int i = 0; i < (int) (sizeof(kChains) / sizeof(kChains[0])); i++)
+    {
+        const chain_t *chain = &kChains[i];
+        if (opts.only != NULL && strcmp(opts.only, chain->name) != 0)
+        {
+            continue;
+        }
+        result_t result;
+        memset(&result, 0, sizeof(result));
+        if (chain->needs_cert && ! have_cert)
+        {
+            snprintf(result.error, sizeof(result.error), "skipped, no certificate");
+        }
+        else
+        {
+            fprintf(stderr, "running %s ...\n", chain->name);
+            runChain(&opts, chain, i, workdir, &result);
+        }
+        failures += result.ok ? 0 : 1;
+        printResult(&opts, chain, &result);
+    }
+    return failures == 0 ? 0 : 1;
+}
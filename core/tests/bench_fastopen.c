@@ -0,0 +1,177 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "hloop.h"
+#include "hsocket.h"
+#include "hthread.h"
+#include "ww.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    TcpConnector fast open benchmark, time to first byte
+
+    an echo server loop (fast open enabled on the listener) runs on its own thread, the client loop opens REQUESTS
+    connections one after another, like the connector does it writes MESSAGE_SIZE bytes once the socket reports
+    connected and waits for the echo, the time from socket() to the echo is the time to first byte
+
+        plain       connect, wait for the handshake, then write (1 rtt before the data leaves)
+        fastopen    TCP_FASTOPEN_CONNECT, the first connection gets a cookie, the next ones return from connect()
+                    right away and the write goes out in the syn
+
+    the kernel has to allow fast open for both sides (net.ipv4.tcp_fastopen = 3), the saving is a full rtt so it
+    only shows with a delay on the link, run it in its own network namespace:
+        unshare -n sh -c 'ip link set lo up; sysctl -q net.ipv4.tcp_fastopen=3;
+                          tc qdisc add dev lo root netem delay 1ms; ./bench'
+
+    reports avg / p50 / p99 in microseconds and how many connections actually sent data in the syn
+*/
+
+#define REQUESTS     5000
+#define MESSAGE_SIZE 64
+
+static hloop_t   *server_loop;
+static hloop_t   *client_loop;
+static sockaddr_u server_addr;
+static bool       fastopen_mode;
+static int        done;
+static int        syn_data_count;
+static uint64_t   started_us;
+static uint64_t   samples[REQUESTS];
+static size_t     pending;
+
+static void startLine(void);
+
+static int cmpSamples(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static void onServerRecv(hio_t *io, shift_buffer_t *buf)
+{
+    hio_write(io, buf);
+}
+
+static void onAccept(hio_t *io)
+{
+    hio_setcb_read(io, onServerRecv);
+    hio_read(io);
+}
+
+static HTHREAD_ROUTINE(serverThread)
+{
+    (void) userdata;
+    hloop_run(server_loop);
+    return 0;
+}
+
+static void onClientRecv(hio_t *io, shift_buffer_t *buf)
+{
+    pending -= bufLen(buf);
+    reuseBuffer(hloop_bufferpool(client_loop), buf);
+    if (pending > 0)
+    {
+        return;
+    }
+    samples[done++] = nowUs() - started_us;
+
+    struct tcp_info info;
+    socklen_t       len = sizeof(info);
+    if (getsockopt(hio_fd(io), IPPROTO_TCP, TCP_INFO, &info, &len) == 0 && (info.tcpi_options & TCPI_OPT_SYN_DATA))
+    {
+        syn_data_count++;
+    }
+    hio_close(io);
+    if (done == REQUESTS)
+    {
+        hloop_stop(client_loop);
+        return;
+    }
+    startLine();
+}
+
+static void sendMessage(hio_t *io)
+{
+    hio_setcb_read(io, onClientRecv);
+    hio_read(io);
+    shift_buffer_t *buf = popBuffer(hloop_bufferpool(client_loop));
+    setLen(buf, MESSAGE_SIZE);
+    memset(rawBufMut(buf), 'w', MESSAGE_SIZE);
+    pending = MESSAGE_SIZE;
+    hio_write(io, buf);
+}
+
+static void startLine(void)
+{
+    started_us = nowUs();
+    int fd     = socket(AF_INET, SOCK_STREAM, 0);
+    tcp_nodelay(fd, 1);
+    if (fastopen_mode)
+    {
+        const int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &yes, sizeof(yes));
+    }
+    hio_t *io = hio_get(client_loop, fd);
+    hio_set_peeraddr(io, &server_addr.sa, (int) sockaddr_len(&server_addr));
+    hio_setcb_connect(io, sendMessage);
+    hio_connect(io);
+}
+
+static void onStart(htimer_t *timer)
+{
+    (void) timer;
+    startLine();
+}
+
+static void runOnce(bool fastopen)
+{
+    fastopen_mode  = fastopen;
+    done           = 0;
+    syn_data_count = 0;
+    htimer_add(client_loop, onStart, 10, 1);
+    hloop_run(client_loop);
+
+    qsort(samples, REQUESTS, sizeof(samples[0]), cmpSamples);
+    uint64_t sum = 0;
+    for (int i = 0; i < REQUESTS; i++)
+    {
+        sum += samples[i];
+    }
+    printf("%-8s  requests: %d  ttfb avg: %7.1f us  p50: %5llu us  p99: %5llu us  data in syn: %d\n",
+           fastopen ? "fastopen" : "plain", REQUESTS, (double) sum / REQUESTS, (unsigned long long) samples[REQUESTS / 2],
+           (unsigned long long) samples[(REQUESTS * 99) / 100], syn_data_count);
+}
+
+int main(void)
+{
+    ram_profile = kRamProfileM1Memory;
+
+    server_loop = hloop_new(0, createSmallBufferPool(), 0);
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_set_ipport(&server_addr, "127.0.0.1", 0);
+    bind(listen_fd, &server_addr.sa, sockaddr_len(&server_addr));
+    listen(listen_fd, 1024);
+    const int qlen = 4096;
+    if (setsockopt(listen_fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) != 0)
+    {
+        printf("could not enable fast open on the listener\n");
+    }
+    socklen_t len = sizeof(server_addr);
+    getsockname(listen_fd, &server_addr.sa, &len);
+    haccept(server_loop, listen_fd, onAccept);
+    hthread_t server = hthread_create(serverThread, NULL);
+
+    client_loop = hloop_new(0, createSmallBufferPool(), 1);
+    runOnce(false);
+    hloop_free(&client_loop);
+
+    client_loop = hloop_new(0, createSmallBufferPool(), 1);
+    runOnce(true);
+
+    hloop_stop(server_loop);
+    hthread_join(server);
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include "bench.h"
+#include "cidr_trie.h"
+#include "frand.h"
+#include "hmutex.h"
+#include "managers/socket_filter_index.h"
+#include "managers/socket_manager.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    socket manager dispatch benchmark, linear filter scan vs the compiled filter index
+
+    N tcp filters, each on its own 2 port range with a whitelist of WHITELIST_SIZE /24 prefixes, every
+    4th one also has a blacklist, a lookup is a random (port, peer) pair, half of the peers are inside
+    the whitelist of the filter that owns the port
+
+    "linear" is what distributeTcpSocket used to do: take the filters lock, copy every option, check
+    the port range and walk the whitelist masks one by one
+
+    both answers are compared for every lookup, reports ns/lookup for each filter count
+*/
+
+#define LOOKUPS        2000000
+#define WHITELIST_SIZE 32
+#define BASE_PORT      10000
+
+typedef struct linear_filter_s
+{
+    socket_filter_option_t option;
+    uint32_t               white_base[WHITELIST_SIZE];
+    uint32_t               white_mask[WHITELIST_SIZE];
+    uint32_t               black_base;
+    uint32_t               black_mask;
+
+} linear_filter_t;
+
+typedef struct lookup_s
+{
+    sockaddr_u addr;
+    uint16_t   port;
+
+} lookup_t;
+
+static linear_filter_t *filters;
+static hhybridmutex_t   filters_mutex;
+
+static void *linearFind(unsigned int count, const sockaddr_u *addr, uint16_t port)
+{
+    hhybridmutex_lock(&filters_mutex);
+    const uint32_t ip = ntohl(addr->sin.sin_addr.s_addr);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        socket_filter_option_t option = filters[i].option;
+        if (option.protocol != kSapTcp || option.port_min > port || option.port_max < port)
+        {
+            continue;
+        }
+        if (option.black_list_raddr != NULL && (ip & filters[i].black_mask) == filters[i].black_base)
+        {
+            continue;
+        }
+        bool white = false;
+        for (unsigned int w = 0; w < WHITELIST_SIZE; w++)
+        {
+            if ((ip & filters[i].white_mask[w]) == filters[i].white_base[w])
+            {
+                white = true;
+                break;
+            }
+        }
+        if (! white)
+        {
+            continue;
+        }
+        hhybridmutex_unlock(&filters_mutex);
+        return &filters[i];
+    }
+    hhybridmutex_unlock(&filters_mutex);
+    return NULL;
+}
+
+static void runOnce(unsigned int count, lookup_t *lookups)
+{
+    static char *dummy_list[] = {NULL};
+
+    filters                      = calloc(count, sizeof(linear_filter_t));
+    socket_filter_index_t *index = newSocketFilterIndex();
+    for (unsigned int i = 0; i < count; i++)
+    {
+        linear_filter_t *f = &filters[i];
+        f->option          = (socket_filter_option_t){.protocol         = kSapTcp,
+                                                      .port_min         = (uint16_t) (BASE_PORT + (2 * i)),
+                                                      .port_max         = (uint16_t) (BASE_PORT + (2 * i) + 1),
+                                                      .white_list_raddr = dummy_list,
+                                                      .white_list_trie  = newCidrTrie()};
+        for (unsigned int w = 0; w < WHITELIST_SIZE; w++)
+        {
+            char cidr[32];
+            snprintf(cidr, sizeof(cidr), "10.%u.%u.0/24", i % 256, w);
+            insertCidrTrie(f->option.white_list_trie, cidr);
+            f->white_base[w] = (10U << 24) | ((i % 256) << 16) | (w << 8);
+            f->white_mask[w] = 0xFFFFFF00;
+        }
+        if (i % 4 == 0)
+        {
+            // the first address of each whitelist is banned again
+            char cidr[32];
+            snprintf(cidr, sizeof(cidr), "10.%u.0.1/32", i % 256);
+            f->option.black_list_raddr = dummy_list;
+            f->option.black_list_trie  = newCidrTrie();
+            insertCidrTrie(f->option.black_list_trie, cidr);
+            f->black_base = (10U << 24) | ((i % 256) << 16) | 1;
+            f->black_mask = 0xFFFFFFFF;
+        }
+        addSocketFilterToIndex(index, &f->option, f);
+    }
+    compileSocketFilterIndex(index);
+
+    for (unsigned int l = 0; l < LOOKUPS; l++)
+    {
+        const uint32_t r        = fastRand();
+        const uint32_t owner    = r % count;
+        const uint32_t inside   = (r >> 16) & 1;
+        lookups[l].port         = (uint16_t) (BASE_PORT + (2 * owner) + ((r >> 17) & 1));
+        lookups[l].addr.sin     = (struct sockaddr_in){.sin_family = AF_INET};
+        const uint32_t ip       = inside ? ((10U << 24) | ((owner % 256) << 16) | ((fastRand() % WHITELIST_SIZE) << 8) |
+                                      (fastRand() % 4))
+                                         : ((11U << 24) | (fastRand() & 0xFFFFFF));
+        lookups[l].addr.sin.sin_addr.s_addr = htonl(ip);
+    }
+
+    unsigned int mismatches = 0;
+    for (unsigned int l = 0; l < LOOKUPS; l++)
+    {
+        if (linearFind(count, &lookups[l].addr, lookups[l].port) !=
+            findSocketFilterInIndex(index, kSapTcp, &lookups[l].addr, lookups[l].port))
+        {
+            mismatches++;
+        }
+    }
+
+    uintptr_t sink  = 0;
+    double    start = now();
+    for (unsigned int l = 0; l < LOOKUPS; l++)
+    {
+        sink += (uintptr_t) linearFind(count, &lookups[l].addr, lookups[l].port);
+    }
+    double linear_ns = (now() - start) * 1e9 / LOOKUPS;
+
+    start = now();
+    for (unsigned int l = 0; l < LOOKUPS; l++)
+    {
+        sink += (uintptr_t) findSocketFilterInIndex(index, kSapTcp, &lookups[l].addr, lookups[l].port);
+    }
+    double index_ns = (now() - start) * 1e9 / LOOKUPS;
+
+    printf("filters: %-5u  linear: %8.1f ns/lookup  index: %6.1f ns/lookup  mismatches: %u  (%lu)\n", count,
+           linear_ns, index_ns, mismatches, (unsigned long) (sink & 0x1));
+
+    destroySocketFilterIndex(index);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        destroyCidrTrie(filters[i].option.white_list_trie);
+        if (filters[i].option.black_list_trie)
+        {
+            destroyCidrTrie(filters[i].option.black_list_trie);
+        }
+    }
+    free(filters);
+}
+
+int main(void)
+{
+    hhybridmutex_init(&filters_mutex);
+    lookup_t          *lookups  = malloc(sizeof(lookup_t) * LOOKUPS);
+    const unsigned int counts[] = {1, 16, 128, 1024};
+    for (unsigned int i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+    {
+        runOnce(counts[i], lookups);
+    }
+    free(lookups);
+    return 0;
+}
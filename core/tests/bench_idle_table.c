@@ -0,0 +1,144 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "hloop.h"
+#include "idle_table.h"
+#include "ww.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    idle table benchmark / test
+
+        insert      ITEMS items with the udp listener keep time (60s)
+        refresh     REFRESHES keepIdleItemForAtleast calls on random items (getIdleItemByHash + keep, what the
+                    udp listener does for every packet of a known peer)
+        remove      all items by hash
+
+    then EXPIRE_ITEMS items with deadlines spread over EXPIRE_SPREAD ms are left to expire on the loop, half of
+    them are kept for longer once from their callback, every callback checks it did not run before the deadline
+    and the run fails if an item expired twice, too early, or never
+
+    reports ns/op
+*/
+
+#define ITEMS         100000
+#define REFRESHES     1000000
+#define EXPIRE_ITEMS  10000
+#define EXPIRE_SPREAD 3000 // ms
+#define TICK_SLACK    1100 // ms, the table checks once a second
+
+static hloop_t      *loop;
+static idle_table_t *table;
+static uint64_t      deadlines[EXPIRE_ITEMS];
+static unsigned int  expired[EXPIRE_ITEMS];
+static unsigned int  expired_count;
+static unsigned int  failures;
+
+static void onBenchExpire(idle_item_t *item)
+{
+    (void) item;
+    failures++;
+}
+
+static void onTestExpire(idle_item_t *item)
+{
+    const size_t   i       = (size_t) item->userdata;
+    const uint64_t time_ms = hloop_now_ms(loop);
+    if (time_ms < deadlines[i] || time_ms > deadlines[i] + TICK_SLACK)
+    {
+        printf("item %zu expired at %llu, deadline %llu\n", i, (unsigned long long) time_ms,
+               (unsigned long long) deadlines[i]);
+        failures++;
+    }
+    if (i % 2 == 0 && expired[i] == 0)
+    {
+        // keep it once more, it has to come back
+        expired[i]   = 1;
+        deadlines[i] = time_ms + 500;
+        keepIdleItemForAtleast(table, item, 500);
+        return;
+    }
+    expired[i] += 1;
+    expired_count++;
+    if (expired_count == EXPIRE_ITEMS)
+    {
+        hloop_stop(loop);
+    }
+}
+
+static void onTimeout(htimer_t *timer)
+{
+    printf("timed out, %u of %d items expired\n", expired_count, EXPIRE_ITEMS);
+    failures++;
+    hloop_stop(hevent_loop(timer));
+}
+
+static void bench(void)
+{
+    table = newIdleTable();
+
+    double start = now();
+    for (size_t i = 0; i < ITEMS; i++)
+    {
+        newIdleItem(table, (hash_t) i * 0x9E3779B97F4A7C15ULL, NULL, onBenchExpire, 0, 60 * 1000);
+    }
+    printf("insert   %7.1f ns/op\n", (now() - start) * 1e9 / ITEMS);
+
+    unsigned long long x = 88172645463325252ULL;
+    start                = now();
+    for (size_t i = 0; i < REFRESHES; i++)
+    {
+        x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+        idle_item_t *item = getIdleItemByHash(0, table, (hash_t) (x % ITEMS) * 0x9E3779B97F4A7C15ULL);
+        keepIdleItemForAtleast(table, item, 60 * 1000);
+    }
+    printf("refresh  %7.1f ns/op\n", (now() - start) * 1e9 / REFRESHES);
+
+    start = now();
+    for (size_t i = 0; i < ITEMS; i++)
+    {
+        if (! removeIdleItemByHash(0, table, (hash_t) i * 0x9E3779B97F4A7C15ULL))
+        {
+            failures++;
+        }
+    }
+    printf("remove   %7.1f ns/op\n", (now() - start) * 1e9 / ITEMS);
+    destroyIdleTable(table);
+}
+
+static void onStart(htimer_t *timer)
+{
+    (void) timer;
+    table = newIdleTable();
+    srand(7);
+    for (size_t i = 0; i < EXPIRE_ITEMS; i++)
+    {
+        const uint64_t age = (uint64_t) (rand() % EXPIRE_SPREAD);
+        deadlines[i]       = hloop_now_ms(loop) + age;
+        newIdleItem(table, (hash_t) i + 1, (void *) i, onTestExpire, 0, age);
+    }
+    htimer_add(loop, onTimeout, EXPIRE_SPREAD + 500 + (3 * TICK_SLACK), 1);
+}
+
+int main(void)
+{
+    ram_profile   = kRamProfileM1Memory;
+    workers_count = 1;
+    loop          = hloop_new(0, createSmallBufferPool(), 0);
+    loops         = &loop;
+
+    bench();
+
+    htimer_add(loop, onStart, 10, 1);
+    hloop_run(loop);
+    for (size_t i = 0; i < EXPIRE_ITEMS; i++)
+    {
+        if (expired[i] != (i % 2 == 0 ? 2 : 1))
+        {
+            failures++;
+        }
+    }
+    printf("expire   %u of %d items, failures: %u\n", expired_count, EXPIRE_ITEMS, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "hloop.h"
+#include "hsocket.h"
+#include "hthread.h"
+#include "ww.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    event backend benchmark, build it once as is (epoll) and once with -DEVENT_IO_URING=1
+    (cmake -DIO_URING_BACKEND=ON) and compare
+
+    an echo server loop and a client loop (own threads), CONNECTIONS tcp connections each keep one MESSAGE_SIZE
+    message in flight for PHASE_SECONDS, every echo is written with hio_write and every read goes through read_cb
+    like the adapters do, so the cost per round trip is mostly the watcher (waiting + re-arming the fds)
+
+    reports round trips/sec and the loop iterations it took
+*/
+
+#define CONNECTIONS   256
+#define MESSAGE_SIZE  512
+#define PHASE_SECONDS 5
+
+static hloop_t    *server_loop;
+static hloop_t    *client_loop;
+static sockaddr_u  server_addr;
+static size_t      round_trips;
+static size_t      pending_bytes[CONNECTIONS];
+static atomic_bool stop;
+
+static void onServerRecv(hio_t *io, shift_buffer_t *buf)
+{
+    hio_write(io, buf);
+}
+
+static void onAccept(hio_t *io)
+{
+    hio_setcb_read(io, onServerRecv);
+    hio_read(io);
+}
+
+static void sendMessage(hio_t *io)
+{
+    shift_buffer_t *buf = popBuffer(hloop_bufferpool(client_loop));
+    reserveBufSpace(buf, MESSAGE_SIZE);
+    setLen(buf, MESSAGE_SIZE);
+    memset(rawBufMut(buf), 'w', MESSAGE_SIZE);
+    hio_write(io, buf);
+}
+
+static void onClientRecv(hio_t *io, shift_buffer_t *buf)
+{
+    size_t *pending = hevent_userdata(io);
+    *pending -= bufLen(buf);
+    reuseBuffer(hloop_bufferpool(client_loop), buf);
+    if (*pending == 0)
+    {
+        round_trips++;
+        *pending = MESSAGE_SIZE;
+        sendMessage(io);
+    }
+}
+
+static void onCheckStop(htimer_t *timer)
+{
+    if (atomic_load(&stop))
+    {
+        hloop_stop(hevent_loop(timer));
+    }
+}
+
+static HTHREAD_ROUTINE(serverThread)
+{
+    (void) userdata;
+    hloop_run(server_loop);
+    return 0;
+}
+
+static HTHREAD_ROUTINE(stopAfter)
+{
+    (void) userdata;
+    hv_sleep(PHASE_SECONDS);
+    atomic_store(&stop, true);
+    return 0;
+}
+
+int main(void)
+{
+    ram_profile = kRamProfileM1Memory;
+
+    server_loop = hloop_new(0, createSmallBufferPool(), 0);
+    client_loop = hloop_new(0, createSmallBufferPool(), 1);
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_set_ipport(&server_addr, "127.0.0.1", 0);
+    bind(listen_fd, &server_addr.sa, sockaddr_len(&server_addr));
+    listen(listen_fd, CONNECTIONS);
+    socklen_t len = sizeof(server_addr);
+    getsockname(listen_fd, &server_addr.sa, &len);
+    haccept(server_loop, listen_fd, onAccept);
+    htimer_add(server_loop, onCheckStop, 10, INFINITE);
+    hthread_t server = hthread_create(serverThread, NULL);
+
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        connect(fd, &server_addr.sa, sockaddr_len(&server_addr));
+        tcp_nodelay(fd, 1);
+        hio_t *io        = hio_get(client_loop, fd);
+        pending_bytes[i] = MESSAGE_SIZE;
+        hevent_set_userdata(io, &pending_bytes[i]);
+        hio_setcb_read(io, onClientRecv);
+        hio_read(io);
+        sendMessage(io);
+    }
+    htimer_add(client_loop, onCheckStop, 10, INFINITE);
+
+    // the client loop runs on this thread, another one flips the flag
+    hthread_t stopper = hthread_create(stopAfter, NULL);
+    double    start   = now();
+    hloop_run(client_loop);
+    double elapsed = now() - start;
+    hthread_join(stopper);
+    hthread_join(server);
+
+    printf("engine: %-9s  connections: %d  message: %d  round trips/sec: %.0f  loop iterations: %llu + %llu\n",
+           hio_engine(), CONNECTIONS, MESSAGE_SIZE, (double) round_trips / elapsed,
+           (unsigned long long) hloop_count(client_loop), (unsigned long long) hloop_count(server_loop));
+    return 0;
+}
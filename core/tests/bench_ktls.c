@@ -0,0 +1,408 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "hsocket.h"
+#include "hthread.h"
+#include "openssl_buffer_bio.h"
+#include "openssl_ktls.h"
+#include "ww.h"
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+/*
+    kernel tls benchmark, userspace records (buffer bio) vs the kernel (openssl_ktls.h) on loopback
+
+        keys     the crypto info made for each side decrypts a record openssl wrote after it, for every cipher the
+                 kernel takes, so the keys and sequence numbers are checked even where the kernel has no tls ulp
+        loopback a client thread (plain openssl on the socket) sends TOTAL_BYTES to the server (this thread), the
+                 server does the handshake over the buffer bio like the tunnel, then reads the plaintext either
+                 with SSL_read from the pushed buffers (userspace) or straight from the socket after TLS_RX (ktls),
+                 reports Gbit/sec and the cpu seconds per GB of the server thread (user + sys, the kernel decrypts in
+                 the read)
+
+    after the switch the server sends one byte to the client, with ktls it goes out through TLS_TX, so the client
+    reading it checks the tx side too
+*/
+
+#define TOTAL_BYTES (1024UL * 1024 * 1024)
+#define CHUNK       (16 * 1024)
+
+static buffer_pool_t *pool;
+static SSL_CTX       *server_ctx;
+static SSL_CTX       *client_ctx;
+static sockaddr_u     addr;
+
+static double threadCpu(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_THREAD, &ru);
+    return (double) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) + ((ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6);
+}
+
+static void makeContexts(int version, const char *suite)
+{
+    static EVP_PKEY *key  = NULL;
+    static X509     *cert = NULL;
+    if (key == NULL)
+    {
+        key  = EVP_EC_gen("P-256");
+        cert = X509_new();
+        X509_set_version(cert, 2);
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+        X509_set_pubkey(cert, key);
+        X509_sign(cert, key, EVP_sha256());
+    }
+    SSL_CTX_free(server_ctx);
+    SSL_CTX_free(client_ctx);
+    server_ctx = SSL_CTX_new(TLS_server_method());
+    client_ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_use_certificate(server_ctx, cert);
+    SSL_CTX_use_PrivateKey(server_ctx, key);
+    SSL_CTX_set_min_proto_version(client_ctx, version);
+    SSL_CTX_set_max_proto_version(client_ctx, version);
+    if (version == TLS1_3_VERSION)
+    {
+        SSL_CTX_set_ciphersuites(client_ctx, suite);
+    }
+    else
+    {
+        SSL_CTX_set_cipher_list(client_ctx, suite);
+    }
+    sslKtlsCtxInit(server_ctx);
+    sslKtlsCtxInit(client_ctx);
+}
+
+// opens a record with the crypto info (at its sequence number), returns the plaintext length or -1
+static int openRecord(ssl_ktls_crypto_info_t *ci, const unsigned char *rec, int rec_len, unsigned char *out)
+{
+    const bool           tls13  = ci->info.version == TLS_1_3_VERSION;
+    const bool           chacha = ci->info.cipher_type == TLS_CIPHER_CHACHA20_POLY1305;
+    const bool           aes128 = ci->info.cipher_type == TLS_CIPHER_AES_GCM_128;
+    unsigned char        nonce[12];
+    unsigned char        aad[13];
+    const unsigned char *key;
+    const unsigned char *seq;
+    const unsigned char *body     = rec + 5;
+    int                  body_len = rec_len - 5;
+
+    if (chacha)
+    {
+        key = ci->chacha20_poly1305.key;
+        seq = ci->chacha20_poly1305.rec_seq;
+        memcpy(nonce, ci->chacha20_poly1305.iv, 12);
+    }
+    else
+    {
+        key = aes128 ? ci->aes_gcm_128.key : ci->aes_gcm_256.key;
+        seq = aes128 ? ci->aes_gcm_128.rec_seq : ci->aes_gcm_256.rec_seq;
+        memcpy(nonce, aes128 ? ci->aes_gcm_128.salt : ci->aes_gcm_256.salt, 4);
+        memcpy(nonce + 4, tls13 ? (aes128 ? ci->aes_gcm_128.iv : ci->aes_gcm_256.iv) : body, 8);
+    }
+    if (chacha || tls13)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            nonce[4 + i] ^= seq[i];
+        }
+    }
+    else
+    {
+        // the explicit nonce of tls 1.2 aes-gcm
+        body += 8;
+        body_len -= 8;
+    }
+    const int text_len = body_len - 16;
+    int       aad_len  = 5;
+    memcpy(aad, rec, 5);
+    if (! tls13)
+    {
+        memcpy(aad, seq, 8);
+        memcpy(aad + 8, rec, 3);
+        aad[11] = (unsigned char) (text_len >> 8);
+        aad[12] = (unsigned char) text_len;
+        aad_len = 13;
+    }
+
+    const EVP_CIPHER *cipher = chacha ? EVP_chacha20_poly1305() : aes128 ? EVP_aes_128_gcm() : EVP_aes_256_gcm();
+    EVP_CIPHER_CTX   *ctx    = EVP_CIPHER_CTX_new();
+    int               len;
+    const bool        ok = EVP_DecryptInit_ex(ctx, cipher, NULL, key, nonce) == 1 &&
+                    EVP_DecryptUpdate(ctx, NULL, &len, aad, aad_len) == 1 &&
+                    EVP_DecryptUpdate(ctx, out, &len, body, text_len) == 1 &&
+                    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, 16, (void *) (body + text_len)) == 1 &&
+                    EVP_DecryptFinal_ex(ctx, out + len, &len) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    return ok ? text_len : -1;
+}
+
+static void pump(SSL *from, SSL *to)
+{
+    shift_buffer_t *buf;
+    while ((buf = bufferBioPop(SSL_get_wbio(from))) != NULL)
+    {
+        bufferBioPush(SSL_get_rbio(to), buf);
+    }
+}
+
+// true if the tx crypto info of `from` and the rx one of `to` both open the next record `from` writes
+static bool checkSide(SSL *from, ssl_ktls_t *from_ks, SSL *to, ssl_ktls_t *to_ks)
+{
+    ssl_ktls_crypto_info_t tx;
+    ssl_ktls_crypto_info_t rx;
+    if (sslKtlsCryptoInfo(from, from_ks, true, &tx) == 0 || sslKtlsCryptoInfo(to, to_ks, false, &rx) == 0)
+    {
+        return false;
+    }
+    SSL_write(from, "ktls", 4);
+    shift_buffer_t *buf = bufferBioPop(SSL_get_wbio(from));
+    unsigned char   text[64];
+    // tls 1.3 has the inner content type after the text
+    const bool ok = openRecord(&tx, rawBuf(buf), (int) bufLen(buf), text) >= 4 && memcmp(text, "ktls", 4) == 0 &&
+                    openRecord(&rx, rawBuf(buf), (int) bufLen(buf), text) >= 4;
+    reuseBuffer(pool, buf);
+    return ok;
+}
+
+static void checkKeys(const char *name, int version, const char *suite)
+{
+    makeContexts(version, suite);
+    SSL *client = SSL_new(client_ctx);
+    SSL *server = SSL_new(server_ctx);
+    BIO *cbio   = newBufferBio(pool);
+    BIO *sbio   = newBufferBio(pool);
+    SSL_set_bio(client, cbio, cbio);
+    SSL_set_bio(server, sbio, sbio);
+    SSL_set_connect_state(client);
+    SSL_set_accept_state(server);
+    ssl_ktls_t *cks = newSslKtls(client);
+    ssl_ktls_t *sks = newSslKtls(server);
+
+    for (int i = 0; i < 16 && ! (SSL_is_init_finished(client) && SSL_is_init_finished(server)); i++)
+    {
+        SSL_do_handshake(client);
+        pump(client, server);
+        SSL_do_handshake(server);
+        pump(server, client);
+    }
+    // some records of the traffic keys go through userspace first, then the sequence numbers are not 0
+    char byte;
+    for (int i = 0; i < 3; i++)
+    {
+        SSL_write(server, "s", 1);
+        SSL_write(client, "c", 1);
+        pump(server, client);
+        pump(client, server);
+        SSL_read(client, &byte, 1);
+        SSL_read(server, &byte, 1);
+    }
+
+    const bool ok = checkSide(server, sks, client, cks) && checkSide(client, cks, server, sks);
+    printf("keys      %-8s %-32s %s\n", name, suite, ok ? "ok" : "WRONG");
+    destroySslKtls(client, cks);
+    destroySslKtls(server, sks);
+    SSL_free(client);
+    SSL_free(server);
+    if (! ok)
+    {
+        exit(1);
+    }
+}
+
+static HTHREAD_ROUTINE(clientThread)
+{
+    (void) userdata;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    connect(fd, &addr.sa, sockaddr_len(&addr));
+    SSL *ssl = SSL_new(client_ctx);
+    SSL_set_fd(ssl, fd);
+    if (SSL_connect(ssl) != 1)
+    {
+        ERR_print_errors_fp(stderr);
+        exit(1);
+    }
+    // the server is ready (and with ktls, its tx works)
+    char byte;
+    if (SSL_read(ssl, &byte, 1) != 1 || byte != 'g')
+    {
+        printf("client: the go byte did not come\n");
+        exit(1);
+    }
+
+    static char buf[CHUNK];
+    memset(buf, 'w', sizeof(buf));
+    for (size_t sent = 0; sent < TOTAL_BYTES; sent += CHUNK)
+    {
+        SSL_write(ssl, buf, CHUNK);
+    }
+    SSL_free(ssl);
+    closesocket(fd);
+    return 0;
+}
+
+static void sendAll(int fd, SSL *ssl)
+{
+    shift_buffer_t *buf;
+    while ((buf = bufferBioPop(SSL_get_wbio(ssl))) != NULL)
+    {
+        send(fd, rawBuf(buf), bufLen(buf), 0);
+        reuseBuffer(pool, buf);
+    }
+}
+
+static bool recvInto(int fd, SSL *ssl)
+{
+    shift_buffer_t *buf = popBuffer(pool);
+    const ssize_t   n   = recv(fd, rawBufMut(buf), rCap(buf), 0);
+    if (n <= 0)
+    {
+        reuseBuffer(pool, buf);
+        return false;
+    }
+    setLen(buf, (unsigned int) n);
+    bufferBioPush(SSL_get_rbio(ssl), buf);
+    return true;
+}
+
+static void runLoopback(const char *name, int version, const char *suite, bool ktls)
+{
+    makeContexts(version, suite);
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_set_ipport(&addr, "127.0.0.1", 0);
+    bind(listen_fd, &addr.sa, sockaddr_len(&addr));
+    listen(listen_fd, 1);
+    socklen_t addr_len = sizeof(addr);
+    getsockname(listen_fd, &addr.sa, &addr_len);
+
+    hthread_t client = hthread_create(clientThread, NULL);
+    int       fd     = accept(listen_fd, NULL, NULL);
+    SSL      *ssl    = SSL_new(server_ctx);
+    BIO      *bio    = newBufferBio(pool);
+    SSL_set_bio(ssl, bio, bio);
+    SSL_set_accept_state(ssl);
+    ssl_ktls_t *ks = newSslKtls(ssl);
+
+    while (SSL_do_handshake(ssl) != 1)
+    {
+        sendAll(fd, ssl);
+        if (! recvInto(fd, ssl))
+        {
+            ERR_print_errors_fp(stderr);
+            exit(1);
+        }
+    }
+    sendAll(fd, ssl);
+
+    const char *mode = "userspace";
+    if (ktls)
+    {
+        mode = "ktls";
+        if (! sslKtlsReady(ssl, ks, bio, false) || ! sslKtlsInstall(ssl, ks, fd, true) ||
+            ! sslKtlsInstall(ssl, ks, fd, false))
+        {
+            printf("loopback  %-8s %-32s ktls       unavailable (%s), the tunnels fall back to userspace\n", name,
+                   suite, strerror(errno));
+            // let the client finish in userspace
+            ktls = false;
+            mode = "fallback";
+        }
+    }
+    if (ktls)
+    {
+        send(fd, "g", 1, 0);
+    }
+    else
+    {
+        SSL_write(ssl, "g", 1);
+        sendAll(fd, ssl);
+    }
+
+    size_t       received  = 0;
+    const double start     = now();
+    const double cpu_start = threadCpu();
+    while (received < TOTAL_BYTES)
+    {
+        if (ktls)
+        {
+            shift_buffer_t *buf = popBuffer(pool);
+            const ssize_t   n   = recv(fd, rawBufMut(buf), rCap(buf), 0);
+            reuseBuffer(pool, buf);
+            if (n <= 0)
+            {
+                break;
+            }
+            received += (size_t) n;
+            continue;
+        }
+        if (! recvInto(fd, ssl))
+        {
+            break;
+        }
+        int n;
+        do
+        {
+            shift_buffer_t *buf = popBuffer(pool);
+            n                   = SSL_read(ssl, rawBufMut(buf), (int) rCap(buf));
+            reuseBuffer(pool, buf);
+            received += n > 0 ? (size_t) n : 0;
+        } while (n > 0);
+    }
+    const double elapsed = now() - start;
+    const double cpu     = threadCpu() - cpu_start;
+    hthread_join(client);
+
+    if (strcmp(mode, "fallback") != 0)
+    {
+        printf("loopback  %-8s %-32s %-10s %6.2f Gbit/sec  %5.2f cpu sec/GB  (%zu bytes)\n", name, suite, mode,
+               (double) received * 8 / elapsed / 1e9, cpu / ((double) received / 1e9), received);
+    }
+    destroySslKtls(ssl, ks);
+    SSL_free(ssl);
+    closesocket(fd);
+    closesocket(listen_fd);
+}
+
+int main(void)
+{
+    ram_profile = kRamProfileM1Memory;
+
+    pool = createBufferPool();
+    bufferBioGlobalInit();
+    sslKtlsGlobalInit();
+
+    const struct
+    {
+        const char *name;
+        int         version;
+        const char *suite;
+    } suites[] = {
+        {"tls 1.3", TLS1_3_VERSION, "TLS_AES_128_GCM_SHA256"},
+        {"tls 1.3", TLS1_3_VERSION, "TLS_AES_256_GCM_SHA384"},
+        {"tls 1.3", TLS1_3_VERSION, "TLS_CHACHA20_POLY1305_SHA256"},
+        {"tls 1.2", TLS1_2_VERSION, "ECDHE-ECDSA-AES128-GCM-SHA256"},
+        {"tls 1.2", TLS1_2_VERSION, "ECDHE-ECDSA-AES256-GCM-SHA384"},
+        {"tls 1.2", TLS1_2_VERSION, "ECDHE-ECDSA-CHACHA20-POLY1305"},
+    };
+    const unsigned int count = sizeof(suites) / sizeof(suites[0]);
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        checkKeys(suites[i].name, suites[i].version, suites[i].suite);
+    }
+    // the first aes-gcm suite of each version
+    for (unsigned int i = 0; i < count; i += 3)
+    {
+        runLoopback(suites[i].name, suites[i].version, suites[i].suite, false);
+        runLoopback(suites[i].name, suites[i].version, suites[i].suite, true);
+    }
+
+    pool_stats_t stats = getBufferPoolStats(pool);
+    printf("pool buffers: %u allocated %u available\n", stats.allocated, stats.available);
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "bench.h"
+#include "generic_pool.h"
+#include "tunnel.h"
+#include "ww.h"
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    memory per line benchmark
+
+    for a few chain lengths (kMaxChainLen is what every line took before the lines were sized by the chain),
+    LINES lines are opened at once like concurrent connections, every tunnel of the chain keeps a state on them,
+    then they are closed, reports:
+
+        line size   what one line takes in the pool (header + 1 state pointer per chain index)
+        heap        heap bytes per open line (malloc overhead included, the tunnel states excluded)
+        open+close  ns to open and close one line, the chain states are set and dropped like the tunnels do
+*/
+
+#define LINES  200000
+#define ROUNDS 5
+
+static line_t **lines;
+
+static size_t heapInUse(void)
+{
+    return mallinfo2().uordblks;
+}
+
+static void openLines(unsigned int chain_len)
+{
+    static char tunnel_state;
+    for (unsigned int i = 0; i < LINES; i++)
+    {
+        lines[i] = newLine(0);
+        for (unsigned int c = 0; c < chain_len; c++)
+        {
+            LSTATE_I_MUT(lines[i], c) = &tunnel_state;
+        }
+    }
+}
+
+static void closeLines(unsigned int chain_len)
+{
+    for (unsigned int i = 0; i < LINES; i++)
+    {
+        for (unsigned int c = 0; c < chain_len; c++)
+        {
+            LSTATE_I_DROP(lines[i], c);
+        }
+        destroyLine(lines[i]);
+    }
+}
+
+static void run(unsigned int chain_len)
+{
+    setLineChainLen(chain_len);
+
+    const size_t heap_before = heapInUse();
+    openLines(chain_len);
+    const size_t heap_open = heapInUse();
+    closeLines(chain_len);
+
+    double best = 1e18;
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        const double start = now();
+        openLines(chain_len);
+        closeLines(chain_len);
+        const double ns = (now() - start) * 1e9 / LINES;
+        best            = ns < best ? ns : best;
+    }
+
+    printf("chain len: %2u  line size: %4zu bytes  heap: %6.1f bytes/line  open+close: %5.1f ns/line\n", chain_len,
+           lineSize(), (double) (heap_open - heap_before) / LINES, best);
+}
+
+int main(void)
+{
+    ram_profile   = kRamProfileM1Memory;
+    workers_count = 1;
+    line_pools    = malloc(sizeof(generic_pool_t *));
+    line_pools[0] = newGenericPoolWithSize((8) + ram_profile, allocLinePoolHandle, destroyLinePoolHandle);
+    lines         = malloc(sizeof(line_t *) * LINES);
+
+    const unsigned int chain_lens[] = {kMaxChainLen, 12, 6, 3};
+    for (unsigned int i = 0; i < sizeof(chain_lens) / sizeof(chain_lens[0]); i++)
+    {
+        run(chain_lens[i]);
+    }
+
+    free(lines);
+    return 0;
+}
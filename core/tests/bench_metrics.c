@@ -0,0 +1,173 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "hloop.h"
+#include "managers/metrics_manager.h"
+#include "tunnel.h"
+#include "ww.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+    metrics overhead benchmark
+
+    CHAIN_LEN pass through tunnels, the last one is the sink, LINES lines each send CONTEXTS_PER_LINE payloads of
+    PAYLOAD_SIZE up the chain, with and without every tunnel metered (meterTunnel), the two take turns
+
+        chain only  the sink drops the payload, this is the worst case, only the hops and the counting
+        socket      the sink writes the payload to a socketpair and the other end reads it back, like an
+                    adapter writing to its socket
+
+    reports ns per payload for both and the overhead of the metrics, then checks the counters against what was
+    sent
+*/
+
+#define CHAIN_LEN         6
+#define LINES             2000
+#define CONTEXTS_PER_LINE 100
+#define PAYLOAD_SIZE      16384
+#define ROUNDS            10
+
+static hloop_t  *loop;
+static tunnel_t *chain_tunnels[CHAIN_LEN];
+static int       socket_pair[2];
+static bool      write_to_socket;
+static char      drain[PAYLOAD_SIZE];
+
+static void sinkUpStream(tunnel_t *self, context_t *c)
+{
+    (void) self;
+    if (c->payload != NULL)
+    {
+        if (write_to_socket)
+        {
+            if (write(socket_pair[0], rawBuf(c->payload), bufLen(c->payload)) < 0 ||
+                read(socket_pair[1], drain, sizeof(drain)) < 0)
+            {
+                perror("socketpair");
+                exit(1);
+            }
+        }
+        reuseBuffer(buffer_pools[0], c->payload);
+        CONTEXT_PAYLOAD_DROP(c);
+    }
+    destroyContext(c);
+}
+
+static double run(void)
+{
+    const double start = now();
+    for (int l = 0; l < LINES; l++)
+    {
+        line_t    *line = newLine(0);
+        context_t *init = newContext(line);
+        init->init      = true;
+        chain_tunnels[0]->upStream(chain_tunnels[0], init);
+
+        for (int i = 0; i < CONTEXTS_PER_LINE; i++)
+        {
+            context_t *c = newContext(line);
+            c->payload   = popBuffer(buffer_pools[0]);
+            setLen(c->payload, PAYLOAD_SIZE);
+            chain_tunnels[0]->upStream(chain_tunnels[0], c);
+        }
+        context_t *fin = newFinContext(line);
+        chain_tunnels[0]->upStream(chain_tunnels[0], fin);
+        destroyLine(line);
+    }
+    return (now() - start) * 1e9 / ((double) LINES * CONTEXTS_PER_LINE);
+}
+
+int main(void)
+{
+    ram_profile   = kRamProfileM1Memory;
+    workers_count = 1;
+    buffer_pools  = malloc(sizeof(buffer_pool_t *));
+    context_pools = malloc(sizeof(generic_pool_t *));
+    line_pools    = malloc(sizeof(generic_pool_t *));
+
+    buffer_pools[0]  = createBufferPool();
+    context_pools[0] = newGenericPoolWithSize((16) + ram_profile, allocContextPoolHandle, destroyContextPoolHandle);
+    line_pools[0]    = newGenericPoolWithSize((8) + ram_profile, allocLinePoolHandle, destroyLinePoolHandle);
+    loop             = hloop_new(0, buffer_pools[0], 0);
+    loops            = &loop;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socket_pair) != 0)
+    {
+        perror("socketpair");
+        return 1;
+    }
+
+    for (int i = 0; i < CHAIN_LEN; i++)
+    {
+        chain_tunnels[i] = newTunnel();
+        if (i > 0)
+        {
+            chain(chain_tunnels[i - 1], chain_tunnels[i]);
+        }
+    }
+    chain_tunnels[CHAIN_LEN - 1]->upStream = sinkUpStream;
+
+    worker_metrics = createMetricsManager();
+    static char       names[CHAIN_LEN][16];
+    TunnelFlowRoutine metered[CHAIN_LEN];
+    for (int i = 0; i < CHAIN_LEN; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "node%d", i);
+        meterTunnel(chain_tunnels[i], names[i]);
+        metered[i] = chain_tunnels[i]->upStream;
+    }
+
+    // plain and metered take turns, the best of ROUNDS is kept for each
+    double plain_chain = 1e18, metered_chain = 1e18, plain_socket = 1e18, metered_socket = 1e18;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        for (int m = 0; m < 2; m++)
+        {
+            for (int i = 0; i < CHAIN_LEN; i++)
+            {
+                chain_tunnels[i]->upStream = m == 1 ? metered[i] : chain_tunnels[i]->metered_up_stream;
+            }
+            write_to_socket = false;
+            double chain_ns = run();
+            write_to_socket = true;
+            double socket_ns = run();
+            if (m == 1)
+            {
+                metered_chain  = chain_ns < metered_chain ? chain_ns : metered_chain;
+                metered_socket = socket_ns < metered_socket ? socket_ns : metered_socket;
+            }
+            else
+            {
+                plain_chain  = chain_ns < plain_chain ? chain_ns : plain_chain;
+                plain_socket = socket_ns < plain_socket ? socket_ns : plain_socket;
+            }
+        }
+    }
+
+    printf("chain only  plain: %7.1f ns/payload  metered: %7.1f ns/payload  +%5.1f ns  overhead: %6.2f%%\n",
+           plain_chain, metered_chain, metered_chain - plain_chain, (metered_chain - plain_chain) * 100 / plain_chain);
+    printf("socket      plain: %7.1f ns/payload  metered: %7.1f ns/payload  +%5.1f ns  overhead: %6.2f%%\n",
+           plain_socket, metered_socket, metered_socket - plain_socket,
+           (metered_socket - plain_socket) * 100 / plain_socket);
+
+    // 2 metered runs a round went through every node
+    const uint64_t expected_bytes = 2ULL * ROUNDS * LINES * CONTEXTS_PER_LINE * PAYLOAD_SIZE;
+    unsigned int   failures       = 0;
+    for (int i = 0; i < CHAIN_LEN; i++)
+    {
+        node_metrics_t *node = &(worker_metrics[0].nodes[chain_tunnels[i]->metrics_index]);
+        if (metricGet(&(node->bytes_up)) != expected_bytes || metricGet(&(node->lines_opened)) != 2 * ROUNDS * LINES ||
+            metricGet(&(node->lines_closed)) != 2 * ROUNDS * LINES)
+        {
+            failures++;
+        }
+    }
+    size_t len  = 0;
+    char  *text = renderMetrics(&len);
+    printf("rendered %zu bytes of metrics, counter failures: %u\n", len, failures);
+    free(text);
+    return failures == 0 ? 0 : 1;
+}
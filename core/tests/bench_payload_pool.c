@@ -0,0 +1,252 @@
+#include "bench.h"
+#include "generic_pool.h"
+#include "hmutex.h"
+#include "hthread.h"
+#include "managers/payload_pool.h"
+#include "ww.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    socket manager payload pool benchmark, mutex per worker pool vs the payload pool
+
+    the udp path of the socket manager without the sockets: an accept thread takes a payload for a worker
+    and hands it over, the worker releases it, and sends a reply payload of its own back that the accept
+    thread releases (postUdpWrite), the hand over is a ring per worker and direction, the same for both
+
+        mutex     what the socket manager used to do, one generic pool per worker behind a hhybridmutex,
+                  taken by both sides for every pop / reuse
+        payload   payload_pool_t, every thread pops from its own pool, releases go to the owner's
+                  lock-free return stack
+
+    reports payloads/sec (both directions) for each worker count
+*/
+
+#define PHASE_SECONDS 2
+#define RING_SIZE     1024
+#define MAX_WORKERS   16
+
+typedef struct item_s
+{
+    uint8_t tid;
+    uint8_t pool_owner;
+    char    body[64];
+
+} item_t;
+
+typedef struct ring_s
+{
+    atomic_uint head ATTR_ALIGNED_LINE_CACHE;
+    atomic_uint tail ATTR_ALIGNED_LINE_CACHE;
+    item_t     *slots[RING_SIZE];
+
+} ring_t;
+
+static struct
+{
+    generic_pool_t *pool;
+    hhybridmutex_t  mutex;
+
+} old_pools[MAX_WORKERS];
+
+static payload_pool_t *new_pool;
+static ring_t          to_worker[MAX_WORKERS];
+static ring_t          to_accept[MAX_WORKERS];
+static unsigned int    bench_workers;
+static bool            use_payload_pool;
+static atomic_bool     running;
+static atomic_ulong    processed;
+
+static pool_item_t *allocItemHandle(struct generic_pool_s *pool)
+{
+    (void) pool;
+    return malloc(sizeof(item_t));
+}
+
+static void destroyItemHandle(struct generic_pool_s *pool, pool_item_t *item)
+{
+    (void) pool;
+    free(item);
+}
+
+static bool ringPush(ring_t *r, item_t *item)
+{
+    unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&r->head, memory_order_acquire) == RING_SIZE)
+    {
+        return false;
+    }
+    r->slots[tail % RING_SIZE] = item;
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+static item_t *ringPop(ring_t *r)
+{
+    unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&r->tail, memory_order_acquire))
+    {
+        return NULL;
+    }
+    item_t *item = r->slots[head % RING_SIZE];
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return item;
+}
+
+// owner is the thread that pops, tid the worker the item is for (the old pools are per worker)
+static item_t *newItem(unsigned int owner, uint8_t tid)
+{
+    item_t *item;
+    if (use_payload_pool)
+    {
+        item = popPayloadPoolItem(new_pool, owner);
+    }
+    else
+    {
+        hhybridmutex_lock(&(old_pools[tid].mutex));
+        item = popPoolItem(old_pools[tid].pool);
+        hhybridmutex_unlock(&(old_pools[tid].mutex));
+    }
+    item->tid        = tid;
+    item->pool_owner = (uint8_t) owner;
+    return item;
+}
+
+static void releaseItem(item_t *item)
+{
+    if (use_payload_pool)
+    {
+        reusePayloadPoolItem(new_pool, item->pool_owner, item);
+    }
+    else
+    {
+        hhybridmutex_lock(&(old_pools[item->tid].mutex));
+        reusePoolItem(old_pools[item->tid].pool, item);
+        hhybridmutex_unlock(&(old_pools[item->tid].mutex));
+    }
+}
+
+static HTHREAD_ROUTINE(workerThread)
+{
+    const uint8_t tid   = (uint8_t) (uintptr_t) userdata;
+    unsigned long count = 0;
+    while (atomic_load_explicit(&running, memory_order_relaxed))
+    {
+        item_t *item = ringPop(&to_worker[tid]);
+        if (item == NULL)
+        {
+            hv_delay(0);
+            continue;
+        }
+        releaseItem(item);
+        count++;
+
+        item_t *reply = newItem(tid, tid);
+        if (! ringPush(&to_accept[tid], reply))
+        {
+            releaseItem(reply);
+        }
+    }
+    atomic_fetch_add(&processed, count);
+    return 0;
+}
+
+static HTHREAD_ROUTINE(acceptThread)
+{
+    (void) userdata;
+    unsigned long count = 0;
+    uint8_t       tid   = 0;
+    while (atomic_load_explicit(&running, memory_order_relaxed))
+    {
+        item_t *item = newItem(bench_workers, tid);
+        if (! ringPush(&to_worker[tid], item))
+        {
+            releaseItem(item);
+        }
+        item_t *reply = ringPop(&to_accept[tid]);
+        if (reply != NULL)
+        {
+            releaseItem(reply);
+            count++;
+        }
+        tid = (uint8_t) ((tid + 1) % bench_workers);
+    }
+    atomic_fetch_add(&processed, count);
+    return 0;
+}
+
+static void drain(ring_t *r)
+{
+    item_t *item;
+    while ((item = ringPop(r)) != NULL)
+    {
+        releaseItem(item);
+    }
+}
+
+static double runOnce(unsigned int worker_count, bool payload_pool_mode)
+{
+    bench_workers    = worker_count;
+    use_payload_pool = payload_pool_mode;
+    atomic_store(&processed, 0);
+    memset(to_worker, 0, sizeof(to_worker));
+    memset(to_accept, 0, sizeof(to_accept));
+    for (unsigned int i = 0; i < bench_workers; i++)
+    {
+        old_pools[i].pool = newGenericPoolWithSize((8) + ram_profile, allocItemHandle, destroyItemHandle);
+        hhybridmutex_init(&(old_pools[i].mutex));
+    }
+    new_pool = newPayloadPool(bench_workers + 1, (8) + ram_profile, allocItemHandle, destroyItemHandle);
+
+    atomic_store(&running, true);
+    hthread_t threads[MAX_WORKERS + 1];
+    for (unsigned int i = 0; i < bench_workers; i++)
+    {
+        threads[i] = hthread_create(workerThread, (void *) (uintptr_t) i);
+    }
+    threads[bench_workers] = hthread_create(acceptThread, NULL);
+
+    double start = now();
+    hv_sleep(PHASE_SECONDS);
+    atomic_store(&running, false);
+    for (unsigned int i = 0; i <= bench_workers; i++)
+    {
+        hthread_join(threads[i]);
+    }
+    double elapsed = now() - start;
+
+    for (unsigned int i = 0; i < bench_workers; i++)
+    {
+        drain(&to_worker[i]);
+        drain(&to_accept[i]);
+    }
+    destroyPayloadPool(new_pool);
+    for (unsigned int i = 0; i < bench_workers; i++)
+    {
+        generic_pool_t *pool = old_pools[i].pool;
+        for (unsigned int k = 0; k < pool->len; k++)
+        {
+            destroyItemHandle(pool, pool->available[k]);
+        }
+        free(pool);
+        hhybridmutex_destroy(&(old_pools[i].mutex));
+    }
+    return (double) atomic_load(&processed) / elapsed;
+}
+
+int main(void)
+{
+    ram_profile = kRamProfileM1Memory;
+
+    const unsigned int counts[] = {1, 8, 16};
+    for (unsigned int i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+    {
+        double mutex_rate   = runOnce(counts[i], false);
+        double payload_rate = runOnce(counts[i], true);
+        printf("workers: %-3u  mutex: %10.0f payloads/sec  payload pool: %10.0f payloads/sec\n", counts[i],
+               mutex_rate, payload_rate);
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "hloop.h"
+#include "hthread.h"
+#include "ww.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+    cross thread event benchmark (hloop_post_event)
+
+    1..N producer threads post events to 1 loop, the loop callback only counts them,
+    reports events/sec for each producer count
+*/
+
+#define EVENTS_PER_PRODUCER 2000000
+#define MAX_PRODUCERS       8
+
+static hloop_t      *loop;
+static size_t        received;
+static size_t        expected;
+static atomic_int    go;
+
+static void onEvent(hevent_t *ev)
+{
+    (void) ev;
+    if (++received == expected)
+    {
+        hloop_stop(loop);
+    }
+}
+
+static HTHREAD_ROUTINE(producer)
+{
+    (void) userdata;
+    while (! atomic_load(&go))
+    {
+    }
+    for (int i = 0; i < EVENTS_PER_PRODUCER; i++)
+    {
+        hevent_t ev = {.cb = onEvent};
+        hloop_post_event(loop, &ev);
+    }
+    return 0;
+}
+
+static HTHREAD_ROUTINE(consumer)
+{
+    (void) userdata;
+    hloop_run(loop);
+    return 0;
+}
+
+int main(void)
+{
+    ram_profile = kRamProfileM1Memory;
+
+    for (int producers = 1; producers <= MAX_PRODUCERS; producers *= 2)
+    {
+        loop     = hloop_new(0, createSmallBufferPool(), 0);
+        received = 0;
+        expected = (size_t) producers * EVENTS_PER_PRODUCER;
+        atomic_store(&go, 0);
+
+        hthread_t threads[MAX_PRODUCERS];
+        hthread_t cthread = hthread_create(consumer, NULL);
+        for (int i = 0; i < producers; i++)
+        {
+            threads[i] = hthread_create(producer, NULL);
+        }
+
+        double start = now();
+        atomic_store(&go, 1);
+        hthread_join(cthread);
+        double elapsed = now() - start;
+        for (int i = 0; i < producers; i++)
+        {
+            hthread_join(threads[i]);
+        }
+
+        printf("producers: %d  events/sec: %.0f\n", producers, (double) expected / elapsed);
+        hloop_free(&loop);
+    }
+    return 0;
+}
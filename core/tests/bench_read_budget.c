@@ -0,0 +1,185 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "hloop.h"
+#include "hsocket.h"
+#include "hthread.h"
+#include "ww.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    io budget benchmark, one read / 3 accepts per wakeup (what nio did before) vs the default budget
+
+        stream   a client thread pushes TOTAL_BYTES over one loopback tcp connection, the loop reads and drops it,
+                 reports Gbit/sec and the loop iterations it took
+        accept   ACCEPT_THREADS threads connect and close as fast as they can for PHASE_SECONDS, the loop accepts
+                 and closes, reports accepts/sec
+*/
+
+#define TOTAL_BYTES    (4UL * 1024 * 1024 * 1024)
+#define CHUNK          (256 * 1024)
+#define ACCEPT_THREADS 4
+#define PHASE_SECONDS  3
+
+static hloop_t    *loop;
+static sockaddr_u  listen_addr;
+static size_t      received;
+static size_t      accepted;
+static atomic_bool stop;
+
+static HTHREAD_ROUTINE(streamClientThread)
+{
+    (void) userdata;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    connect(fd, &listen_addr.sa, sockaddr_len(&listen_addr));
+
+    static char buf[CHUNK];
+    for (size_t sent = 0; sent < TOTAL_BYTES;)
+    {
+        ssize_t n = send(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+        {
+            break;
+        }
+        sent += n;
+    }
+    closesocket(fd);
+    return 0;
+}
+
+static HTHREAD_ROUTINE(acceptClientThread)
+{
+    (void) userdata;
+    while (! atomic_load_explicit(&stop, memory_order_relaxed))
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, &listen_addr.sa, sockaddr_len(&listen_addr)) != 0)
+        {
+            closesocket(fd);
+            continue;
+        }
+        // no time_wait on the client side, the local ports would run out
+        struct linger lg = {.l_onoff = 1, .l_linger = 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, (const char *) &lg, sizeof(lg));
+        closesocket(fd);
+    }
+    return 0;
+}
+
+static HTHREAD_ROUTINE(stopAfter)
+{
+    (void) userdata;
+    hv_sleep(PHASE_SECONDS);
+    atomic_store(&stop, true);
+    return 0;
+}
+
+static void onRecv(hio_t *io, shift_buffer_t *buf)
+{
+    received += bufLen(buf);
+    reuseBuffer(hloop_bufferpool(hevent_loop(io)), buf);
+}
+
+static void onStreamClose(hio_t *io)
+{
+    hloop_stop(hevent_loop(io));
+}
+
+static void onStreamAccept(hio_t *io)
+{
+    hio_setcb_read(io, onRecv);
+    hio_setcb_close(io, onStreamClose);
+    hio_read(io);
+}
+
+static void onConnectionAccept(hio_t *io)
+{
+    accepted++;
+    hio_close(io);
+}
+
+static void onCheckStop(htimer_t *timer)
+{
+    if (atomic_load(&stop))
+    {
+        hloop_stop(hevent_loop(timer));
+    }
+}
+
+static int listenLoopback(void)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_set_ipport(&listen_addr, "127.0.0.1", 0);
+    bind(fd, &listen_addr.sa, sockaddr_len(&listen_addr));
+    listen(fd, 4096);
+    socklen_t len = sizeof(listen_addr);
+    getsockname(fd, &listen_addr.sa, &len);
+    return fd;
+}
+
+static void runStream(const char *name, hloop_io_budget_t budget)
+{
+    received = 0;
+    loop     = hloop_new(0, createBufferPool(), 0);
+    hloop_set_io_budget(loop, budget);
+    int listen_fd = listenLoopback();
+    haccept(loop, listen_fd, onStreamAccept);
+
+    double    start  = now();
+    hthread_t client = hthread_create(streamClientThread, NULL);
+    hloop_run(loop);
+    double elapsed = now() - start;
+    hthread_join(client);
+
+    printf("stream  %-8s  %6.2f Gbit/sec  %8llu loop iterations  %zu bytes\n", name,
+           (double) received * 8 / elapsed / 1e9, (unsigned long long) hloop_count(loop), received);
+    closesocket(listen_fd);
+    hloop_free(&loop);
+}
+
+static void runAccept(const char *name, hloop_io_budget_t budget)
+{
+    accepted = 0;
+    atomic_store(&stop, false);
+    loop = hloop_new(0, createSmallBufferPool(), 0);
+    hloop_set_io_budget(loop, budget);
+    int listen_fd = listenLoopback();
+    haccept(loop, listen_fd, onConnectionAccept);
+    htimer_add(loop, onCheckStop, 10, INFINITE);
+
+    hthread_t clients[ACCEPT_THREADS];
+    for (int i = 0; i < ACCEPT_THREADS; i++)
+    {
+        clients[i] = hthread_create(acceptClientThread, NULL);
+    }
+    hthread_t stopper = hthread_create(stopAfter, NULL);
+    hloop_run(loop);
+    for (int i = 0; i < ACCEPT_THREADS; i++)
+    {
+        hthread_join(clients[i]);
+    }
+    hthread_join(stopper);
+
+    printf("accept  %-8s  %8.0f accepts/sec  %8llu loop iterations\n", name, (double) accepted / PHASE_SECONDS,
+           (unsigned long long) hloop_count(loop));
+    closesocket(listen_fd);
+    hloop_free(&loop);
+}
+
+int main(void)
+{
+    ram_profile = kRamProfileM1Memory;
+
+    const hloop_io_budget_t single  = {.read_bytes = 1, .reads = 1, .accepts = 3};
+    const hloop_io_budget_t budget  = {.read_bytes = HLOOP_DEFAULT_READ_BUDGET_BYTES,
+                                       .reads      = HLOOP_DEFAULT_READ_BUDGET_READS,
+                                       .accepts    = HLOOP_DEFAULT_ACCEPT_BUDGET};
+
+    runStream("single", single);
+    runStream("budget", budget);
+    runAccept("single", single);
+    runAccept("budget", budget);
+    return 0;
+}
@@ -0,0 +1,211 @@
+#include "buffer_pool.h"
+#include "hloop.h"
+#include "hsocket.h"
+#include "ww.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+/*
+    read sizing benchmark, memory of many mostly idle connections
+
+    opens CONNECTIONS socketpairs, the loop reads one end of each, every round writes a KEEPALIVE_SIZE keepalive
+    on the other end of all of them, the read callback keeps the last buffer of each connection (like a tunnel
+    that holds a partial frame or a queued write) and gives the previous one back
+
+        adaptive  keeps the buffer nio_read gave, it is sized by the recent reads of the io
+        fixed     copies it into a buffer of the full pool size first, that is what nio_read gave before the
+                  size classes
+
+    after the idle rounds a few connections get a BURST_SIZE burst, the reads have to grow back to the largest
+    class, the bytes per read show if they did
+
+    run `bench_read_sizing adaptive` and `bench_read_sizing fixed` separately since rss is per process,
+    the number of connections is the second argument (default 100000, needs 2 fds each)
+*/
+
+#define CONNECTIONS     100000
+#define KEEPALIVE_SIZE  60
+#define IDLE_ROUNDS     8
+#define BURST_LINES     64
+#define BURST_SIZE      (1024 * 1024)
+
+static hloop_t         *loop;
+static buffer_pool_t   *pool;
+static int             *peers;
+static shift_buffer_t **held;
+static unsigned int     connections;
+static bool             fixed_mode;
+static uint64_t         received;
+static uint64_t         expected;
+static uint64_t         reads;
+static unsigned int     round_index;
+static uint64_t         burst_reads;
+static uint64_t         burst_start;
+static long             start_rss;
+
+static long currentRssKB(void)
+{
+    long  pages = 0;
+    FILE *f     = fopen("/proc/self/statm", "r");
+    if (f)
+    {
+        if (fscanf(f, "%*s %ld", &pages) != 1)
+        {
+            pages = 0;
+        }
+        fclose(f);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void onRecv(hio_t *io, shift_buffer_t *buf)
+{
+    const uintptr_t index = (uintptr_t) hevent_userdata(io);
+    received += bufLen(buf);
+    reads += 1;
+
+    if (fixed_mode)
+    {
+        shift_buffer_t *full = popBuffer(pool);
+        setLen(full, bufLen(buf));
+        memcpy(rawBufMut(full), rawBuf(buf), bufLen(buf));
+        reuseBuffer(pool, buf);
+        buf = full;
+    }
+    if (held[index] != NULL)
+    {
+        reuseBuffer(pool, held[index]);
+    }
+    held[index] = buf;
+}
+
+static void sendAll(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0)
+        {
+            perror("write");
+            exit(1);
+        }
+        data += n;
+        len -= (size_t) n;
+    }
+}
+
+// a new round starts when the loop has read everything of the last one
+static void onTick(htimer_t *timer)
+{
+    (void) timer;
+    if (received < expected)
+    {
+        return;
+    }
+    static char keepalive[KEEPALIVE_SIZE];
+    if (round_index < IDLE_ROUNDS)
+    {
+        for (unsigned int i = 0; i < connections; i++)
+        {
+            sendAll(peers[i], keepalive, sizeof(keepalive));
+        }
+        expected += (uint64_t) connections * KEEPALIVE_SIZE;
+    }
+    else if (round_index == IDLE_ROUNDS)
+    {
+        const long idle_rss = currentRssKB();
+        printf("idle       rss: %ld KB  held per connection: %.0f bytes\n", idle_rss,
+               (double) (idle_rss - start_rss) * 1024 / connections);
+        burst_reads = reads;
+        burst_start = received;
+        // the socketpair buffers are small, the burst is written in pieces by the next ticks
+        expected += (uint64_t) BURST_LINES * BURST_SIZE;
+    }
+    else
+    {
+        hloop_stop(loop);
+        return;
+    }
+    round_index++;
+}
+
+static void onBurstTick(htimer_t *timer)
+{
+    (void) timer;
+    static char   chunk[64 * 1024];
+    static size_t written;
+    // the peers are blocking, a chunk is only written after the loop read the last one
+    if (round_index <= IDLE_ROUNDS || written >= (size_t) BURST_SIZE ||
+        received < burst_start + (uint64_t) written * BURST_LINES)
+    {
+        return;
+    }
+    for (unsigned int i = 0; i < BURST_LINES && i < connections; i++)
+    {
+        sendAll(peers[i], chunk, sizeof(chunk));
+    }
+    written += sizeof(chunk);
+}
+
+int main(int argc, char **argv)
+{
+    ram_profile = kRamProfileM1Memory;
+
+    fixed_mode  = argc > 1 && strcmp(argv[1], "fixed") == 0;
+    connections = argc > 2 ? (unsigned int) atoi(argv[2]) : CONNECTIONS;
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < 2 * (rlim_t) connections + 64)
+    {
+        connections = (unsigned int) ((limit.rlim_cur - 64) / 2);
+        printf("fd limit, only %u connections\n", connections);
+    }
+
+    pool  = createBufferPool();
+    loop  = hloop_new(0, pool, 0);
+    peers = malloc(sizeof(int) * connections);
+    held  = calloc(connections, sizeof(shift_buffer_t *));
+
+    for (unsigned int i = 0; i < connections; i++)
+    {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+        {
+            perror("socketpair");
+            return 1;
+        }
+        peers[i]  = pair[1];
+        hio_t *io = hio_get(loop, pair[0]);
+        hevent_set_userdata(io, (void *) (uintptr_t) i);
+        hio_setcb_read(io, onRecv);
+        hio_read(io);
+    }
+    start_rss = currentRssKB();
+    printf("mode: %s  connections: %u  pool classes:", fixed_mode ? "fixed" : "adaptive", connections);
+    for (unsigned int i = 0; i < bufferPoolClassCount(pool); i++)
+    {
+        printf(" %u", bufferPoolClassSize(pool, i));
+    }
+    printf("\nopened     rss: %ld KB\n", start_rss);
+
+    htimer_add(loop, onTick, 5, INFINITE);
+    htimer_add(loop, onBurstTick, 1, INFINITE);
+    hloop_run(loop);
+
+    // what the idle connections hold is measured after the idle rounds, the burst only checks the read sizes
+    pool_stats_t stats = getBufferPoolStats(pool);
+    printf("end        rss: %ld KB  pool buffers: %u allocated %u available\n", currentRssKB(), stats.allocated,
+           stats.available);
+    printf("burst      %.0f bytes per read (%llu reads)\n",
+           (double) BURST_LINES * BURST_SIZE / (double) (reads - burst_reads),
+           (unsigned long long) (reads - burst_reads));
+    printf("received   %llu / %llu bytes\n", (unsigned long long) received, (unsigned long long) expected);
+    return received == expected ? 0 : 1;
+}
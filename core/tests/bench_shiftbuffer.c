@@ -0,0 +1,120 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "shiftbuffer.h"
+#include "ww.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    shift buffer allocation benchmark, pop / slice / reuse cycles
+
+        new+destroy      newShiftBuffer + destroyShiftBuffer, what a pool recharge / shrink costs per buffer
+        pop+reuse        popBuffer + reuseBuffer on a warm pool
+        shallow slice    pop, write, shallowSliceBuffer into 4 pieces that are destroyed, reuse
+                         (the buffer_stream / tls fallback pattern)
+        slice            pop 2, write, sliceBufferTo the bigger part (the payloads are swapped), reuse both
+        expand           pop, write past the cap once (moves to a bigger payload), reuse
+
+    runs on a heap pool and on a slab pool, every cycle touches the data so the work is not optimized out,
+    reports ns/cycle
+*/
+
+#define CYCLES       2000000
+#define PAYLOAD_SIZE 1400
+
+static buffer_pool_t *pool;
+static unsigned long  sink;
+
+static shift_buffer_t *popFilled(void)
+{
+    shift_buffer_t *buf = popBuffer(pool);
+    setLen(buf, PAYLOAD_SIZE);
+    memset(rawBufMut(buf), 'w', PAYLOAD_SIZE);
+    return buf;
+}
+
+static void cycleNewDestroy(void)
+{
+    shift_buffer_t *buf = newShiftBuffer(4096);
+    setLen(buf, 16);
+    sink += rawBufMut(buf)[0];
+    destroyShiftBuffer(buf);
+}
+
+static void cyclePopReuse(void)
+{
+    shift_buffer_t *buf = popBuffer(pool);
+    setLen(buf, 16);
+    sink += rawBufMut(buf)[0];
+    reuseBuffer(pool, buf);
+}
+
+static void cycleShallowSlice(void)
+{
+    shift_buffer_t *buf = popFilled();
+    for (int i = 0; i < 4; i++)
+    {
+        shift_buffer_t *piece = shallowSliceBuffer(buf, PAYLOAD_SIZE / 8);
+        sink += bufLen(piece);
+        destroyShiftBuffer(piece);
+    }
+    reuseBuffer(pool, buf);
+}
+
+static void cycleSlice(void)
+{
+    shift_buffer_t *buf   = popFilled();
+    shift_buffer_t *first = popBuffer(pool);
+    sliceBufferTo(first, buf, (PAYLOAD_SIZE * 3) / 4);
+    sink += bufLen(first) + bufLen(buf);
+    reuseBuffer(pool, first);
+    reuseBuffer(pool, buf);
+}
+
+static void cycleExpand(void)
+{
+    shift_buffer_t *buf = popFilled();
+    const unsigned  len = bufLen(buf) + rCap(buf) + 1;
+    setLen(buf, len);
+    sink += rawBufMut(buf)[len - 1];
+    reuseBuffer(pool, buf);
+}
+
+static void run(const char *name, void (*cycle)(void), unsigned int cycles)
+{
+    // warm the pool up first
+    for (unsigned int i = 0; i < 1000; i++)
+    {
+        cycle();
+    }
+    double start = now();
+    for (unsigned int i = 0; i < cycles; i++)
+    {
+        cycle();
+    }
+    printf("%-14s  %7.1f ns/cycle\n", name, (now() - start) * 1e9 / cycles);
+}
+
+int main(void)
+{
+    ram_profile = kRamProfileM1Memory;
+
+    printf("heap pool\n");
+    pool = createHeapBufferPool();
+    run("new+destroy", cycleNewDestroy, CYCLES);
+    run("pop+reuse", cyclePopReuse, CYCLES);
+    run("shallow slice", cycleShallowSlice, CYCLES);
+    run("slice", cycleSlice, CYCLES);
+    run("expand", cycleExpand, CYCLES / 4);
+
+    printf("slab pool\n");
+    pool = createSlabBufferPool();
+    run("pop+reuse", cyclePopReuse, CYCLES);
+    run("shallow slice", cycleShallowSlice, CYCLES);
+    run("slice", cycleSlice, CYCLES);
+    run("expand", cycleExpand, CYCLES / 4);
+
+    printf("(%lu)\n", sink & 0x1);
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "hloop.h"
+#include "hsocket.h"
+#include "hthread.h"
+#include "ww.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    tcp relay benchmark, buffer path vs hio_splice
+
+    a client thread pushes TOTAL_BYTES into the relay, the relay (one loop) forwards each accepted connection to a
+    sink thread that reads and checks the byte pattern, reports MB/sec for:
+
+        buffers  read_cb => hio_write to the other io, reading stops while the other io has a write queued
+                 (the same thing TcpListener -> TcpConnector do with the line pause / resume)
+        splice   hio_splice on both ios, the bytes never leave the kernel
+*/
+
+#define TOTAL_BYTES (1024UL * 1024 * 1024)
+#define CHUNK       (64 * 1024)
+
+static hloop_t    *loop;
+static sockaddr_u  relay_addr;
+static sockaddr_u  sink_addr;
+static int         sink_listen_fd;
+static bool        use_splice;
+static atomic_bool sink_done;
+static size_t      sink_received;
+static bool        sink_corrupted;
+
+static HTHREAD_ROUTINE(sinkThread)
+{
+    (void) userdata;
+    int fd = accept(sink_listen_fd, NULL, NULL);
+
+    static unsigned char buf[CHUNK];
+    ssize_t              n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+    {
+        // sampled, checking every byte would make the sink the bottleneck
+        for (ssize_t i = 0; i < n; i += 61)
+        {
+            if (buf[i] != (unsigned char) ((sink_received + i) % 251))
+            {
+                sink_corrupted = true;
+            }
+        }
+        sink_received += n;
+    }
+    closesocket(fd);
+    atomic_store(&sink_done, true);
+    return 0;
+}
+
+static HTHREAD_ROUTINE(clientThread)
+{
+    (void) userdata;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    connect(fd, &relay_addr.sa, sockaddr_len(&relay_addr));
+
+    // one extra period, so a send can start anywhere in the pattern
+    static unsigned char buf[251 * 257];
+    for (size_t i = 0; i < sizeof(buf); i++)
+    {
+        buf[i] = (unsigned char) (i % 251);
+    }
+    for (size_t sent = 0; sent < TOTAL_BYTES;)
+    {
+        size_t  len = TOTAL_BYTES - sent < 251 * 256 ? TOTAL_BYTES - sent : 251 * 256;
+        ssize_t n   = send(fd, buf + (sent % 251), len, 0);
+        if (n <= 0)
+        {
+            break;
+        }
+        sent += n;
+    }
+    closesocket(fd);
+    return 0;
+}
+
+static void onWriteComplete(hio_t *io)
+{
+    if (hio_write_is_complete(io))
+    {
+        hio_setcb_write(io, NULL);
+        hio_read(hevent_userdata(io));
+    }
+}
+
+static void onRecv(hio_t *io, shift_buffer_t *buf)
+{
+    hio_t *peer = hevent_userdata(io);
+    hio_write(peer, buf);
+    if (! hio_write_is_complete(peer))
+    {
+        hio_read_stop(io);
+        hio_setcb_write(peer, onWriteComplete);
+    }
+}
+
+static void onClose(hio_t *io)
+{
+    hio_t *peer = hevent_userdata(io);
+    if (peer != NULL)
+    {
+        hevent_set_userdata(peer, NULL);
+        hio_close(peer);
+    }
+}
+
+static void onAccept(hio_t *io)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    connect(fd, &sink_addr.sa, sockaddr_len(&sink_addr));
+    hio_t *upstream_io = hio_get(loop, fd);
+
+    hevent_set_userdata(io, upstream_io);
+    hevent_set_userdata(upstream_io, io);
+    hio_setcb_close(io, onClose);
+    hio_setcb_close(upstream_io, onClose);
+    hio_setcb_read(io, onRecv);
+    hio_setcb_read(upstream_io, onRecv);
+
+    if (use_splice && hio_splice(io, upstream_io) != 0)
+    {
+        printf("hio_splice failed\n");
+        exit(1);
+    }
+    hio_read(io);
+    hio_read(upstream_io);
+}
+
+static void onCheckDone(htimer_t *timer)
+{
+    (void) timer;
+    if (atomic_load(&sink_done))
+    {
+        hloop_stop(loop);
+    }
+}
+
+static void listenOn(sockaddr_u *addr, int fd)
+{
+    sockaddr_set_ipport(addr, "127.0.0.1", 0);
+    bind(fd, &addr->sa, sockaddr_len(addr));
+    listen(fd, 16);
+    socklen_t len = sizeof(*addr);
+    getsockname(fd, &addr->sa, &len);
+}
+
+static void runOnce(bool splice_mode)
+{
+    use_splice     = splice_mode;
+    sink_received  = 0;
+    sink_corrupted = false;
+    atomic_store(&sink_done, false);
+    loop = hloop_new(0, createSmallBufferPool(), 0);
+
+    sink_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    listenOn(&sink_addr, sink_listen_fd);
+    int relay_fd = socket(AF_INET, SOCK_STREAM, 0);
+    listenOn(&relay_addr, relay_fd);
+    haccept(loop, relay_fd, onAccept);
+    htimer_add(loop, onCheckDone, 10, INFINITE);
+
+    hthread_t sink   = hthread_create(sinkThread, NULL);
+    double    start  = now();
+    hthread_t client = hthread_create(clientThread, NULL);
+    hloop_run(loop);
+    double elapsed = now() - start;
+    hthread_join(client);
+    hthread_join(sink);
+
+    printf("%-8s  received: %zu / %lu  %s  MB/sec: %.0f\n", splice_mode ? "splice" : "buffers", sink_received,
+           TOTAL_BYTES, sink_corrupted ? "CORRUPTED" : "intact", (double) sink_received / elapsed / (1024 * 1024));
+    closesocket(sink_listen_fd);
+    hloop_free(&loop);
+}
+
+int main(void)
+{
+    ram_profile = kRamProfileM1Memory;
+
+    runOnce(false);
+    runOnce(true);
+    return 0;
+}
@@ -0,0 +1,430 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "generic_pool.h"
+#include "hloop.h"
+#include "hsocket.h"
+#include "hthread.h"
+#include "openssl_buffer_bio.h"
+#include "openssl_handshake_pool.h"
+#include "tunnel.h"
+#include "ww.h"
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+    handshake offload benchmark, handshakes on the loop vs on the crypto threads (openssl_handshake_pool.h)
+
+    one loop serves tls 1.3 the way the openssl server tunnel does (buffer bio, or a handshake job until the
+    handshake is done), the key is rsa 2048 so a full handshake costs the server a signature, on the lines it
+    already serves:
+
+        ping    a client sends an 8 byte ping every millisecond and waits for the echo, reports the round trip
+                p50 / p99 / max
+        bulk    a client streams as fast as it can, the loop reads and drops it, reports Mbit/sec
+
+    for PHASE_SECONDS, quiet (only the two lines) and under a flood (FLOOD_THREADS clients doing full handshakes in
+    a loop, reports the handshakes/sec the server finished), with the handshakes on the loop and on HANDSHAKE_THREADS
+    crypto threads
+*/
+
+#define PHASE_SECONDS     4
+#define FLOOD_THREADS     4
+#define HANDSHAKE_THREADS 2
+#define PING_INTERVAL_US  1000
+#define MAX_PINGS         (PHASE_SECONDS * 1000000 / PING_INTERVAL_US)
+#define BULK_CHUNK        (16 * 1024)
+
+typedef struct
+{
+    hio_t               *io;
+    line_t              *line;
+    SSL                 *ssl;
+    BIO                 *bio;       // after the handshake (or from the start without offload)
+    ssl_handshake_job_t *handshake; // until the handshake is done, with offload
+    bool                 closed;
+
+} conn_t;
+
+static hloop_t    *loop;
+static SSL_CTX    *server_ctx;
+static SSL_CTX    *client_ctx;
+static sockaddr_u  listen_addr;
+static bool        offload;
+static atomic_bool stop;
+static atomic_int  open_conns;
+static atomic_long handshakes;
+static size_t      bulk_received;
+static double      rtts[MAX_PINGS];
+static int         pings;
+
+static void makeContexts(void)
+{
+    EVP_PKEY  *key  = EVP_RSA_gen(2048);
+    X509      *cert = X509_new();
+    X509_NAME *name = X509_get_subject_name(cert);
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *) "bench", -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509_sign(cert, key, EVP_sha256());
+
+    server_ctx = SSL_CTX_new(TLS_server_method());
+    client_ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_use_certificate(server_ctx, cert);
+    SSL_CTX_use_PrivateKey(server_ctx, key);
+    SSL_CTX_set_min_proto_version(server_ctx, TLS1_3_VERSION);
+    // every handshake is a full one
+    SSL_CTX_set_num_tickets(server_ctx, 0);
+    SSL_CTX_set_session_cache_mode(server_ctx, SSL_SESS_CACHE_OFF);
+    SSL_CTX_set_session_cache_mode(client_ctx, SSL_SESS_CACHE_OFF);
+
+    X509_free(cert);
+    EVP_PKEY_free(key);
+}
+
+static void freeConn(conn_t *cn)
+{
+    if (cn->handshake != NULL)
+    {
+        destroySslHandshakeJob(cn->handshake);
+    }
+    SSL_free(cn->ssl);
+    destroyLine(cn->line);
+    free(cn);
+    atomic_fetch_sub(&open_conns, 1);
+}
+
+static shift_buffer_t *popRecord(conn_t *cn)
+{
+    return cn->handshake != NULL ? sslHandshakeJobPop(cn->handshake) : bufferBioPop(cn->bio);
+}
+
+static void flush(conn_t *cn)
+{
+    shift_buffer_t *buf;
+    while ((buf = popRecord(cn)) != NULL)
+    {
+        hio_write(cn->io, buf); // closes it async on errors
+    }
+}
+
+static void readRecords(conn_t *cn)
+{
+    while (true)
+    {
+        shift_buffer_t *buf = popBuffer(getLineBufferPool(cn->line));
+        const int       n   = SSL_read(cn->ssl, rawBufMut(buf), (int) rCap(buf));
+        if (n <= 0)
+        {
+            reuseBuffer(getLineBufferPool(cn->line), buf);
+            break;
+        }
+        if (((const char *) rawBuf(buf))[0] == 'p')
+        {
+            SSL_write(cn->ssl, rawBuf(buf), n);
+        }
+        else
+        {
+            bulk_received += (size_t) n;
+        }
+        reuseBuffer(getLineBufferPool(cn->line), buf);
+    }
+    flush(cn);
+}
+
+// the server finished a handshake
+static void handshakeDone(conn_t *cn)
+{
+    atomic_fetch_add(&handshakes, 1);
+    readRecords(cn);
+}
+
+static void onStepBack(ssl_handshake_job_t *job)
+{
+    conn_t *cn = job->userdata;
+    if (cn->closed)
+    {
+        freeConn(cn);
+        return;
+    }
+    if (job->error != SSL_ERROR_NONE && job->error != SSL_ERROR_WANT_READ)
+    {
+        hio_close_async(cn->io);
+        return;
+    }
+    flush(cn);
+    if (! SSL_is_init_finished(cn->ssl))
+    {
+        if (sslHandshakeJobHasInput(job))
+        {
+            sslHandshakeJobRun(job);
+        }
+        return;
+    }
+    cn->bio = newBufferBio(getLineBufferPool(cn->line));
+    sslHandshakeJobFinish(job, cn->bio);
+    cn->handshake = NULL;
+    handshakeDone(cn);
+}
+
+static void onRead(hio_t *io, shift_buffer_t *buf)
+{
+    conn_t *cn = hevent_userdata(io);
+    if (cn->handshake != NULL)
+    {
+        sslHandshakeJobPush(cn->handshake, buf);
+        if (! cn->handshake->running)
+        {
+            sslHandshakeJobRun(cn->handshake);
+        }
+        return;
+    }
+    bufferBioPush(cn->bio, buf);
+    if (! SSL_is_init_finished(cn->ssl))
+    {
+        const int n = SSL_do_handshake(cn->ssl);
+        flush(cn);
+        if (n != 1)
+        {
+            if (SSL_get_error(cn->ssl, n) != SSL_ERROR_WANT_READ)
+            {
+                hio_close_async(io);
+            }
+            return;
+        }
+        handshakeDone(cn);
+        return;
+    }
+    readRecords(cn);
+}
+
+static void onClose(hio_t *io)
+{
+    conn_t *cn = hevent_userdata(io);
+    if (cn->handshake != NULL && cn->handshake->running)
+    {
+        cn->closed = true; // freed when the step is back
+        return;
+    }
+    freeConn(cn);
+}
+
+static void onAccept(hio_t *io)
+{
+    conn_t *cn = malloc(sizeof(conn_t));
+    *cn        = (conn_t){.io = io, .line = newLine(0), .ssl = SSL_new(server_ctx)};
+    SSL_set_accept_state(cn->ssl);
+    if (offload)
+    {
+        cn->handshake = newSslHandshakeJob(cn->ssl, cn->line, NULL, onStepBack, cn);
+    }
+    else
+    {
+        cn->bio = newBufferBio(getLineBufferPool(cn->line));
+        SSL_set_bio(cn->ssl, cn->bio, cn->bio);
+    }
+    atomic_fetch_add(&open_conns, 1);
+    hevent_set_userdata(io, cn);
+    hio_setcb_read(io, onRead);
+    hio_setcb_close(io, onClose);
+    hio_read(io);
+}
+
+static void onCheckStop(htimer_t *timer)
+{
+    // nothing may be left on the crypto threads when the loop goes
+    if (atomic_load(&stop) && atomic_load(&open_conns) == 0)
+    {
+        hloop_stop(hevent_loop(timer));
+    }
+}
+
+static SSL *connectClient(int *fd_out)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, &listen_addr.sa, sockaddr_len(&listen_addr)) != 0)
+    {
+        closesocket(fd);
+        return NULL;
+    }
+    SSL *ssl = SSL_new(client_ctx);
+    SSL_set_fd(ssl, fd);
+    if (SSL_connect(ssl) != 1)
+    {
+        SSL_free(ssl);
+        closesocket(fd);
+        return NULL;
+    }
+    *fd_out = fd;
+    return ssl;
+}
+
+static void closeClient(SSL *ssl, int fd)
+{
+    // no time_wait on the client side, the local ports would run out
+    struct linger lg = {.l_onoff = 1, .l_linger = 0};
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, (const char *) &lg, sizeof(lg));
+    SSL_free(ssl);
+    closesocket(fd);
+}
+
+static HTHREAD_ROUTINE(floodThread)
+{
+    (void) userdata;
+    while (! atomic_load_explicit(&stop, memory_order_relaxed))
+    {
+        int  fd;
+        SSL *ssl = connectClient(&fd);
+        if (ssl != NULL)
+        {
+            closeClient(ssl, fd);
+        }
+    }
+    return 0;
+}
+
+static HTHREAD_ROUTINE(pingThread)
+{
+    (void) userdata;
+    int  fd;
+    SSL *ssl = connectClient(&fd);
+    if (ssl == NULL)
+    {
+        printf("ping: could not connect\n");
+        exit(1);
+    }
+    char ping[8] = "pingping";
+    char pong[8];
+    while (! atomic_load_explicit(&stop, memory_order_relaxed) && pings < MAX_PINGS)
+    {
+        const double start = now();
+        SSL_write(ssl, ping, sizeof(ping));
+        if (SSL_read(ssl, pong, sizeof(pong)) != (int) sizeof(pong))
+        {
+            printf("ping: no echo\n");
+            exit(1);
+        }
+        rtts[pings++] = now() - start;
+        hv_usleep(PING_INTERVAL_US);
+    }
+    closeClient(ssl, fd);
+    return 0;
+}
+
+static HTHREAD_ROUTINE(bulkThread)
+{
+    (void) userdata;
+    int  fd;
+    SSL *ssl = connectClient(&fd);
+    if (ssl == NULL)
+    {
+        printf("bulk: could not connect\n");
+        exit(1);
+    }
+    static char chunk[BULK_CHUNK];
+    memset(chunk, 'b', sizeof(chunk));
+    while (! atomic_load_explicit(&stop, memory_order_relaxed))
+    {
+        SSL_write(ssl, chunk, sizeof(chunk));
+    }
+    closeClient(ssl, fd);
+    return 0;
+}
+
+static HTHREAD_ROUTINE(phaseThread)
+{
+    const bool flood = (bool) (uintptr_t) userdata;
+    hthread_t  ping  = hthread_create(pingThread, NULL);
+    hthread_t  bulk  = hthread_create(bulkThread, NULL);
+    hthread_t  flooders[FLOOD_THREADS];
+    if (flood)
+    {
+        for (int i = 0; i < FLOOD_THREADS; i++)
+        {
+            flooders[i] = hthread_create(floodThread, NULL);
+        }
+    }
+    hv_sleep(PHASE_SECONDS);
+    atomic_store(&stop, true);
+    hthread_join(ping);
+    hthread_join(bulk);
+    if (flood)
+    {
+        for (int i = 0; i < FLOOD_THREADS; i++)
+        {
+            hthread_join(flooders[i]);
+        }
+    }
+    return 0;
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+    const double x = *(const double *) a;
+    const double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static void runPhase(bool offload_mode, bool flood)
+{
+    offload       = offload_mode;
+    bulk_received = 0;
+    pings         = 0;
+    atomic_store(&stop, false);
+    atomic_store(&handshakes, 0);
+
+    loop   = hloop_new(0, buffer_pools[0], 0);
+    loops  = &loop;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_set_ipport(&listen_addr, "127.0.0.1", 0);
+    bind(fd, &listen_addr.sa, sockaddr_len(&listen_addr));
+    listen(fd, 4096);
+    socklen_t len = sizeof(listen_addr);
+    getsockname(fd, &listen_addr.sa, &len);
+    haccept(loop, fd, onAccept);
+    htimer_add(loop, onCheckStop, 10, INFINITE);
+
+    const double start = now();
+    hthread_t    phase = hthread_create(phaseThread, (void *) (uintptr_t) flood);
+    hloop_run(loop);
+    const double elapsed = now() - start;
+    hthread_join(phase);
+    hloop_free(&loop); // closes the listener too
+
+    qsort(rtts, (size_t) pings, sizeof(double), compareDouble);
+    printf("%-7s %-5s  ping p50 %7.3f ms  p99 %7.3f ms  max %7.3f ms   bulk %6.0f Mbit/sec   %5.0f handshakes/sec\n",
+           offload_mode ? "offload" : "loop", flood ? "flood" : "quiet", rtts[pings / 2] * 1e3,
+           rtts[(pings * 99) / 100] * 1e3, rtts[pings - 1] * 1e3, (double) bulk_received * 8 / elapsed / 1e6,
+           (double) (atomic_load(&handshakes) - 2) / elapsed);
+}
+
+int main(void)
+{
+    ram_profile   = kRamProfileM1Memory;
+    workers_count = 1;
+    buffer_pools  = malloc(sizeof(buffer_pool_t *));
+    line_pools    = malloc(sizeof(generic_pool_t *));
+
+    buffer_pools[0] = createBufferPool();
+    line_pools[0]   = newGenericPoolWithSize((8) + ram_profile, allocLinePoolHandle, destroyLinePoolHandle);
+
+    bufferBioGlobalInit();
+    sslHandshakePoolInit(HANDSHAKE_THREADS);
+    makeContexts();
+
+    runPhase(false, false);
+    runPhase(false, true);
+    runPhase(true, false);
+    runPhase(true, true);
+    return 0;
+}
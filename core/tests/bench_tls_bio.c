@@ -0,0 +1,241 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "buffer_stream.h"
+#include "openssl_buffer_bio.h"
+#include "ww.h"
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+    tls bio benchmark, memory bios (what the openssl tunnels used before) vs the buffer bio
+
+    a client and a server SSL talk tls 1.3 (aes-128-gcm) in memory, the client writes TOTAL_BYTES in CHUNK sized
+    payloads, the records go to the server the way the tunnels hand them over the chain and the server reads the
+    plaintext into pool buffers, reports Gbit/sec of plaintext and the handshakes/sec of both sides together
+
+        mem      BIO_s_mem pairs, the records are BIO_read into a popped buffer (what the tunnel sends down) and
+                 BIO_write into the bio of the peer
+        buffer   the record buffers the buffer bio filled are pushed into the bio of the peer as they are
+
+    the key and the self signed certificate are made at start, nothing is read from disk
+*/
+
+#define TOTAL_BYTES (2UL * 1024 * 1024 * 1024)
+#define CHUNK       (16 * 1024)
+#define HANDSHAKES  2000
+#define ROUNDS      3
+
+typedef struct
+{
+    SSL *ssl;
+    BIO *rbio;
+    BIO *wbio; // the same as rbio in buffer mode
+
+} endpoint_t;
+
+static buffer_pool_t *pool;
+static SSL_CTX       *server_ctx;
+static SSL_CTX       *client_ctx;
+
+static void makeContexts(void)
+{
+    EVP_PKEY  *key  = EVP_EC_gen("P-256");
+    X509      *cert = X509_new();
+    X509_NAME *name = X509_get_subject_name(cert);
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *) "bench", -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509_sign(cert, key, EVP_sha256());
+
+    server_ctx = SSL_CTX_new(TLS_server_method());
+    client_ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_use_certificate(server_ctx, cert);
+    SSL_CTX_use_PrivateKey(server_ctx, key);
+    SSL_CTX_set_min_proto_version(server_ctx, TLS1_3_VERSION);
+    SSL_CTX_set_ciphersuites(server_ctx, "TLS_AES_128_GCM_SHA256");
+    SSL_CTX_set_ciphersuites(client_ctx, "TLS_AES_128_GCM_SHA256");
+    // every handshake is a full one
+    SSL_CTX_set_num_tickets(server_ctx, 0);
+    SSL_CTX_set_session_cache_mode(server_ctx, SSL_SESS_CACHE_OFF);
+
+    X509_free(cert);
+    EVP_PKEY_free(key);
+}
+
+static void openEndpoint(endpoint_t *e, bool buffer_mode, bool server)
+{
+    e->ssl = SSL_new(server ? server_ctx : client_ctx);
+    if (buffer_mode)
+    {
+        e->rbio = newBufferBio(pool);
+        e->wbio = e->rbio;
+    }
+    else
+    {
+        e->rbio = BIO_new(BIO_s_mem());
+        e->wbio = BIO_new(BIO_s_mem());
+    }
+    SSL_set_bio(e->ssl, e->rbio, e->wbio);
+    if (server)
+    {
+        SSL_set_accept_state(e->ssl);
+    }
+    else
+    {
+        SSL_set_connect_state(e->ssl);
+    }
+}
+
+// moves what one side wrote to the other side
+static void pump(endpoint_t *from, endpoint_t *to, bool buffer_mode)
+{
+    if (buffer_mode)
+    {
+        shift_buffer_t *buf;
+        while ((buf = bufferBioPop(from->wbio)) != NULL)
+        {
+            bufferBioPush(to->rbio, buf);
+        }
+        return;
+    }
+    while (true)
+    {
+        shift_buffer_t *buf = popBuffer(pool);
+        int             n   = BIO_read(from->wbio, rawBufMut(buf), (int) rCap(buf));
+        if (n <= 0)
+        {
+            reuseBuffer(pool, buf);
+            return;
+        }
+        setLen(buf, n);
+        BIO_write(to->rbio, rawBuf(buf), n);
+        reuseBuffer(pool, buf);
+    }
+}
+
+static bool handshake(endpoint_t *client, endpoint_t *server, bool buffer_mode)
+{
+    for (int i = 0; i < 16; i++)
+    {
+        int c = SSL_do_handshake(client->ssl);
+        pump(client, server, buffer_mode);
+        int s = SSL_do_handshake(server->ssl);
+        pump(server, client, buffer_mode);
+        if (c == 1 && s == 1)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t drain(endpoint_t *e)
+{
+    size_t total = 0;
+    while (true)
+    {
+        shift_buffer_t *buf = popBuffer(pool);
+        int             n   = SSL_read(e->ssl, rawBufMut(buf), (int) rCap(buf));
+        reuseBuffer(pool, buf);
+        if (n <= 0)
+        {
+            return total;
+        }
+        total += (size_t) n;
+    }
+}
+
+static double runThroughput(bool buffer_mode)
+{
+    endpoint_t client;
+    endpoint_t server;
+    openEndpoint(&client, buffer_mode, false);
+    openEndpoint(&server, buffer_mode, true);
+    if (! handshake(&client, &server, buffer_mode))
+    {
+        ERR_print_errors_fp(stderr);
+        exit(1);
+    }
+
+    size_t       received = 0;
+    const double start    = now();
+    for (size_t sent = 0; sent < TOTAL_BYTES; sent += CHUNK)
+    {
+        shift_buffer_t *payload = popBuffer(pool);
+        setLen(payload, CHUNK);
+        memset(rawBufMut(payload), 'w', CHUNK);
+        SSL_write(client.ssl, rawBuf(payload), CHUNK);
+        reuseBuffer(pool, payload);
+        pump(&client, &server, buffer_mode);
+        received += drain(&server);
+    }
+    const double elapsed = now() - start;
+
+    if (received != TOTAL_BYTES)
+    {
+        printf("received %zu / %lu bytes\n", received, TOTAL_BYTES);
+        exit(1);
+    }
+    SSL_free(client.ssl);
+    SSL_free(server.ssl);
+    return (double) TOTAL_BYTES * 8 / elapsed / 1e9;
+}
+
+static double runHandshakes(bool buffer_mode)
+{
+    const double start = now();
+    for (int i = 0; i < HANDSHAKES; i++)
+    {
+        endpoint_t client;
+        endpoint_t server;
+        openEndpoint(&client, buffer_mode, false);
+        openEndpoint(&server, buffer_mode, true);
+        if (! handshake(&client, &server, buffer_mode))
+        {
+            ERR_print_errors_fp(stderr);
+            exit(1);
+        }
+        SSL_free(client.ssl);
+        SSL_free(server.ssl);
+    }
+    return HANDSHAKES / (now() - start);
+}
+
+int main(void)
+{
+    ram_profile = kRamProfileM1Memory;
+
+    pool = createBufferPool();
+    bufferBioGlobalInit();
+    makeContexts();
+
+    for (int mode = 0; mode < 2; mode++)
+    {
+        const bool buffer_mode = mode == 1;
+        double     best_gbps   = 0;
+        double     best_hs     = 0;
+        for (int r = 0; r < ROUNDS; r++)
+        {
+            const double gbps = runThroughput(buffer_mode);
+            const double hs   = runHandshakes(buffer_mode);
+            best_gbps         = gbps > best_gbps ? gbps : best_gbps;
+            best_hs           = hs > best_hs ? hs : best_hs;
+        }
+        printf("%-7s %6.2f Gbit/sec  %7.0f handshakes/sec\n", buffer_mode ? "buffer" : "mem", best_gbps, best_hs);
+    }
+
+    pool_stats_t stats = getBufferPoolStats(pool);
+    printf("pool buffers: %u allocated %u available\n", stats.allocated, stats.available);
+    return 0;
+}
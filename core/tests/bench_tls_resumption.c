@@ -0,0 +1,156 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "openssl_buffer_bio.h"
+#include "openssl_session.h"
+#include "tunnel.h"
+#include "ww.h"
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+    tls session resumption benchmark, full handshakes vs resumed ones
+
+    a client and a server SSL do HANDSHAKES handshakes in memory (buffer bios like the tunnels), the client ctx has
+    the session cache of the openssl client tunnel and the server ctx the rotating ticket keys of the server
+    tunnel, after each handshake the client reads the tickets the server sent, reports handshakes/sec (both sides
+    on one thread) and how many of them were resumed
+
+        full     the client never offers a session
+        resumed  the client takes a session of its worker cache before every handshake (sslSessionResume)
+
+    for tls 1.3 (psk_dhe_ke resumption) and tls 1.2 (ticket resumption), the server key is ecdsa p-256
+*/
+
+#define HANDSHAKES 3000
+#define SNI        "bench.example"
+
+static buffer_pool_t *pool;
+static SSL_CTX       *server_ctx;
+static line_t        *bench_line; // the new session callback finds the worker of the line (tid 0)
+
+static void makeServerContext(void)
+{
+    EVP_PKEY  *key  = EVP_EC_gen("P-256");
+    X509      *cert = X509_new();
+    X509_NAME *name = X509_get_subject_name(cert);
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *) SNI, -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509_sign(cert, key, EVP_sha256());
+
+    server_ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_use_certificate(server_ctx, cert);
+    SSL_CTX_use_PrivateKey(server_ctx, key);
+    newSslTicketKeys(server_ctx, 3600);
+
+    X509_free(cert);
+    EVP_PKEY_free(key);
+}
+
+static SSL_CTX *makeClientContext(int max_version)
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_max_proto_version(ctx, max_version);
+    sslSessionCacheInit(ctx);
+    return ctx;
+}
+
+static void pump(SSL *from, SSL *to)
+{
+    shift_buffer_t *buf;
+    while ((buf = bufferBioPop(SSL_get_wbio(from))) != NULL)
+    {
+        bufferBioPush(SSL_get_rbio(to), buf);
+    }
+}
+
+// returns true if the handshake was resumed
+static bool handshake(SSL_CTX *client_ctx, bool resume)
+{
+    SSL *client = SSL_new(client_ctx);
+    SSL *server = SSL_new(server_ctx);
+    BIO *cbio   = newBufferBio(pool);
+    BIO *sbio   = newBufferBio(pool);
+    SSL_set_bio(client, cbio, cbio);
+    SSL_set_bio(server, sbio, sbio);
+    SSL_set_connect_state(client);
+    SSL_set_accept_state(server);
+    SSL_set_tlsext_host_name(client, SNI);
+    SSL_set_app_data(client, bench_line);
+    if (resume)
+    {
+        sslSessionResume(client, bench_line->tid);
+    }
+
+    bool done = false;
+    for (int i = 0; i < 16 && ! done; i++)
+    {
+        int c = SSL_do_handshake(client);
+        pump(client, server);
+        int s = SSL_do_handshake(server);
+        pump(server, client);
+        done = c == 1 && s == 1;
+    }
+    if (! done)
+    {
+        ERR_print_errors_fp(stderr);
+        exit(1);
+    }
+    // the tls 1.3 tickets come after the handshake, reading them stores them in the cache
+    char byte;
+    SSL_read(client, &byte, 1);
+
+    const bool resumed = SSL_session_reused(client);
+    SSL_free(client);
+    SSL_free(server);
+    return resumed;
+}
+
+static void run(const char *name, SSL_CTX *client_ctx, bool resume)
+{
+    // one handshake first so the resumed run has a ticket
+    handshake(client_ctx, resume);
+
+    unsigned int resumed = 0;
+    const double start   = now();
+    for (int i = 0; i < HANDSHAKES; i++)
+    {
+        resumed += handshake(client_ctx, resume) ? 1 : 0;
+    }
+    const double elapsed = now() - start;
+    printf("%-8s %-8s %7.0f handshakes/sec  %4u / %u resumed\n", name, resume ? "resumed" : "full",
+           HANDSHAKES / elapsed, resumed, HANDSHAKES);
+}
+
+int main(void)
+{
+    ram_profile   = kRamProfileM1Memory;
+    workers_count = 1;
+
+    pool       = createBufferPool();
+    bench_line = calloc(1, sizeof(line_t));
+    bufferBioGlobalInit();
+    makeServerContext();
+
+    SSL_CTX *tls13 = makeClientContext(TLS1_3_VERSION);
+    SSL_CTX *tls12 = makeClientContext(TLS1_2_VERSION);
+
+    run("tls 1.3", tls13, false);
+    run("tls 1.3", tls13, true);
+    run("tls 1.2", tls12, false);
+    run("tls 1.2", tls12, true);
+
+    pool_stats_t stats = getBufferPoolStats(pool);
+    printf("pool buffers: %u allocated %u available\n", stats.allocated, stats.available);
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "hloop.h"
+#include "hsocket.h"
+#include "hthread.h"
+#include "ww.h"
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    batched udp io benchmark (hio_set_batch, recvmmsg/sendmmsg)
+
+    a udp echo server runs on the loop, a client thread sends windows of small datagrams and waits for
+    their echoes, reports echoed packets/sec with batching off and on, every datagram goes through
+    read_cb and hio_write just like the udp listener does
+*/
+
+#define DATAGRAMS    400000
+#define WINDOW       256
+#define PAYLOAD_SIZE 64
+
+static hloop_t    *loop;
+static sockaddr_u  server_addr;
+static atomic_bool client_done;
+static size_t      echoed;
+static size_t      server_received;
+
+static void onRecvFrom(hio_t *io, shift_buffer_t *buf)
+{
+    server_received++;
+    // peeraddr is the sender of this datagram, so the echo goes back to it
+    hio_write(io, buf);
+}
+
+static void onCheckDone(htimer_t *timer)
+{
+    (void) timer;
+    if (atomic_load(&client_done))
+    {
+        hloop_stop(loop);
+    }
+}
+
+static HTHREAD_ROUTINE(client)
+{
+    (void) userdata;
+    int fd = socket(server_addr.sa.sa_family, SOCK_DGRAM, 0);
+    connect(fd, &server_addr.sa, sockaddr_len(&server_addr));
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    char payload[PAYLOAD_SIZE];
+    memset(payload, 'w', sizeof(payload));
+
+    for (size_t sent = 0; sent < DATAGRAMS; sent += WINDOW)
+    {
+        for (int i = 0; i < WINDOW; i++)
+        {
+            send(fd, payload, sizeof(payload), 0);
+        }
+        // wait for the echoes of this window, the ones lost are lost (it is udp)
+        for (int got = 0; got < WINDOW;)
+        {
+            struct pollfd pfd = {.fd = fd, .events = POLLIN};
+            if (poll(&pfd, 1, 20) <= 0)
+            {
+                break;
+            }
+            char in[PAYLOAD_SIZE * 2];
+            while (recv(fd, in, sizeof(in), MSG_DONTWAIT) > 0)
+            {
+                got++;
+                echoed++;
+            }
+        }
+    }
+    closesocket(fd);
+    atomic_store(&client_done, true);
+    return 0;
+}
+
+static void runOnce(unsigned int batch)
+{
+    loop            = hloop_new(0, createSmallBufferPool(), 0);
+    echoed          = 0;
+    server_received = 0;
+    atomic_store(&client_done, false);
+
+    hio_t *server = hloop_create_udp_server(loop, "127.0.0.1", 0);
+    if (server == NULL)
+    {
+        printf("could not create the udp server\n");
+        exit(1);
+    }
+    // localaddr holds the requested port (0), ask the kernel which one it picked
+    socklen_t addrlen = sizeof(server_addr);
+    getsockname(hio_fd(server), &server_addr.sa, &addrlen);
+    hio_set_batch(server, batch);
+    hio_setcb_read(server, onRecvFrom);
+    hio_read(server);
+    htimer_add(loop, onCheckDone, 10, INFINITE);
+
+    double    start   = now();
+    hthread_t cthread = hthread_create(client, NULL);
+    hloop_run(loop);
+    double elapsed = now() - start;
+    hthread_join(cthread);
+
+    printf("batch: %-3u  received: %zu  echoed: %zu  echoed pps: %.0f\n", batch, server_received, echoed,
+           (double) echoed / elapsed);
+    hloop_free(&loop);
+}
+
+int main(void)
+{
+    ram_profile = kRamProfileM1Memory;
+
+    const unsigned int batches[] = {0, 8, 32, HIO_MAX_BATCH};
+    for (unsigned int i = 0; i < sizeof(batches) / sizeof(batches[0]); i++)
+    {
+        runOnce(batches[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "bench.h"
+#include "buffer_pool.h"
+#include "hloop.h"
+#include "hsocket.h"
+#include "hthread.h"
+#include "ww.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+    write queue drain benchmark (vectored writes in nio_write)
+
+    the loop writes small records (think tls records or http2 frames) to a tcp socket as fast as the write queue
+    allows, a reader thread on the other end reads slowly enough that the queue keeps filling, reports for each
+    record size:
+
+        queued/MB     records that went through the write queue, the old drain did one send() for each of them
+        syscalls/MB   send() + sendmsg() calls that were actually made for the socket
+
+    send and sendmsg are wrapped here to count the calls (linux, the executable symbols win over libc)
+*/
+
+#define TOTAL_BYTES  (256UL * 1024 * 1024)
+#define QUEUE_TARGET (4U * 1024 * 1024)
+#define READ_CHUNK   (16 * 1024)
+
+static hloop_t    *loop;
+static hio_t      *writer;
+static int         writer_fd;
+static int         reader_fd;
+static unsigned    record_size;
+static size_t      produced;
+static size_t      queued_records;
+static size_t      send_calls;
+static size_t      sendmsg_calls;
+static bool        producing;
+static atomic_bool reader_done;
+
+ssize_t send(int fd, const void *buf, size_t len, int flags)
+{
+    if (fd == writer_fd)
+    {
+        send_calls++;
+    }
+    return syscall(SYS_sendto, fd, buf, len, flags, NULL, 0);
+}
+
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+    if (fd == writer_fd)
+    {
+        sendmsg_calls++;
+    }
+    return syscall(SYS_sendmsg, fd, msg, flags);
+}
+
+static HTHREAD_ROUTINE(readerThread)
+{
+    (void) userdata;
+    static char buf[READ_CHUNK];
+    size_t      received = 0;
+    while (received < TOTAL_BYTES)
+    {
+        ssize_t n = recv(reader_fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+        {
+            break;
+        }
+        received += n;
+        if (received % (1024 * 1024) < (size_t) n)
+        {
+            // a slow peer, lets the socket buffer fill up so the records pile up in the write queue
+            hv_msleep(1);
+        }
+    }
+    atomic_store(&reader_done, true);
+    return 0;
+}
+
+static void produce(hio_t *io)
+{
+    while (produced < TOTAL_BYTES && hio_write_bufsize(io) < QUEUE_TARGET)
+    {
+        shift_buffer_t *buf = popBuffer(hloop_bufferpool(loop));
+        reserveBufSpace(buf, record_size);
+        setLen(buf, record_size);
+        memset(rawBufMut(buf), 'w', record_size);
+        produced += record_size;
+        if (hio_write(io, buf) < (int) record_size)
+        {
+            queued_records++;
+        }
+    }
+}
+
+static void onWrite(hio_t *io)
+{
+    // refill once the queue went down to a quarter, hio_write calls this too when it writes right away
+    if (! producing && hio_write_bufsize(io) < QUEUE_TARGET / 4)
+    {
+        producing = true;
+        produce(io);
+        producing = false;
+    }
+}
+
+static void onStart(htimer_t *timer)
+{
+    (void) timer;
+    onWrite(writer);
+}
+
+static void onCheckDone(htimer_t *timer)
+{
+    (void) timer;
+    if (atomic_load(&reader_done))
+    {
+        hloop_stop(loop);
+    }
+}
+
+static void runOnce(unsigned size)
+{
+    record_size    = size;
+    produced       = 0;
+    queued_records = 0;
+    send_calls     = 0;
+    sendmsg_calls  = 0;
+    atomic_store(&reader_done, false);
+    loop = hloop_new(0, createSmallBufferPool(), 0);
+
+    sockaddr_u addr;
+    int        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_set_ipport(&addr, "127.0.0.1", 0);
+    bind(listen_fd, &addr.sa, sockaddr_len(&addr));
+    listen(listen_fd, 1);
+    socklen_t len = sizeof(addr);
+    getsockname(listen_fd, &addr.sa, &len);
+    writer_fd = socket(AF_INET, SOCK_STREAM, 0);
+    // a small socket buffer, the line is backpressured most of the time
+    int sndbuf = 64 * 1024;
+    setsockopt(writer_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    connect(writer_fd, &addr.sa, sockaddr_len(&addr));
+    reader_fd = accept(listen_fd, NULL, NULL);
+    closesocket(listen_fd);
+
+    writer = hio_get(loop, writer_fd);
+    hio_set_max_write_bufsize(writer, QUEUE_TARGET * 2);
+    hio_setcb_write(writer, onWrite);
+    htimer_add(loop, onStart, 1, 1);
+    htimer_add(loop, onCheckDone, 10, INFINITE);
+
+    hthread_t reader = hthread_create(readerThread, NULL);
+    double    start  = now();
+    hloop_run(loop);
+    double elapsed = now() - start;
+    hthread_join(reader);
+
+    const double mb = (double) TOTAL_BYTES / (1024 * 1024);
+    printf("record: %-6u  queued/MB: %8.1f  syscalls/MB: %7.1f  (send %zu, sendmsg %zu)  MB/sec: %.0f\n", size,
+           (double) queued_records / mb, (double) (send_calls + sendmsg_calls) / mb, send_calls, sendmsg_calls,
+           mb / elapsed);
+    closesocket(reader_fd);
+    hloop_free(&loop);
+}
+
+int main(void)
+{
+    ram_profile = kRamProfileM1Memory;
+
+    const unsigned sizes[] = {64, 512, 1400, 4096, 16384};
+    for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        runOnce(sizes[i]);
+    }
+    return 0;
+}
@@ -2,14 +2,34 @@
 #include "basic_types.h"
 #include "hsocket.h"
 #include "loggers/network_logger.h"
-#include "sync_dns.h"
 #include "tunnel.h"
 #include "types.h"
 #include "utils/jsonutils.h"
 #include "utils/sockutils.h"
 
+enum
+{
+    kWarmPoolDefaultMaxIdleSec = 30,
+    kWarmPoolRetryDelayMs      = 1000,
+    kFastOpenFirstWriteWaitMs  = 50
+};
+
+static void stopFastOpenWait(tcp_connector_con_state_t *cstate)
+{
+    if (cstate->fastopen_timer)
+    {
+        htimer_del(cstate->fastopen_timer);
+        cstate->fastopen_timer = NULL;
+    }
+}
+
 static void cleanup(tcp_connector_con_state_t *cstate, bool write_queue)
 {
+    if (cstate->dns_waiter)
+    {
+        cancelDnsWaiter(cstate->dns_waiter);
+    }
+    stopFastOpenWait(cstate);
     if (cstate->io)
     {
         hevent_set_userdata(cstate->io, NULL);
@@ -58,6 +78,27 @@ static bool resumeWriteQueue(tcp_connector_con_state_t *cstate)
     return true;
 }
 
+/*
+    plain port forwarding: the tunnel right below us is a tcp socket too, so there is nothing to do with the bytes
+    and the kernel can move them between the 2 sockets without copying them to our buffers, any other tunnel in
+    between keeps the normal path, the listener io has nothing queued at this point (no downstream data before est)
+*/
+static void trySplice(tunnel_t *self, tcp_connector_con_state_t *cstate)
+{
+    tcp_connector_state_t *state = STATE(self);
+    if (! state->splice || self->dw == NULL || self->dw->getTcpIo == NULL ||
+        cstate->fastopen_timer != NULL || ! hio_write_is_complete(cstate->io))
+    {
+        return;
+    }
+    hio_t *dw_io = self->dw->getTcpIo(self->dw, cstate->line);
+    if (dw_io == NULL || hio_splice(dw_io, cstate->io) != 0)
+    {
+        return;
+    }
+    LOGD("TcpConnector: splice relay FD:%x <=> FD:%x", hio_fd(dw_io), hio_fd(cstate->io));
+}
+
 static void onWriteComplete(hio_t *io)
 {
     // resume the read on other end of the connection
@@ -137,6 +178,22 @@ static void onLineResumed(void *userdata)
     }
 }
 
+static void onFastOpenWaitExpire(htimer_t *timer)
+{
+    tcp_connector_con_state_t *cstate = hevent_userdata(timer);
+    cstate->fastopen_timer            = NULL;
+    // nothing to send with the syn (the peer talks first ?), an empty send starts the handshake
+    send(hio_fd(cstate->io), NULL, 0, 0);
+}
+
+// the line is established before the handshake when the connect was held for the first write (fast open)
+static bool isFastOpenPending(hio_t *io)
+{
+    sockaddr_u addr;
+    socklen_t  addrlen = sizeof(addr);
+    return getpeername(hio_fd(io), &(addr.sa), &addrlen) != 0;
+}
+
 static void onOutBoundConnected(hio_t *upstream_io)
 {
     tcp_connector_con_state_t *cstate = hevent_userdata(upstream_io);
@@ -153,8 +210,9 @@ static void onOutBoundConnected(hio_t *upstream_io)
     LOGD("TcpConnector: tcp connect took %d ms", (int) (time_spent * 1000));
 #endif
 
-    tunnel_t *self = cstate->tunnel;
-    line_t   *line = cstate->line;
+    tunnel_t              *self  = cstate->tunnel;
+    tcp_connector_state_t *state = STATE(self);
+    line_t                *line  = cstate->line;
     hio_setcb_read(upstream_io, onRecv);
 
     if (logger_will_write_level(getNetworkLogger(), LOG_LEVEL_DEBUG))
@@ -167,10 +225,288 @@ static void onOutBoundConnected(hio_t *upstream_io)
              SOCKADDR_STR(hio_peeraddr(upstream_io), peeraddrstr));
     }
 
+    if (state->tcp_fast_open && isFastOpenPending(upstream_io))
+    {
+        cstate->fastopen_timer = htimer_add(hevent_loop(upstream_io), onFastOpenWaitExpire,
+                                            kFastOpenFirstWriteWaitMs, 1);
+        hevent_set_userdata(cstate->fastopen_timer, cstate);
+    }
+
     setupLineUpSide(line, onLinePaused, cstate, onLineResumed);
     self->downStream(self, newEstContext(line));
 }
 
+static hio_t *newOutBoundIo(tcp_connector_state_t *state, hloop_t *loop, sockaddr_u *addr, bool fast_open)
+{
+    int sockfd = socket(addr->sa.sa_family, SOCK_STREAM, 0);
+    if (sockfd < 0)
+    {
+        LOGE("Connector: socket fd < 0");
+        return NULL;
+    }
+    if (state->tcp_no_delay)
+    {
+        tcp_nodelay(sockfd, 1);
+    }
+    if (state->reuse_addr)
+    {
+        so_reuseport(sockfd, 1);
+    }
+
+#ifdef TCP_FASTOPEN_CONNECT
+    if (fast_open)
+    {
+        // with a cookie from the peer, connect() returns right away and the syn goes out with the first write
+        // (carrying it), without one it is a normal connect that asks for a cookie
+        const int yes = 1;
+        if (setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, (const char *) &yes, sizeof(yes)) != 0)
+        {
+            LOGW("TcpConnector: could not enable fast open on FD:%x, connecting normally", sockfd);
+        }
+    }
+#endif
+
+    hio_t *io = hio_get(loop, sockfd);
+    assert(io != NULL);
+
+    hio_set_peeraddr(io, &(addr->sa), (int) sockaddr_len(addr));
+    return io;
+}
+
+/*
+    warm pool: when the destination is a constant ip and port, every worker keeps warm-pool sockets connected to
+    it ahead of time, a new line takes one and is established right away instead of waiting for the handshake
+
+    a waiting socket is not watched, it is checked when a line takes it: anything the peer sent meanwhile (data,
+    eof, reset) means it is not fresh anymore so it is closed and the next one is tried, and it is replaced after
+    warm-pool-max-idle before the peer or a nat on the way drops it
+
+    the est of a line that took one is posted to the loop, so it comes after the init returns like a real connect
+*/
+
+static void fillWarmPool(tcp_connector_warm_box_t *box);
+
+static void addWarmCon(tcp_connector_warm_box_t *box, tcp_connector_warm_con_t *wcon)
+{
+    wcon->next     = box->root.next;
+    box->root.next = wcon;
+    wcon->prev     = &box->root;
+    if (wcon->next)
+    {
+        wcon->next->prev = wcon;
+    }
+    box->length += 1;
+}
+
+static void removeWarmCon(tcp_connector_warm_box_t *box, tcp_connector_warm_con_t *wcon)
+{
+    wcon->prev->next = wcon->next;
+    if (wcon->next)
+    {
+        wcon->next->prev = wcon->prev;
+    }
+    box->length -= 1;
+}
+
+static void onWarmRetry(htimer_t *timer)
+{
+    tcp_connector_warm_box_t *box = hevent_userdata(timer);
+    box->retry_timer              = NULL;
+    fillWarmPool(box);
+}
+
+static void retryWarmPoolLater(tcp_connector_warm_box_t *box)
+{
+    if (box->retry_timer == NULL)
+    {
+        box->retry_timer = htimer_add(loops[box->tid], onWarmRetry, kWarmPoolRetryDelayMs, 1);
+        hevent_set_userdata(box->retry_timer, box);
+    }
+}
+
+static void onWarmExpire(idle_item_t *idle)
+{
+    tcp_connector_warm_con_t *wcon = idle->userdata;
+    wcon->idle_handle              = NULL;
+    hio_close(wcon->io);
+}
+
+// nothing to read and no error pending, the peer has not touched the socket since it connected
+static bool isWarmIoFresh(hio_t *io)
+{
+    char      byte;
+    const int ret = (int) recv(hio_fd(io), &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static void onWarmClose(hio_t *io)
+{
+    tcp_connector_warm_con_t *wcon  = hevent_userdata(io);
+    tcp_connector_warm_box_t *box   = wcon->box;
+    tcp_connector_state_t    *state = STATE(box->tunnel);
+
+    if (! wcon->connected)
+    {
+        box->connecting -= 1;
+        free(wcon);
+        LOGW("TcpConnector: warm pool connect failed, retrying in %d ms", kWarmPoolRetryDelayMs);
+        retryWarmPoolLater(box);
+        return;
+    }
+
+    removeWarmCon(box, wcon);
+    if (wcon->idle_handle == NULL)
+    {
+        // we closed it after max idle, replace it now
+        free(wcon);
+        fillWarmPool(box);
+        return;
+    }
+    removeIdleItemByHash(box->tid, state->warm_idle_table, (hash_t) (size_t) (wcon));
+    free(wcon);
+    LOGD("TcpConnector: a warm socket was not fresh anymore FD:%x", hio_fd(io));
+    retryWarmPoolLater(box);
+}
+
+static void onWarmConnected(hio_t *io)
+{
+    tcp_connector_warm_con_t *wcon  = hevent_userdata(io);
+    tcp_connector_warm_box_t *box   = wcon->box;
+    tcp_connector_state_t    *state = STATE(box->tunnel);
+
+    box->connecting -= 1;
+    wcon->connected   = true;
+    wcon->idle_handle = newIdleItem(state->warm_idle_table, (hash_t) (size_t) (wcon), wcon, onWarmExpire, box->tid,
+                                    state->warm_pool_max_idle_ms);
+    addWarmCon(box, wcon);
+}
+
+static void fillWarmPool(tcp_connector_warm_box_t *box)
+{
+    tcp_connector_state_t *state = STATE(box->tunnel);
+
+    while (box->retry_timer == NULL && box->length + box->connecting < (unsigned int) state->warm_pool_size)
+    {
+        // no fast open here, the syn would wait for a write that only comes when a line takes the socket
+        hio_t *io = newOutBoundIo(state, loops[box->tid], &(state->constant_dest_addr.address), false);
+        if (io == NULL)
+        {
+            retryWarmPoolLater(box);
+            return;
+        }
+        tcp_connector_warm_con_t *wcon = malloc(sizeof(tcp_connector_warm_con_t));
+        *wcon                          = (tcp_connector_warm_con_t){.box = box, .io = io};
+
+        box->connecting += 1;
+        hevent_set_userdata(io, wcon);
+        hio_setcb_connect(io, onWarmConnected);
+        hio_setcb_close(io, onWarmClose);
+        hio_connect(io);
+    }
+}
+
+static void startWarmPool(hevent_t *ev)
+{
+    fillWarmPool(hevent_userdata(ev));
+}
+
+// a fresh connected socket for this worker, or NULL when the pool is empty, the caller refills the pool
+static hio_t *popWarmIo(tunnel_t *self, uint8_t tid)
+{
+    tcp_connector_state_t    *state = STATE(self);
+    tcp_connector_warm_box_t *box   = &(state->warm_boxes[tid]);
+    while (box->length > 0)
+    {
+        tcp_connector_warm_con_t *wcon = box->root.next;
+        hio_t                    *io   = wcon->io;
+        if (! isWarmIoFresh(io))
+        {
+            // onWarmClose takes it out of the pool
+            hio_close(io);
+            continue;
+        }
+        removeWarmCon(box, wcon);
+        removeIdleItemByHash(tid, state->warm_idle_table, (hash_t) (size_t) (wcon));
+        free(wcon);
+        hevent_set_userdata(io, NULL);
+        return io;
+    }
+    return NULL;
+}
+
+static void onWarmEst(hevent_t *ev)
+{
+    hio_t         *io = hevent_userdata(ev);
+    const uint32_t id = (uint32_t) (uintptr_t) ev->privdata;
+    // the line may have been closed meanwhile (the io has no userdata then) and the fd reused
+    if (hio_id(io) != id || hio_is_closed(io))
+    {
+        return;
+    }
+    onOutBoundConnected(io);
+}
+
+static bool connectWarm(tunnel_t *self, tcp_connector_con_state_t *cstate)
+{
+    const uint8_t tid         = cstate->line->tid;
+    hio_t        *upstream_io = popWarmIo(self, tid);
+    if (upstream_io == NULL)
+    {
+        return false;
+    }
+    LOGD("TcpConnector: took a warm socket FD:%x", hio_fd(upstream_io));
+    cstate->io = upstream_io;
+    hevent_set_userdata(upstream_io, cstate);
+    hio_setcb_close(upstream_io, onClose);
+
+    hevent_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.cb       = onWarmEst;
+    ev.userdata = upstream_io;
+    ev.privdata = (void *) (uintptr_t) hio_id(upstream_io);
+    hloop_post_event(loops[tid], &ev);
+
+    tcp_connector_state_t *state = STATE(self);
+    fillWarmPool(&(state->warm_boxes[tid]));
+    return true;
+}
+
+static bool connectToDest(tunnel_t *self, tcp_connector_con_state_t *cstate)
+{
+    tcp_connector_state_t *state    = STATE(self);
+    socket_context_t      *dest_ctx = &(cstate->line->dest_ctx);
+    hloop_t               *loop     = loops[cstate->line->tid];
+
+    hio_t *upstream_io = newOutBoundIo(state, loop, &(dest_ctx->address), state->tcp_fast_open);
+    if (upstream_io == NULL)
+    {
+        return false;
+    }
+    cstate->io = upstream_io;
+    hevent_set_userdata(upstream_io, cstate);
+    hio_setcb_connect(upstream_io, onOutBoundConnected);
+    hio_setcb_close(upstream_io, onClose);
+    hio_connect(upstream_io);
+    return true;
+}
+
+static void onDnsResolved(socket_context_t *dest_ctx, bool success, void *userdata)
+{
+    (void) dest_ctx;
+    tcp_connector_con_state_t *cstate = userdata;
+    tunnel_t                  *self   = cstate->tunnel;
+    line_t                    *line   = cstate->line;
+    cstate->dns_waiter                = NULL;
+
+    if (success && connectToDest(self, cstate))
+    {
+        return;
+    }
+    LSTATE_DROP(line);
+    cleanup(cstate, false);
+    self->dw->downStream(self->dw, newFinContext(line));
+}
+
 static void upStream(tunnel_t *self, context_t *c)
 {
     tcp_connector_con_state_t *cstate = CSTATE(c);
@@ -184,6 +520,7 @@ static void upStream(tunnel_t *self, context_t *c)
         }
         else
         {
+            stopFastOpenWait(cstate);
             int bytes  = (int) bufLen(c->payload);
             int nwrite = hio_write(cstate->io, c->payload);
             CONTEXT_PAYLOAD_DROP(c);
@@ -245,49 +582,40 @@ static void upStream(tunnel_t *self, context_t *c)
             // sockaddr_set_ipport(&(dest_ctx.addr), "127.0.0.1", 443);
             // LOGD("TcpConnector: initiating connection");
 
+            if (state->warm_boxes != NULL && connectWarm(self, cstate))
+            {
+                // the est goes down on the next loop iteration, write_paused queues the payloads until then
+                destroyContext(c);
+                return;
+            }
+
             if (dest_ctx->address_type == kSatDomainName && ! dest_ctx->domain_resolved)
             {
-                if (! resolveContextSync(dest_ctx))
+                if (state->domain_strategy != kDsInvalid)
                 {
+                    dest_ctx->domain_strategy = (enum domain_strategy) state->domain_strategy;
+                }
+                switch (resolveContextAsync(dest_ctx, c->line->tid, onDnsResolved, cstate, &(cstate->dns_waiter)))
+                {
+                case kDrsPending:
+                    // the line stays parked (write_paused queues the payloads) until onDnsResolved
+                    destroyContext(c);
+                    return;
+                case kDrsFailed:
                     CSTATE_DROP(c);
                     cleanup(cstate, false);
                     goto fail;
+                case kDrsResolved:
+                    break;
                 }
             }
 
-            hloop_t *loop   = loops[c->line->tid];
-            int      sockfd = socket(dest_ctx->address.sa.sa_family, SOCK_STREAM, 0);
-            if (sockfd < 0)
+            if (! connectToDest(self, cstate))
             {
-                LOGE("Connector: socket fd < 0");
                 CSTATE_DROP(c);
                 cleanup(cstate, false);
                 goto fail;
             }
-            if (state->tcp_no_delay)
-            {
-                tcp_nodelay(sockfd, 1);
-            }
-            if (state->reuse_addr)
-            {
-                so_reuseport(sockfd, 1);
-            }
-
-            if (state->tcp_fast_open)
-            {
-                const int yes = 1;
-                setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN, (const char *) &yes, sizeof(yes));
-            }
-
-            hio_t *upstream_io = hio_get(loop, sockfd);
-            assert(upstream_io != NULL);
-
-            hio_set_peeraddr(upstream_io, &(dest_ctx->address.sa), (int) sockaddr_len(&(dest_ctx->address)));
-            cstate->io = upstream_io;
-            hevent_set_userdata(upstream_io, cstate);
-            hio_setcb_connect(upstream_io, onOutBoundConnected);
-            hio_setcb_close(upstream_io, onClose);
-            hio_connect(upstream_io);
             destroyContext(c);
         }
         else if (c->fin)
@@ -329,9 +657,14 @@ static void downStream(tunnel_t *self, context_t *c)
         {
             cstate->established = true;
             hio_read(cstate->io);
+            if (contextQueueLen(cstate->data_queue) > 0)
+            {
+                stopFastOpenWait(cstate);
+            }
             if (resumeWriteQueue(cstate))
             {
                 cstate->write_paused = false;
+                trySplice(self, cstate);
                 resumeLineDownSide(cstate->line);
             }
             else
@@ -349,6 +682,12 @@ static void downStream(tunnel_t *self, context_t *c)
     }
 }
 
+static hio_t *getTcpIo(tunnel_t *self, line_t *l)
+{
+    tcp_connector_con_state_t *cstate = LSTATE(l);
+    return cstate == NULL ? NULL : cstate->io;
+}
+
 tunnel_t *newTcpConnector(node_instance_context_t *instance_info)
 {
     tcp_connector_state_t *state = malloc(sizeof(tcp_connector_state_t));
@@ -363,7 +702,15 @@ tunnel_t *newTcpConnector(node_instance_context_t *instance_info)
 
     getBoolFromJsonObjectOrDefault(&(state->tcp_no_delay), settings, "nodelay", true);
     getBoolFromJsonObjectOrDefault(&(state->tcp_fast_open), settings, "fastopen", false);
+#ifndef TCP_FASTOPEN_CONNECT
+    if (state->tcp_fast_open)
+    {
+        LOGW("TcpConnector: fastopen is not supported on this platform, connecting normally");
+        state->tcp_fast_open = false;
+    }
+#endif
     getBoolFromJsonObjectOrDefault(&(state->reuse_addr), settings, "reuseaddr", false);
+    getBoolFromJsonObjectOrDefault(&(state->splice), settings, "splice", false);
     getIntFromJsonObjectOrDefault(&(state->domain_strategy), settings, "domain-strategy", 0);
 
     state->dest_addr_selected =
@@ -401,10 +748,41 @@ tunnel_t *newTcpConnector(node_instance_context_t *instance_info)
         socketContextPortSet(&(state->constant_dest_addr), state->dest_port_selected.value);
     }
 
+    int warm_pool_max_idle_sec = 0;
+    getIntFromJsonObjectOrDefault(&(state->warm_pool_size), settings, "warm-pool", 0);
+    getIntFromJsonObjectOrDefault(&warm_pool_max_idle_sec, settings, "warm-pool-max-idle", kWarmPoolDefaultMaxIdleSec);
+    state->warm_pool_max_idle_ms = warm_pool_max_idle_sec * 1000;
+
     tunnel_t *t   = newTunnel();
     t->state      = state;
     t->upStream   = &upStream;
     t->downStream = &downStream;
+    t->getTcpIo   = &getTcpIo;
+
+    if (state->warm_pool_size > 0)
+    {
+        if (state->dest_addr_selected.status != kDvsConstant || state->dest_port_selected.status != kDvsConstant ||
+            state->constant_dest_addr.address_type == kSatDomainName || state->warm_pool_max_idle_ms <= 0)
+        {
+            LOGW("TcpConnector: warm-pool needs a constant ip address and port (and a max idle time), it is "
+                 "disabled");
+        }
+        else
+        {
+            state->warm_idle_table = newIdleTable();
+            state->warm_boxes      = malloc(sizeof(tcp_connector_warm_box_t) * workers_count);
+            memset(state->warm_boxes, 0, sizeof(tcp_connector_warm_box_t) * workers_count);
+            for (unsigned int i = 0; i < workers_count; i++)
+            {
+                state->warm_boxes[i].tunnel = t;
+                state->warm_boxes[i].tid    = (uint8_t) i;
+
+                hevent_t ev = {.loop = loops[i], .cb = startWarmPool};
+                ev.userdata = &(state->warm_boxes[i]);
+                hloop_post_event(loops[i], &ev);
+            }
+        }
+    }
 
     return t;
 }
@@ -1,5 +1,7 @@
 #pragma once
 #include "api.h"
+#include "async_dns.h"
+#include "idle_table.h"
 
 // enable profile to see how much it takes to connect and downstream write
 // #define PROFILE 1
@@ -12,30 +14,64 @@ enum tcp_connector_dynamic_value_status
     kCdvsFromDest,
 };
 
+struct tcp_connector_warm_box_s;
+
+// a connected socket waiting for a line
+typedef struct tcp_connector_warm_con_s
+{
+    struct tcp_connector_warm_con_s *prev, *next;
+    struct tcp_connector_warm_box_s *box;
+    hio_t                           *io;
+    idle_item_t                     *idle_handle;
+    bool                             connected;
+
+} tcp_connector_warm_con_t;
+
+// the warm pool of one worker, only that worker touches it
+typedef struct tcp_connector_warm_box_s
+{
+    tunnel_t                *tunnel;
+    htimer_t                *retry_timer;
+    unsigned int             length;
+    unsigned int             connecting;
+    uint8_t                  tid;
+    tcp_connector_warm_con_t root;
+
+} tcp_connector_warm_box_t;
+
 typedef struct tcp_connector_state_s
 {
     // settings
     bool             tcp_no_delay;
-    bool             tcp_fast_open;
+    bool             tcp_fast_open; // connect with TCP_FASTOPEN_CONNECT, the first payload goes in the syn
     bool             reuse_addr;
+    bool             splice;
     int              domain_strategy;
     dynamic_value_t  dest_addr_selected;
     dynamic_value_t  dest_port_selected;
     socket_context_t constant_dest_addr;
+    int              warm_pool_size;        // per worker, 0 disables it
+    int              warm_pool_max_idle_ms; // a warm socket is replaced after this long
+
+    idle_table_t             *warm_idle_table;
+    tcp_connector_warm_box_t *warm_boxes;
 
 } tcp_connector_state_t;
 
 typedef struct tcp_connector_con_state_s
 {
+    hio_t *io;
+
 #ifdef PROFILE
     struct timeval __profile_conenct;
 #endif
 
     tunnel_t        *tunnel;
     line_t          *line;
-    hio_t           *io;
     buffer_pool_t   *buffer_pool;
     context_queue_t *data_queue;
+    dns_waiter_t    *dns_waiter;     // the line is parked while its destination is resolving
+    htimer_t        *fastopen_timer; // the syn is held for the first payload, sent empty if it does not come
     bool             write_paused;
     bool             established;
     bool             read_paused;
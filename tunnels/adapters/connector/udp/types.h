@@ -1,5 +1,6 @@
 #pragma once
 #include "api.h"
+#include "async_dns.h"
 
 // enable profile to see how much it takes to connect and downstream write
 // #define PROFILE 1
@@ -17,6 +18,7 @@ typedef struct udp_connector_state_s
     // settings
     bool             reuse_addr;
     int              domain_strategy;
+    int              batch; // datagrams per recvmmsg/sendmmsg (linux), 0 or 1 disables batching
     dynamic_value_t  dest_addr_selected;
     dynamic_value_t  dest_port_selected;
     socket_context_t constant_dest_addr;
@@ -29,10 +31,12 @@ typedef struct udp_connector_con_state_s
     struct timeval __profile_conenct;
 #endif
 
-    tunnel_t *     tunnel;
-    line_t *       line;
-    hio_t *        io;
-    buffer_pool_t *buffer_pool;
+    tunnel_t *       tunnel;
+    line_t *         line;
+    hio_t *          io;
+    buffer_pool_t *  buffer_pool;
+    dns_waiter_t *   dns_waiter;
+    context_queue_t *resolve_queue; // payloads that arrived while the destination was resolving
 
     bool established;
 } udp_connector_con_state_t;
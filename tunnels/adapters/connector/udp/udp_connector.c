@@ -1,12 +1,19 @@
 #include "hplatform.h"
 #include "loggers/network_logger.h"
-#include "sync_dns.h"
 #include "types.h"
 #include "utils/jsonutils.h"
 #include "utils/sockutils.h"
 
 static void cleanup(udp_connector_con_state_t *cstate)
 {
+    if (cstate->dns_waiter)
+    {
+        cancelDnsWaiter(cstate->dns_waiter);
+    }
+    if (cstate->resolve_queue)
+    {
+        destroyContextQueue(cstate->resolve_queue);
+    }
     free(cstate);
 }
 static void onRecvFrom(hio_t *io, shift_buffer_t *buf)
@@ -38,12 +45,49 @@ static void onRecvFrom(hio_t *io, shift_buffer_t *buf)
     self->downStream(self, context);
 }
 
+static void onDnsResolved(socket_context_t *dest_ctx, bool success, void *userdata)
+{
+    udp_connector_con_state_t *cstate = userdata;
+    tunnel_t                  *self   = cstate->tunnel;
+    line_t                    *line   = cstate->line;
+    cstate->dns_waiter                = NULL;
+
+    if (! success)
+    {
+        hio_t *io = cstate->io;
+        hevent_set_userdata(io, NULL);
+        LSTATE_DROP(line);
+        cleanup(cstate);
+        hio_close(io);
+        self->dw->downStream(self->dw, newFinContext(line));
+        return;
+    }
+
+    hio_set_peeraddr(cstate->io, &(dest_ctx->address.sa), (int) sockaddr_len(&(dest_ctx->address)));
+
+    context_queue_t *queue = cstate->resolve_queue;
+    cstate->resolve_queue  = NULL;
+    while (contextQueueLen(queue) > 0)
+    {
+        context_t *c = contextQueuePop(queue);
+        hio_write(cstate->io, c->payload);
+        c->payload = NULL;
+        destroyContext(c);
+    }
+    destroyContextQueue(queue);
+}
+
 static void upStream(tunnel_t *self, context_t *c)
 {
     udp_connector_con_state_t *cstate = CSTATE(c);
 
     if (c->payload != NULL)
     {
+        if (cstate->resolve_queue)
+        {
+            contextQueuePush(cstate->resolve_queue, c);
+            return;
+        }
 
         if (hio_is_closed(cstate->io))
         {
@@ -105,6 +149,7 @@ static void upStream(tunnel_t *self, context_t *c)
 
             cstate->io = upstream_io;
             hevent_set_userdata(upstream_io, cstate);
+            hio_set_batch(upstream_io, (unsigned int) state->batch);
             hio_setcb_read(upstream_io, onRecvFrom);
             hio_read(upstream_io);
 
@@ -137,11 +182,25 @@ static void upStream(tunnel_t *self, context_t *c)
 
             if (dest_ctx->address_type == kSatDomainName && ! dest_ctx->domain_resolved)
             {
-                if (! resolveContextSync(dest_ctx))
+                if (state->domain_strategy != kDsInvalid)
+                {
+                    dest_ctx->domain_strategy = (enum domain_strategy) state->domain_strategy;
+                }
+                switch (resolveContextAsync(dest_ctx, c->line->tid, onDnsResolved, cstate, &(cstate->dns_waiter)))
                 {
+                case kDrsPending:
+                    // payloads are held until onDnsResolved sets the peer address
+                    cstate->resolve_queue = newContextQueue(cstate->buffer_pool);
+                    destroyContext(c);
+                    return;
+                case kDrsFailed:
+                    hevent_set_userdata(upstream_io, NULL);
+                    hio_close(upstream_io);
                     cleanup(CSTATE(c));
                     CSTATE_DROP(c);
                     goto fail;
+                case kDrsResolved:
+                    break;
                 }
             }
             hio_set_peeraddr(cstate->io, &(dest_ctx->address.sa), (int) sockaddr_len(&(dest_ctx->address)));
@@ -191,6 +250,13 @@ tunnel_t *newUdpConnector(node_instance_context_t *instance_info)
     }
 
     getBoolFromJsonObject(&(state->reuse_addr), settings, "reuseaddr");
+    getIntFromJsonObjectOrDefault(&(state->domain_strategy), settings, "domain-strategy", 0);
+    getIntFromJsonObjectOrDefault(&(state->batch), settings, "batch", 0);
+    if (state->batch < 0 || state->batch > HIO_MAX_BATCH)
+    {
+        LOGF("JSON Error: UdpConnector->settings->batch (number field) : must be between 0 and %d", HIO_MAX_BATCH);
+        return NULL;
+    }
 
     state->dest_addr_selected =
         parseDynamicStrValueFromJsonObject(settings, "address", 2, "src_context->address", "dest_context->address");
@@ -202,6 +268,7 @@ tunnel_t *newUdpConnector(node_instance_context_t *instance_info)
     }
     if (state->dest_addr_selected.status == kDvsConstant)
     {
+        state->constant_dest_addr.address_type = getHostAddrType(state->dest_addr_selected.value_ptr);
         if (state->constant_dest_addr.address_type == kSatDomainName)
         {
             socketContextDomainSetConstMem(&(state->constant_dest_addr), state->dest_addr_selected.value_ptr,
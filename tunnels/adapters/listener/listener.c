@@ -19,20 +19,15 @@ typedef struct listener_con_state_s
     void*_;
 } listener_con_state_t;
 
-// set function pointers baby))
-static void upStream(tunnel_t *self, context_t *c);
-
-static void firstUpStream(tunnel_t *self, context_t *c)
-{
-
-    listener_state_t *state = STATE(self);
-    state->tcp_listener     = state->tcp_inbound_node->instance;
-    state->udp_listener     = state->udp_inbound_node->instance;
-    self->upStream          = upStream;
-    upStream(self, c);
-}
 static void upStream(tunnel_t *self, context_t *c)
 {
+    listener_state_t *state = STATE(self);
+    // resolved on the first call, self->upStream is not swapped since it may be the metrics wrapper
+    if (WW_UNLIKELY(state->tcp_listener == NULL))
+    {
+        state->tcp_listener = state->tcp_inbound_node->instance;
+        state->udp_listener = state->udp_inbound_node->instance;
+    }
     self->up->upStream(self->up, c);
 }
 static void downStream(tunnel_t *self, context_t *c)
@@ -84,7 +79,7 @@ tunnel_t *newListener(node_instance_context_t *instance_info)
 
     tunnel_t *t   = newTunnel();
     t->state      = state;
-    t->upStream   = &firstUpStream;
+    t->upStream   = &upStream;
     t->downStream = &downStream;
     
     return t;
@@ -1,6 +1,7 @@
 #include "tcp_listener.h"
 #include "buffer_pool.h"
 #include "hloop.h"
+#include "idle_table.h"
 #include "loggers/network_logger.h"
 #include "managers/socket_manager.h"
 #include "tunnel.h"
@@ -31,16 +32,20 @@ typedef struct tcp_listener_state_s
     bool     fast_open;
     bool     no_delay;
 
+    idle_table_t *keepalive_table;
+
 } tcp_listener_state_t;
 
 typedef struct tcp_listener_con_state_s
 {
+    hio_t           *io;
     hloop_t         *loop;
     tunnel_t        *tunnel;
     line_t          *line;
-    hio_t           *io;
     context_queue_t *data_queue;
     buffer_pool_t   *buffer_pool;
+    idle_item_t     *keepalive_handle;
+    uint64_t         keepalive_ms;
     bool             write_paused;
     bool             established;
     bool             first_packet_sent;
@@ -49,6 +54,11 @@ typedef struct tcp_listener_con_state_s
 
 static void cleanup(tcp_listener_con_state_t *cstate, bool write_queue)
 {
+    if (cstate->keepalive_handle)
+    {
+        tcp_listener_state_t *state = STATE(cstate->tunnel);
+        removeIdleItemByHash(cstate->line->tid, state->keepalive_table, (hash_t) (size_t) (cstate));
+    }
     if (cstate->io)
     {
         hevent_set_userdata(cstate->io, NULL);
@@ -206,8 +216,8 @@ static void downStream(tunnel_t *self, context_t *c)
         if (c->est)
         {
             assert(! cstate->established);
-            cstate->established = true;
-            hio_set_keepalive_timeout(cstate->io, kEstablishedKeepAliveTimeOutMs);
+            cstate->established  = true;
+            cstate->keepalive_ms = kEstablishedKeepAliveTimeOutMs;
             destroyContext(c);
             return;
         }
@@ -261,6 +271,24 @@ static void onClose(hio_t *io)
     }
 }
 
+// the reads and writes do not touch the item, it is only checked when it expires (same as hio keepalive)
+static void onKeepAliveExpire(idle_item_t *idle)
+{
+    tcp_listener_con_state_t *cstate = idle->userdata;
+    tcp_listener_state_t     *state  = STATE(cstate->tunnel);
+
+    const uint64_t last_rw_ms  = MAX(hio_last_read_time(cstate->io), hio_last_write_time(cstate->io));
+    const uint64_t inactive_ms = hloop_now_ms(cstate->loop) - last_rw_ms;
+    if (inactive_ms + 100 < cstate->keepalive_ms)
+    {
+        keepIdleItemForAtleast(state->keepalive_table, idle, cstate->keepalive_ms - inactive_ms);
+        return;
+    }
+    LOGD("TcpListener: keepalive timeout FD:%x ", hio_fd(cstate->io));
+    cstate->keepalive_handle = NULL;
+    hio_close(cstate->io);
+}
+
 static void onInboundConnected(hevent_t *ev)
 {
     hloop_t                *loop = ev->loop;
@@ -268,9 +296,9 @@ static void onInboundConnected(hevent_t *ev)
     hio_t                  *io   = data->io;
     size_t                  tid  = data->tid;
     hio_attach(loop, io);
-    hio_set_keepalive_timeout(io, kDefaultKeepAliveTimeOutMs);
 
     tunnel_t                 *self   = data->tunnel;
+    tcp_listener_state_t     *state  = STATE(self);
     line_t                   *line   = newLine(tid);
     tcp_listener_con_state_t *cstate = malloc(sizeof(tcp_listener_con_state_t));
 
@@ -279,13 +307,18 @@ static void onInboundConnected(hevent_t *ev)
     line->src_ctx.address          = *(sockaddr_u *) hio_peeraddr(io);
 
     *cstate = (tcp_listener_con_state_t){.line              = line,
+                                         .loop              = loop,
                                          .buffer_pool       = getThreadBufferPool(tid),
                                          .data_queue        = newContextQueue(getThreadBufferPool(tid)),
                                          .io                = io,
                                          .tunnel            = self,
                                          .write_paused      = false,
                                          .established       = false,
-                                         .first_packet_sent = false};
+                                         .first_packet_sent = false,
+                                         .keepalive_ms      = kDefaultKeepAliveTimeOutMs};
+
+    cstate->keepalive_handle = newIdleItem(state->keepalive_table, (hash_t) (size_t) (cstate), cstate,
+                                           onKeepAliveExpire, tid, kDefaultKeepAliveTimeOutMs);
 
     setupLineDownSide(line, onLinePaused, cstate, onLineResumed);
 
@@ -369,6 +402,13 @@ static void parsePortSection(tcp_listener_state_t *state, const cJSON *settings)
         }
     }
 }
+
+static hio_t *getTcpIo(tunnel_t *self, line_t *l)
+{
+    tcp_listener_con_state_t *cstate = LSTATE(l);
+    return cstate == NULL ? NULL : cstate->io;
+}
+
 tunnel_t *newTcpListener(node_instance_context_t *instance_info)
 {
     tcp_listener_state_t *state = malloc(sizeof(tcp_listener_state_t));
@@ -381,13 +421,14 @@ tunnel_t *newTcpListener(node_instance_context_t *instance_info)
         return NULL;
     }
     getBoolFromJsonObject(&(state->no_delay), settings, "nodelay");
+    getBoolFromJsonObject(&(state->fast_open), settings, "fastopen");
 
     if (! getStringFromJsonObject(&(state->address), settings, "address"))
     {
         LOGF("JSON Error: TcpListener->settings->address (string field) : The data was empty or invalid");
         return NULL;
     }
-    socket_filter_option_t filter_opt = {.no_delay = state->no_delay};
+    socket_filter_option_t filter_opt = {.no_delay = state->no_delay, .fast_open = state->fast_open};
 
     filter_opt.multiport_backend = kMultiportBackendNothing;
     parsePortSection(state, settings);
@@ -406,46 +447,39 @@ tunnel_t *newTcpListener(node_instance_context_t *instance_info)
         }
     }
 
-    filter_opt.white_list_raddr = NULL;
-    const cJSON *wlist          = cJSON_GetObjectItemCaseSensitive(settings, "whitelist");
-    if (cJSON_IsArray(wlist))
+    if (! getIpCidrListFromJsonObject(&(filter_opt.white_list_raddr), settings, "whitelist", getNetworkLogger()))
     {
-        size_t len = cJSON_GetArraySize(wlist);
-        if (len > 0)
-        {
-            char **list = (char **) malloc(sizeof(char *) * (len + 1));
-            memset((void *) list, 0, sizeof(char *) * (len + 1));
-            list[len]              = 0x0;
-            int          i         = 0;
-            const cJSON *list_item = NULL;
-            cJSON_ArrayForEach(list_item, wlist)
-            {
-                if (! getStringFromJson(&(list[i]), list_item) || ! verifyIpCdir(list[i], getNetworkLogger()))
-                {
-                    LOGF("JSON Error: TcpListener->settings->whitelist (array of strings field) index %d : The data "
-                         "was empty or invalid",
-                         i);
-                    exit(1);
-                }
+        LOGF("JSON Error: TcpListener->settings->whitelist (array of strings field) : The data was empty or invalid");
+        exit(1);
+    }
+    if (! getIpCidrListFromJsonObject(&(filter_opt.black_list_raddr), settings, "blacklist", getNetworkLogger()))
+    {
+        LOGF("JSON Error: TcpListener->settings->blacklist (array of strings field) : The data was empty or invalid");
+        exit(1);
+    }
 
-                i++;
-            }
+    filter_opt.host     = state->address;
+    filter_opt.port_min = state->port_min;
+    filter_opt.port_max = state->port_max;
+    filter_opt.protocol = kSapTcp;
 
-            filter_opt.white_list_raddr = list;
-        }
-    }
+    // every worker accepts on its own SO_REUSEPORT socket (linux, single port only)
+    getBoolFromJsonObject(&(filter_opt.reuse_port), settings, "reuseport");
+    getBoolFromJsonObject(&(filter_opt.reuse_port_cpu_steering), settings, "reuseport-cpu-steering");
 
-    filter_opt.host             = state->address;
-    filter_opt.port_min         = state->port_min;
-    filter_opt.port_max         = state->port_max;
-    filter_opt.protocol         = kSapTcp;
-    filter_opt.black_list_raddr = NULL;
+    state->keepalive_table = newIdleTable();
 
     tunnel_t *t   = newTunnel();
     t->state      = state;
     t->upStream   = &upStream;
     t->downStream = &downStream;
-    registerSocketAcceptor(t, filter_opt, onInboundConnected);
+    t->getTcpIo   = &getTcpIo;
+    if (! registerSocketAcceptor(t, filter_opt, onInboundConnected))
+    {
+        LOGF("TcpListener: could not register the socket acceptor");
+        free(t);
+        return NULL;
+    }
 
     return t;
 }
@@ -23,6 +23,7 @@ typedef struct udp_listener_state_s
     uint16_t port_max;
     char   **white_list_raddr;
     char   **black_list_raddr;
+    int      batch;
 
 } udp_listener_state_t;
 
@@ -31,6 +32,7 @@ typedef struct udp_listener_con_state_s
     hloop_t       *loop;
     tunnel_t      *tunnel;
     udpsock_t     *uio;
+    sockaddr_u     peer_addr;
     line_t        *line;
     idle_item_t   *idle_handle;
     buffer_pool_t *buffer_pool;
@@ -101,7 +103,7 @@ static void downStream(tunnel_t *self, context_t *c)
 
     if (c->payload != NULL)
     {
-        postUdpWrite(cstate->uio,c->line->tid, c->payload);
+        postUdpWrite(cstate->uio, c->line->tid, &cstate->peer_addr, c->payload);
         CONTEXT_PAYLOAD_DROP(c);
         destroyContext(c);
     }
@@ -142,17 +144,19 @@ static void onUdpConnectonExpire(idle_item_t *idle_udp)
     self->upStream(self, context);
 }
 
-static udp_listener_con_state_t *newConnection(uint8_t tid, tunnel_t *self, udpsock_t *uio, uint16_t real_localport)
+static udp_listener_con_state_t *newConnection(uint8_t tid, tunnel_t *self, udpsock_t *uio,
+                                               const sockaddr_u *peer_addr, uint16_t real_localport)
 {
     line_t                   *line   = newLine(tid);
     udp_listener_con_state_t *cstate = malloc(sizeof(udp_listener_con_state_t));
     LSTATE_MUT(line)                 = cstate;
+    line->src_ctx.address            = *peer_addr;
     line->src_ctx.address_type       = line->src_ctx.address.sa.sa_family == AF_INET ? kSatIPV4 : kSatIPV6;
     line->src_ctx.address_protocol   = kSapUdp;
-    line->src_ctx.address            = *(sockaddr_u *) hio_peeraddr(uio->io);
 
     *cstate = (udp_listener_con_state_t){.loop              = loops[tid],
                                          .line              = line,
+                                         .peer_addr         = *peer_addr,
                                          .buffer_pool       = getThreadBufferPool(tid),
                                          .uio               = uio,
                                          .tunnel            = self,
@@ -171,7 +175,7 @@ static udp_listener_con_state_t *newConnection(uint8_t tid, tunnel_t *self, udps
         char peeraddrstr[SOCKADDR_STRLEN]  = {0};
 
         LOGD("UdpListener: Accepted FD:%x  [%s] <= [%s]", hio_fd(cstate->uio->io),
-             SOCKADDR_STR(&log_localaddr, localaddrstr), SOCKADDR_STR(hio_peeraddr(uio->io), peeraddrstr));
+             SOCKADDR_STR(&log_localaddr, localaddrstr), SOCKADDR_STR(peer_addr, peeraddrstr));
     }
 
     // send the init packet
@@ -192,8 +196,9 @@ static udp_listener_con_state_t *newConnection(uint8_t tid, tunnel_t *self, udps
 
 static void onFilteredRecv(hevent_t *ev)
 {
+    // the listen io is shared by every peer, only the payload knows who sent it
     udp_payload_t *data          = (udp_payload_t *) hevent_userdata(ev);
-    hash_t         peeraddr_hash = sockAddrCalcHash((sockaddr_u *) hio_peeraddr(data->sock->io));
+    hash_t         peeraddr_hash = sockAddrCalcHash(&data->peer_addr);
 
     idle_item_t *idle = getIdleItemByHash(data->tid, data->sock->table, peeraddr_hash);
     if (idle == NULL)
@@ -206,7 +211,8 @@ static void onFilteredRecv(hevent_t *ev)
             destroyUdpPayload(data);
             return;
         }
-        udp_listener_con_state_t *con = newConnection(data->tid, data->tunnel, data->sock, data->real_localport);
+        udp_listener_con_state_t *con = newConnection(data->tid, data->tunnel, data->sock, &data->peer_addr,
+                                                      data->real_localport);
 
         if (! con)
         {
@@ -275,6 +281,7 @@ static void parsePortSection(udp_listener_state_t *state, const cJSON *settings)
         }
     }
 }
+
 tunnel_t *newUdpListener(node_instance_context_t *instance_info)
 {
     udp_listener_state_t *state = malloc(sizeof(udp_listener_state_t));
@@ -311,46 +318,45 @@ tunnel_t *newUdpListener(node_instance_context_t *instance_info)
         }
     }
 
-    filter_opt.white_list_raddr = NULL;
-    const cJSON *wlist          = cJSON_GetObjectItemCaseSensitive(settings, "whitelist");
-    if (cJSON_IsArray(wlist))
+    if (! getIpCidrListFromJsonObject(&(filter_opt.white_list_raddr), settings, "whitelist", getNetworkLogger()))
     {
-        size_t len = cJSON_GetArraySize(wlist);
-        if (len > 0)
-        {
-            char **list = (char **) malloc(sizeof(char *) * (len + 1));
-            memset((void *) list, 0, sizeof(char *) * (len + 1));
-            list[len]              = 0x0;
-            int          i         = 0;
-            const cJSON *list_item = NULL;
-            cJSON_ArrayForEach(list_item, wlist)
-            {
-                if (! getStringFromJson(&(list[i]), list_item) || ! verifyIpCdir(list[i], getNetworkLogger()))
-                {
-                    LOGF("JSON Error: UdpListener->settings->whitelist (array of strings field) index %d : The data "
-                         "was empty or invalid",
-                         i);
-                    exit(1);
-                }
+        LOGF("JSON Error: UdpListener->settings->whitelist (array of strings field) : The data was empty or invalid");
+        exit(1);
+    }
+    if (! getIpCidrListFromJsonObject(&(filter_opt.black_list_raddr), settings, "blacklist", getNetworkLogger()))
+    {
+        LOGF("JSON Error: UdpListener->settings->blacklist (array of strings field) : The data was empty or invalid");
+        exit(1);
+    }
 
-                i++;
-            }
+    filter_opt.host     = state->address;
+    filter_opt.port_min = state->port_min;
+    filter_opt.port_max = state->port_max;
+    filter_opt.protocol = kSapUdp;
 
-            filter_opt.white_list_raddr = list;
-        }
-    }
+    // every worker accepts on its own SO_REUSEPORT socket (linux, single port only)
+    getBoolFromJsonObject(&(filter_opt.reuse_port), settings, "reuseport");
+    getBoolFromJsonObject(&(filter_opt.reuse_port_cpu_steering), settings, "reuseport-cpu-steering");
 
-    filter_opt.host             = state->address;
-    filter_opt.port_min         = state->port_min;
-    filter_opt.port_max         = state->port_max;
-    filter_opt.protocol         = kSapUdp;
-    filter_opt.black_list_raddr = NULL;
+    // datagrams per recvmmsg/sendmmsg on the listen socket (linux), 0 or 1 disables batching
+    getIntFromJsonObjectOrDefault(&(state->batch), settings, "batch", 0);
+    if (state->batch < 0 || state->batch > HIO_MAX_BATCH)
+    {
+        LOGF("JSON Error: UdpListener->settings->batch (number field) : must be between 0 and %d", HIO_MAX_BATCH);
+        return NULL;
+    }
+    filter_opt.udp_batch = (unsigned int) state->batch;
 
     tunnel_t *t   = newTunnel();
     t->state      = state;
     t->upStream   = &upStream;
     t->downStream = &downStream;
-    registerSocketAcceptor(t, filter_opt, onFilteredRecv);
+    if (! registerSocketAcceptor(t, filter_opt, onFilteredRecv))
+    {
+        LOGF("UdpListener: could not register the socket acceptor");
+        free(t);
+        return NULL;
+    }
 
     return t;
 }
@@ -124,15 +124,16 @@ static void downStream(tunnel_t *self, context_t *c)
 
             if (bufferStreamLen(cstate->read_stream) >= ((unsigned int) kBgpHeaderLen + required_length))
             {
-                shift_buffer_t *buf = bufferStreamRead(cstate->read_stream, kBgpHeaderLen + required_length);
-
                 static const uint8_t kExpecetd[kMarkerLength] = {VAL_8X, VAL_8X};
 
-                if (0 != memcmp(rawBuf(buf), kExpecetd, kMarkerLength))
+                // the marker is checked in place, only the payload is read out of the stream
+                uint8_t marker[kMarkerLength];
+                bufferStreamViewBytesAt(cstate->read_stream, 0, marker, kMarkerLength);
+
+                if (0 != memcmp(marker, kExpecetd, kMarkerLength))
                 {
                     LOGE("Bgp4Client: invalid marker");
                     destroyBufferStream(cstate->read_stream);
-                    reuseBuffer(getContextBufferPool(c), buf);
                     free(cstate);
                     CSTATE_DROP(c);
                     self->up->upStream(self->up, newFinContextFrom(c));
@@ -140,17 +141,22 @@ static void downStream(tunnel_t *self, context_t *c)
                     destroyContext(c);
                     return;
                 }
-                shiftr(buf, kBgpHeaderLen + 1); // 1 byte is type
+                bufferStreamSkip(cstate->read_stream, kBgpHeaderLen + 1); // 1 byte is type
 
-                if (bufLen(buf) <= 0)
+                // the payload goes on as the buffers it arrived in, only the last one is sliced
+                for (size_t remain = (size_t) required_length - 1; remain > 0;)
                 {
-                    LOGE("Bgp4Client: message had no payload");
-                    reuseBuffer(getContextBufferPool(c), buf);
-                    goto disconnect;
+                    context_t *data_ctx = newContext(c->line);
+                    data_ctx->payload   = bufferStreamReadChunk(cstate->read_stream, remain);
+                    remain -= bufLen(data_ctx->payload);
+                    self->dw->downStream(self->dw, data_ctx);
+
+                    if (! isAlive(c->line))
+                    {
+                        destroyContext(c);
+                        return;
+                    }
                 }
-                context_t *data_ctx = newContext(c->line);
-                data_ctx->payload   = buf;
-                self->dw->downStream(self->dw, data_ctx);
             }
             else
             {
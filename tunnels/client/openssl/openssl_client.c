@@ -3,7 +3,10 @@
 #include "buffer_stream.h"
 #include "loggers/network_logger.h"
 #include "managers/node_manager.h"
+#include "openssl_buffer_bio.h"
 #include "openssl_globals.h"
+#include "openssl_ktls.h"
+#include "openssl_session.h"
 #include "utils/jsonutils.h"
 #include <openssl/bio.h>
 #include <openssl/err.h>
@@ -18,16 +21,20 @@ typedef struct oss_client_state_s
     char *alpn;
     char *sni;
     bool  verify;
+    bool  session_resumption;
+    bool  ktls; // kernel tls when the tunnel above is a tcp socket
 
 } oss_client_state_t;
 
 typedef struct oss_client_con_state_s
 {
     SSL             *ssl;
-    BIO             *rbio;
-    BIO             *wbio;
+    BIO             *bio;  // buffer bio, both sides
+    ssl_ktls_t      *ktls; // until both sides are in the kernel
     context_queue_t *queue;
     bool             handshake_completed;
+    bool             ktls_tx; // the kernel encrypts what we send up, plaintext goes to the socket
+    bool             ktls_rx; // the kernel decrypts, the socket gives plaintext
 
 } oss_client_con_state_t;
 
@@ -58,7 +65,11 @@ static void cleanup(tunnel_t *self, context_t *c)
     oss_client_con_state_t *cstate = CSTATE(c);
     if (cstate != NULL)
     {
-        SSL_free(cstate->ssl); /* free the SSL object and its BIO's */
+        if (cstate->ktls != NULL)
+        {
+            destroySslKtls(cstate->ssl, cstate->ktls);
+        }
+        SSL_free(cstate->ssl); /* free the SSL object and its BIO */
         destroyContextQueue(cstate->queue);
 
         free(cstate);
@@ -66,6 +77,55 @@ static void cleanup(tunnel_t *self, context_t *c)
     }
 }
 
+// moves the sides openssl has nothing pending on to the kernel, a side that can not be moved stays in userspace
+static void tryKtls(tunnel_t *self, context_t *c)
+{
+    oss_client_con_state_t *cstate = CSTATE(c);
+    if (cstate->ktls == NULL)
+    {
+        return;
+    }
+    hio_t *io = NULL;
+    if (self->up != NULL && self->up->getTcpIo != NULL)
+    {
+        io = self->up->getTcpIo(self->up, c->line);
+    }
+    if (io == NULL)
+    {
+        goto give_up;
+    }
+    // what is queued on the socket was encrypted by openssl already
+    if (! cstate->ktls_tx && hio_write_is_complete(io) && sslKtlsReady(cstate->ssl, cstate->ktls, cstate->bio, true))
+    {
+        if (! sslKtlsInstall(cstate->ssl, cstate->ktls, hio_fd(io), true))
+        {
+            goto give_up;
+        }
+        cstate->ktls_tx = true;
+    }
+    if (! cstate->ktls_rx && sslKtlsReady(cstate->ssl, cstate->ktls, cstate->bio, false))
+    {
+        if (! sslKtlsInstall(cstate->ssl, cstate->ktls, hio_fd(io), false))
+        {
+            goto give_up;
+        }
+        cstate->ktls_rx = true;
+    }
+    if (cstate->ktls_tx && cstate->ktls_rx)
+    {
+        LOGD("OpensslClient: kernel tls FD:%x", hio_fd(io));
+        destroySslKtls(cstate->ssl, cstate->ktls);
+        cstate->ktls = NULL;
+    }
+    return;
+
+give_up:;
+    LOGD("OpensslClient: no kernel tls for the line (tx: %d rx: %d), the rest stays in userspace", cstate->ktls_tx,
+         cstate->ktls_rx);
+    destroySslKtls(cstate->ssl, cstate->ktls);
+    cstate->ktls = NULL;
+}
+
 static void flushWriteQueue(tunnel_t *self, context_t *c)
 {
     oss_client_con_state_t *cstate = CSTATE(c);
@@ -89,6 +149,16 @@ static void upStream(tunnel_t *self, context_t *c)
             contextQueuePush(cstate->queue, c);
             return;
         }
+        if (cstate->ktls != NULL)
+        {
+            tryKtls(self, c);
+        }
+        if (cstate->ktls_tx)
+        {
+            // the kernel encrypts it
+            self->up->upStream(self->up, c);
+            return;
+        }
 
         enum sslstatus status;
         int            len = (int) bufLen(c->payload);
@@ -103,37 +173,20 @@ static void upStream(tunnel_t *self, context_t *c)
                 /* consume the waiting bytes that have been used by SSL */
                 shiftr(c->payload, n);
                 len -= n;
-                /* take the output of the SSL object and queue it for socket write */
-                do
+                /* take the records the SSL object wrote and queue them for socket write */
+                shift_buffer_t *buf;
+                while ((buf = bufferBioPop(cstate->bio)) != NULL)
                 {
-                    shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                    int             avail = (int) rCap(buf);
-                    n                     = BIO_read(cstate->wbio, rawBufMut(buf), avail);
-                    if (n > 0)
-                    {
-                        setLen(buf, n);
-                        context_t *send_context = newContextFrom(c);
-                        send_context->payload   = buf;
-                        self->up->upStream(self->up, send_context);
-                        if (! isAlive(c->line))
-                        {
-                            reuseContextBuffer(c);
-                            destroyContext(c);
-                            return;
-                        }
-                    }
-                    else if (! BIO_should_retry(cstate->wbio))
+                    context_t *send_context = newContextFrom(c);
+                    send_context->payload   = buf;
+                    self->up->upStream(self->up, send_context);
+                    if (! isAlive(c->line))
                     {
-                        // If BIO_should_retry() is false then the cause is an error condition.
-                        reuseBuffer(getContextBufferPool(c), buf);
                         reuseContextBuffer(c);
-                        goto failed;
-                    }
-                    else
-                    {
-                        reuseBuffer(getContextBufferPool(c), buf);
+                        destroyContext(c);
+                        return;
                     }
-                } while (n > 0);
+                }
             }
 
             if (status == kSslstatusFail)
@@ -159,13 +212,21 @@ static void upStream(tunnel_t *self, context_t *c)
             CSTATE_MUT(c) = malloc(sizeof(oss_client_con_state_t));
             oss_client_con_state_t *cstate = CSTATE(c);
             memset(cstate, 0, sizeof(oss_client_con_state_t));
-            cstate->rbio                   = BIO_new(BIO_s_mem());
-            cstate->wbio                   = BIO_new(BIO_s_mem());
+            cstate->bio                    = newBufferBio(getContextBufferPool(c));
             cstate->ssl                    = SSL_new(state->ssl_context);
             cstate->queue                  = newContextQueue(getContextBufferPool(c));
             SSL_set_connect_state(cstate->ssl); /* sets ssl to work in client mode. */
-            SSL_set_bio(cstate->ssl, cstate->rbio, cstate->wbio);
+            SSL_set_bio(cstate->ssl, cstate->bio, cstate->bio);
             SSL_set_tlsext_host_name(cstate->ssl, state->sni);
+            if (state->session_resumption)
+            {
+                SSL_set_app_data(cstate->ssl, c->line);
+                sslSessionResume(cstate->ssl, c->line->tid);
+            }
+            if (state->ktls)
+            {
+                cstate->ktls = newSslKtls(cstate->ssl);
+            }
             context_t *client_hello_ctx = newContextFrom(c);
             self->up->upStream(self->up, c);
             if (! isAlive(client_hello_ctx->line))
@@ -181,25 +242,16 @@ static void upStream(tunnel_t *self, context_t *c)
             /* Did SSL request to write bytes? */
             if (status == kSslstatusWantIo)
             {
-                shift_buffer_t *buf   = popBuffer(getContextBufferPool(client_hello_ctx));
-                int             avail = (int) rCap(buf);
-                n                     = BIO_read(cstate->wbio, rawBufMut(buf), avail);
-                if (n > 0)
+                shift_buffer_t *buf = bufferBioPop(cstate->bio);
+                if (buf != NULL)
                 {
-                    setLen(buf, n);
                     client_hello_ctx->payload = buf;
                     client_hello_ctx->first   = true;
                     self->up->upStream(self->up, client_hello_ctx);
                 }
-                else if (! BIO_should_retry(cstate->rbio))
-                {
-                    // If BIO_should_retry() is false then the cause is an error condition.
-                    reuseBuffer(getContextBufferPool(client_hello_ctx), buf);
-                    goto failed;
-                }
                 else
                 {
-                    reuseBuffer(getContextBufferPool(client_hello_ctx), buf);
+                    destroyContext(client_hello_ctx);
                 }
             }
             if (status == kSslstatusFail)
@@ -235,155 +287,105 @@ static void downStream(tunnel_t *self, context_t *c)
         int            n;
         enum sslstatus status;
 
-        int len = (int) bufLen(c->payload);
+        if (cstate->ktls_rx)
+        {
+            // the kernel decrypted it
+            self->dw->downStream(self->dw, c);
+            return;
+        }
 
-        while (len > 0 && isAlive(c->line))
+        // the bio reads the records straight out of the payload
+        bufferBioPush(cstate->bio, c->payload);
+        CONTEXT_PAYLOAD_DROP(c);
+
+        if (! cstate->handshake_completed)
         {
-            n = BIO_write(cstate->rbio, rawBuf(c->payload), len);
+            // printSSLState(cstate->ssl);
+            n = SSL_connect(cstate->ssl);
+            // printSSLState(cstate->ssl);
+            status = getSslStatus(cstate->ssl, n);
 
-            if (n <= 0)
+            if (status == kSslstatusFail)
             {
-                /* if BIO write fails, assume unrecoverable */
-                reuseContextBuffer(c);
+                SSL_get_verify_result(cstate->ssl);
+                printSSLError();
                 goto failed;
             }
-            shiftr(c->payload, n);
-            len -= n;
 
-            if (! cstate->handshake_completed)
+            /* Did SSL request to write bytes? */
+            shift_buffer_t *buf;
+            while ((buf = bufferBioPop(cstate->bio)) != NULL)
             {
-                // printSSLState(cstate->ssl);
-                n = SSL_connect(cstate->ssl);
-                // printSSLState(cstate->ssl);
-                status = getSslStatus(cstate->ssl, n);
-
-                /* Did SSL request to write bytes? */
-                if (status == kSslstatusWantIo)
+                context_t *req_cont = newContextFrom(c);
+                req_cont->payload   = buf;
+                self->up->upStream(self->up, req_cont);
+                if (! isAlive(c->line))
                 {
-                    do
-                    {
-                        shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                        int             avail = (int) rCap(buf);
-                        n                     = BIO_read(cstate->wbio, rawBufMut(buf), avail);
-
-                        if (n > 0)
-                        {
-                            setLen(buf, n);
-                            context_t *req_cont = newContextFrom(c);
-                            req_cont->payload   = buf;
-                            self->up->upStream(self->up, req_cont);
-                            if (! isAlive(c->line))
-                            {
-                                reuseContextBuffer(c);
-                                destroyContext(c);
-                                return;
-                            }
-                        }
-                        else if (! BIO_should_retry(cstate->rbio))
-                        {
-                            // If BIO_should_retry() is false then the cause is an error condition.
-                            reuseContextBuffer(c);
-                            reuseBuffer(getContextBufferPool(c), buf);
-                            goto failed;
-                        }
-                        else
-                        {
-                            reuseBuffer(getContextBufferPool(c), buf);
-                        }
-                    } while (n > 0);
-                }
-                if (status == kSslstatusFail)
-                {
-                    SSL_get_verify_result(cstate->ssl);
-                    printSSLError();
-                    reuseContextBuffer(c);
-                    goto failed;
+                    destroyContext(c);
+                    return;
                 }
+            }
 
-                /* Did SSL request to write bytes? */
-                shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                int             avail = (int) rCap(buf);
-                n                     = BIO_read(cstate->wbio, rawBufMut(buf), avail);
-                if (n > 0)
-                {
-                    setLen(buf, n);
-                    context_t *data_ctx = newContext(c->line);
-                    data_ctx->payload   = buf;
-                    self->up->upStream(self->up, data_ctx);
-                    if (! isAlive(c->line))
-                    {
-                        reuseContextBuffer(c);
-                        destroyContext(c);
-                        return;
-                    }
-                }
-                else
-                {
-                    reuseBuffer(getContextBufferPool(c), buf);
-                }
+            if (! cstate->handshake_completed && SSL_is_init_finished(cstate->ssl))
+            {
+                LOGD("OpensslClient: Tls handshake complete%s", SSL_session_reused(cstate->ssl) ? " (resumed)" : "");
+                cstate->handshake_completed = true;
+                flushWriteQueue(self, c);
 
-                if (! cstate->handshake_completed && SSL_is_init_finished(cstate->ssl))
-                {
-                    LOGD("OpensslClient: Tls handshake complete");
-                    cstate->handshake_completed = true;
-                    flushWriteQueue(self, c);
-
-                    context_t *dw_est_ctx = newContextFrom(c);
-                    dw_est_ctx->est       = true;
-                    self->dw->downStream(self->dw, dw_est_ctx);
-
-                    // queue is flushed and we are done
-                    // reuseContextBuffer(c);
-                    // destroyContext(c);
-                    // return;
-                }
+                context_t *dw_est_ctx = newContextFrom(c);
+                dw_est_ctx->est       = true;
+                self->dw->downStream(self->dw, dw_est_ctx);
 
-                reuseContextBuffer(c);
-                destroyContext(c);
-                return;
+                // queue is flushed and we are done
+                // destroyContext(c);
+                // return;
             }
 
-            /* The encrypted data is now in the input bio so now we can perform actual
-             * read of unencrypted data. */
+            destroyContext(c);
+            return;
+        }
 
-            do
-            {
-                shift_buffer_t *buf = popBuffer(getContextBufferPool(c));
-                shiftl(buf, 8192 / 2);
-                setLen(buf, 0);
-                int avail = (int) rCap(buf);
-                n         = SSL_read(cstate->ssl, rawBufMut(buf), avail);
+        /* The encrypted data is now in the input bio so now we can perform actual
+         * read of unencrypted data. */
 
-                if (n > 0)
-                {
-                    setLen(buf, n);
-                    context_t *data_ctx = newContextFrom(c);
-                    data_ctx->payload   = buf;
-                    self->dw->downStream(self->dw, data_ctx);
-                    if (! isAlive(c->line))
-                    {
-                        reuseContextBuffer(c);
-                        destroyContext(c);
-                        return;
-                    }
-                }
-                else
+        do
+        {
+            shift_buffer_t *buf = popBuffer(getContextBufferPool(c));
+            shiftl(buf, 8192 / 2);
+            setLen(buf, 0);
+            int avail = (int) rCap(buf);
+            n         = SSL_read(cstate->ssl, rawBufMut(buf), avail);
+
+            if (n > 0)
+            {
+                setLen(buf, n);
+                context_t *data_ctx = newContextFrom(c);
+                data_ctx->payload   = buf;
+                self->dw->downStream(self->dw, data_ctx);
+                if (! isAlive(c->line))
                 {
-                    reuseBuffer(getContextBufferPool(c), buf);
+                    destroyContext(c);
+                    return;
                 }
+            }
+            else
+            {
+                reuseBuffer(getContextBufferPool(c), buf);
+            }
 
-            } while (n > 0);
+        } while (n > 0);
 
-            status = getSslStatus(cstate->ssl, n);
+        status = getSslStatus(cstate->ssl, n);
 
-            if (status == kSslstatusFail)
-            {
-                reuseContextBuffer(c);
-                goto failed;
-            }
+        if (status == kSslstatusFail)
+        {
+            goto failed;
+        }
+        if (cstate->ktls != NULL)
+        {
+            tryKtls(self, c);
         }
         // done with socket data
-        reuseContextBuffer(c);
         destroyContext(c);
     }
     else
@@ -441,10 +443,15 @@ tunnel_t *newOpenSSLClient(node_instance_context_t *instance_info)
 
     getStringFromJsonObjectOrDefault(&(state->alpn), settings, "alpn", "http/1.1");
 
+    getBoolFromJsonObjectOrDefault(&(state->session_resumption), settings, "session-resumption", true);
+
+    getBoolFromJsonObjectOrDefault(&(state->ktls), settings, "ktls", false);
+
     ssl_param->verify_peer = state->verify ? 1 : 0;
     ssl_param->endpoint    = kSslClient;
     // ssl_param->ca_path = "cacert.pem";
     state->ssl_context = sslCtxNew(ssl_param);
+    bufferBioGlobalInit();
     free(ssl_param);
     // SSL_CTX_load_verify_store(state->ssl_context,cacert_bytes);
 
@@ -454,6 +461,16 @@ tunnel_t *newOpenSSLClient(node_instance_context_t *instance_info)
         return NULL;
     }
 
+    if (state->session_resumption)
+    {
+        sslSessionCacheInit(state->ssl_context);
+    }
+    if (state->ktls)
+    {
+        sslKtlsGlobalInit();
+        sslKtlsCtxInit(state->ssl_context);
+    }
+
     size_t alpn_len = strlen(state->alpn);
     struct
     {
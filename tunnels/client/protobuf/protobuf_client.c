@@ -16,7 +16,8 @@
 */
 enum
 {
-    kMaxPacketSize = (65536 * 1)
+    kMaxPacketSize = (65536 * 1),
+    kMaxHeaderSize = 1 + 10 // tag + uleb128 of a uint64
 };
 
 typedef struct protobuf_client_state_s
@@ -82,52 +83,53 @@ static void downStream(tunnel_t *self, context_t *c)
                 destroyContext(c);
                 return;
             }
-            shift_buffer_t *full_data    = bufferStreamFullRead(bstream);
-            const uint8_t  *uleb_data    = &(((uint8_t *) rawBuf(full_data))[1]); // first byte is \n (protobuf)
-            uint64_t        data_len     = 0;
-            size_t          bytes_passed = readUleb128ToUint64(uleb_data, uleb_data + bufLen(full_data) - 1, &data_len);
-            if (data_len == 0 || (bufLen(full_data) - (bytes_passed + 1)) < data_len)
+            // the header is viewed in place, the stream is only read once the whole frame is there
+            uint8_t      header[kMaxHeaderSize];
+            const size_t header_len =
+                bufferStreamLen(bstream) < sizeof(header) ? bufferStreamLen(bstream) : sizeof(header);
+            bufferStreamViewBytesAt(bstream, 0, header, header_len);
+
+            uint64_t data_len     = 0;
+            size_t   bytes_passed = readUleb128ToUint64(&header[1], &header[header_len], &data_len); // [0] is \n
+            if (bytes_passed == 0 && header_len == kMaxHeaderSize)
             {
-                bufferStreamPush(bstream, full_data);
-                destroyContext(c);
-                return;
+                // all 10 bytes of the varint have the continuation bit, it would never end
+                LOGE("ProtoBufClient: rejected, invalid length varint");
+                goto disconnect;
             }
-
             if (data_len > kMaxPacketSize)
             {
-                LOGE("ProtoBufServer: rejected, size too large");
+                LOGE("ProtoBufClient: rejected, size too large");
                 goto disconnect;
             }
-
-            shiftr(full_data, 1 + bytes_passed);
-
-            context_t *downstream_ctx = newContextFrom(c);
-            downstream_ctx->payload   = popBuffer(getContextBufferPool(c));
-
-            sliceBufferTo(downstream_ctx->payload, full_data, data_len);
-            // upstream_ctx->payload   = shallowSliceBuffer();
-
-            if (bufLen(full_data) > 0)
+            if (data_len == 0 || (bufferStreamLen(bstream) - (bytes_passed + 1)) < data_len)
             {
-                bufferStreamPush(bstream, full_data);
-            }
-            else
-            {
-                reuseBuffer(getContextBufferPool(c), full_data);
-            }
-
-            if (! cstate->first_sent)
-            {
-                downstream_ctx->first = true;
-                cstate->first_sent    = true;
+                destroyContext(c);
+                return;
             }
 
-            self->dw->downStream(self->dw, downstream_ctx);
+            bufferStreamSkip(bstream, 1 + bytes_passed);
 
-            if (! isAlive(c->line))
+            // the frame goes on as the buffers it arrived in, only the last one is sliced
+            while (data_len > 0)
             {
-                destroyContext(c);
-                return;
+                context_t *downstream_ctx = newContextFrom(c);
+                downstream_ctx->payload   = bufferStreamReadChunk(bstream, data_len);
+                data_len -= bufLen(downstream_ctx->payload);
+
+                if (! cstate->first_sent)
+                {
+                    downstream_ctx->first = true;
+                    cstate->first_sent    = true;
+                }
+
+                self->dw->downStream(self->dw, downstream_ctx);
+
+                if (! isAlive(c->line))
+                {
+                    destroyContext(c);
+                    return;
+                }
             }
         }
     }
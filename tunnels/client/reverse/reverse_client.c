@@ -177,7 +177,7 @@ tunnel_t *newReverseClient(node_instance_context_t *instance_info)
     line_t *l = newLine(0);
     destroyLine(l);
 
-    state->starved_connections = newIdleTable(loops[0]);
+    state->starved_connections = newIdleTable();
 
     tunnel_t *t           = newTunnel();
     t->state              = state;
@@ -2,7 +2,9 @@
 #include "buffer_pool.h"
 #include "loggers/network_logger.h"
 #include "utils/jsonutils.h"
+#include "wolfssl_buffer_bio.h"
 #include "wolfssl_globals.h"
+#include "wolfssl_session.h"
 
 #include <wolfssl/openssl/bio.h>
 #include <wolfssl/openssl/err.h>
@@ -18,6 +20,7 @@ typedef struct wssl_client_state_s
     char *alpn;
     char *sni;
     bool  verify;
+    bool  session_resumption;
 
 } wssl_client_state_t;
 
@@ -25,8 +28,7 @@ typedef struct wssl_client_con_state_s
 {
     bool             handshake_completed;
     SSL             *ssl;
-    BIO             *rbio;
-    BIO             *wbio;
+    BIO             *bio; // buffer bio, both sides
     context_queue_t *queue;
 
 } wssl_client_con_state_t;
@@ -55,10 +57,15 @@ static enum sslstatus getSslStatus(SSL *ssl, int n)
 
 static void cleanup(tunnel_t *self, context_t *c)
 {
+    wssl_client_state_t     *state  = STATE(self);
     wssl_client_con_state_t *cstate = CSTATE(c);
     if (cstate != NULL)
     {
-        SSL_free(cstate->ssl); /* free the SSL object and its BIO's */
+        if (state->session_resumption && cstate->handshake_completed)
+        {
+            sslSessionKeep(cstate->ssl, c->line->tid);
+        }
+        SSL_free(cstate->ssl); /* free the SSL object and its BIO */
         destroyContextQueue(cstate->queue);
 
         free(cstate);
@@ -103,37 +110,20 @@ static void upStream(tunnel_t *self, context_t *c)
                 /* consume the waiting bytes that have been used by SSL */
                 shiftr(c->payload, n);
                 len -= n;
-                /* take the output of the SSL object and queue it for socket write */
-                do
+                /* take the records the SSL object wrote and queue them for socket write */
+                shift_buffer_t *buf;
+                while ((buf = bufferBioPop(cstate->bio)) != NULL)
                 {
-                    shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                    int             avail = (int) rCap(buf);
-                    n                     = BIO_read(cstate->wbio, rawBufMut(buf), avail);
-                    if (n > 0)
-                    {
-                        setLen(buf, n);
-                        context_t *send_context = newContextFrom(c);
-                        send_context->payload   = buf;
-                        self->up->upStream(self->up, send_context);
-                        if (! isAlive(c->line))
-                        {
-                            reuseContextBuffer(c);
-                            destroyContext(c);
-                            return;
-                        }
-                    }
-                    else if (! BIO_should_retry(cstate->wbio))
+                    context_t *send_context = newContextFrom(c);
+                    send_context->payload   = buf;
+                    self->up->upStream(self->up, send_context);
+                    if (! isAlive(c->line))
                     {
-                        // If BIO_should_retry() is false then the cause is an error condition.
-                        reuseBuffer(getContextBufferPool(c), buf);
                         reuseContextBuffer(c);
-                        goto failed;
-                    }
-                    else
-                    {
-                        reuseBuffer(getContextBufferPool(c), buf);
+                        destroyContext(c);
+                        return;
                     }
-                } while (n > 0);
+                }
             }
 
             if (status == kSslstatusFail)
@@ -159,13 +149,17 @@ static void upStream(tunnel_t *self, context_t *c)
             CSTATE_MUT(c)                   = malloc(sizeof(wssl_client_con_state_t));
             wssl_client_con_state_t *cstate = CSTATE(c);
             memset(cstate, 0, sizeof(wssl_client_con_state_t));
-            cstate->rbio  = BIO_new(BIO_s_mem());
-            cstate->wbio  = BIO_new(BIO_s_mem());
+            cstate->bio   = newBufferBio(getContextBufferPool(c));
             cstate->ssl   = SSL_new(state->ssl_context);
             cstate->queue = newContextQueue(getContextBufferPool(c));
             SSL_set_connect_state(cstate->ssl); /* sets ssl to work in client mode. */
-            SSL_set_bio(cstate->ssl, cstate->rbio, cstate->wbio);
+            SSL_set_bio(cstate->ssl, cstate->bio, cstate->bio);
             SSL_set_tlsext_host_name(cstate->ssl, state->sni);
+            if (state->session_resumption)
+            {
+                sslSessionUseTickets(cstate->ssl);
+                sslSessionResume(cstate->ssl, c->line->tid);
+            }
             context_t *client_hello_ctx = newContextFrom(c);
             self->up->upStream(self->up, c);
             if (! isAlive(client_hello_ctx->line))
@@ -181,25 +175,16 @@ static void upStream(tunnel_t *self, context_t *c)
             /* Did SSL request to write bytes? */
             if (status == kSslstatusWantIo)
             {
-                shift_buffer_t *buf   = popBuffer(getContextBufferPool(client_hello_ctx));
-                int             avail = (int) rCap(buf);
-                n                     = BIO_read(cstate->wbio, rawBufMut(buf), avail);
-                if (n > 0)
+                shift_buffer_t *buf = bufferBioPop(cstate->bio);
+                if (buf != NULL)
                 {
-                    setLen(buf, n);
                     client_hello_ctx->payload = buf;
                     client_hello_ctx->first   = true;
                     self->up->upStream(self->up, client_hello_ctx);
                 }
-                else if (! BIO_should_retry(cstate->rbio))
-                {
-                    // If BIO_should_retry() is false then the cause is an error condition.
-                    reuseBuffer(getContextBufferPool(client_hello_ctx), buf);
-                    goto failed;
-                }
                 else
                 {
-                    reuseBuffer(getContextBufferPool(client_hello_ctx), buf);
+                    destroyContext(client_hello_ctx);
                 }
             }
             if (status == kSslstatusFail)
@@ -235,157 +220,101 @@ static void downStream(tunnel_t *self, context_t *c)
         int            n;
         enum sslstatus status;
 
-        int len = (int) bufLen(c->payload);
+        // the bio reads the records straight out of the payload
+        bufferBioPush(cstate->bio, c->payload);
+        CONTEXT_PAYLOAD_DROP(c);
 
-        while (len > 0 && isAlive(c->line))
+        if (! cstate->handshake_completed)
         {
-            n = BIO_write(cstate->rbio, rawBuf(c->payload), len);
+            // printSSLState(cstate->ssl);
+            n = SSL_connect(cstate->ssl);
+            // printSSLState(cstate->ssl);
+            status = getSslStatus(cstate->ssl, n);
 
-            if (n <= 0)
+            if (status == kSslstatusFail)
             {
-                /* if BIO write fails, assume unrecoverable */
-                reuseContextBuffer(c);
+                SSL_get_verify_result(cstate->ssl);
+                printSSLError();
                 goto failed;
             }
-            shiftr(c->payload, n);
-            len -= n;
 
-            if (! cstate->handshake_completed)
+            /* Did SSL request to write bytes? */
+            shift_buffer_t *buf;
+            while ((buf = bufferBioPop(cstate->bio)) != NULL)
             {
-                // printSSLState(cstate->ssl);
-                n = SSL_connect(cstate->ssl);
-                // printSSLState(cstate->ssl);
-                status = getSslStatus(cstate->ssl, n);
-
-                /* Did SSL request to write bytes? */
-                if (status == kSslstatusWantIo)
-                {
-                    do
-                    {
-                        shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                        int             avail = (int) rCap(buf);
-                        n                     = BIO_read(cstate->wbio, rawBufMut(buf), avail);
-
-                        if (n > 0)
-                        {
-                            setLen(buf, n);
-                            context_t *req_cont = newContextFrom(c);
-                            req_cont->payload   = buf;
-                            self->up->upStream(self->up, req_cont);
-                            if (! isAlive(c->line))
-                            {
-                                reuseContextBuffer(c);
-                                destroyContext(c);
-                                return;
-                            }
-                        }
-                        else if (! BIO_should_retry(cstate->rbio))
-                        {
-                            // If BIO_should_retry() is false then the cause is an error condition.
-                            reuseContextBuffer(c);
-                            reuseBuffer(getContextBufferPool(c), buf);
-                            goto failed;
-                        }
-                        else
-                        {
-                            reuseBuffer(getContextBufferPool(c), buf);
-                        }
-                    } while (n > 0);
-                }
-                if (status == kSslstatusFail)
+                context_t *req_cont = newContextFrom(c);
+                req_cont->payload   = buf;
+                self->up->upStream(self->up, req_cont);
+                if (! isAlive(c->line))
                 {
-                    SSL_get_verify_result(cstate->ssl);
-                    printSSLError();
-                    reuseContextBuffer(c);
-                    goto failed;
+                    destroyContext(c);
+                    return;
                 }
+            }
 
-                /* Did SSL request to write bytes? */
-                shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                int             avail = (int) rCap(buf);
-                n                     = BIO_read(cstate->wbio, rawBufMut(buf), avail);
-                if (n > 0)
-                {
-                    setLen(buf, n);
-                    context_t *data_ctx = newContext(c->line);
-                    data_ctx->payload   = buf;
-                    self->up->upStream(self->up, data_ctx);
-                }
-                else
+            if (! SSL_is_init_finished(cstate->ssl))
+            {
+                //     destroyContext(c);
+                //     return;
+            }
+            else
+            {
+                LOGD("WolfClient: Tls handshake complete%s", SSL_session_reused(cstate->ssl) ? " (resumed)" : "");
+                cstate->handshake_completed = true;
+                context_t *dw_est_ctx       = newContextFrom(c);
+                dw_est_ctx->est             = true;
+                self->dw->downStream(self->dw, dw_est_ctx);
+                if (! isAlive(c->line))
                 {
-                    reuseBuffer(getContextBufferPool(c), buf);
+                    LOGW("WolfsslClient: prev node instantly closed the est with fin");
+                    destroyContext(c);
+                    return;
                 }
+                flushWriteQueue(self, c);
+                // queue is flushed and we are done
+            }
 
-                if (! SSL_is_init_finished(cstate->ssl))
-                {
-                    //     reuseContextBuffer(c);
-                    //     destroyContext(c);
-                    //     return;
-                }
-                else
-                {
-                    LOGD("WolfClient: Tls handshake complete");
-                    cstate->handshake_completed = true;
-                    context_t *dw_est_ctx       = newContextFrom(c);
-                    dw_est_ctx->est             = true;
-                    self->dw->downStream(self->dw, dw_est_ctx);
-                    if (! isAlive(c->line))
-                    {
-                        LOGW("WolfsslClient: prev node instantly closed the est with fin");
-                        reuseContextBuffer(c);
-                        destroyContext(c);
-                        return;
-                    }
-                    flushWriteQueue(self, c);
-                    // queue is flushed and we are done
-                }
+            destroyContext(c);
+            return;
+        }
 
-                reuseContextBuffer(c);
-                destroyContext(c);
-                return;
-            }
+        /* The encrypted data is now in the input bio so now we can perform actual
+         * read of unencrypted data. */
 
-            /* The encrypted data is now in the input bio so now we can perform actual
-             * read of unencrypted data. */
+        do
+        {
+            shift_buffer_t *buf = popBuffer(getContextBufferPool(c));
+            shiftl(buf, 8192 / 2);
+            setLen(buf, 0);
+            int avail = (int) rCap(buf);
+            n         = SSL_read(cstate->ssl, rawBufMut(buf), avail);
 
-            do
+            if (n > 0)
             {
-                shift_buffer_t *buf = popBuffer(getContextBufferPool(c));
-                shiftl(buf, 8192 / 2);
-                setLen(buf, 0);
-                int avail = (int) rCap(buf);
-                n         = SSL_read(cstate->ssl, rawBufMut(buf), avail);
-
-                if (n > 0)
+                setLen(buf, n);
+                context_t *data_ctx = newContextFrom(c);
+                data_ctx->payload   = buf;
+                self->dw->downStream(self->dw, data_ctx);
+                if (! isAlive(c->line))
                 {
-                    setLen(buf, n);
-                    context_t *data_ctx = newContextFrom(c);
-                    data_ctx->payload   = buf;
-                    self->dw->downStream(self->dw, data_ctx);
-                    if (! isAlive(c->line))
-                    {
-                        reuseContextBuffer(c);
-                        destroyContext(c);
-                        return;
-                    }
-                }
-                else
-                {
-                    reuseBuffer(getContextBufferPool(c), buf);
+                    destroyContext(c);
+                    return;
                 }
+            }
+            else
+            {
+                reuseBuffer(getContextBufferPool(c), buf);
+            }
 
-            } while (n > 0);
+        } while (n > 0);
 
-            status = getSslStatus(cstate->ssl, n);
+        status = getSslStatus(cstate->ssl, n);
 
-            if (status == kSslstatusFail)
-            {
-                reuseContextBuffer(c);
-                goto failed;
-            }
+        if (status == kSslstatusFail)
+        {
+            goto failed;
         }
         // done with socket data
-        reuseContextBuffer(c);
         destroyContext(c);
     }
     else
@@ -443,10 +372,13 @@ tunnel_t *newWolfSSLClient(node_instance_context_t *instance_info)
 
     getStringFromJsonObjectOrDefault(&(state->alpn), settings, "alpn", "http/1.1");
 
+    getBoolFromJsonObjectOrDefault(&(state->session_resumption), settings, "session-resumption", true);
+
     ssl_param->verify_peer = state->verify ? 1 : 0;
     ssl_param->endpoint    = kSslClient;
     // ssl_param->ca_path = "cacert.pem";
     state->ssl_context = sslCtxNew(ssl_param);
+    bufferBioGlobalInit();
     free(ssl_param);
     // SSL_CTX_load_verify_store(state->ssl_context,cacert_bytes);
 
@@ -456,6 +388,11 @@ tunnel_t *newWolfSSLClient(node_instance_context_t *instance_info)
         return NULL;
     }
 
+    if (state->session_resumption)
+    {
+        sslSessionCacheInit(state->ssl_context);
+    }
+
     size_t alpn_len = strlen(state->alpn);
     struct
     {
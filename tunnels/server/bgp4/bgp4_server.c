@@ -60,73 +60,73 @@ static void upStream(tunnel_t *self, context_t *c)
 
             if (bufferStreamLen(cstate->read_stream) >= ((unsigned int) kBgpHeaderLen + required_length))
             {
-                shift_buffer_t *buf = bufferStreamRead(cstate->read_stream, kBgpHeaderLen + required_length);
-
                 static const uint8_t kExpecetd[kMarkerLength] = {VAL_8X, VAL_8X};
 
-                if (0 != memcmp(rawBuf(buf), kExpecetd, kMarkerLength))
+                // the headers are checked in place, only the payload is read out of the stream
+                const size_t frame_len = (size_t) kBgpHeaderLen + required_length;
+                uint8_t      header[kBgpHeaderLen + kBgpOpenPacketHeaderSize + 1];
+                bufferStreamViewBytesAt(cstate->read_stream, 0, header,
+                                        frame_len < sizeof(header) ? frame_len : sizeof(header));
+
+                if (0 != memcmp(header, kExpecetd, kMarkerLength))
                 {
                     LOGE("Bgp4Server: invalid marker");
-                    reuseBuffer(getContextBufferPool(c), buf);
                     goto disconnect;
                 }
-                shiftr(buf, kBgpHeaderLen);
+
+                size_t skip = kBgpHeaderLen + 1; // pass type
 
                 if (! cstate->open_received)
                 {
-                    if (bufLen(buf) < kBgpOpenPacketHeaderSize + 1) // +1 for type
+                    if (required_length < kBgpOpenPacketHeaderSize + 1) // +1 for type
                     {
                         LOGE("Bgp4Server: open packet length is shorter than bgp header");
-                        reuseBuffer(getContextBufferPool(c), buf);
                         goto disconnect;
                     }
 
-                    uint8_t bgp_type;
-                    readUI8(buf, &bgp_type);
-                    if (bgp_type == 1)
-                    {
-                        cstate->open_received = true;
-                    }
-                    else
+                    if (header[kBgpHeaderLen] != kBgpTypeOpen)
                     {
                         LOGE("Bgp4Server: first message type was not bgp_open");
-                        reuseBuffer(getContextBufferPool(c), buf);
                         goto disconnect;
                     }
+                    cstate->open_received = true;
 
-                    shiftr(buf, kBgpOpenPacketHeaderSize); // now at index addition
-
-                    uint8_t bgp_additions;
-                    readUI8(buf, &bgp_additions);
-
-                    if (bgp_additions > 0 && bufLen(buf) - 1 < bgp_additions)
+                    const uint8_t bgp_additions = header[kBgpHeaderLen + kBgpOpenPacketHeaderSize];
+                    if (bgp_additions > 0 && required_length - kBgpOpenPacketHeaderSize - 1 < bgp_additions)
                     {
                         LOGE("Bgp4Server: open message had extensions more than the length");
-                        reuseBuffer(getContextBufferPool(c), buf);
                         goto disconnect;
                     }
-                    shiftr(buf, bgp_additions + 1); // pass addition count and items
-                }
-                else
-                {
-                    shiftr(buf, 1); // pass type
+                    // pass addition count and items
+                    skip = kBgpHeaderLen + kBgpOpenPacketHeaderSize + bgp_additions + 1;
                 }
 
-                if (bufLen(buf) <= 0)
+                if (frame_len <= skip)
                 {
                     LOGE("Bgp4Server: message had no payload");
-                    reuseBuffer(getContextBufferPool(c), buf);
                     goto disconnect;
                 }
+                bufferStreamSkip(cstate->read_stream, skip);
 
-                context_t *data_ctx = newContext(c->line);
-                data_ctx->payload   = buf;
-                if (! cstate->first_sent)
+                // the payload goes on as the buffers it arrived in, only the last one is sliced
+                for (size_t remain = frame_len - skip; remain > 0;)
                 {
-                    cstate->first_sent = true;
-                    c->first           = true;
+                    context_t *data_ctx = newContext(c->line);
+                    data_ctx->payload   = bufferStreamReadChunk(cstate->read_stream, remain);
+                    remain -= bufLen(data_ctx->payload);
+                    if (! cstate->first_sent)
+                    {
+                        cstate->first_sent = true;
+                        data_ctx->first    = true;
+                    }
+                    self->up->upStream(self->up, data_ctx);
+
+                    if (! isAlive(c->line))
+                    {
+                        destroyContext(c);
+                        return;
+                    }
                 }
-                self->up->upStream(self->up, data_ctx);
             }
             else
             {
@@ -92,29 +92,36 @@ static int onDataChunkRecvCallback(nghttp2_session *session, uint8_t flags, int3
         {
             if (stream->bytes_needed == 0 && bufferStreamLen(stream->chunkbs) >= GRPC_MESSAGE_HDLEN)
             {
-                shift_buffer_t *gheader_buf = bufferStreamRead(stream->chunkbs, GRPC_MESSAGE_HDLEN);
+                uint8_t         gheader[GRPC_MESSAGE_HDLEN];
                 grpc_message_hd msghd;
-                grpcMessageHdUnpack(&msghd, rawBuf(gheader_buf));
+                bufferStreamViewBytesAt(stream->chunkbs, 0, gheader, GRPC_MESSAGE_HDLEN);
+                bufferStreamSkip(stream->chunkbs, GRPC_MESSAGE_HDLEN);
+                grpcMessageHdUnpack(&msghd, gheader);
                 stream->bytes_needed = msghd.length;
-                reuseBuffer(getLineBufferPool(con->line), gheader_buf);
             }
             if (stream->bytes_needed > 0 && bufferStreamLen(stream->chunkbs) >= stream->bytes_needed)
             {
-                shift_buffer_t *gdata_buf = bufferStreamRead(stream->chunkbs, stream->bytes_needed);
-                stream->bytes_needed      = 0;
-                context_t *stream_data    = newContext(stream->line);
-                stream_data->payload      = gdata_buf;
-                if (! stream->first_sent)
+                // the message goes on as the buffers it arrived in, only the last one is sliced
+                size_t remain        = stream->bytes_needed;
+                stream->bytes_needed = 0;
+                while (remain > 0)
                 {
-                    stream->first_sent = true;
-                    stream_data->first = true;
-                }
-                stream->tunnel->up->upStream(stream->tunnel->up, stream_data);
+                    context_t *stream_data = newContext(stream->line);
+                    stream_data->payload   = bufferStreamReadChunk(stream->chunkbs, remain);
+                    remain -= bufLen(stream_data->payload);
+                    if (! stream->first_sent)
+                    {
+                        stream->first_sent = true;
+                        stream_data->first = true;
+                    }
+                    stream->tunnel->up->upStream(stream->tunnel->up, stream_data);
 
-                if (nghttp2_session_get_stream_user_data(session, stream_id))
-                {
-                    continue;
+                    if (! nghttp2_session_get_stream_user_data(session, stream_id))
+                    {
+                        return 0;
+                    }
                 }
+                continue;
             }
             break;
         }
@@ -4,7 +4,11 @@
 #include "frand.h"
 #include "loggers/network_logger.h"
 #include "managers/node_manager.h"
+#include "openssl_buffer_bio.h"
 #include "openssl_globals.h"
+#include "openssl_handshake_pool.h"
+#include "openssl_ktls.h"
+#include "openssl_session.h"
 #include "utils/jsonutils.h"
 #include "utils/mathutils.h"
 #include <openssl/bio.h>
@@ -21,13 +25,19 @@ typedef struct
 
 typedef struct oss_server_state_s
 {
-    ssl_ctx_t    ssl_context;
-    alpn_item_t *alpns;
-    unsigned int alpns_length;
+    ssl_ctx_t          ssl_context;
+    alpn_item_t       *alpns;
+    unsigned int       alpns_length;
+    ssl_ticket_keys_t *ticket_keys;
 
     // settings
     tunnel_t *fallback;
     bool      anti_tit; // solve tls in tls using paddings
+    bool      session_resumption;
+    bool      ktls;            // kernel tls when the tunnel below is a tcp socket
+    bool      async_handshake; // handshake steps run on the crypto threads, not on the loop of the line
+    int       ticket_key_rotation; // seconds
+    int       handshake_threads;
 
 } oss_server_state_t;
 
@@ -41,10 +51,15 @@ typedef struct oss_server_con_state_s
     bool             first_sent;
     bool             init_sent;
     bool             fallback_disabled;
+    bool             ktls_tx; // the kernel encrypts what we send down, plaintext goes to the socket
+    bool             ktls_rx; // the kernel decrypts, the socket gives plaintext
+    bool             closed;  // cleaned up while a handshake step was running, freed when the step is back
     buffer_stream_t *fallback_buf;
     SSL             *ssl;
-    BIO             *rbio;
-    BIO             *wbio;
+    BIO             *bio;  // buffer bio, both sides (after the handshake if it runs on the crypto threads)
+    ssl_ktls_t      *ktls; // until both sides are in the kernel
+
+    ssl_handshake_job_t *handshake; // until the handshake is done, if it runs on the crypto threads
 
     int reply_sent_tit;
 
@@ -83,9 +98,9 @@ enum sslstatus
     kSslstatusFail
 };
 
-static enum sslstatus getSslstatus(SSL *ssl, int n)
+static enum sslstatus sslstatusOf(int error)
 {
-    switch (SSL_get_error(ssl, n))
+    switch (error)
     {
     case SSL_ERROR_NONE:
         return kSslstatusOk;
@@ -99,6 +114,11 @@ static enum sslstatus getSslstatus(SSL *ssl, int n)
     }
 }
 
+static enum sslstatus getSslstatus(SSL *ssl, int n)
+{
+    return sslstatusOf(SSL_get_error(ssl, n));
+}
+
 static size_t paddingDecisionCb(SSL *ssl, int type, size_t len, void *arg)
 {
     (void) ssl;
@@ -132,16 +152,86 @@ static size_t paddingDecisionCb(SSL *ssl, int type, size_t len, void *arg)
     return 0;
 }
 
+static void freeConState(oss_server_con_state_t *cstate)
+{
+    destroyBufferStream(cstate->fallback_buf);
+    if (cstate->handshake != NULL)
+    {
+        destroySslHandshakeJob(cstate->handshake);
+    }
+    if (cstate->ktls != NULL)
+    {
+        destroySslKtls(cstate->ssl, cstate->ktls);
+    }
+    SSL_free(cstate->ssl); /* free the SSL object and its BIO */
+    free(cstate);
+}
+
 static void cleanup(tunnel_t *self, context_t *c)
 {
     oss_server_con_state_t *cstate = CSTATE(c);
     assert(cstate != NULL);
-    destroyBufferStream(cstate->fallback_buf);
-    SSL_free(cstate->ssl); /* free the SSL object and its BIO's */
-    free(cstate);
+    if (cstate->handshake != NULL && cstate->handshake->running)
+    {
+        // a crypto thread has the ssl
+        cstate->closed = true;
+    }
+    else
+    {
+        freeConState(cstate);
+    }
     CSTATE_DROP(c);
 }
 
+// moves the sides openssl has nothing pending on to the kernel, a side that can not be moved stays in userspace
+static void tryKtls(tunnel_t *self, context_t *c)
+{
+    oss_server_con_state_t *cstate = CSTATE(c);
+    if (cstate->ktls == NULL)
+    {
+        return;
+    }
+    hio_t *io = NULL;
+    if (self->dw != NULL && self->dw->getTcpIo != NULL)
+    {
+        io = self->dw->getTcpIo(self->dw, c->line);
+    }
+    if (io == NULL)
+    {
+        goto give_up;
+    }
+    // what is queued on the socket was encrypted by openssl already
+    if (! cstate->ktls_tx && hio_write_is_complete(io) && sslKtlsReady(cstate->ssl, cstate->ktls, cstate->bio, true))
+    {
+        if (! sslKtlsInstall(cstate->ssl, cstate->ktls, hio_fd(io), true))
+        {
+            goto give_up;
+        }
+        cstate->ktls_tx = true;
+    }
+    if (! cstate->ktls_rx && sslKtlsReady(cstate->ssl, cstate->ktls, cstate->bio, false))
+    {
+        if (! sslKtlsInstall(cstate->ssl, cstate->ktls, hio_fd(io), false))
+        {
+            goto give_up;
+        }
+        cstate->ktls_rx = true;
+    }
+    if (cstate->ktls_tx && cstate->ktls_rx)
+    {
+        LOGD("OpensslServer: kernel tls FD:%x", hio_fd(io));
+        destroySslKtls(cstate->ssl, cstate->ktls);
+        cstate->ktls = NULL;
+    }
+    return;
+
+give_up:;
+    LOGD("OpensslServer: no kernel tls for the line (tx: %d rx: %d), the rest stays in userspace", cstate->ktls_tx,
+         cstate->ktls_rx);
+    destroySslKtls(cstate->ssl, cstate->ktls);
+    cstate->ktls = NULL;
+}
+
 static void fallbackWrite(tunnel_t *self, context_t *c)
 {
     if (! isAlive(c->line))
@@ -182,211 +272,278 @@ static void fallbackWrite(tunnel_t *self, context_t *c)
     state->fallback->upStream(state->fallback, c);
 }
 
-static void upStream(tunnel_t *self, context_t *c)
+static void closeLine(tunnel_t *self, context_t *c)
+{
+    oss_server_con_state_t *cstate = CSTATE(c);
+    if (cstate->init_sent)
+    {
+        self->up->upStream(self->up, newFinContextFrom(c));
+    }
+
+    context_t *fail_context = newFinContextFrom(c);
+    cleanup(self, c);
+    destroyContext(c);
+    self->dw->downStream(self->dw, fail_context);
+}
+
+static shift_buffer_t *popHandshakeRecord(oss_server_con_state_t *cstate)
+{
+    return cstate->handshake != NULL ? sslHandshakeJobPop(cstate->handshake) : bufferBioPop(cstate->bio);
+}
+
+// sends what a handshake step wrote, returns true if the handshake is done and the records after it can be read,
+// otherwise c is consumed
+static bool afterHandshakeStep(tunnel_t *self, context_t *c, enum sslstatus status)
 {
     oss_server_state_t     *state  = STATE(self);
     oss_server_con_state_t *cstate = CSTATE(c);
 
-    if (c->payload != NULL)
+    /* Did SSL request to write bytes? (the last step writes the session tickets) */
+    if (status != kSslstatusFail)
     {
+        shift_buffer_t *buf;
+        while ((buf = popHandshakeRecord(cstate)) != NULL)
+        {
+            // since then, we should not go to fallback
+            cstate->fallback_disabled = true;
 
-        if (state->fallback != NULL && ! cstate->handshake_completed)
+            context_t *answer = newContextFrom(c);
+            answer->payload   = buf;
+            self->dw->downStream(self->dw, answer);
+
+            if (! isAlive(c->line))
+            {
+                destroyContext(c);
+                return false;
+            }
+        }
+    }
+
+    if (status == kSslstatusFail)
+    {
+        if (cstate->handshake != NULL)
         {
-            bufferStreamPush(cstate->fallback_buf, newShallowShiftBuffer(c->payload));
+            printSslHandshakeJobError(cstate->handshake);
         }
-        if (cstate->fallback_mode)
+        else
         {
-            reuseContextBuffer(c);
+            printSSLError();
+        }
+        if (state->fallback != NULL && ! cstate->fallback_disabled)
+        {
+            cstate->fallback_mode = true;
             fallbackWrite(self, c);
-            return;
+            return false;
         }
-        enum sslstatus status;
-        int            n;
-        unsigned int   len = bufLen(c->payload);
 
-        while (len > 0 && isAlive(c->line))
-        {
-            n = BIO_write(cstate->rbio, rawBuf(c->payload), (int) len);
+        closeLine(self, c);
+        return false;
+    }
 
-            if (n <= 0)
-            {
-                /* if BIO write fails, assume unrecoverable */
-                reuseContextBuffer(c);
-                goto disconnect;
-            }
-            shiftr(c->payload, n);
-            len -= n;
+    if (! SSL_is_init_finished(cstate->ssl))
+    {
+        if (cstate->handshake != NULL && sslHandshakeJobHasInput(cstate->handshake))
+        {
+            // records came while the step was running
+            sslHandshakeJobRun(cstate->handshake);
+        }
+        destroyContext(c);
+        return false;
+    }
 
-            if (! SSL_is_init_finished(cstate->ssl))
-            {
-                n      = SSL_accept(cstate->ssl);
-                status = getSslstatus(cstate->ssl, n);
+    if (cstate->handshake != NULL)
+    {
+        cstate->bio = newBufferBio(getContextBufferPool(c));
+        sslHandshakeJobFinish(cstate->handshake, cstate->bio);
+        cstate->handshake = NULL;
+    }
+    LOGD("OpensslServer: Tls handshake complete%s", SSL_session_reused(cstate->ssl) ? " (resumed)" : "");
+    cstate->handshake_completed = true;
+    empytBufferStream(cstate->fallback_buf);
+    return true;
+}
 
-                /* Did SSL request to write bytes? */
-                if (status == kSslstatusWantIo)
-                {
-                    do
-                    {
-                        shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                        unsigned int    avail = rCap(buf);
-                        n                     = BIO_read(cstate->wbio, rawBufMut(buf), (int) avail);
-                        // assert(-1 == BIO_read(cstate->wbio, rawBuf(buf), avail));
-                        if (n > 0)
-                        {
-                            // since then, we should not go to fallback
-                            cstate->fallback_disabled = true;
-
-                            setLen(buf, n);
-                            context_t *answer = newContextFrom(c);
-                            answer->payload   = buf;
-                            self->dw->downStream(self->dw, answer);
-
-                            if (! isAlive(c->line))
-                            {
-                                reuseContextBuffer(c);
-                                destroyContext(c);
-                                return;
-                            }
-                        }
-                        else if (! BIO_should_retry(cstate->wbio))
-                        {
-                            // If BIO_should_retry() is false then the cause is an error condition.
-                            reuseContextBuffer(c);
-                            reuseBuffer(getContextBufferPool(c), buf);
-                            goto disconnect;
-                        }
-                        else
-                        {
-                            reuseBuffer(getContextBufferPool(c), buf);
-                        }
-                    } while (n > 0);
-                }
+// the records are in the bio, reads the plaintext out of them and sends it up
+static void readRecords(tunnel_t *self, context_t *c)
+{
+    oss_server_con_state_t *cstate = CSTATE(c);
+    enum sslstatus          status;
+    int                     n;
 
-                if (status == kSslstatusFail)
-                {
-                    reuseContextBuffer(c); // payload already buffered
-                    printSSLError();
-                    if (state->fallback != NULL && ! cstate->fallback_disabled)
-                    {
-                        cstate->fallback_mode = true;
-                        fallbackWrite(self, c);
-                        return;
-                    }
+    /* The encrypted data is now in the input bio so now we can perform actual
+     * read of unencrypted data. */
 
-                    goto disconnect;
-                }
+    do
+    {
+        shift_buffer_t *buf = popBuffer(getContextBufferPool(c));
+        shiftl(buf, lCap(buf) / 2);
+        setLen(buf, 0);
+        unsigned int avail = rCap(buf);
+        n                  = SSL_read(cstate->ssl, rawBufMut(buf), (int) avail);
 
-                if (! SSL_is_init_finished(cstate->ssl))
+        if (n > 0)
+        {
+            if (WW_UNLIKELY(! cstate->init_sent))
+            {
+                self->up->upStream(self->up, newInitContext(c->line));
+                if (! isAlive(c->line))
                 {
-                    reuseContextBuffer(c);
+                    LOGW("OpensslServer: next node instantly closed the init with fin");
                     destroyContext(c);
+
                     return;
                 }
+                cstate->init_sent = true;
+            }
 
-                LOGD("OpensslServer: Tls handshake complete");
-                cstate->handshake_completed = true;
-                empytBufferStream(cstate->fallback_buf);
+            setLen(buf, n);
+            context_t *data_ctx = newContextFrom(c);
+            data_ctx->payload   = buf;
+            if (! (cstate->first_sent))
+            {
+                data_ctx->first    = true;
+                cstate->first_sent = true;
+            }
+            self->up->upStream(self->up, data_ctx);
+            if (! isAlive(c->line))
+            {
+                destroyContext(c);
+                return;
             }
+        }
+        else
+        {
+            reuseBuffer(getContextBufferPool(c), buf);
+        }
+
+    } while (n > 0);
 
-            /* The encrypted data is now in the input bio so now we can perform actual
-             * read of unencrypted data. */
+    status = getSslstatus(cstate->ssl, n);
 
-            do
+    /* Did SSL request to write bytes? This can happen if peer has requested SSL
+     * renegotiation. */
+    if (status == kSslstatusWantIo)
+    {
+        if (cstate->ktls_tx && BIO_wpending(cstate->bio) > 0)
+        {
+            // the answer would need the keys of openssl, but the kernel has the sending side now
+            LOGW("OpensslServer: the peer sent a post handshake message that needs an answer, kernel tls can "
+                 "not answer it");
+            closeLine(self, c);
+            return;
+        }
+        shift_buffer_t *buf;
+        while ((buf = bufferBioPop(cstate->bio)) != NULL)
+        {
+            context_t *answer = newContextFrom(c);
+            answer->payload   = buf;
+            self->dw->downStream(self->dw, answer);
+            if (! isAlive(c->line))
             {
-                shift_buffer_t *buf = popBuffer(getContextBufferPool(c));
-                shiftl(buf, lCap(buf) / 2);
-                setLen(buf, 0);
-                unsigned int avail = rCap(buf);
-                n                  = SSL_read(cstate->ssl, rawBufMut(buf), (int) avail);
+                destroyContext(c);
 
-                if (n > 0)
-                {
-                    if (WW_UNLIKELY(! cstate->init_sent))
-                    {
-                        self->up->upStream(self->up, newInitContext(c->line));
-                        if (! isAlive(c->line))
-                        {
-                            LOGW("OpensslServer: next node instantly closed the init with fin");
-                            reuseContextBuffer(c);
-                            destroyContext(c);
-
-                            return;
-                        }
-                        cstate->init_sent = true;
-                    }
+                return;
+            }
+        }
+    }
 
-                    setLen(buf, n);
-                    context_t *data_ctx = newContextFrom(c);
-                    data_ctx->payload   = buf;
-                    if (! (cstate->first_sent))
-                    {
-                        data_ctx->first    = true;
-                        cstate->first_sent = true;
-                    }
-                    self->up->upStream(self->up, data_ctx);
-                    if (! isAlive(c->line))
-                    {
-                        reuseContextBuffer(c);
-                        destroyContext(c);
-                        return;
-                    }
-                }
-                else
-                {
-                    reuseBuffer(getContextBufferPool(c), buf);
-                }
+    if (status == kSslstatusFail)
+    {
+        closeLine(self, c);
+        return;
+    }
+    if (cstate->ktls != NULL)
+    {
+        tryKtls(self, c);
+    }
+    // done with socket data
+    destroyContext(c);
+}
 
-            } while (n > 0);
+// a handshake step is back from the crypto thread
+static void onHandshakeStepBack(ssl_handshake_job_t *job)
+{
+    tunnel_t               *self   = job->tunnel;
+    oss_server_con_state_t *cstate = job->userdata;
+    if (cstate->closed)
+    {
+        freeConState(cstate);
+        return;
+    }
+    context_t *c = newContext(job->line);
+    if (! afterHandshakeStep(self, c, sslstatusOf(job->error)))
+    {
+        return;
+    }
+    readRecords(self, c);
+}
 
-            status = getSslstatus(cstate->ssl, n);
+static void upStream(tunnel_t *self, context_t *c)
+{
+    oss_server_state_t     *state  = STATE(self);
+    oss_server_con_state_t *cstate = CSTATE(c);
+
+    if (c->payload != NULL)
+    {
 
-            /* Did SSL request to write bytes? This can happen if peer has requested SSL
-             * renegotiation. */
-            if (status == kSslstatusWantIo)
+        if (state->fallback != NULL && ! cstate->handshake_completed)
+        {
+            bufferStreamPush(cstate->fallback_buf, newShallowShiftBuffer(c->payload));
+        }
+        if (cstate->fallback_mode)
+        {
+            reuseContextBuffer(c);
+            fallbackWrite(self, c);
+            return;
+        }
+        if (cstate->ktls_rx)
+        {
+            // the kernel decrypted it
+            if (WW_UNLIKELY(! cstate->init_sent))
             {
-                do
+                self->up->upStream(self->up, newInitContext(c->line));
+                if (! isAlive(c->line))
                 {
-                    shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                    unsigned int    avail = rCap(buf);
-
-                    n = BIO_read(cstate->wbio, rawBufMut(buf), (int) avail);
-                    if (n > 0)
-                    {
-                        setLen(buf, n);
-                        context_t *answer = newContextFrom(c);
-                        answer->payload   = buf;
-                        self->dw->downStream(self->dw, answer);
-                        if (! isAlive(c->line))
-                        {
-                            reuseContextBuffer(c);
-                            destroyContext(c);
-
-                            return;
-                        }
-                    }
-                    else if (! BIO_should_retry(cstate->wbio))
-                    {
-                        // If BIO_should_retry() is false then the cause is an error condition.
-                        reuseBuffer(getContextBufferPool(c), buf);
-                        reuseContextBuffer(c);
-                        goto disconnect;
-                    }
-                    else
-                    {
-                        reuseBuffer(getContextBufferPool(c), buf);
-                    }
-                } while (n > 0);
+                    reuseContextBuffer(c);
+                    destroyContext(c);
+                    return;
+                }
+                cstate->init_sent = true;
+            }
+            if (! cstate->first_sent)
+            {
+                c->first           = true;
+                cstate->first_sent = true;
+            }
+            self->up->upStream(self->up, c);
+            return;
+        }
+        if (cstate->handshake != NULL)
+        {
+            // the handshake runs on the crypto threads
+            sslHandshakeJobPush(cstate->handshake, c->payload);
+            CONTEXT_PAYLOAD_DROP(c);
+            if (! cstate->handshake->running)
+            {
+                sslHandshakeJobRun(cstate->handshake);
             }
+            destroyContext(c);
+            return;
+        }
 
-            if (status == kSslstatusFail)
+        // the bio reads the records straight out of the payload
+        bufferBioPush(cstate->bio, c->payload);
+        CONTEXT_PAYLOAD_DROP(c);
+
+        if (! SSL_is_init_finished(cstate->ssl))
+        {
+            int n = SSL_accept(cstate->ssl);
+            if (! afterHandshakeStep(self, c, getSslstatus(cstate->ssl, n)))
             {
-                reuseContextBuffer(c);
-                goto disconnect;
+                return;
             }
         }
-        // done with socket data
-        reuseContextBuffer(c);
-        destroyContext(c);
+        readRecords(self, c);
     }
     else
     {
@@ -396,12 +553,18 @@ static void upStream(tunnel_t *self, context_t *c)
             CSTATE_MUT(c) = malloc(sizeof(oss_server_con_state_t));
             memset(CSTATE(c), 0, sizeof(oss_server_con_state_t));
             oss_server_con_state_t *cstate = CSTATE(c);
-            cstate->rbio                   = BIO_new(BIO_s_mem());
-            cstate->wbio                   = BIO_new(BIO_s_mem());
             cstate->ssl                    = SSL_new(state->ssl_context);
             cstate->fallback_buf           = newBufferStream(getContextBufferPool(c));
             SSL_set_accept_state(cstate->ssl); /* sets ssl to work in server mode. */
-            SSL_set_bio(cstate->ssl, cstate->rbio, cstate->wbio);
+            if (state->async_handshake)
+            {
+                cstate->handshake = newSslHandshakeJob(cstate->ssl, c->line, self, onHandshakeStepBack, cstate);
+            }
+            else
+            {
+                cstate->bio = newBufferBio(getContextBufferPool(c));
+                SSL_set_bio(cstate->ssl, cstate->bio, cstate->bio);
+            }
             if (state->anti_tit)
             {
                 if (1 != SSL_set_record_padding_callback(cstate->ssl, paddingDecisionCb))
@@ -410,6 +573,10 @@ static void upStream(tunnel_t *self, context_t *c)
                 }
                 SSL_set_record_padding_callback_arg(cstate->ssl, cstate);
             }
+            if (state->ktls)
+            {
+                cstate->ktls = newSslKtls(cstate->ssl);
+            }
             destroyContext(c);
         }
         else if (c->fin)
@@ -441,18 +608,6 @@ static void upStream(tunnel_t *self, context_t *c)
         }
     }
 
-    return;
-
-disconnect:;
-    if (cstate->init_sent)
-    {
-        self->up->upStream(self->up, newFinContextFrom(c));
-    }
-
-    context_t *fail_context = newFinContextFrom(c);
-    cleanup(self, c);
-    destroyContext(c);
-    self->dw->downStream(self->dw, fail_context);
 }
 
 static void downStream(tunnel_t *self, context_t *c)
@@ -484,6 +639,16 @@ static void downStream(tunnel_t *self, context_t *c)
             LOGF("How it is possible to receive data before sending init to upstream?");
             exit(1);
         }
+        if (cstate->ktls != NULL)
+        {
+            tryKtls(self, c);
+        }
+        if (cstate->ktls_tx)
+        {
+            // the kernel encrypts it
+            self->dw->downStream(self->dw, c);
+            return;
+        }
         int len = (int) bufLen(c->payload);
         while (len > 0 && isAlive(c->line))
         {
@@ -505,38 +670,21 @@ static void downStream(tunnel_t *self, context_t *c)
                 /* consume the waiting bytes that have been used by SSL */
                 shiftr(c->payload, n);
                 len -= n;
-                /* take the output of the SSL object and queue it for socket write */
-                do
+                /* take the records the SSL object wrote and queue them for socket write */
+                shift_buffer_t *buf;
+                while ((buf = bufferBioPop(cstate->bio)) != NULL)
                 {
-                    shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                    unsigned int    avail = rCap(buf);
-                    n                     = BIO_read(cstate->wbio, rawBufMut(buf), (int) avail);
-                    if (n > 0)
-                    {
-                        setLen(buf, n);
-                        context_t *dw_context = newContextFrom(c);
-                        dw_context->payload   = buf;
-                        self->dw->downStream(self->dw, dw_context);
-                        if (! isAlive(c->line))
-                        {
-                            reuseContextBuffer(c);
-                            destroyContext(c);
-
-                            return;
-                        }
-                    }
-                    else if (! BIO_should_retry(cstate->wbio))
+                    context_t *dw_context = newContextFrom(c);
+                    dw_context->payload   = buf;
+                    self->dw->downStream(self->dw, dw_context);
+                    if (! isAlive(c->line))
                     {
-                        // If BIO_should_retry() is false then the cause is an error condition.
-                        reuseBuffer(getContextBufferPool(c), buf);
                         reuseContextBuffer(c);
-                        goto disconnect;
-                    }
-                    else
-                    {
-                        reuseBuffer(getContextBufferPool(c), buf);
+                        destroyContext(c);
+
+                        return;
                     }
-                } while (n > 0);
+                }
             }
 
             if (status == kSslstatusFail)
@@ -670,10 +818,32 @@ tunnel_t *newOpenSSLServer(node_instance_context_t *instance_info)
     }
     free(fallback_node);
     getBoolFromJsonObjectOrDefault(&(state->anti_tit), settings, "anti-tls-in-tls", false);
+    getBoolFromJsonObjectOrDefault(&(state->session_resumption), settings, "session-resumption", true);
+    getBoolFromJsonObjectOrDefault(&(state->ktls), settings, "ktls", false);
+    if (state->ktls && state->anti_tit)
+    {
+        LOGW("OpensslServer: kernel tls can not pad the records, ktls is off since anti-tls-in-tls is on");
+        state->ktls = false;
+    }
+    getIntFromJsonObjectOrDefault(&(state->ticket_key_rotation), settings, "ticket-key-rotation", 3600);
+    if (state->ticket_key_rotation <= 0)
+    {
+        LOGF("JSON Error: OpensslServer->settings->ticket-key-rotation (int field) : must be a positive number of "
+             "seconds");
+        return NULL;
+    }
+    getBoolFromJsonObjectOrDefault(&(state->async_handshake), settings, "async-handshake", false);
+    getIntFromJsonObjectOrDefault(&(state->handshake_threads), settings, "handshake-threads", 2);
+    if (state->async_handshake && state->handshake_threads <= 0)
+    {
+        LOGF("JSON Error: OpensslServer->settings->handshake-threads (int field) : must be a positive number");
+        return NULL;
+    }
 
     ssl_param->verify_peer = 0; // no mtls
     ssl_param->endpoint    = kSslServer;
     state->ssl_context     = sslCtxNew(ssl_param);
+    bufferBioGlobalInit();
     // int brotli_alg = TLSEXT_comp_cert_brotli;
     // SSL_set1_cert_comp_preference(state->ssl_context,&brotli_alg,1);
     // SSL_compress_certs(state->ssl_context,TLSEXT_comp_cert_brotli);
@@ -690,6 +860,28 @@ tunnel_t *newOpenSSLServer(node_instance_context_t *instance_info)
 
     SSL_CTX_set_alpn_select_cb(state->ssl_context, onAlpnSelect, state);
 
+    if (state->session_resumption)
+    {
+        state->ticket_keys = newSslTicketKeys(state->ssl_context, (unsigned int) state->ticket_key_rotation);
+    }
+    else
+    {
+        SSL_CTX_set_options(state->ssl_context, SSL_OP_NO_TICKET);
+        SSL_CTX_set_session_cache_mode(state->ssl_context, SSL_SESS_CACHE_OFF);
+        SSL_CTX_set_num_tickets(state->ssl_context, 0);
+    }
+
+    if (state->ktls)
+    {
+        sslKtlsGlobalInit();
+        sslKtlsCtxInit(state->ssl_context);
+    }
+
+    if (state->async_handshake)
+    {
+        sslHandshakePoolInit((unsigned int) state->handshake_threads);
+    }
+
     tunnel_t *t = newTunnel();
     t->state    = state;
     if (state->fallback != NULL)
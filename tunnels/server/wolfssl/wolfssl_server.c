@@ -4,7 +4,9 @@
 #include "loggers/network_logger.h"
 #include "managers/node_manager.h"
 #include "utils/jsonutils.h"
+#include "wolfssl_buffer_bio.h"
 #include "wolfssl_globals.h"
+#include "wolfssl_session.h"
 
 #include <wolfssl/openssl/bio.h>
 #include <wolfssl/openssl/err.h>
@@ -22,12 +24,15 @@ typedef struct
 typedef struct wssl_server_state_s
 {
 
-    ssl_ctx_t    ssl_context;
-    alpn_item_t *alpns;
-    unsigned int alpns_length;
+    ssl_ctx_t          ssl_context;
+    alpn_item_t       *alpns;
+    unsigned int       alpns_length;
+    ssl_ticket_keys_t *ticket_keys;
     // settings
     tunnel_t *fallback;
     bool      anti_tit; // solve tls in tls using paddings
+    bool      session_resumption;
+    int       ticket_key_rotation; // seconds
 } wssl_server_state_t;
 
 typedef struct wssl_server_con_state_s
@@ -42,8 +47,7 @@ typedef struct wssl_server_con_state_s
     bool             fallback_disabled;
     buffer_stream_t *fallback_buf;
     SSL             *ssl;
-    BIO             *rbio;
-    BIO             *wbio;
+    BIO             *bio; // buffer bio, both sides
 
 } wssl_server_con_state_t;
 
@@ -111,7 +115,7 @@ static void cleanup(tunnel_t *self, context_t *c)
     wssl_server_con_state_t *cstate = CSTATE(c);
     assert(cstate != NULL);
     destroyBufferStream(cstate->fallback_buf);
-    SSL_free(cstate->ssl); /* free the SSL object and its BIO's */
+    SSL_free(cstate->ssl); /* free the SSL object and its BIO */
     free(cstate);
     CSTATE_DROP(c);
 }
@@ -176,200 +180,144 @@ static void upStream(tunnel_t *self, context_t *c)
         }
         enum sslstatus status;
         int            n;
-        int            len = (int) bufLen(c->payload);
 
-        while (len > 0 && isAlive(c->line))
-        {
-            n = BIO_write(cstate->rbio, rawBuf(c->payload), len);
+        // the bio reads the records straight out of the payload
+        bufferBioPush(cstate->bio, c->payload);
+        CONTEXT_PAYLOAD_DROP(c);
 
-            if (n <= 0)
-            {
-                /* if BIO write fails, assume unrecoverable */
-                reuseContextBuffer(c);
-                goto disconnect;
-            }
-            shiftr(c->payload, n);
-            len -= n;
+        if (! SSL_is_init_finished(cstate->ssl))
+        {
+            n      = SSL_accept(cstate->ssl);
+            status = getSslstatus(cstate->ssl, n);
 
-            if (! SSL_is_init_finished(cstate->ssl))
+            /* Did SSL request to write bytes? */
+            if (status == kSslstatusWantIo)
             {
-                n      = SSL_accept(cstate->ssl);
-                status = getSslstatus(cstate->ssl, n);
-
-                /* Did SSL request to write bytes? */
-                if (status == kSslstatusWantIo)
+                shift_buffer_t *buf;
+                while ((buf = bufferBioPop(cstate->bio)) != NULL)
                 {
-                    do
-                    {
-                        shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                        int             avail = (int) rCap(buf);
-                        n                     = BIO_read(cstate->wbio, rawBufMut(buf), avail);
-                        // assert(-1 == BIO_read(cstate->wbio, rawBuf(buf), avail));
-                        if (n > 0)
-                        {
-                            // since then, we should not go to fallback
-                            cstate->fallback_disabled = true;
-
-                            setLen(buf, n);
-                            context_t *answer = newContextFrom(c);
-                            answer->payload   = buf;
-                            self->dw->downStream(self->dw, answer);
-
-                            if (! isAlive(c->line))
-                            {
-                                reuseContextBuffer(c);
-                                destroyContext(c);
-                                return;
-                            }
-                        }
-                        else if (! BIO_should_retry(cstate->wbio))
-                        {
-                            // If BIO_should_retry() is false then the cause is an error condition.
-                            reuseContextBuffer(c);
-                            reuseBuffer(getContextBufferPool(c), buf);
-                            goto disconnect;
-                        }
-                        else
-                        {
-                            reuseBuffer(getContextBufferPool(c), buf);
-                        }
-                    } while (n > 0);
-                }
+                    // since then, we should not go to fallback
+                    cstate->fallback_disabled = true;
 
-                if (status == kSslstatusFail)
-                {
-                    reuseContextBuffer(c); // payload already buffered
-                    printSSLError();
-                    if (state->fallback != NULL && ! cstate->fallback_disabled)
+                    context_t *answer = newContextFrom(c);
+                    answer->payload   = buf;
+                    self->dw->downStream(self->dw, answer);
+
+                    if (! isAlive(c->line))
                     {
-                        cstate->fallback_mode = true;
-                        fallbackWrite(self, c);
+                        destroyContext(c);
                         return;
                     }
-
-                    goto disconnect;
                 }
+            }
 
-                if (! SSL_is_init_finished(cstate->ssl))
+            if (status == kSslstatusFail)
+            {
+                printSSLError();
+                if (state->fallback != NULL && ! cstate->fallback_disabled)
                 {
-                    reuseContextBuffer(c);
-                    destroyContext(c);
+                    cstate->fallback_mode = true;
+                    fallbackWrite(self, c);
                     return;
                 }
 
-                LOGD("WolfsslServer: Tls handshake complete");
-                cstate->handshake_completed = true;
+                goto disconnect;
             }
 
-            /* The encrypted data is now in the input bio so now we can perform actual
-             * read of unencrypted data. */
-
-            do
+            if (! SSL_is_init_finished(cstate->ssl))
             {
-                shift_buffer_t *buf = popBuffer(getContextBufferPool(c));
-                shiftl(buf, 8192 / 2);
-                setLen(buf, 0);
-                int avail = (int) rCap(buf);
-                n         = SSL_read(cstate->ssl, rawBufMut(buf), avail);
+                destroyContext(c);
+                return;
+            }
 
-                if (n > 0)
-                {
-                    if (WW_UNLIKELY(! cstate->init_sent))
-                    {
-                        self->up->upStream(self->up, newInitContext(c->line));
-                        if (! isAlive(c->line))
-                        {
-                            LOGW("WolfsslServer: next node instantly closed the init with fin");
-                            reuseContextBuffer(c);
-                            destroyContext(c);
-
-                            return;
-                        }
-                        cstate->init_sent = true;
-                    }
+            LOGD("WolfsslServer: Tls handshake complete%s", SSL_session_reused(cstate->ssl) ? " (resumed)" : "");
+            cstate->handshake_completed = true;
+        }
+
+        /* The encrypted data is now in the input bio so now we can perform actual
+         * read of unencrypted data. */
 
+        do
+        {
+            shift_buffer_t *buf = popBuffer(getContextBufferPool(c));
+            shiftl(buf, 8192 / 2);
+            setLen(buf, 0);
+            int avail = (int) rCap(buf);
+            n         = SSL_read(cstate->ssl, rawBufMut(buf), avail);
+
+            if (n > 0)
+            {
+                if (WW_UNLIKELY(! cstate->init_sent))
+                {
                     self->up->upStream(self->up, newInitContext(c->line));
                     if (! isAlive(c->line))
                     {
                         LOGW("WolfsslServer: next node instantly closed the init with fin");
-                        reuseContextBuffer(c);
                         destroyContext(c);
 
                         return;
                     }
                     cstate->init_sent = true;
+                }
 
-                    setLen(buf, n);
-                    context_t *data_ctx = newContextFrom(c);
-                    data_ctx->payload   = buf;
-                    if (! (cstate->first_sent))
-                    {
-                        data_ctx->first    = true;
-                        cstate->first_sent = true;
-                    }
-                    self->up->upStream(self->up, data_ctx);
-                    if (! isAlive(c->line))
-                    {
-                        reuseContextBuffer(c);
-                        destroyContext(c);
-                        return;
-                    }
+                self->up->upStream(self->up, newInitContext(c->line));
+                if (! isAlive(c->line))
+                {
+                    LOGW("WolfsslServer: next node instantly closed the init with fin");
+                    destroyContext(c);
+
+                    return;
                 }
-                else
+                cstate->init_sent = true;
+
+                setLen(buf, n);
+                context_t *data_ctx = newContextFrom(c);
+                data_ctx->payload   = buf;
+                if (! (cstate->first_sent))
                 {
-                    reuseBuffer(getContextBufferPool(c), buf);
+                    data_ctx->first    = true;
+                    cstate->first_sent = true;
                 }
+                self->up->upStream(self->up, data_ctx);
+                if (! isAlive(c->line))
+                {
+                    destroyContext(c);
+                    return;
+                }
+            }
+            else
+            {
+                reuseBuffer(getContextBufferPool(c), buf);
+            }
 
-            } while (n > 0);
+        } while (n > 0);
 
-            status = getSslstatus(cstate->ssl, n);
+        status = getSslstatus(cstate->ssl, n);
 
-            /* Did SSL request to write bytes? This can happen if peer has requested SSL
-             * renegotiation. */
-            if (status == kSslstatusWantIo)
+        /* Did SSL request to write bytes? This can happen if peer has requested SSL
+         * renegotiation. */
+        if (status == kSslstatusWantIo)
+        {
+            shift_buffer_t *buf;
+            while ((buf = bufferBioPop(cstate->bio)) != NULL)
             {
-                do
+                context_t *answer = newContextFrom(c);
+                answer->payload   = buf;
+                self->dw->downStream(self->dw, answer);
+                if (! isAlive(c->line))
                 {
-                    shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                    int             avail = (int) rCap(buf);
+                    destroyContext(c);
 
-                    n = BIO_read(cstate->wbio, rawBufMut(buf), avail);
-                    if (n > 0)
-                    {
-                        setLen(buf, n);
-                        context_t *answer = newContextFrom(c);
-                        answer->payload   = buf;
-                        self->dw->downStream(self->dw, answer);
-                        if (! isAlive(c->line))
-                        {
-                            reuseContextBuffer(c);
-                            destroyContext(c);
-
-                            return;
-                        }
-                    }
-                    else if (! BIO_should_retry(cstate->wbio))
-                    {
-                        // If BIO_should_retry() is false then the cause is an error condition.
-                        reuseBuffer(getContextBufferPool(c), buf);
-                        reuseContextBuffer(c);
-                        goto disconnect;
-                    }
-                    else
-                    {
-                        reuseBuffer(getContextBufferPool(c), buf);
-                    }
-                } while (n > 0);
+                    return;
+                }
             }
+        }
 
-            if (status == kSslstatusFail)
-            {
-                reuseContextBuffer(c);
-                goto disconnect;
-            }
+        if (status == kSslstatusFail)
+        {
+            goto disconnect;
         }
         // done with socket data
-        reuseContextBuffer(c);
         destroyContext(c);
     }
     else
@@ -380,12 +328,11 @@ static void upStream(tunnel_t *self, context_t *c)
             CSTATE_MUT(c) = malloc(sizeof(wssl_server_con_state_t));
             memset(CSTATE(c), 0, sizeof(wssl_server_con_state_t));
             wssl_server_con_state_t *cstate = CSTATE(c);
-            cstate->rbio                    = BIO_new(BIO_s_mem());
-            cstate->wbio                    = BIO_new(BIO_s_mem());
+            cstate->bio                     = newBufferBio(getContextBufferPool(c));
             cstate->ssl                     = SSL_new(state->ssl_context);
             cstate->fallback_buf            = newBufferStream(getContextBufferPool(c));
             SSL_set_accept_state(cstate->ssl); /* sets ssl to work in server mode. */
-            SSL_set_bio(cstate->ssl, cstate->rbio, cstate->wbio);
+            SSL_set_bio(cstate->ssl, cstate->bio, cstate->bio);
             // if (state->anti_tit)
             // {
             //     if (1 != SSL_set_record_padding_callback(cstate->ssl, paddingDecisionCb))
@@ -474,39 +421,21 @@ static void downStream(tunnel_t *self, context_t *c)
                 /* consume the waiting bytes that have been used by SSL */
                 shiftr(c->payload, n);
                 len -= n;
-                /* take the output of the SSL object and queue it for socket write */
-                do
+                /* take the records the SSL object wrote and queue them for socket write */
+                shift_buffer_t *buf;
+                while ((buf = bufferBioPop(cstate->bio)) != NULL)
                 {
-
-                    shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                    int             avail = (int) rCap(buf);
-                    n                     = BIO_read(cstate->wbio, rawBufMut(buf), avail);
-                    if (n > 0)
-                    {
-                        setLen(buf, n);
-                        context_t *dw_context = newContextFrom(c);
-                        dw_context->payload   = buf;
-                        self->dw->downStream(self->dw, dw_context);
-                        if (! isAlive(c->line))
-                        {
-                            reuseContextBuffer(c);
-                            destroyContext(c);
-
-                            return;
-                        }
-                    }
-                    else if (! BIO_should_retry(cstate->wbio))
+                    context_t *dw_context = newContextFrom(c);
+                    dw_context->payload   = buf;
+                    self->dw->downStream(self->dw, dw_context);
+                    if (! isAlive(c->line))
                     {
-                        // If BIO_should_retry() is false then the cause is an error condition.
-                        reuseBuffer(getContextBufferPool(c), buf);
                         reuseContextBuffer(c);
-                        goto disconnect;
-                    }
-                    else
-                    {
-                        reuseBuffer(getContextBufferPool(c), buf);
+                        destroyContext(c);
+
+                        return;
                     }
-                } while (n > 0);
+                }
             }
 
             if (status == kSslstatusFail)
@@ -642,6 +571,14 @@ tunnel_t *newWolfSSLServer(node_instance_context_t *instance_info)
     free(fallback_node);
 
     getBoolFromJsonObjectOrDefault(&(state->anti_tit), settings, "anti-tls-in-tls", false);
+    getBoolFromJsonObjectOrDefault(&(state->session_resumption), settings, "session-resumption", true);
+    getIntFromJsonObjectOrDefault(&(state->ticket_key_rotation), settings, "ticket-key-rotation", 3600);
+    if (state->ticket_key_rotation <= 0)
+    {
+        LOGF("JSON Error: WolfsslServer->settings->ticket-key-rotation (int field) : must be a positive number of "
+             "seconds");
+        return NULL;
+    }
     if (state->anti_tit)
     {
         LOGF("WolfsslServer: anti tls in tls is not currently supported for wolfssl, use other ssl backend");
@@ -650,6 +587,7 @@ tunnel_t *newWolfSSLServer(node_instance_context_t *instance_info)
     ssl_param->verify_peer = 0; // no mtls
     ssl_param->endpoint    = kSslServer;
     state->ssl_context     = sslCtxNew(ssl_param);
+    bufferBioGlobalInit();
     // int brotli_alg = TLSEXT_comp_cert_brotli;
     // SSL_set1_cert_comp_preference(state->ssl_context,&brotli_alg,1);
     // SSL_compress_certs(state->ssl_context,TLSEXT_comp_cert_brotli);
@@ -666,6 +604,16 @@ tunnel_t *newWolfSSLServer(node_instance_context_t *instance_info)
 
     SSL_CTX_set_alpn_select_cb(state->ssl_context, onAlpnSelect, NULL);
 
+    if (state->session_resumption)
+    {
+        state->ticket_keys = newSslTicketKeys(state->ssl_context, (unsigned int) state->ticket_key_rotation);
+    }
+    else
+    {
+        SSL_CTX_set_options(state->ssl_context, SSL_OP_NO_TICKET);
+        SSL_CTX_set_session_cache_mode(state->ssl_context, SSL_SESS_CACHE_OFF);
+    }
+
     tunnel_t *t = newTunnel();
     t->state    = state;
     if (state->fallback != NULL)
@@ -0,0 +1,243 @@
+#pragma once
+#include "buffer_pool.h"
+#include "buffer_stream.h"
+#include "hloop.h"
+#include "hmutex.h"
+#include "hthread.h"
+#include "loggers/network_logger.h"
+#include "openssl_buffer_bio.h"
+#include "tunnel.h"
+#include "ww.h"
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    tls handshakes on crypto threads
+
+    the private key operation of a full handshake (the signature, rsa or ecdsa) costs far more than the records of a
+    line, when many clients connect at once the loop of a worker spends its time signing and the lines it already
+    serves wait behind the handshakes
+
+    a line that handshakes this way has a job, every handshake step (SSL_do_handshake) of it runs on one of the crypto
+    threads and the result comes back to the loop of the line as an event, the loop only moves the records
+
+        - while a step runs the crypto thread owns the ssl, records that come meanwhile wait in the job and go to the
+          ssl when the step is back, the line is locked until then
+        - the ssl has memory bios during the handshake, the buffer pools are per worker and a crypto thread must not
+          pop or reuse their buffers, once the handshake is done sslHandshakeJobFinish gives the ssl its buffer bio
+        - the error queue of openssl is per thread, the job keeps the result, SSL_get_error and the first error of the
+          step as the crypto thread saw them
+
+    the pool is shared by all workers, sslHandshakePoolInit is called from the constructor of the tunnel before the
+    workers start, the threads live as long as the process
+*/
+
+typedef struct ssl_handshake_job_s ssl_handshake_job_t;
+
+// runs on the loop of the line when a step is back
+typedef void (*SslHandshakeJobDone)(ssl_handshake_job_t *job);
+
+struct ssl_handshake_job_s
+{
+    ssl_handshake_job_t *next; // queue of the pool
+    SSL                 *ssl;
+    BIO                 *in;      // memory bios of the ssl, owned by it
+    BIO                 *out;
+    buffer_stream_t     *waiting; // records that came while a step was running
+    hloop_t             *loop;
+    line_t              *line;
+    tunnel_t            *tunnel;
+    SslHandshakeJobDone  done;
+    void                *userdata;
+    int                  result; // of SSL_do_handshake
+    int                  error;  // SSL_get_error of the result
+    unsigned long        reason; // first error of the step, 0 if none
+    bool                 running;
+};
+
+typedef struct ssl_handshake_pool_s
+{
+    hmutex_t             guard;
+    hcondvar_t           cond;
+    ssl_handshake_job_t *head;
+    ssl_handshake_job_t *tail;
+    unsigned int         threads_count;
+
+} ssl_handshake_pool_t;
+
+static ssl_handshake_pool_t *ssl_handshake_pool = NULL;
+
+static void onSslHandshakeJobBack(hevent_t *ev)
+{
+    ssl_handshake_job_t *job  = hevent_userdata(ev);
+    line_t              *line = job->line;
+    job->running              = false;
+
+    while (bufferStreamLen(job->waiting) > 0)
+    {
+        shift_buffer_t *buf = bufferStreamIdealRead(job->waiting);
+        BIO_write(job->in, rawBuf(buf), (int) bufLen(buf));
+        reuseBuffer(getLineBufferPool(line), buf);
+    }
+    job->done(job); // may free the job
+    unLockLine(line);
+}
+
+static HTHREAD_ROUTINE(sslHandshakeThread) // NOLINT
+{
+    ssl_handshake_pool_t *pool = userdata;
+    while (true)
+    {
+        hmutex_lock(&pool->guard);
+        while (pool->head == NULL)
+        {
+            hcondvar_wait(&pool->cond, &pool->guard);
+        }
+        ssl_handshake_job_t *job = pool->head;
+        pool->head               = job->next;
+        if (pool->head == NULL)
+        {
+            pool->tail = NULL;
+        }
+        hmutex_unlock(&pool->guard);
+
+        ERR_clear_error();
+        job->result = SSL_do_handshake(job->ssl);
+        job->error  = SSL_get_error(job->ssl, job->result);
+        job->reason = ERR_peek_error();
+        ERR_clear_error();
+
+        hevent_t ev = {.loop = job->loop, .cb = onSslHandshakeJobBack};
+        ev.userdata = job;
+        hloop_post_event(job->loop, &ev);
+    }
+    return 0;
+}
+
+static void sslHandshakePoolInit(unsigned int threads_count)
+{
+    if (ssl_handshake_pool != NULL)
+    {
+        return; // the first tunnel decides the size
+    }
+    ssl_handshake_pool = malloc(sizeof(ssl_handshake_pool_t));
+    memset(ssl_handshake_pool, 0, sizeof(ssl_handshake_pool_t));
+    hmutex_init(&ssl_handshake_pool->guard);
+    hcondvar_init(&ssl_handshake_pool->cond);
+    ssl_handshake_pool->threads_count = threads_count;
+    for (unsigned int i = 0; i < threads_count; i++)
+    {
+        hthread_create(sslHandshakeThread, ssl_handshake_pool);
+    }
+}
+
+// gives the ssl memory bios, the job handshakes it on the crypto threads until sslHandshakeJobFinish
+static ssl_handshake_job_t *newSslHandshakeJob(SSL *ssl, line_t *line, tunnel_t *tunnel, SslHandshakeJobDone done,
+                                               void *userdata)
+{
+    ssl_handshake_job_t *job = malloc(sizeof(ssl_handshake_job_t));
+    *job                     = (ssl_handshake_job_t){.ssl      = ssl,
+                                                     .in       = BIO_new(BIO_s_mem()),
+                                                     .out      = BIO_new(BIO_s_mem()),
+                                                     .waiting  = newBufferStream(getLineBufferPool(line)),
+                                                     .loop     = loops[line->tid],
+                                                     .line     = line,
+                                                     .tunnel   = tunnel,
+                                                     .done     = done,
+                                                     .userdata = userdata};
+    SSL_set_bio(ssl, job->in, job->out);
+    return job;
+}
+
+// the ssl (and the memory bios it still has) is not freed, must not be running
+static void destroySslHandshakeJob(ssl_handshake_job_t *job)
+{
+    assert(! job->running);
+    destroyBufferStream(job->waiting);
+    free(job);
+}
+
+// records of the peer, the buffer is consumed
+static void sslHandshakeJobPush(ssl_handshake_job_t *job, shift_buffer_t *buf)
+{
+    if (job->running)
+    {
+        bufferStreamPush(job->waiting, buf);
+        return;
+    }
+    BIO_write(job->in, rawBuf(buf), (int) bufLen(buf));
+    reuseBuffer(getLineBufferPool(job->line), buf);
+}
+
+// records the ssl wrote for the peer, NULL if there are none
+static shift_buffer_t *sslHandshakeJobPop(ssl_handshake_job_t *job)
+{
+    assert(! job->running);
+    if (BIO_pending(job->out) <= 0)
+    {
+        return NULL;
+    }
+    shift_buffer_t *buf = popBuffer(getLineBufferPool(job->line));
+    setLen(buf, 0);
+    const int n = BIO_read(job->out, rawBufMut(buf), (int) rCap(buf));
+    setLen(buf, n > 0 ? (unsigned int) n : 0);
+    return buf;
+}
+
+// true if there are records the last step did not see yet
+static bool sslHandshakeJobHasInput(ssl_handshake_job_t *job)
+{
+    return BIO_pending(job->in) > 0;
+}
+
+// runs the next step on a crypto thread, the done callback of the job is called on the loop of the line
+static void sslHandshakeJobRun(ssl_handshake_job_t *job)
+{
+    assert(! job->running && ssl_handshake_pool != NULL);
+    job->running = true;
+    job->next    = NULL;
+    lockLine(job->line);
+
+    hmutex_lock(&ssl_handshake_pool->guard);
+    if (ssl_handshake_pool->tail == NULL)
+    {
+        ssl_handshake_pool->head = job;
+    }
+    else
+    {
+        ssl_handshake_pool->tail->next = job;
+    }
+    ssl_handshake_pool->tail = job;
+    hcondvar_signal(&ssl_handshake_pool->cond);
+    hmutex_unlock(&ssl_handshake_pool->guard);
+}
+
+static void printSslHandshakeJobError(ssl_handshake_job_t *job)
+{
+    if (job->reason != 0)
+    {
+        char reason[256];
+        ERR_error_string_n(job->reason, reason, sizeof(reason));
+        LOGE("%s", reason);
+    }
+}
+
+// the handshake is done, the ssl gets the buffer bio (with what the peer sent after its last handshake record) and
+// the job is freed
+static void sslHandshakeJobFinish(ssl_handshake_job_t *job, BIO *buffer_bio)
+{
+    assert(! job->running && BIO_pending(job->out) <= 0);
+    while (BIO_pending(job->in) > 0)
+    {
+        shift_buffer_t *buf = popBuffer(getLineBufferPool(job->line));
+        setLen(buf, 0);
+        const int n = BIO_read(job->in, rawBufMut(buf), (int) rCap(buf));
+        setLen(buf, n > 0 ? (unsigned int) n : 0);
+        bufferBioPush(buffer_bio, buf);
+    }
+    SSL_set_bio(job->ssl, buffer_bio, buffer_bio); // frees the memory bios
+    destroySslHandshakeJob(job);
+}
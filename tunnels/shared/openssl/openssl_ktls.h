@@ -0,0 +1,383 @@
+#pragma once
+#include "hsocket.h"
+#include <errno.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/ssl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(OS_LINUX)
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+#define SSL_HAVE_KTLS 1
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#endif
+
+/*
+    kernel tls offload
+
+    once the handshake is done, the keys and the record sequence numbers of the connection are installed on the tcp
+    socket of the adapter next to the tls tunnel (TLS_TX / TLS_RX of the "tls" ulp), from then on the kernel
+    encrypts what the adapter writes and decrypts what it reads, the tunnel passes plaintext between the adapter
+    and the rest of the chain and openssl is out of the way
+
+    the socket bio of openssl does this by itself, the buffer bio can not, so the parts are collected here
+
+        keys        tls 1.3 the traffic secrets (keylog callback) expanded with hkdf
+                    tls 1.2 the key block of the master secret (tls1 prf)
+        sequences   the msg callback counts every record openssl writes and reads, the count when the traffic keys
+                    of the connection started (our / the peer's Finished on 1.3, ChangeCipherSpec on 1.2) is record 0
+
+    tx and rx are installed on their own, a side is installed when openssl has nothing of it pending anymore, if
+    the kernel does not have the tls ulp or the cipher (aes-gcm 128/256 and chacha20-poly1305 are supported), the
+    line keeps the userspace path, this is the fallback
+
+    the kernel only passes application data to a plain read, any other record the peer sends afterwards (an alert,
+    a tls 1.3 key update or session ticket) is a read error and closes the line, the tls 1.3 client waits for the
+    first application data before installing rx, the session tickets of the server come before it
+
+    call sslKtlsGlobalInit and sslKtlsCtxInit once before the workers start (the tunnel constructor does it)
+*/
+
+typedef struct ssl_ktls_s
+{
+    uint64_t      tx_records; // records openssl wrote / read so far
+    uint64_t      rx_records;
+    uint64_t      tx_base; // the counts at the first record of the traffic keys
+    uint64_t      rx_base;
+    unsigned char tx_secret[EVP_MAX_MD_SIZE]; // tls 1.3 traffic secrets
+    unsigned char rx_secret[EVP_MAX_MD_SIZE];
+    unsigned int  tx_secret_len;
+    unsigned int  rx_secret_len;
+    bool          rx_app_data; // an application data record was read
+
+} ssl_ktls_t;
+
+#ifdef SSL_HAVE_KTLS
+typedef union ssl_ktls_crypto_info_u {
+    struct tls_crypto_info               info;
+    struct tls12_crypto_info_aes_gcm_128 aes_gcm_128;
+    struct tls12_crypto_info_aes_gcm_256 aes_gcm_256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    struct tls12_crypto_info_chacha20_poly1305 chacha20_poly1305;
+#endif
+} ssl_ktls_crypto_info_t;
+#endif
+
+static int ssl_ktls_index = -1;
+
+static void onSslKtlsMessage(int write_p, int version, int content_type, const void *buf, size_t len, SSL *ssl,
+                             void *arg)
+{
+    (void) version;
+    ssl_ktls_t          *ks = arg;
+    const unsigned char *b  = buf;
+    switch (content_type)
+    {
+    case SSL3_RT_HEADER:
+        write_p ? ks->tx_records++ : ks->rx_records++;
+        // the records after a ChangeCipherSpec have the new keys, tls 1.3 moves the base again at the Finished
+        // (the header, openssl has no message callback for a ChangeCipherSpec it reads)
+        if (len > 0 && b[0] == SSL3_RT_CHANGE_CIPHER_SPEC)
+        {
+            write_p ? (ks->tx_base = ks->tx_records) : (ks->rx_base = ks->rx_records);
+        }
+        break;
+    case SSL3_RT_HANDSHAKE:
+        if (len > 0 && b[0] == SSL3_MT_FINISHED && SSL_version(ssl) == TLS1_3_VERSION)
+        {
+            write_p ? (ks->tx_base = ks->tx_records) : (ks->rx_base = ks->rx_records);
+        }
+        break;
+    case SSL3_RT_INNER_CONTENT_TYPE:
+        if (! write_p && len > 0 && b[0] == SSL3_RT_APPLICATION_DATA)
+        {
+            ks->rx_app_data = true;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static bool sslKtlsHexDecode(const char *hex, unsigned char *out, unsigned int *out_len)
+{
+    size_t n = strlen(hex);
+    if (n % 2 != 0 || n / 2 > EVP_MAX_MD_SIZE)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < n / 2; i++)
+    {
+        unsigned int byte;
+        if (sscanf(hex + (i * 2), "%2x", &byte) != 1)
+        {
+            return false;
+        }
+        out[i] = (unsigned char) byte;
+    }
+    *out_len = (unsigned int) (n / 2);
+    return true;
+}
+
+// "<label> <client random> <secret>", only the application traffic secrets are kept
+static void onSslKtlsKeylog(const SSL *ssl, const char *line)
+{
+    ssl_ktls_t *ks = SSL_get_ex_data(ssl, ssl_ktls_index);
+    if (ks == NULL)
+    {
+        return;
+    }
+    const bool server = SSL_is_server((SSL *) ssl);
+    bool       tx;
+    if (strncmp(line, "SERVER_TRAFFIC_SECRET_0 ", 24) == 0)
+    {
+        tx = server;
+    }
+    else if (strncmp(line, "CLIENT_TRAFFIC_SECRET_0 ", 24) == 0)
+    {
+        tx = ! server;
+    }
+    else
+    {
+        return;
+    }
+    const char *secret = strchr(line + 24, ' ');
+    if (secret == NULL)
+    {
+        return;
+    }
+    if (tx)
+    {
+        sslKtlsHexDecode(secret + 1, ks->tx_secret, &ks->tx_secret_len);
+    }
+    else
+    {
+        sslKtlsHexDecode(secret + 1, ks->rx_secret, &ks->rx_secret_len);
+    }
+}
+
+static void sslKtlsGlobalInit(void)
+{
+    if (ssl_ktls_index < 0)
+    {
+        ssl_ktls_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    }
+}
+
+static void sslKtlsCtxInit(SSL_CTX *ctx)
+{
+    SSL_CTX_set_keylog_callback(ctx, onSslKtlsKeylog);
+}
+
+// the line wants the offload, call it before the handshake starts
+static ssl_ktls_t *newSslKtls(SSL *ssl)
+{
+    ssl_ktls_t *ks = malloc(sizeof(ssl_ktls_t));
+    memset(ks, 0, sizeof(ssl_ktls_t));
+    SSL_set_ex_data(ssl, ssl_ktls_index, ks);
+    SSL_set_msg_callback(ssl, onSslKtlsMessage);
+    SSL_set_msg_callback_arg(ssl, ks);
+    return ks;
+}
+
+// both sides are installed or given up, the secrets are wiped
+static void destroySslKtls(SSL *ssl, ssl_ktls_t *ks)
+{
+    SSL_set_ex_data(ssl, ssl_ktls_index, NULL);
+    SSL_set_msg_callback(ssl, NULL);
+    SSL_set_msg_callback_arg(ssl, NULL);
+    OPENSSL_cleanse(ks, sizeof(ssl_ktls_t));
+    free(ks);
+}
+
+// hkdf-expand-label of tls 1.3 with an empty context
+static bool sslKtlsExpandLabel(const EVP_MD *md, const unsigned char *secret, unsigned int secret_len,
+                               const char *label, unsigned char *out, size_t out_len)
+{
+    unsigned char info[2 + 1 + 255 + 1];
+    const size_t  label_len = 6 + strlen(label);
+    info[0]                 = (unsigned char) (out_len >> 8);
+    info[1]                 = (unsigned char) out_len;
+    info[2]                 = (unsigned char) label_len;
+    memcpy(info + 3, "tls13 ", 6);
+    memcpy(info + 9, label, label_len - 6);
+    info[3 + label_len] = 0;
+
+    EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    const bool    ok   = pctx != NULL && EVP_PKEY_derive_init(pctx) == 1 &&
+                    EVP_PKEY_CTX_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) == 1 &&
+                    EVP_PKEY_CTX_set_hkdf_md(pctx, md) == 1 &&
+                    EVP_PKEY_CTX_set1_hkdf_key(pctx, secret, (int) secret_len) == 1 &&
+                    EVP_PKEY_CTX_add1_hkdf_info(pctx, info, (int) (4 + label_len)) == 1 &&
+                    EVP_PKEY_derive(pctx, out, &out_len) == 1;
+    EVP_PKEY_CTX_free(pctx);
+    return ok;
+}
+
+// the key block of tls 1.2 (no mac keys with aead ciphers)
+static bool sslKtlsKeyBlock(SSL *ssl, const EVP_MD *md, unsigned char *out, size_t out_len)
+{
+    unsigned char master[SSL_MAX_MASTER_KEY_LENGTH];
+    unsigned char client_random[SSL3_RANDOM_SIZE];
+    unsigned char server_random[SSL3_RANDOM_SIZE];
+    const size_t  master_len = SSL_SESSION_get_master_key(SSL_get_session(ssl), master, sizeof(master));
+    SSL_get_client_random(ssl, client_random, sizeof(client_random));
+    SSL_get_server_random(ssl, server_random, sizeof(server_random));
+
+    EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_TLS1_PRF, NULL);
+    const bool    ok   = pctx != NULL && master_len > 0 && EVP_PKEY_derive_init(pctx) == 1 &&
+                    EVP_PKEY_CTX_set_tls1_prf_md(pctx, md) == 1 &&
+                    EVP_PKEY_CTX_set1_tls1_prf_secret(pctx, master, (int) master_len) == 1 &&
+                    EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, (const unsigned char *) "key expansion", 13) == 1 &&
+                    EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, server_random, sizeof(server_random)) == 1 &&
+                    EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, client_random, sizeof(client_random)) == 1 &&
+                    EVP_PKEY_derive(pctx, out, &out_len) == 1;
+    EVP_PKEY_CTX_free(pctx);
+    OPENSSL_cleanse(master, sizeof(master));
+    return ok;
+}
+
+#ifdef SSL_HAVE_KTLS
+/*
+    fills the crypto info of one side, returns its size or 0 if the kernel can not do the connection
+    iv is the whole 12 byte nonce base on tls 1.3 and chacha20, the 4 byte salt of aes-gcm on tls 1.2
+*/
+static size_t sslKtlsFillCryptoInfo(ssl_ktls_crypto_info_t *ci, int version, int nid, const unsigned char *key,
+                                    const unsigned char *iv, uint64_t seq)
+{
+    unsigned char rec_seq[8];
+    for (int i = 7; i >= 0; i--)
+    {
+        rec_seq[i] = (unsigned char) seq;
+        seq >>= 8;
+    }
+    memset(ci, 0, sizeof(*ci));
+    ci->info.version = version == TLS1_3_VERSION ? TLS_1_3_VERSION : TLS_1_2_VERSION;
+
+    switch (nid)
+    {
+    case NID_aes_128_gcm:
+    case NID_aes_256_gcm: {
+        const bool     aes128 = nid == NID_aes_128_gcm;
+        unsigned char *c_iv   = aes128 ? ci->aes_gcm_128.iv : ci->aes_gcm_256.iv;
+        unsigned char *c_salt = aes128 ? ci->aes_gcm_128.salt : ci->aes_gcm_256.salt;
+        ci->info.cipher_type  = aes128 ? TLS_CIPHER_AES_GCM_128 : TLS_CIPHER_AES_GCM_256;
+        memcpy(aes128 ? ci->aes_gcm_128.key : ci->aes_gcm_256.key, key, aes128 ? 16 : 32);
+        memcpy(aes128 ? ci->aes_gcm_128.rec_seq : ci->aes_gcm_256.rec_seq, rec_seq, 8);
+        memcpy(c_salt, iv, 4);
+        // tls 1.2 sends the explicit nonce in the record, the sequence number is a unique one to start from
+        memcpy(c_iv, version == TLS1_3_VERSION ? iv + 4 : rec_seq, 8);
+        return aes128 ? sizeof(ci->aes_gcm_128) : sizeof(ci->aes_gcm_256);
+    }
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    case NID_chacha20_poly1305:
+        ci->info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+        memcpy(ci->chacha20_poly1305.key, key, 32);
+        memcpy(ci->chacha20_poly1305.iv, iv, 12);
+        memcpy(ci->chacha20_poly1305.rec_seq, rec_seq, 8);
+        return sizeof(ci->chacha20_poly1305);
+#endif
+    default:
+        return 0;
+    }
+}
+
+// the crypto info of our side (tx) or the peer's (rx) at the current record
+static size_t sslKtlsCryptoInfo(SSL *ssl, ssl_ktls_t *ks, bool tx, ssl_ktls_crypto_info_t *ci)
+{
+    const SSL_CIPHER *cipher  = SSL_get_current_cipher(ssl);
+    const int         version = SSL_version(ssl);
+    if (cipher == NULL || (version != TLS1_2_VERSION && version != TLS1_3_VERSION))
+    {
+        return 0;
+    }
+    const int     nid     = SSL_CIPHER_get_cipher_nid(cipher);
+    const EVP_MD *md      = SSL_CIPHER_get_handshake_digest(cipher);
+    const size_t  key_len = nid == NID_aes_128_gcm ? 16 : 32;
+    const size_t  iv_len  = (version == TLS1_3_VERSION || nid == NID_chacha20_poly1305) ? 12 : 4;
+    const uint64_t seq    = tx ? ks->tx_records - ks->tx_base : ks->rx_records - ks->rx_base;
+    if (md == NULL || (nid != NID_aes_128_gcm && nid != NID_aes_256_gcm && nid != NID_chacha20_poly1305))
+    {
+        return 0;
+    }
+
+    unsigned char key[32];
+    unsigned char iv[12];
+    bool          ok;
+    if (version == TLS1_3_VERSION)
+    {
+        const unsigned char *secret     = tx ? ks->tx_secret : ks->rx_secret;
+        const unsigned int   secret_len = tx ? ks->tx_secret_len : ks->rx_secret_len;
+        ok = secret_len > 0 && sslKtlsExpandLabel(md, secret, secret_len, "key", key, key_len) &&
+             sslKtlsExpandLabel(md, secret, secret_len, "iv", iv, iv_len);
+    }
+    else
+    {
+        // client key, server key, client iv, server iv
+        unsigned char block[(32 + 12) * 2];
+        const bool    client_keys = tx != (bool) SSL_is_server(ssl);
+        ok                        = sslKtlsKeyBlock(ssl, md, block, (key_len + iv_len) * 2);
+        memcpy(key, block + (client_keys ? 0 : key_len), key_len);
+        memcpy(iv, block + (key_len * 2) + (client_keys ? 0 : iv_len), iv_len);
+        OPENSSL_cleanse(block, sizeof(block));
+    }
+
+    const size_t size = ok ? sslKtlsFillCryptoInfo(ci, version, nid, key, iv, seq) : 0;
+    OPENSSL_cleanse(key, sizeof(key));
+    OPENSSL_cleanse(iv, sizeof(iv));
+    return size;
+}
+#endif
+
+// openssl has nothing pending on that side, so the kernel can take it over
+static bool sslKtlsReady(SSL *ssl, ssl_ktls_t *ks, BIO *bio, bool tx)
+{
+    if (! SSL_is_init_finished(ssl))
+    {
+        return false;
+    }
+    if (tx)
+    {
+        return BIO_wpending(bio) == 0;
+    }
+    if (BIO_ctrl_pending(bio) != 0 || SSL_has_pending(ssl))
+    {
+        return false;
+    }
+    return SSL_version(ssl) != TLS1_3_VERSION || SSL_is_server(ssl) || ks->rx_app_data;
+}
+
+// installs one side on the socket, false if the kernel can not take it (the line stays in userspace)
+static bool sslKtlsInstall(SSL *ssl, ssl_ktls_t *ks, int fd, bool tx)
+{
+#ifdef SSL_HAVE_KTLS
+    ssl_ktls_crypto_info_t ci;
+    const size_t           size = sslKtlsCryptoInfo(ssl, ks, tx, &ci);
+    if (size == 0)
+    {
+        return false;
+    }
+    // the ulp is already there if the other side was installed
+    if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0 && errno != EEXIST)
+    {
+        OPENSSL_cleanse(&ci, sizeof(ci));
+        return false;
+    }
+    const bool ok = setsockopt(fd, SOL_TLS, tx ? TLS_TX : TLS_RX, &ci, (socklen_t) size) == 0;
+    OPENSSL_cleanse(&ci, sizeof(ci));
+    return ok;
+#else
+    (void) ssl;
+    (void) ks;
+    (void) fd;
+    (void) tx;
+    return false;
+#endif
+}
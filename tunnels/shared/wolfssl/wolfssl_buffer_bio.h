@@ -0,0 +1,178 @@
+#pragma once
+#include "buffer_pool.h"
+#include "buffer_stream.h"
+#include "shiftbuffer.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wolfssl/options.h>
+#include <wolfssl/openssl/bio.h>
+
+/*
+    buffer bio
+
+    a BIO that works on the shift buffers of the line instead of memory of its own, one of them is both the rbio
+    and the wbio of a SSL
+
+        read    the ciphertext the tunnel received is queued as it is (bufferBioPush), wolfssl reads its records
+                straight out of the queued buffers
+        write   the records wolfssl writes are appended to a pool buffer, the tunnel takes them with bufferBioPop
+                and sends them down as they are, the buffer keeps the left padding of the pool so the next tunnels
+                can still shiftl their headers without a copy
+
+    with the memory bios every byte was copied into the bio and out of it again, now it is only copied by wolfssl
+    itself (into and out of its own record buffers, the records are encrypted and decrypted in place there)
+
+    the bio never fails or blocks on write, a read of an empty bio is a retry (SSL_ERROR_WANT_READ)
+    call bufferBioGlobalInit once before the workers start (the tunnel constructor does it)
+    this is the openssl compat api of wolfssl, the same as openssl_buffer_bio.h
+*/
+
+typedef struct buffer_bio_s
+{
+    buffer_pool_t   *pool;
+    buffer_stream_t *in;
+    buffer_stream_t *out;      // records that did not fit in the tail, in order
+    shift_buffer_t  *out_tail; // the next records are appended to this one
+
+} buffer_bio_t;
+
+static BIO_METHOD *buffer_bio_method = NULL;
+
+static int bufferBioWrite(BIO *bio, const char *data, int len)
+{
+    buffer_bio_t *bb = BIO_get_data(bio);
+    BIO_clear_retry_flags(bio);
+    if (len <= 0)
+    {
+        return 0;
+    }
+
+    if (bb->out_tail != NULL && rCap(bb->out_tail) - bufLen(bb->out_tail) < (unsigned int) len)
+    {
+        bufferStreamPush(bb->out, bb->out_tail);
+        bb->out_tail = NULL;
+    }
+    if (bb->out_tail == NULL)
+    {
+        bb->out_tail = popBuffer(bb->pool);
+    }
+    // only a record bigger than a whole pool buffer makes this grow the buffer
+    const unsigned int offset = bufLen(bb->out_tail);
+    setLen(bb->out_tail, offset + (unsigned int) len);
+    memcpy(rawBufMut(bb->out_tail) + offset, data, (size_t) len);
+    return len;
+}
+
+static int bufferBioRead(BIO *bio, char *out, int len)
+{
+    buffer_bio_t *bb = BIO_get_data(bio);
+    BIO_clear_retry_flags(bio);
+
+    const size_t available = bufferStreamLen(bb->in);
+    if (available == 0)
+    {
+        BIO_set_retry_read(bio);
+        return -1;
+    }
+    if (len <= 0)
+    {
+        return 0;
+    }
+
+    const size_t n = available < (size_t) len ? available : (size_t) len;
+    bufferStreamViewBytesAt(bb->in, 0, (uint8_t *) out, n);
+    bufferStreamSkip(bb->in, n);
+    return (int) n;
+}
+
+static long bufferBioCtrl(BIO *bio, int cmd, long num, void *ptr)
+{
+    (void) num;
+    (void) ptr;
+    buffer_bio_t *bb = BIO_get_data(bio);
+
+    switch (cmd)
+    {
+    case BIO_CTRL_FLUSH:
+        return 1;
+    case BIO_CTRL_PENDING:
+        return (long) bufferStreamLen(bb->in);
+    case BIO_CTRL_WPENDING:
+        return (long) (bufferStreamLen(bb->out) + (bb->out_tail != NULL ? bufLen(bb->out_tail) : 0));
+    default:
+        return 0;
+    }
+}
+
+static int bufferBioCreate(BIO *bio)
+{
+    BIO_set_data(bio, NULL);
+    BIO_set_init(bio, 0);
+    return 1;
+}
+
+static int bufferBioDestroy(BIO *bio)
+{
+    buffer_bio_t *bb = BIO_get_data(bio);
+    if (bb == NULL)
+    {
+        return 0;
+    }
+    destroyBufferStream(bb->in);
+    destroyBufferStream(bb->out);
+    if (bb->out_tail != NULL)
+    {
+        reuseBuffer(bb->pool, bb->out_tail);
+    }
+    free(bb);
+    BIO_set_data(bio, NULL);
+    BIO_set_init(bio, 0);
+    return 1;
+}
+
+static void bufferBioGlobalInit(void)
+{
+    if (buffer_bio_method != NULL)
+    {
+        return;
+    }
+    buffer_bio_method = BIO_meth_new(WOLFSSL_BIO_UNDEF, "ww buffer");
+    BIO_meth_set_write(buffer_bio_method, bufferBioWrite);
+    BIO_meth_set_read(buffer_bio_method, bufferBioRead);
+    BIO_meth_set_ctrl(buffer_bio_method, bufferBioCtrl);
+    BIO_meth_set_create(buffer_bio_method, bufferBioCreate);
+    BIO_meth_set_destroy(buffer_bio_method, bufferBioDestroy);
+}
+
+static BIO *newBufferBio(buffer_pool_t *pool)
+{
+    assert(buffer_bio_method != NULL);
+    BIO          *bio = BIO_new(buffer_bio_method);
+    buffer_bio_t *bb  = malloc(sizeof(buffer_bio_t));
+    *bb               = (buffer_bio_t){.pool = pool, .in = newBufferStream(pool), .out = newBufferStream(pool)};
+    BIO_set_data(bio, bb);
+    BIO_set_init(bio, 1);
+    return bio;
+}
+
+// the ciphertext that came from the peer, the bio owns the buffer now
+static void bufferBioPush(BIO *bio, shift_buffer_t *buf)
+{
+    buffer_bio_t *bb = BIO_get_data(bio);
+    bufferStreamPush(bb->in, buf);
+}
+
+// the next buffer of records to send to the peer, NULL when wolfssl wrote nothing more
+static shift_buffer_t *bufferBioPop(BIO *bio)
+{
+    buffer_bio_t *bb = BIO_get_data(bio);
+    if (bufferStreamLen(bb->out) > 0)
+    {
+        return bufferStreamIdealRead(bb->out);
+    }
+    shift_buffer_t *buf = bb->out_tail;
+    bb->out_tail        = NULL;
+    return buf;
+}
@@ -0,0 +1,278 @@
+#pragma once
+#include "hmutex.h"
+#include "loggers/network_logger.h"
+#include "tunnel.h"
+#include "utils/hashutils.h"
+#include "ww.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wolfssl/options.h>
+#include <wolfssl/openssl/evp.h>
+#include <wolfssl/openssl/hmac.h>
+#include <wolfssl/openssl/rand.h>
+#include <wolfssl/openssl/ssl.h>
+
+/*
+    tls session resumption
+
+    client  every worker keeps the last sessions (tickets) the servers gave, keyed by the ssl context and the sni,
+            a new line takes the newest one of its sni out of the cache (a ticket is used once) and resumes with it,
+            tls 1.3 as a psk (psk_dhe_ke, the resumed handshake still has forward secrecy), tls 1.2 with the ticket
+
+            the session of a line goes to the cache of its worker when the line closes (sslSessionKeep), the new
+            session callback of openssl_session.h needs the external cache of wolfssl, that is not in every build
+
+    server  the tickets are encrypted with the keys of the tunnel instead of the key wolfssl makes for each
+            context, the keys rotate every ticket-key-rotation seconds and the last kSslTicketKeys of them still
+            decrypt (every resumed session gets a new ticket), the keys are the only thing the workers share, the
+            stateful session cache of wolfssl is off since the tickets carry the sessions, needs a wolfssl built
+            with session tickets (HAVE_SESSION_TICKET), without them the server does full handshakes
+
+    this is the openssl compat api of wolfssl, the same as openssl_session.h
+
+    tunnels call sslSessionCacheInit / newSslTicketKeys from their constructor, before the workers start
+*/
+
+enum
+{
+    kSslSessionCacheSize = 32, // sessions per worker
+    kSslTicketKeys       = 3,
+    kSslTicketKeyNameLen = 16
+};
+
+typedef struct ssl_session_entry_s
+{
+    const SSL_CTX *ctx;
+    hash_t         sni_hash;
+    SSL_SESSION   *session;
+    uint64_t       seq; // bigger is newer
+
+} ssl_session_entry_t;
+
+typedef struct ssl_session_cache_s
+{
+    uint64_t            seq;
+    ssl_session_entry_t entries[kSslSessionCacheSize];
+
+} ssl_session_cache_t;
+
+typedef struct ssl_ticket_key_s
+{
+    unsigned char name[kSslTicketKeyNameLen];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+
+} ssl_ticket_key_t;
+
+typedef struct ssl_ticket_keys_s
+{
+    hmutex_t         guard;
+    time_t           rotated_at;
+    unsigned int     rotation; // seconds
+    unsigned int     current;  // index of the key new tickets get, the rest are older ones
+    ssl_ticket_key_t keys[kSslTicketKeys];
+
+} ssl_ticket_keys_t;
+
+static ssl_session_cache_t *ssl_session_caches = NULL; // one for each worker
+
+static hash_t sslSessionSniHash(SSL *ssl)
+{
+    const char *sni = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    return sni == NULL ? 0 : CALC_HASH_BYTES(sni, strlen(sni));
+}
+
+static bool sslSessionUsable(SSL_SESSION *session)
+{
+    return time(NULL) < (time_t) (SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session));
+}
+
+static void sslSessionStore(SSL *ssl, SSL_SESSION *session, uint8_t tid)
+{
+    ssl_session_cache_t *cache = &ssl_session_caches[tid];
+
+    // an empty entry, or the oldest one
+    ssl_session_entry_t *slot = &cache->entries[0];
+    for (unsigned int i = 0; i < kSslSessionCacheSize; i++)
+    {
+        if (cache->entries[i].session == NULL)
+        {
+            slot = &cache->entries[i];
+            break;
+        }
+        if (cache->entries[i].seq < slot->seq)
+        {
+            slot = &cache->entries[i];
+        }
+    }
+    if (slot->session != NULL)
+    {
+        SSL_SESSION_free(slot->session);
+    }
+    *slot = (ssl_session_entry_t){
+        .ctx = SSL_get_SSL_CTX(ssl), .sni_hash = sslSessionSniHash(ssl), .session = session, .seq = ++cache->seq};
+}
+
+static void sslSessionCacheInit(SSL_CTX *ctx)
+{
+    if (ssl_session_caches == NULL)
+    {
+        ssl_session_caches = calloc(workers_count, sizeof(ssl_session_cache_t));
+    }
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+}
+
+// call it before freeing the ssl of a line that finished its handshake
+static void sslSessionKeep(SSL *ssl, uint8_t tid)
+{
+    SSL_SESSION *session = SSL_get1_session(ssl);
+    if (session == NULL)
+    {
+        return;
+    }
+    if (! sslSessionUsable(session))
+    {
+        SSL_SESSION_free(session);
+        return;
+    }
+    sslSessionStore(ssl, session, tid);
+}
+
+static void sslSessionUseTickets(SSL *ssl)
+{
+#ifdef HAVE_SESSION_TICKET
+    wolfSSL_UseSessionTicket(ssl);
+#else
+    (void) ssl;
+#endif
+}
+
+// call it after the sni is set, the ssl resumes the newest session of its sni if the worker has one
+static void sslSessionResume(SSL *ssl, uint8_t tid)
+{
+    ssl_session_cache_t *cache    = &ssl_session_caches[tid];
+    const SSL_CTX       *ctx      = SSL_get_SSL_CTX(ssl);
+    const hash_t         sni_hash = sslSessionSniHash(ssl);
+    ssl_session_entry_t *newest   = NULL;
+
+    for (unsigned int i = 0; i < kSslSessionCacheSize; i++)
+    {
+        ssl_session_entry_t *e = &cache->entries[i];
+        if (e->session == NULL || e->ctx != ctx || e->sni_hash != sni_hash)
+        {
+            continue;
+        }
+        if (! sslSessionUsable(e->session))
+        {
+            SSL_SESSION_free(e->session);
+            *e = (ssl_session_entry_t){0};
+            continue;
+        }
+        if (newest == NULL || e->seq > newest->seq)
+        {
+            newest = e;
+        }
+    }
+    if (newest != NULL)
+    {
+        SSL_set_session(ssl, newest->session);
+        SSL_SESSION_free(newest->session);
+        *newest = (ssl_session_entry_t){0};
+    }
+}
+
+static void sslTicketKeysRotate(ssl_ticket_keys_t *tk)
+{
+    // overwrites the oldest one
+    tk->current           = (tk->current + 1) % kSslTicketKeys;
+    ssl_ticket_key_t *key = &tk->keys[tk->current];
+    if (RAND_bytes((unsigned char *) key, sizeof(*key)) != 1)
+    {
+        LOGF("WolfSSL Error: could not make a session ticket key");
+        exit(1);
+    }
+    tk->rotated_at = time(NULL);
+}
+
+// the key for a new ticket (enc) or the one of the ticket, returns what the ticket key callback should return
+static int sslTicketKeyFor(SSL *ssl, unsigned char *key_name, int enc, ssl_ticket_key_t *key)
+{
+    ssl_ticket_keys_t *tk     = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    int                result = 0;
+
+    hmutex_lock(&tk->guard);
+    if (enc)
+    {
+        if (time(NULL) - tk->rotated_at >= (time_t) tk->rotation)
+        {
+            sslTicketKeysRotate(tk);
+        }
+        *key   = tk->keys[tk->current];
+        result = 1;
+    }
+    else
+    {
+        for (unsigned int i = 0; i < kSslTicketKeys; i++)
+        {
+            if (memcmp(tk->keys[i].name, key_name, kSslTicketKeyNameLen) == 0)
+            {
+                *key   = tk->keys[i];
+                // 2 renews the ticket (with the current key), tls 1.3 only sends a new ticket on a resumption if
+                // it is renewed and the clients use every ticket once
+                result = 2;
+                break;
+            }
+        }
+    }
+    hmutex_unlock(&tk->guard);
+    return result;
+}
+
+#ifdef HAVE_SESSION_TICKET
+static int onSslTicketKey(SSL *ssl, unsigned char *key_name, unsigned char *iv, EVP_CIPHER_CTX *cipher_ctx,
+                          HMAC_CTX *mac_ctx, int enc)
+{
+    ssl_ticket_key_t key;
+    const int        result = sslTicketKeyFor(ssl, key_name, enc, &key);
+    if (result == 0)
+    {
+        return 0; // unknown key, full handshake
+    }
+    if (enc)
+    {
+        memcpy(key_name, key.name, kSslTicketKeyNameLen);
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+        {
+            return -1;
+        }
+    }
+
+    const bool ok = EVP_CipherInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv, enc) == 1 &&
+                    HMAC_Init_ex(mac_ctx, key.hmac_key, sizeof(key.hmac_key), EVP_sha256(), NULL) == 1;
+    memset(&key, 0, sizeof(key));
+    return ok ? result : -1;
+}
+#endif
+
+static ssl_ticket_keys_t *newSslTicketKeys(SSL_CTX *ctx, unsigned int rotation)
+{
+    ssl_ticket_keys_t *tk = malloc(sizeof(ssl_ticket_keys_t));
+    memset(tk, 0, sizeof(ssl_ticket_keys_t));
+    hmutex_init(&tk->guard);
+    tk->rotation = rotation;
+    for (unsigned int i = 0; i < kSslTicketKeys; i++)
+    {
+        sslTicketKeysRotate(tk);
+    }
+
+    SSL_CTX_set_app_data(ctx, tk);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    // a ticket is decryptable until its key is the oldest one and rotates out
+    SSL_CTX_set_timeout(ctx, (long) rotation * (kSslTicketKeys - 1));
+#ifdef HAVE_SESSION_TICKET
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx, onSslTicketKey);
+#endif
+    return tk;
+}
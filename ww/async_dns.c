@@ -0,0 +1,1056 @@
+#include "async_dns.h"
+#include "buffer_pool.h"
+#include "hdef.h"
+#include "hsocket.h"
+#include "loggers/dns_logger.h"
+#include "utils/hashutils.h"
+#include "utils/sockutils.h"
+#include "ww.h"
+#include <stdio.h>
+#include <string.h>
+#if defined(OS_LINUX)
+#include <sys/random.h>
+#elif defined(OS_WIN)
+#include <bcrypt.h>
+#endif
+
+enum
+{
+    kDnsPort           = 53,
+    kDnsMaxServers     = 3,
+    kDnsMaxHosts       = 1024,
+    kDnsQueryTimeout   = 2000, // ms, for each attempt
+    kDnsMaxAttempts    = 4,    // attempts rotate between the servers
+    kDnsMinTtl         = 1,    // seconds, a ttl 0 answer must still survive until its waiters read it
+    kDnsMaxTtl         = 3600,
+    kDnsNegativeTtl    = 30, // nxdomain / no record, when the server sent no soa
+    kDnsMaxNegativeTtl = 300,
+    kDnsFailureTtl     = 5, // servfail, refused, timeout
+    kDnsCacheBaseSize  = 256,
+    kDnsHeaderSize     = 12,
+    kDnsMaxNameLen     = 253,
+    kDnsMaxLabelLen    = 63,
+    kDnsFlagResponse   = 0x8000,
+    kDnsFlagTruncated  = 0x0200,
+    kDnsFlagRecursion  = 0x0100,
+    kDnsRcodeNoError   = 0,
+    kDnsRcodeNxDomain  = 3,
+    kDnsTypeA          = 1,
+    kDnsTypeSoa        = 6,
+    kDnsTypeAAAA       = 28,
+    kDnsClassIn        = 1
+};
+
+enum dns_record_state
+{
+    kDnsRecordUnknown = 0,
+    kDnsRecordPositive,
+    kDnsRecordNegative
+};
+
+typedef struct dns_record_s
+{
+    enum dns_record_state state;
+    uint64_t              expire_at_ms;
+    sockaddr_u            address; // port is not used
+
+} dns_record_t;
+
+typedef struct dns_cache_entry_s
+{
+    struct dns_cache_entry_s *next; // another domain with the same hash
+    char                     *domain;
+    unsigned int              domain_len;
+    dns_record_t              v4;
+    dns_record_t              v6;
+
+} dns_cache_entry_t;
+
+typedef struct dns_host_s
+{
+    char        *domain;
+    unsigned int domain_len;
+    sockaddr_u   address;
+
+} dns_host_t;
+
+typedef struct dns_query_s
+{
+    dns_resolver_t      *resolver;
+    hio_t               *io;
+    htimer_t            *timer;
+    dns_waiter_t        *waiters;
+    sockaddr_u           server; // the one asked by the current attempt
+    char                *domain;
+    unsigned int         domain_len;
+    hash_t               domain_hash;
+    hash_t               key;
+    bool                 indexed;     // false only if another domain with the same key was already in flight
+    struct dns_query_s  *parked_next; // the ones that are not indexed are in the parked list of the resolver
+    struct dns_query_s **parked_link;
+    uint16_t             id;
+    uint16_t             qtype;
+    unsigned int         attempt;
+
+} dns_query_t;
+
+struct dns_waiter_s
+{
+    dns_waiter_t      *next;
+    dns_query_t       *query; // NULL while the query it was waiting on is dispatching its waiters
+    socket_context_t  *sctx;
+    hash_t             domain_hash;
+    DnsResolveCallBack cb;
+    void              *userdata;
+};
+
+typedef struct dns_answer_s
+{
+    unsigned int rcode;
+    bool         truncated;
+    bool         found;
+    sockaddr_u   address;
+    uint32_t     ttl;
+
+} dns_answer_t;
+
+#define i_TYPE hmap_dns_cache_t, uint64_t, struct dns_cache_entry_s * // NOLINT
+#include "stc/hmap.h"
+
+#define i_TYPE hmap_dns_queries_t, uint64_t, struct dns_query_s * // NOLINT
+#include "stc/hmap.h"
+
+struct dns_resolver_s
+{
+    hloop_t           *loop;
+    hmap_dns_cache_t   cache;
+    hmap_dns_queries_t queries;
+    dns_query_t       *parked;
+    size_t             cache_size; // entries, colliding ones included
+    size_t             cache_cap;
+    dns_host_t        *hosts;
+    unsigned int       hosts_count;
+    unsigned int       servers_count;
+    sockaddr_u         servers[kDnsMaxServers];
+};
+
+static enum dns_resolve_status resolveStep(dns_resolver_t *self, socket_context_t *sctx, hash_t domain_hash,
+                                           dns_query_t **query);
+
+static uint16_t readU16(const uint8_t *p)
+{
+    return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static uint32_t readU32(const uint8_t *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+static uint32_t clampTtl(uint32_t ttl, uint32_t max_ttl)
+{
+    return MIN(MAX(ttl, (uint32_t) kDnsMinTtl), max_ttl);
+}
+
+/*
+    resolv.conf and hosts are read once when the resolver is created, only "nameserver" lines are used
+    from resolv.conf, if there is none, 127.0.0.1 is used like glibc does
+*/
+static void loadServers(dns_resolver_t *self)
+{
+#ifdef OS_UNIX
+    FILE *f = fopen("/etc/resolv.conf", "r");
+    if (f)
+    {
+        char line[256];
+        while (self->servers_count < kDnsMaxServers && fgets(line, sizeof(line), f))
+        {
+            char ip[128];
+            if (sscanf(line, " nameserver %127s", ip) != 1 || ! is_ipaddr(ip))
+            {
+                continue;
+            }
+            sockaddr_u *server = &(self->servers[self->servers_count]);
+            memset(server, 0, sizeof(sockaddr_u));
+            if (sockaddr_set_ipport(server, ip, kDnsPort) == 0)
+            {
+                self->servers_count += 1;
+            }
+        }
+        fclose(f);
+    }
+#endif
+    if (self->servers_count == 0)
+    {
+        memset(&(self->servers[0]), 0, sizeof(sockaddr_u));
+        sockaddr_set_ipport(&(self->servers[0]), "127.0.0.1", kDnsPort);
+        self->servers_count = 1;
+    }
+}
+
+static void loadHosts(dns_resolver_t *self)
+{
+#ifdef OS_UNIX
+    FILE *f = fopen("/etc/hosts", "r");
+    if (f == NULL)
+    {
+        return;
+    }
+    char line[512];
+    while (self->hosts_count < kDnsMaxHosts && fgets(line, sizeof(line), f))
+    {
+        char *comment = strchr(line, '#');
+        if (comment)
+        {
+            *comment = '\0';
+        }
+        char      *saveptr = NULL;
+        const char *ip     = strtok_r(line, " \t\r\n", &saveptr);
+        sockaddr_u  address;
+        memset(&address, 0, sizeof(sockaddr_u));
+        if (ip == NULL || ! is_ipaddr(ip) || sockaddr_set_ip(&address, ip) != 0)
+        {
+            continue;
+        }
+        const char *name;
+        while (self->hosts_count < kDnsMaxHosts && (name = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL)
+        {
+            self->hosts = realloc(self->hosts, sizeof(dns_host_t) * (self->hosts_count + 1));
+            self->hosts[self->hosts_count] =
+                (dns_host_t){.domain = strdup(name), .domain_len = (unsigned int) strlen(name), .address = address};
+            self->hosts_count += 1;
+        }
+    }
+    fclose(f);
+#else
+    (void) self;
+#endif
+}
+
+static int familyOfType(uint16_t qtype)
+{
+    return qtype == kDnsTypeA ? AF_INET : AF_INET6;
+}
+
+// the ip versions a socket context accepts, in the order of preference
+static unsigned int typesOfStrategy(enum domain_strategy strategy, uint16_t types[2])
+{
+    switch (strategy)
+    {
+    case kDsOnlyIpV4:
+        types[0] = kDnsTypeA;
+        return 1;
+    case kDsOnlyIpV6:
+        types[0] = kDnsTypeAAAA;
+        return 1;
+    case kDsPreferIpV6:
+        types[0] = kDnsTypeAAAA;
+        types[1] = kDnsTypeA;
+        return 2;
+    default:
+    case kDsInvalid:
+    case kDsPreferIpV4:
+        types[0] = kDnsTypeA;
+        types[1] = kDnsTypeAAAA;
+        return 2;
+    }
+}
+
+// copies the ip into the context, the port of the context stays as it was
+static void setResolvedAddress(socket_context_t *sctx, const sockaddr_u *address)
+{
+    const in_port_t port = sctx->address.sin.sin_port; // same offset for v4 and v6
+    sctx->address              = *address; // family included, sockAddrCopy only copies the ip
+    sctx->address.sin.sin_port = port;
+    sctx->domain_resolved      = true;
+}
+
+static bool lookUpHosts(dns_resolver_t *self, socket_context_t *sctx, const uint16_t *types, unsigned int types_count)
+{
+    for (unsigned int t = 0; t < types_count; t++)
+    {
+        for (unsigned int i = 0; i < self->hosts_count; i++)
+        {
+            dns_host_t *host = &(self->hosts[i]);
+            if (host->address.sa.sa_family == familyOfType(types[t]) && host->domain_len == sctx->domain_len &&
+                strncasecmp(host->domain, sctx->domain, sctx->domain_len) == 0)
+            {
+                setResolvedAddress(sctx, &(host->address));
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// frees the entry and the ones that collided with it
+static void freeCacheEntries(dns_cache_entry_t *entry)
+{
+    while (entry)
+    {
+        dns_cache_entry_t *next = entry->next;
+        free(entry->domain);
+        free(entry);
+        entry = next;
+    }
+}
+
+static void flushCache(dns_resolver_t *self)
+{
+    c_foreach(k, hmap_dns_cache_t, self->cache)
+    {
+        freeCacheEntries(k.ref->second);
+    }
+    hmap_dns_cache_t_clear(&(self->cache));
+    self->cache_size = 0;
+}
+
+static dns_cache_entry_t *findCacheEntry(dns_resolver_t *self, const char *domain, unsigned int domain_len,
+                                         hash_t domain_hash)
+{
+    hmap_dns_cache_t_iter find_result = hmap_dns_cache_t_find(&(self->cache), domain_hash);
+    if (find_result.ref == hmap_dns_cache_t_end(&(self->cache)).ref)
+    {
+        return NULL;
+    }
+    for (dns_cache_entry_t *entry = find_result.ref->second; entry; entry = entry->next)
+    {
+        if (entry->domain_len == domain_len && memcmp(entry->domain, domain, domain_len) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// returns the entry of the domain, created if needed, the whole cache is flushed when it grows beyond its cap
+static dns_cache_entry_t *cacheEntryOf(dns_resolver_t *self, const char *domain, unsigned int domain_len,
+                                       hash_t domain_hash)
+{
+    dns_cache_entry_t *entry = findCacheEntry(self, domain, domain_len, domain_hash);
+    if (entry)
+    {
+        return entry;
+    }
+    if (self->cache_size >= self->cache_cap)
+    {
+        flushCache(self);
+    }
+
+    entry  = malloc(sizeof(dns_cache_entry_t));
+    *entry = (dns_cache_entry_t){.domain = strndup(domain, domain_len), .domain_len = domain_len};
+    self->cache_size += 1;
+
+    hmap_dns_cache_t_iter find_result = hmap_dns_cache_t_find(&(self->cache), domain_hash);
+    if (find_result.ref != hmap_dns_cache_t_end(&(self->cache)).ref)
+    {
+        // another domain with the same hash, both are kept
+        entry->next             = find_result.ref->second;
+        find_result.ref->second = entry;
+        return entry;
+    }
+    hmap_dns_cache_t_insert(&(self->cache), domain_hash, entry);
+    return entry;
+}
+
+static dns_record_t *recordOf(dns_cache_entry_t *entry, uint16_t qtype)
+{
+    return qtype == kDnsTypeA ? &(entry->v4) : &(entry->v6);
+}
+
+static void cacheRecord(dns_query_t *query, uint16_t qtype, enum dns_record_state state, const sockaddr_u *address,
+                        uint32_t ttl)
+{
+    dns_resolver_t    *self   = query->resolver;
+    dns_cache_entry_t *entry  = cacheEntryOf(self, query->domain, query->domain_len, query->domain_hash);
+    dns_record_t      *record = recordOf(entry, qtype);
+
+    record->state        = state;
+    record->expire_at_ms = hloop_now_ms(self->loop) + ((uint64_t) ttl * 1000);
+    if (address)
+    {
+        record->address = *address;
+    }
+}
+
+/*
+    tells where a socket context stands, resolved (the address is set), failed, or pending, in that case
+    qtype is the record that has to be asked
+*/
+static enum dns_resolve_status lookUp(dns_resolver_t *self, socket_context_t *sctx, hash_t domain_hash,
+                                      uint16_t *qtype)
+{
+    uint16_t           types[2];
+    const unsigned int types_count = typesOfStrategy(sctx->domain_strategy, types);
+
+    if (self->hosts_count > 0 && lookUpHosts(self, sctx, types, types_count))
+    {
+        return kDrsResolved;
+    }
+
+    dns_cache_entry_t *entry = findCacheEntry(self, sctx->domain, sctx->domain_len, domain_hash);
+    const uint64_t     now   = hloop_now_ms(self->loop);
+
+    for (unsigned int t = 0; t < types_count; t++)
+    {
+        dns_record_t *record = entry ? recordOf(entry, types[t]) : NULL;
+        if (record == NULL || record->state == kDnsRecordUnknown || record->expire_at_ms <= now)
+        {
+            *qtype = types[t];
+            return kDrsPending;
+        }
+        if (record->state == kDnsRecordPositive)
+        {
+            setResolvedAddress(sctx, &(record->address));
+            return kDrsResolved;
+        }
+        // negative, the next ip version (if it is accepted) may still have a record
+    }
+    return kDrsFailed;
+}
+
+static size_t writeQuestion(uint8_t *out, const char *domain, unsigned int domain_len, uint16_t id, uint16_t qtype)
+{
+    if (domain_len > 0 && domain[domain_len - 1] == '.')
+    {
+        domain_len -= 1;
+    }
+    if (domain_len == 0 || domain_len > kDnsMaxNameLen)
+    {
+        return 0;
+    }
+
+    memset(out, 0, kDnsHeaderSize);
+    out[0] = (uint8_t) (id >> 8);
+    out[1] = (uint8_t) id;
+    out[2] = (uint8_t) (kDnsFlagRecursion >> 8);
+    out[5] = 1; // qdcount
+
+    size_t       pos   = kDnsHeaderSize;
+    unsigned int start = 0;
+    for (unsigned int i = 0; i <= domain_len; i++)
+    {
+        if (i == domain_len || domain[i] == '.')
+        {
+            const unsigned int label_len = i - start;
+            if (label_len == 0 || label_len > kDnsMaxLabelLen)
+            {
+                return 0;
+            }
+            out[pos++] = (uint8_t) label_len;
+            memcpy(out + pos, domain + start, label_len);
+            pos += label_len;
+            start = i + 1;
+        }
+    }
+    out[pos++] = 0;
+    out[pos++] = (uint8_t) (qtype >> 8);
+    out[pos++] = (uint8_t) qtype;
+    out[pos++] = 0;
+    out[pos++] = kDnsClassIn;
+    return pos;
+}
+
+static bool skipName(const uint8_t *msg, size_t len, size_t *pos)
+{
+    while (*pos < len)
+    {
+        const uint8_t label_len = msg[*pos];
+        if ((label_len & 0xC0) == 0xC0)
+        {
+            *pos += 2; // compression pointer, always ends the name
+            return *pos <= len;
+        }
+        if (label_len & 0xC0)
+        {
+            return false;
+        }
+        *pos += 1 + (size_t) label_len;
+        if (label_len == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the question name must be the domain of the query, labels are compared case insensitive (servers may echo it
+// in another case, rfc 4343), a compression pointer in the question is not accepted
+static bool matchName(const uint8_t *msg, size_t len, size_t *pos, const char *domain, unsigned int domain_len)
+{
+    if (domain_len > 0 && domain[domain_len - 1] == '.')
+    {
+        domain_len -= 1;
+    }
+    unsigned int d = 0;
+    while (*pos < len)
+    {
+        const uint8_t label_len = msg[*pos];
+        *pos += 1;
+        if (label_len == 0)
+        {
+            return d == domain_len + 1;
+        }
+        if ((label_len & 0xC0) || *pos + label_len > len || d + label_len > domain_len)
+        {
+            return false;
+        }
+        if (strncasecmp((const char *) msg + *pos, domain + d, label_len) != 0)
+        {
+            return false;
+        }
+        d += label_len;
+        if (d < domain_len && domain[d] != '.')
+        {
+            return false;
+        }
+        d += 1; // the dot, or one past the end after the last label
+        *pos += label_len;
+    }
+    return false;
+}
+
+/*
+    only the things the cache needs are taken from the response: the first record of the asked type and the
+    smallest ttl of the answer section (cname chains included), or the negative ttl from the soa when there is
+    no such record
+
+    returns false if the packet is malformed or not the response of this query (id, question name and type)
+*/
+static bool parseResponse(const dns_query_t *query, const uint8_t *msg, size_t len, dns_answer_t *answer)
+{
+    if (len < kDnsHeaderSize || readU16(msg) != query->id || ! (readU16(msg + 2) & kDnsFlagResponse))
+    {
+        return false;
+    }
+    const unsigned int qdcount = readU16(msg + 4);
+    const unsigned int ancount = readU16(msg + 6);
+    const unsigned int nscount = readU16(msg + 8);
+
+    *answer = (dns_answer_t){.rcode     = readU16(msg + 2) & 0xF,
+                             .truncated = (readU16(msg + 2) & kDnsFlagTruncated) != 0,
+                             .found     = false,
+                             .ttl       = UINT32_MAX};
+
+    size_t pos = kDnsHeaderSize;
+    if (qdcount != 1 || ! matchName(msg, len, &pos, query->domain, query->domain_len) || pos + 4 > len ||
+        readU16(msg + pos) != query->qtype || readU16(msg + pos + 2) != kDnsClassIn)
+    {
+        return false;
+    }
+    pos += 4;
+    if (answer->truncated)
+    {
+        return true; // the rest may be cut anywhere, the caller does not use it
+    }
+
+    for (unsigned int i = 0; i < ancount; i++)
+    {
+        if (! skipName(msg, len, &pos) || pos + 10 > len)
+        {
+            return false;
+        }
+        const uint16_t type   = readU16(msg + pos);
+        const uint16_t class  = readU16(msg + pos + 2);
+        const uint32_t ttl    = readU32(msg + pos + 4);
+        const uint16_t rd_len = readU16(msg + pos + 8);
+        pos += 10;
+        if (pos + rd_len > len)
+        {
+            return false;
+        }
+        answer->ttl = MIN(answer->ttl, ttl);
+
+        if (! answer->found && class == kDnsClassIn && type == query->qtype)
+        {
+            memset(&(answer->address), 0, sizeof(sockaddr_u));
+            if (type == kDnsTypeA && rd_len == 4)
+            {
+                answer->address.sin.sin_family = AF_INET;
+                memcpy(&(answer->address.sin.sin_addr), msg + pos, 4);
+                answer->found = true;
+            }
+            else if (type == kDnsTypeAAAA && rd_len == 16)
+            {
+                answer->address.sin6.sin6_family = AF_INET6;
+                memcpy(&(answer->address.sin6.sin6_addr), msg + pos, 16);
+                answer->found = true;
+            }
+        }
+        pos += rd_len;
+    }
+
+    if (answer->found)
+    {
+        return true;
+    }
+
+    // negative answer, its ttl is min(soa ttl, soa minimum) (rfc 2308), a broken authority section is not fatal
+    answer->ttl = kDnsNegativeTtl;
+    for (unsigned int i = 0; i < nscount; i++)
+    {
+        if (! skipName(msg, len, &pos) || pos + 10 > len)
+        {
+            break;
+        }
+        const uint16_t type   = readU16(msg + pos);
+        const uint32_t ttl    = readU32(msg + pos + 4);
+        const uint16_t rd_len = readU16(msg + pos + 8);
+        pos += 10;
+        if (pos + rd_len > len)
+        {
+            break;
+        }
+        size_t rd_pos = pos;
+        if (type == kDnsTypeSoa && skipName(msg, len, &rd_pos) && skipName(msg, len, &rd_pos) && rd_pos + 20 <= len)
+        {
+            answer->ttl = MIN(ttl, readU32(msg + rd_pos + 16));
+            break;
+        }
+        pos += rd_len;
+    }
+    return true;
+}
+
+static void closeQueryIo(dns_query_t *query)
+{
+    if (query->timer)
+    {
+        htimer_del(query->timer);
+        query->timer = NULL;
+    }
+    if (query->io)
+    {
+        hevent_set_userdata(query->io, NULL);
+        hio_close(query->io);
+        query->io = NULL;
+    }
+}
+
+static void onQueryTimeout(htimer_t *timer);
+static void onQueryResponse(hio_t *io, shift_buffer_t *buf);
+
+// the id is what an off path attacker has to guess (with the source port), it must not be predictable
+static uint16_t newQueryId(void)
+{
+    uint16_t id = 0;
+#if defined(OS_LINUX)
+    if (getrandom(&id, sizeof(id), 0) == (ssize_t) sizeof(id))
+    {
+        return id;
+    }
+#elif defined(OS_DARWIN) || defined(OS_BSD)
+    arc4random_buf(&id, sizeof(id));
+    return id;
+#elif defined(OS_WIN)
+    if (BCRYPT_SUCCESS(BCryptGenRandom(NULL, (PUCHAR) &id, sizeof(id), BCRYPT_USE_SYSTEM_PREFERRED_RNG)))
+    {
+        return id;
+    }
+#endif
+    LOGF("AsyncDns: no secure random source for the query id");
+    exit(1);
+}
+
+/*
+    every attempt uses a new socket (new source port) and a new random id, the answer must come from the
+    server that was asked and carry the same id and question
+*/
+static bool sendAttempt(dns_query_t *query)
+{
+    dns_resolver_t *self   = query->resolver;
+    sockaddr_u     *server = &(query->server);
+    *server                = self->servers[query->attempt % self->servers_count];
+
+    int sockfd = socket(server->sa.sa_family, SOCK_DGRAM, 0);
+    if (sockfd < 0)
+    {
+        LOGE("AsyncDns: socket fd < 0");
+        return false;
+    }
+
+    query->id = newQueryId();
+
+    buffer_pool_t  *pool = hloop_bufferpool(self->loop);
+    shift_buffer_t *buf  = popBuffer(pool);
+    reserveBufSpace(buf, kDnsHeaderSize + kDnsMaxNameLen + 8);
+    const size_t size = writeQuestion(rawBufMut(buf), query->domain, query->domain_len, query->id, query->qtype);
+    if (size == 0)
+    {
+        LOGE("AsyncDns: invalid domain name %.*s", (int) query->domain_len, query->domain);
+        reuseBuffer(pool, buf);
+        closesocket(sockfd);
+        return false;
+    }
+    setLen(buf, (unsigned int) size);
+
+    hio_t *io = hio_get(self->loop, sockfd);
+    assert(io != NULL);
+    hio_set_peeraddr(io, &(server->sa), (int) sockaddr_len(server));
+    hevent_set_userdata(io, query);
+    hio_setcb_read(io, onQueryResponse);
+    hio_read(io);
+    hio_write(io, buf);
+
+    query->io    = io;
+    query->timer = htimer_add(self->loop, onQueryTimeout, kDnsQueryTimeout, 1);
+    hevent_set_userdata(query->timer, query);
+    return true;
+}
+
+// tries the remaining attempts, false means all of them are used
+static bool nextAttempt(dns_query_t *query)
+{
+    closeQueryIo(query);
+    while (query->attempt < kDnsMaxAttempts)
+    {
+        const bool sent = sendAttempt(query);
+        query->attempt += 1;
+        if (sent)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void unIndexQuery(dns_query_t *query)
+{
+    if (query->indexed)
+    {
+        dns_resolver_t            *self        = query->resolver;
+        hmap_dns_queries_t_iter    find_result = hmap_dns_queries_t_find(&(self->queries), query->key);
+        assert(find_result.ref != hmap_dns_queries_t_end(&(self->queries)).ref);
+        hmap_dns_queries_t_erase_at(&(self->queries), find_result);
+        query->indexed = false;
+    }
+    else if (query->parked_link)
+    {
+        *(query->parked_link) = query->parked_next;
+        if (query->parked_next)
+        {
+            query->parked_next->parked_link = query->parked_link;
+        }
+        query->parked_link = NULL;
+    }
+}
+
+static void freeQuery(dns_query_t *query)
+{
+    unIndexQuery(query);
+    closeQueryIo(query);
+    free(query->domain);
+    free(query);
+}
+
+/*
+    the query is done and its result is in the cache, every waiter looks at the cache again, it is either done
+    or it needs the other ip version and waits on another query
+
+    callbacks may cancel waiters of this same list, those are only marked (cb = NULL) and freed here
+*/
+static void completeQuery(dns_query_t *query)
+{
+    dns_resolver_t *self    = query->resolver;
+    dns_waiter_t   *waiters = query->waiters;
+    for (dns_waiter_t *w = waiters; w; w = w->next)
+    {
+        w->query = NULL;
+    }
+    freeQuery(query);
+
+    while (waiters)
+    {
+        dns_waiter_t *waiter = waiters;
+        waiters              = waiter->next;
+        if (waiter->cb == NULL)
+        {
+            free(waiter);
+            continue;
+        }
+
+        dns_query_t                  *next_query = NULL;
+        const enum dns_resolve_status status     = resolveStep(self, waiter->sctx, waiter->domain_hash, &next_query);
+        if (status == kDrsPending)
+        {
+            waiter->query       = next_query;
+            waiter->next        = next_query->waiters;
+            next_query->waiters = waiter;
+            continue;
+        }
+        waiter->cb(waiter->sctx, status == kDrsResolved, waiter->userdata);
+        free(waiter);
+    }
+}
+
+static void failQuery(dns_query_t *query)
+{
+    LOGE("AsyncDns: resolve failed  %.*s", (int) query->domain_len, query->domain);
+    cacheRecord(query, query->qtype, kDnsRecordNegative, NULL, kDnsFailureTtl);
+    completeQuery(query);
+}
+
+static void onQueryTimeout(htimer_t *timer)
+{
+    dns_query_t *query = hevent_userdata(timer);
+    query->timer       = NULL; // a timer with repeat 1 is freed by the loop after this callback
+
+    LOGW("AsyncDns: query for %.*s timed out", (int) query->domain_len, query->domain);
+    if (! nextAttempt(query))
+    {
+        failQuery(query);
+    }
+}
+
+static void onQueryResponse(hio_t *io, shift_buffer_t *buf)
+{
+    dns_query_t   *query = hevent_userdata(io);
+    buffer_pool_t *pool  = hloop_bufferpool(hevent_loop(io));
+    if (query == NULL)
+    {
+        reuseBuffer(pool, buf);
+        return;
+    }
+
+    sockaddr_u  *from = (sockaddr_u *) hio_peeraddr(io); // recvfrom wrote the sender there
+    dns_answer_t answer;
+
+    const bool accepted = sockAddrCmpIP(from, &(query->server)) &&
+                          sockaddr_port(from) == sockaddr_port(&(query->server)) &&
+                          parseResponse(query, rawBuf(buf), bufLen(buf), &answer);
+    reuseBuffer(pool, buf);
+    if (! accepted)
+    {
+        return; // keep waiting for the real answer
+    }
+    if (answer.truncated)
+    {
+        // no tcp fallback, a cut answer is not cached (not even as negative), the next attempt may fit
+        LOGW("AsyncDns: truncated answer for %.*s", (int) query->domain_len, query->domain);
+        if (! nextAttempt(query))
+        {
+            failQuery(query);
+        }
+        return;
+    }
+    if (answer.rcode != kDnsRcodeNoError && answer.rcode != kDnsRcodeNxDomain)
+    {
+        LOGW("AsyncDns: server refused %.*s with rcode %u", (int) query->domain_len, query->domain, answer.rcode);
+        if (! nextAttempt(query))
+        {
+            failQuery(query);
+        }
+        return;
+    }
+
+    if (answer.found)
+    {
+        cacheRecord(query, query->qtype, kDnsRecordPositive, &answer.address, clampTtl(answer.ttl, kDnsMaxTtl));
+        if (logger_will_write_level(getDnsLogger(), (log_level_e) LOG_LEVEL_INFO))
+        {
+            char ip[64];
+            sockaddr_ip(&answer.address, ip, 64);
+            LOGI("AsyncDns: %.*s resolved to %s", (int) query->domain_len, query->domain, ip);
+        }
+    }
+    else
+    {
+        const uint32_t ttl = clampTtl(answer.ttl, kDnsMaxNegativeTtl);
+        cacheRecord(query, query->qtype, kDnsRecordNegative, NULL, ttl);
+        if (answer.rcode == kDnsRcodeNxDomain)
+        {
+            // the domain does not exist at all, no need to ask the other ip version
+            cacheRecord(query, query->qtype == kDnsTypeA ? kDnsTypeAAAA : kDnsTypeA, kDnsRecordNegative, NULL, ttl);
+        }
+        LOGD("AsyncDns: %.*s has no record of type %u", (int) query->domain_len, query->domain, query->qtype);
+    }
+    completeQuery(query);
+}
+
+static hash_t queryKey(hash_t domain_hash, uint16_t qtype)
+{
+    return domain_hash ^ ((hash_t) qtype * 0x9E3779B97F4A7C15ULL);
+}
+
+// the running query of this domain and type, or a new one, NULL if it could not be sent (failure is cached)
+static dns_query_t *queryFor(dns_resolver_t *self, socket_context_t *sctx, hash_t domain_hash, uint16_t qtype)
+{
+    const hash_t            key         = queryKey(domain_hash, qtype);
+    hmap_dns_queries_t_iter find_result = hmap_dns_queries_t_find(&(self->queries), key);
+    bool                    can_index   = true;
+
+    if (find_result.ref != hmap_dns_queries_t_end(&(self->queries)).ref)
+    {
+        dns_query_t *running = find_result.ref->second;
+        if (running->domain_len == sctx->domain_len && memcmp(running->domain, sctx->domain, sctx->domain_len) == 0)
+        {
+            return running;
+        }
+        can_index = false;
+        for (dns_query_t *parked = self->parked; parked; parked = parked->parked_next)
+        {
+            if (parked->key == key && parked->domain_len == sctx->domain_len &&
+                memcmp(parked->domain, sctx->domain, sctx->domain_len) == 0)
+            {
+                return parked;
+            }
+        }
+    }
+
+    dns_query_t *query = malloc(sizeof(dns_query_t));
+    *query             = (dns_query_t){.resolver    = self,
+                                       .domain      = strndup(sctx->domain, sctx->domain_len),
+                                       .domain_len  = sctx->domain_len,
+                                       .domain_hash = domain_hash,
+                                       .key         = key,
+                                       .indexed     = can_index,
+                                       .qtype       = qtype};
+    if (can_index)
+    {
+        hmap_dns_queries_t_insert(&(self->queries), key, query);
+    }
+    else
+    {
+        query->parked_next = self->parked;
+        query->parked_link = &(self->parked);
+        if (self->parked)
+        {
+            self->parked->parked_link = &(query->parked_next);
+        }
+        self->parked = query;
+    }
+
+    if (! nextAttempt(query))
+    {
+        LOGE("AsyncDns: resolve failed  %.*s", (int) query->domain_len, query->domain);
+        cacheRecord(query, qtype, kDnsRecordNegative, NULL, kDnsFailureTtl);
+        freeQuery(query);
+        return NULL;
+    }
+    return query;
+}
+
+static enum dns_resolve_status resolveStep(dns_resolver_t *self, socket_context_t *sctx, hash_t domain_hash,
+                                           dns_query_t **query)
+{
+    while (true)
+    {
+        uint16_t                      qtype  = 0;
+        const enum dns_resolve_status status = lookUp(self, sctx, domain_hash, &qtype);
+        if (status != kDrsPending)
+        {
+            return status;
+        }
+        *query = queryFor(self, sctx, domain_hash, qtype);
+        if (*query)
+        {
+            return kDrsPending;
+        }
+        // the failure of that type is cached now, so the next look moves on
+    }
+}
+
+enum dns_resolve_status resolveContextAsync(socket_context_t *sctx, uint8_t tid, DnsResolveCallBack cb,
+                                            void *userdata, dns_waiter_t **waiter)
+{
+    // please check these before calling this function -> more performance
+    assert(sctx->address_type == kSatDomainName && sctx->domain_resolved == false && sctx->domain != NULL);
+    assert(cb != NULL);
+
+    dns_resolver_t *self        = dns_resolvers[tid];
+    const hash_t    domain_hash = CALC_HASH_BYTES(sctx->domain, sctx->domain_len);
+    dns_query_t    *query       = NULL;
+    *waiter                     = NULL;
+
+    const enum dns_resolve_status status = resolveStep(self, sctx, domain_hash, &query);
+    if (status != kDrsPending)
+    {
+        return status;
+    }
+
+    dns_waiter_t *w = malloc(sizeof(dns_waiter_t));
+    *w              = (dns_waiter_t){.next        = query->waiters,
+                                     .query       = query,
+                                     .sctx        = sctx,
+                                     .domain_hash = domain_hash,
+                                     .cb          = cb,
+                                     .userdata    = userdata};
+    query->waiters  = w;
+    *waiter         = w;
+    return kDrsPending;
+}
+
+void cancelDnsWaiter(dns_waiter_t *waiter)
+{
+    dns_query_t *query = waiter->query;
+    if (query == NULL)
+    {
+        waiter->cb = NULL; // its query is dispatching, it frees the waiter
+        return;
+    }
+    dns_waiter_t **link = &(query->waiters);
+    while (*link != waiter)
+    {
+        assert(*link != NULL);
+        link = &((*link)->next);
+    }
+    *link = waiter->next;
+    free(waiter);
+    // the query keeps running with no waiter, its answer still fills the cache
+}
+
+void setDnsResolverServers(dns_resolver_t *self, const sockaddr_u *servers, unsigned int count)
+{
+    assert(count > 0);
+    self->servers_count = MIN(count, (unsigned int) kDnsMaxServers);
+    memcpy(self->servers, servers, sizeof(sockaddr_u) * self->servers_count);
+}
+
+dns_resolver_t *newDnsResolver(hloop_t *loop)
+{
+    dns_resolver_t *self = malloc(sizeof(dns_resolver_t));
+    *self                = (dns_resolver_t){.loop      = loop,
+                                            .cache     = hmap_dns_cache_t_with_capacity(kDnsCacheBaseSize),
+                                            .queries   = hmap_dns_queries_t_with_capacity(16),
+                                            .cache_cap = kDnsCacheBaseSize + ((size_t) 8 * ram_profile),
+                                            .hosts     = NULL};
+    loadServers(self);
+    loadHosts(self);
+    return self;
+}
+
+static void freeQueryWithWaiters(dns_query_t *query)
+{
+    while (query->waiters)
+    {
+        dns_waiter_t *waiter = query->waiters;
+        query->waiters       = waiter->next;
+        free(waiter);
+    }
+    freeQuery(query);
+}
+
+void destroyDnsResolver(dns_resolver_t *self)
+{
+    c_foreach(k, hmap_dns_queries_t, self->queries)
+    {
+        dns_query_t *query = k.ref->second;
+        query->indexed     = false; // the map is dropped as a whole
+        freeQueryWithWaiters(query);
+    }
+    hmap_dns_queries_t_drop(&(self->queries));
+    while (self->parked)
+    {
+        freeQueryWithWaiters(self->parked);
+    }
+
+    flushCache(self);
+    hmap_dns_cache_t_drop(&(self->cache));
+
+    for (unsigned int i = 0; i < self->hosts_count; i++)
+    {
+        free(self->hosts[i].domain);
+    }
+    free(self->hosts);
+    free(self);
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "basic_types.h"
+#include "hloop.h"
+
+/*
+    Non blocking dns resolver
+
+    every worker has its own resolver (see dns_resolvers in ww.h), queries are plain udp dns packets sent
+    to the nameservers of /etc/resolv.conf and the answers are read by the worker eventloop, so a slow
+    resolution only delays the line that asked for it
+
+    the resolver keeps a threadlocal cache, positive answers live for their ttl and failures
+    (nxdomain / no such record / no answer) are cached too for a short while, /etc/hosts is also
+    consulted before the cache just like getaddrinfo would do
+
+    the ip version is chosen by domain_strategy of the socket context (prefer/only v4 or v6), with
+    prefer, the other version is asked if the preferred one has no record
+
+    the same domain asked by many lines at once results in only one query, every line is a waiter
+    on that query
+
+    usage:
+
+        switch (resolveContextAsync(sctx, tid, callback, userdata, &waiter))
+        {
+        case kDrsResolved: // done, sctx->address is ready (cache / hosts)
+        case kDrsFailed:   // done, unresolvable (cached failure)
+        case kDrsPending:  // callback is called later on the same thread, keep the waiter to cancel it
+        }
+
+    the waiter must be canceled if the line is destroyed before the callback, a waiter is freed right
+    after its callback returns
+*/
+
+typedef struct dns_resolver_s dns_resolver_t;
+typedef struct dns_waiter_s   dns_waiter_t;
+
+typedef void (*DnsResolveCallBack)(socket_context_t *sctx, bool success, void *userdata);
+
+enum dns_resolve_status
+{
+    kDrsResolved,
+    kDrsFailed,
+    kDrsPending
+};
+
+dns_resolver_t *newDnsResolver(hloop_t *loop);
+void            destroyDnsResolver(dns_resolver_t *self);
+
+// replaces the nameservers found in resolv.conf, must be called on the resolver thread (or before it runs)
+void setDnsResolverServers(dns_resolver_t *self, const sockaddr_u *servers, unsigned int count);
+
+enum dns_resolve_status resolveContextAsync(socket_context_t *sctx, uint8_t tid, DnsResolveCallBack cb,
+                                            void *userdata, dns_waiter_t **waiter);
+void                    cancelDnsWaiter(dns_waiter_t *waiter);
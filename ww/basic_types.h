@@ -113,15 +113,15 @@ enum socket_address_protocol
     kSapUdp = IPPROTO_UDP,
 };
 
-// all data we need to connect to somewhere
+// all data we need to connect to somewhere, every line has 2 of these so the fields are ordered to leave no holes
 typedef struct socket_context_s
 {
-    enum socket_address_protocol address_protocol;
-    enum socket_address_type     address_type;
-    sockaddr_u                   address;
     char                        *domain;
+    sockaddr_u                   address;
     unsigned int                 domain_len;
-    bool                         domain_constant;
+    enum socket_address_protocol address_protocol;
+    enum socket_address_type     address_type;
     enum domain_strategy         domain_strategy;
+    bool                         domain_constant;
     bool                         domain_resolved;
 } socket_context_t;
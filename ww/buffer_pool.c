@@ -1,4 +1,5 @@
 #include "buffer_pool.h"
+#include "buffer_slab.h"
 #include "hplatform.h"
 #ifdef OS_LINUX
 #include <malloc.h>
@@ -34,77 +35,171 @@
 
 #define BUFFER_SIZE_SMALL (1U << 12) // 4k
 
+// the smaller classes, the largest class of a pool is its own buffers_size
+#define BUFFER_CLASS_TINY (1U << 9)  // 512 (keepalives, dns sized datagrams, small frames)
+#define BUFFER_CLASS_MID  (1U << 12) // 4k
+
+// slab mode is selected at build time (cmake option SLAB_BUFFER_POOL)
+#ifdef SLAB_BUFFER_POOL
+static const bool kSlabBufferPool = true;
+#else
+static const bool kSlabBufferPool = false;
+#endif
+
 // NOLINTEND
 
-struct buffer_pool_s
+typedef struct buffer_class_s
 {
     unsigned int len;
     unsigned int cap;
     unsigned int free_threshould;
     unsigned int buffers_size;
+    unsigned int real_cap;  // payload cap of the buffers of this class (buffers_size + prepadding)
+    unsigned int allocated; // buffers this class made and did not free, handed out or not
+    uint64_t     pops;
+    uint64_t     misses;
+    // non null when the pool is in slab mode, buffers are carved from per worker arenas
+    buffer_slab_allocator_t *slabs;
+    shift_buffer_t         **available;
+
+} buffer_class_t;
+
+struct buffer_pool_s
+{
+    unsigned int   classes_count;
+    buffer_class_t classes[kBufferPoolMaxClasses]; // smallest first, the last one is what popBuffer() gives
 #if defined(DEBUG) && defined(BUFFER_POOL_DEBUG)
     atomic_size_t in_use;
 #endif
-    shift_buffer_t *available[];
+    shift_buffer_t *available[]; // the classes carve their containers out of this
 };
 
-static void firstCharge(buffer_pool_t *pool)
+static shift_buffer_t *newPoolBuffer(buffer_class_t *bclass)
+{
+    if (bclass->slabs)
+    {
+        return newShiftBufferInSlab(bclass->slabs);
+    }
+    return newShiftBuffer(bclass->buffers_size);
+}
+
+static void firstCharge(buffer_class_t *bclass)
 {
-    for (size_t i = 0; i < (pool->cap / 2); i++)
+    for (size_t i = 0; i < (bclass->cap / 2); i++)
     {
-        pool->available[i] = newShiftBuffer(pool->buffers_size);
+        bclass->available[i] = newPoolBuffer(bclass);
     }
-    pool->len = pool->cap / 2;
+    bclass->len       = bclass->cap / 2;
+    bclass->allocated = bclass->len;
 }
 
-static void reCharge(buffer_pool_t *pool)
+static void reCharge(buffer_class_t *bclass)
 {
-    const size_t increase = min((pool->cap - pool->len), pool->cap / 2);
+    const size_t increase = min((bclass->cap - bclass->len), bclass->cap / 2);
 
-    for (size_t i = pool->len; i < (pool->len + increase); i++)
+    for (size_t i = bclass->len; i < (bclass->len + increase); i++)
     {
-        pool->available[i] = newShiftBuffer(pool->buffers_size);
+        bclass->available[i] = newPoolBuffer(bclass);
     }
-    pool->len += increase;
+    bclass->len += increase;
+    bclass->allocated += increase;
 #if defined(DEBUG) && defined(BUFFER_POOL_DEBUG)
-    LOGD("BufferPool: allocated %d new buffers, %zu are in use", increase, pool->in_use);
+    LOGD("BufferPool: allocated %d new buffers of %u bytes", increase, bclass->buffers_size);
 #endif
 }
 
-static void giveMemBackToOs(buffer_pool_t *pool)
+static void giveMemBackToOs(buffer_class_t *bclass)
 {
-    const size_t decrease = min(pool->len, pool->cap / 2);
+    const size_t decrease = min(bclass->len, bclass->cap / 2);
 
-    for (size_t i = pool->len - decrease; i < pool->len; i++)
+    for (size_t i = bclass->len - decrease; i < bclass->len; i++)
     {
-        destroyShiftBuffer(pool->available[i]);
+        destroyShiftBuffer(bclass->available[i]);
+    }
+    bclass->len -= decrease;
+    bclass->allocated -= decrease;
+
+    if (bclass->slabs)
+    {
+        collectBufferSlabs(bclass->slabs);
     }
-    pool->len -= decrease;
 
 #if defined(DEBUG) && defined(BUFFER_POOL_DEBUG)
-    LOGD("BufferPool: freed %d buffers, %zu are in use", decrease, pool->in_use);
+    LOGD("BufferPool: freed %d buffers of %u bytes", decrease, bclass->buffers_size);
 #endif
 #ifdef OS_LINUX
     // malloc_trim(0);
 #endif
 }
 
-shift_buffer_t *popBuffer(buffer_pool_t *pool)
+unsigned int bufferPoolClassCount(buffer_pool_t *pool)
+{
+    return pool->classes_count;
+}
+
+unsigned int bufferPoolClassSize(buffer_pool_t *pool, unsigned int class_index)
 {
+    assert(class_index < pool->classes_count);
+    return pool->classes[class_index].buffers_size;
+}
+
+shift_buffer_t *popBufferOfClass(buffer_pool_t *pool, unsigned int class_index)
+{
+    assert(class_index < pool->classes_count);
+    buffer_class_t *bclass = &(pool->classes[class_index]);
+
 #if defined(DEBUG) && defined(BYPASS_BUFFERPOOL)
-    return newShiftBuffer(pool->buffers_size);
+    return newPoolBuffer(bclass);
 #endif
 
-    if (pool->len <= 0)
+    bclass->pops += 1;
+    if (bclass->len <= 0)
     {
-        reCharge(pool);
+        bclass->misses += 1;
+        reCharge(bclass);
     }
 
 #if defined(DEBUG) && defined(BUFFER_POOL_DEBUG)
     pool->in_use += 1;
 #endif
-    --(pool->len);
-    return pool->available[pool->len];
+    --(bclass->len);
+    return bclass->available[bclass->len];
+}
+
+shift_buffer_t *popBuffer(buffer_pool_t *pool)
+{
+    return popBufferOfClass(pool, pool->classes_count - 1);
+}
+
+// the class that can take the buffer back without a new payload, reset() prefers the payload the header was
+// born with, so that one is checked first, a buffer that matches no class (expanded) goes to the largest one
+static buffer_class_t *classOfBuffer(buffer_pool_t *pool, shift_buffer_t *b)
+{
+    if (b->slot_header)
+    {
+        buffer_slot_t *home = slotOfHeader(b);
+        if ((atomic_load_explicit(&home->refc, memory_order_relaxed) & kShiftBufferRefcMask) == 0 ||
+            &(home->refc) == b->refc)
+        {
+            const unsigned int home_cap = slotPayloadCap(home);
+            for (unsigned int i = 0; i < pool->classes_count; i++)
+            {
+                if (pool->classes[i].real_cap == home_cap)
+                {
+                    return &(pool->classes[i]);
+                }
+            }
+        }
+    }
+    const unsigned int payload_cap = slotPayloadCap(slotOfRefc(b->refc));
+    for (unsigned int i = 0; i < pool->classes_count; i++)
+    {
+        if (pool->classes[i].real_cap == payload_cap)
+        {
+            return &(pool->classes[i]);
+        }
+    }
+    return &(pool->classes[pool->classes_count - 1]);
 }
 
 void reuseBuffer(buffer_pool_t *pool, shift_buffer_t *b)
@@ -122,12 +217,27 @@ void reuseBuffer(buffer_pool_t *pool, shift_buffer_t *b)
 #if defined(DEBUG) && defined(BUFFER_POOL_DEBUG)
     pool->in_use -= 1;
 #endif
-    if (pool->len > pool->free_threshould)
+    buffer_class_t *bclass = classOfBuffer(pool, b);
+    if (bclass->len > bclass->free_threshould)
+    {
+        giveMemBackToOs(bclass);
+    }
+    reset(b, bclass->buffers_size);
+    bclass->available[(bclass->len)++] = b;
+}
+
+pool_stats_t getBufferPoolStats(buffer_pool_t *pool)
+{
+    pool_stats_t stats = {0};
+    for (unsigned int i = 0; i < pool->classes_count; i++)
     {
-        giveMemBackToOs(pool);
+        buffer_class_t *bclass = &(pool->classes[i]);
+        stats.available += bclass->len;
+        stats.allocated += bclass->allocated;
+        stats.hits += bclass->pops - bclass->misses;
+        stats.misses += bclass->misses;
     }
-    reset(b, pool->buffers_size);
-    pool->available[(pool->len)++] = b;
+    return stats;
 }
 
 shift_buffer_t *appendBufferMerge(buffer_pool_t *pool, shift_buffer_t *restrict b1, shift_buffer_t *restrict b2)
@@ -146,7 +256,7 @@ shift_buffer_t *appendBufferMerge(buffer_pool_t *pool, shift_buffer_t *restrict
     return b2;
 }
 
-static buffer_pool_t *allocBufferPool(unsigned long bufcount, unsigned int buffer_size) // NOLINT
+static buffer_pool_t *allocBufferPool(unsigned long bufcount, unsigned int buffer_size, bool slab_mode) // NOLINT
 {
     // stop using pool if you want less, simply uncomment lines in popbuffer and reuseBuffer
     assert(bufcount >= 1);
@@ -154,25 +264,58 @@ static buffer_pool_t *allocBufferPool(unsigned long bufcount, unsigned int buffe
     // half of the pool is used, other half is free at startup
     bufcount = 2 * bufcount;
 
-    const unsigned long container_len = bufcount * sizeof(shift_buffer_t *);
+    // smaller classes only where they are really smaller
+    unsigned int       sizes[kBufferPoolMaxClasses];
+    unsigned int       classes_count = 0;
+    const unsigned int candidates[]  = {BUFFER_CLASS_TINY, BUFFER_CLASS_MID};
+    for (unsigned int i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++)
+    {
+        if (candidates[i] < buffer_size)
+        {
+            sizes[classes_count++] = candidates[i];
+        }
+    }
+    sizes[classes_count++] = buffer_size;
+
+    const unsigned long container_len = classes_count * bufcount * sizeof(shift_buffer_t *);
     buffer_pool_t      *pool          = malloc(sizeof(buffer_pool_t) + container_len);
 #ifdef DEBUG
     memset(pool, 0xEE, sizeof(buffer_pool_t) + container_len);
 #endif
     memset(pool, 0, sizeof(buffer_pool_t));
-    pool->cap             = bufcount;
-    pool->buffers_size    = buffer_size;
-    pool->free_threshould = max(pool->cap / 2, (pool->cap * 2) / 3);
-    firstCharge(pool);
+    pool->classes_count = classes_count;
+
+    for (unsigned int i = 0; i < classes_count; i++)
+    {
+        buffer_class_t *bclass  = &(pool->classes[i]);
+        bclass->cap             = bufcount;
+        bclass->buffers_size    = sizes[i];
+        bclass->real_cap        = shiftBufferRealCap(sizes[i]);
+        bclass->free_threshould = max(bclass->cap / 2, (bclass->cap * 2) / 3);
+        bclass->available       = &(pool->available[i * bufcount]);
+        bclass->slabs           = slab_mode ? newBufferSlabAllocator(bclass->real_cap, bclass->cap / 2) : NULL;
+    }
+    // the smaller classes are charged on their first pop, most pools never need some of them
+    firstCharge(&(pool->classes[classes_count - 1]));
     return pool;
 }
 
 buffer_pool_t *createBufferPool(void)
 {
-    return allocBufferPool(BUFFERPOOL_CONTAINER_LEN, BUFFER_SIZE);
+    return allocBufferPool(BUFFERPOOL_CONTAINER_LEN, BUFFER_SIZE, kSlabBufferPool);
 }
 
 buffer_pool_t *createSmallBufferPool(void)
 {
-    return allocBufferPool(BUFFERPOOL_SMALL_CONTAINER_LEN, BUFFER_SIZE_SMALL);
+    return allocBufferPool(BUFFERPOOL_SMALL_CONTAINER_LEN, BUFFER_SIZE_SMALL, kSlabBufferPool);
+}
+
+buffer_pool_t *createSlabBufferPool(void)
+{
+    return allocBufferPool(BUFFERPOOL_CONTAINER_LEN, BUFFER_SIZE, true);
+}
+
+buffer_pool_t *createHeapBufferPool(void)
+{
+    return allocBufferPool(BUFFERPOOL_CONTAINER_LEN, BUFFER_SIZE, false);
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "generic_pool.h"
 #include "shiftbuffer.h"
 #include <stdatomic.h>
 
@@ -23,17 +24,38 @@
 
     for performance reasons, this pool dose not inherit from generic_pool, so 80% of the code is the same
     but also it has its own differences ofcourse
-    
+
+    slab mode (SLAB_BUFFER_POOL): instead of mallocing every buffer, the pool carves buffers out of large
+    per worker arenas (buffer_slab.h) and gives a whole arena back to the os when it drains, this removes
+    the malloc/free churn of recharge/shrink under connection bursts
+
+    size classes: a pool has up to kBufferPoolMaxClasses classes (512, 4k and its own buffer size), each one
+    is a small pool of its own, popBuffer() gives the largest class like before, popBufferOfClass() is for
+    the readers that know they need less (nio_read sizes its reads by what the io read recently)
+    reuseBuffer() routes a buffer back to the class it fits, so a small buffer is never reallocated to the
+    large size on its way back, the smaller classes start empty and charge on their first pop
+
 */
 
+enum
+{
+    kBufferPoolMaxClasses = 3
+};
+
 struct buffer_pool_s;
 typedef struct buffer_pool_s buffer_pool_t;
 
 buffer_pool_t  *createSmallBufferPool(void);
 buffer_pool_t  *createBufferPool(void);
+buffer_pool_t  *createSlabBufferPool(void);
+buffer_pool_t  *createHeapBufferPool(void);
 shift_buffer_t *popBuffer(buffer_pool_t *pool);
+shift_buffer_t *popBufferOfClass(buffer_pool_t *pool, unsigned int class_index);
+unsigned int    bufferPoolClassCount(buffer_pool_t *pool);
+unsigned int    bufferPoolClassSize(buffer_pool_t *pool, unsigned int class_index);
 void            reuseBuffer(buffer_pool_t *pool, shift_buffer_t *b);
 shift_buffer_t *appendBufferMerge(buffer_pool_t *pool, shift_buffer_t *restrict b1, shift_buffer_t *restrict b2);
+pool_stats_t    getBufferPoolStats(buffer_pool_t *pool);
 
 // [not used] when you change the owner thread of a buffer, you should
 // notify the original buffer pool that 1 buffer is lost form it
@@ -0,0 +1,245 @@
+#include "buffer_slab.h"
+#include "hplatform.h"
+#include "htime.h"
+#include "utils/mathutils.h"
+#include "ww.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef OS_UNIX
+#include <sys/mman.h>
+#endif
+
+enum
+{
+    kSlabHugePageSize = 1U << 21, // 2MB, slabs are multiples of this so that thp can back them
+    kSlabMinSlots     = 8,
+    kSlabReleaseDelay = 5000 // ms
+};
+
+static size_t slabHeaderSize(void)
+{
+    return ALIGN2(sizeof(buffer_slab_t), kCpuLineCacheSize);
+}
+
+static void *mapSlabMemory(size_t size)
+{
+#ifdef OS_UNIX
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return NULL;
+    }
+#if defined(OS_LINUX) && defined(MADV_HUGEPAGE)
+    madvise(mem, size, MADV_HUGEPAGE);
+#endif
+    return mem;
+#else
+    return malloc(size);
+#endif
+}
+
+static void unMapSlabMemory(void *mem, size_t size)
+{
+#ifdef OS_UNIX
+    munmap(mem, size);
+#else
+    (void) size;
+    free(mem);
+#endif
+}
+
+static buffer_slab_t *newSlab(buffer_slab_allocator_t *allocator)
+{
+    buffer_slab_t *slab = mapSlabMemory(allocator->slab_size);
+    if (slab == NULL)
+    {
+        fprintf(stderr, "BufferSlab: could not map a new slab of %zu bytes\n", allocator->slab_size);
+        exit(1);
+    }
+
+    *slab = (buffer_slab_t){.next          = NULL,
+                            .free_slots    = NULL,
+                            .slots_count   = allocator->slots_per_slab,
+                            .free_count    = allocator->slots_per_slab,
+                            .carved        = 0,
+                            .drained_since = 0,
+                            .payload_cap   = allocator->payload_cap,
+                            .mapped_size   = allocator->slab_size};
+    atomic_init(&slab->returned, NULL);
+
+    allocator->slabs_count += 1;
+    return slab;
+}
+
+// moves the slots that other threads (or destroyShiftBuffer) gave back into the owner free list
+static void collectReturned(buffer_slab_t *slab)
+{
+    buffer_slot_t *list = atomic_exchange_explicit(&slab->returned, NULL, memory_order_acquire);
+    while (list)
+    {
+        buffer_slot_t *next = list->next;
+        list->next          = slab->free_slots;
+        slab->free_slots    = list;
+        slab->free_count += 1;
+        list = next;
+    }
+    assert(slab->free_count <= slab->slots_count);
+}
+
+// looks at the full slabs again, the ones that got slots back move to the usable list
+static void refillFromFullSlabs(buffer_slab_allocator_t *allocator)
+{
+    buffer_slab_t **link = &allocator->full_slabs;
+    while (*link)
+    {
+        buffer_slab_t *slab = *link;
+        collectReturned(slab);
+        if (slab->free_count > 0)
+        {
+            *link            = slab->next;
+            slab->next       = allocator->slabs;
+            allocator->slabs = slab;
+            continue;
+        }
+        link = &slab->next;
+    }
+}
+
+buffer_slot_t *popBufferSlot(buffer_slab_allocator_t *allocator)
+{
+    buffer_slab_t *slab = allocator->slabs;
+
+    if (slab == NULL)
+    {
+        refillFromFullSlabs(allocator);
+        slab = allocator->slabs;
+    }
+
+    if (slab == NULL)
+    {
+        slab             = newSlab(allocator);
+        allocator->slabs = slab;
+    }
+
+    buffer_slot_t *slot = slab->free_slots;
+    if (slot)
+    {
+        slab->free_slots = slot->next;
+    }
+    else
+    {
+        assert(slab->carved < slab->slots_count);
+        slot = (buffer_slot_t *) (((unsigned char *) slab) + slabHeaderSize() +
+                                  ((size_t) slab->carved * allocator->slot_size));
+        slot->slab = slab;
+        slab->carved += 1;
+    }
+    slab->free_count -= 1;
+    slab->drained_since = 0;
+
+    if (slab->free_count == 0)
+    {
+        collectReturned(slab);
+        if (slab->free_count == 0)
+        {
+            allocator->slabs      = slab->next;
+            slab->next            = allocator->full_slabs;
+            allocator->full_slabs = slab;
+        }
+    }
+
+    slot->next = NULL;
+    atomic_init(&slot->refc, 1U | kBufferSlotHeaderAlive);
+    return slot;
+}
+
+// a slot that is 1 heap block, used for the buffers outside of slab mode and for the payloads that do not fit a slab
+buffer_slot_t *newHeapBufferSlot(unsigned int payload_cap, bool header_alive)
+{
+    buffer_slot_t *slot = malloc(slotPayloadOffset() + payload_cap);
+    if (slot == NULL)
+    {
+        fprintf(stderr, "BufferSlab: out of memory\n");
+        exit(1);
+    }
+    slot->payload_cap = payload_cap;
+    slot->slab        = NULL;
+    atomic_init(&slot->refc, 1U | (header_alive ? kBufferSlotHeaderAlive : 0));
+    return slot;
+}
+
+void releaseBufferSlot(buffer_slot_t *slot)
+{
+    assert(atomic_load_explicit(&slot->refc, memory_order_relaxed) == 0);
+    buffer_slab_t *slab = slot->slab;
+    if (slab == NULL)
+    {
+        free(slot);
+        return;
+    }
+
+    buffer_slot_t *head = atomic_load_explicit(&slab->returned, memory_order_relaxed);
+    do
+    {
+        slot->next = head;
+    } while (! atomic_compare_exchange_weak_explicit(&slab->returned, &head, slot, memory_order_release,
+                                                     memory_order_relaxed));
+}
+
+/*
+    gives slabs that stayed drained for kSlabReleaseDelay back to the os, a few drained slabs are always kept
+    to absorb the next recharge without new mappings
+*/
+void collectBufferSlabs(buffer_slab_allocator_t *allocator)
+{
+    refillFromFullSlabs(allocator);
+
+    const unsigned int now        = gettick_ms() | 1U; // 0 means not drained
+    buffer_slab_t    **link       = &allocator->slabs;
+    unsigned int       kept_empty = 0;
+
+    while (*link)
+    {
+        buffer_slab_t *slab = *link;
+        collectReturned(slab);
+
+        if (slab->free_count == slab->slots_count)
+        {
+            if (slab->drained_since == 0)
+            {
+                slab->drained_since = now;
+            }
+            if (kept_empty >= allocator->keep_drained && now - slab->drained_since >= kSlabReleaseDelay)
+            {
+                *link = slab->next;
+                unMapSlabMemory(slab, slab->mapped_size);
+                allocator->slabs_count -= 1;
+                continue;
+            }
+            kept_empty += 1;
+        }
+        link = &slab->next;
+    }
+}
+
+buffer_slab_allocator_t *newBufferSlabAllocator(unsigned int payload_cap, unsigned int keep_slots)
+{
+    buffer_slab_allocator_t *allocator = malloc(sizeof(buffer_slab_allocator_t));
+
+    const size_t slot_size = ALIGN2(slotPayloadOffset() + payload_cap, (size_t) kCpuLineCacheSize);
+
+    const size_t slab_size = ALIGN2(slabHeaderSize() + (slot_size * kSlabMinSlots), (size_t) kSlabHugePageSize);
+    const size_t slots     = (slab_size - slabHeaderSize()) / slot_size;
+
+    *allocator = (buffer_slab_allocator_t){.slabs          = NULL,
+                                           .full_slabs     = NULL,
+                                           .keep_drained   = (unsigned int) ((keep_slots + slots - 1) / slots),
+                                           .payload_cap    = payload_cap,
+                                           .slot_size      = (unsigned int) slot_size,
+                                           .slots_per_slab = (unsigned int) slots,
+                                           .slab_size      = slab_size,
+                                           .slabs_count    = 0};
+    return allocator;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "shiftbuffer.h"
+#include "ww.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    Slab arenas for the buffer pool (slab mode)
+
+    instead of 3 mallocs per buffer (header, refc, payload), a slab is one large hugepage friendly
+    mapping that is carved into equal slots, each slot holds the shift_buffer_t header, the refcount and
+    the payload area of exactly 1 buffer
+
+    ------------------------------------ a slab ---------------------------------------
+    | slab_t | slot{header, refc, payload} | slot{header, refc, payload} | ...         |
+    -----------------------------------------------------------------------------------
+
+    header and payload of a slot have separate lifetimes (a shallow copy can keep the payload alive
+    after the header is destroyed, and an expanded buffer keeps its header but moves to a heap payload),
+    so the header is counted in the refc of its slot as kBufferSlotHeaderAlive, the slot is free when the
+    refc reaches 0 and the one atomic decrement that gets it there decides who releases it
+
+    a slab belongs to the allocator (thus the worker) that created it, but buffers travel between threads
+    so a slot can be freed from any thread, freed slots are pushed on a lock free list of their slab and the
+    owner collects them when it needs more buffers or when it is shrinking
+
+    once every slot of a slab is back and it stayed drained for a while, the whole slab is given back
+    to the os at once (the grace period keeps connection bursts from mapping and zeroing slabs over and over)
+
+    outside of slab mode the same slot layout is used for single heap blocks (slab is NULL), so every payload
+    is 1 allocation with its refcount, and a buffer created by newShiftBuffer also carries its header in it
+
+*/
+
+struct buffer_slab_s;
+
+// in the refc of a slot while its header is alive, the payload owners are counted below it
+#define kBufferSlotHeaderAlive ((unsigned int) kShiftBufferRefcMask + 1U)
+
+typedef struct buffer_slot_s
+{
+    union {
+        struct buffer_slot_s *next;        // slab slot, link in the free lists
+        unsigned int          payload_cap; // heap slot, size of the payload area
+    };
+    struct buffer_slab_s *slab; // NULL for a heap slot
+    atomic_uint           refc; // payload owners + kBufferSlotHeaderAlive, shift_buffer_t.refc points here
+    shift_buffer_t        header;
+
+} buffer_slot_t;
+
+typedef struct buffer_slab_s
+{
+    struct buffer_slab_s    *next;
+    buffer_slot_t           *free_slots; // only touched by the owner thread
+    _Atomic(buffer_slot_t *) returned;   // slots freed by any thread, waiting to be collected
+    unsigned int             slots_count;
+    unsigned int             free_count;    // free_slots + the slots that are not carved yet
+    unsigned int             carved;        // slots are carved lazily, so a new slab faults no pages
+    unsigned int             drained_since; // tick (ms) of the collection that found it drained, 0 if in use
+    unsigned int             payload_cap;
+    size_t                   mapped_size;
+
+} buffer_slab_t;
+
+typedef struct buffer_slab_allocator_s
+{
+    buffer_slab_t *slabs;      // slabs that have free slots, the head is used first
+    buffer_slab_t *full_slabs; // slabs that had no free slot at the last look
+    unsigned int   payload_cap;
+    unsigned int   slot_size;
+    unsigned int   slots_per_slab;
+    size_t         slab_size;
+    size_t         slabs_count;
+    unsigned int   keep_drained; // drained slabs that are not unmapped, so a recharge right after a shrink is cheap
+
+} buffer_slab_allocator_t;
+
+buffer_slab_allocator_t *newBufferSlabAllocator(unsigned int payload_cap, unsigned int keep_slots);
+buffer_slot_t           *popBufferSlot(buffer_slab_allocator_t *allocator);
+buffer_slot_t           *newHeapBufferSlot(unsigned int payload_cap, bool header_alive);
+void                     releaseBufferSlot(buffer_slot_t *slot);
+void                     collectBufferSlabs(buffer_slab_allocator_t *allocator);
+
+static inline size_t slotPayloadOffset(void)
+{
+    return ALIGN2(sizeof(buffer_slot_t), (size_t) kCpuLineCacheSize);
+}
+
+static inline unsigned char *slotPayload(buffer_slot_t *slot)
+{
+    return ((unsigned char *) slot) + slotPayloadOffset();
+}
+
+static inline buffer_slot_t *slotOfRefc(atomic_uint *refc)
+{
+    return (buffer_slot_t *) (((char *) refc) - offsetof(buffer_slot_t, refc));
+}
+
+static inline buffer_slot_t *slotOfHeader(shift_buffer_t *header)
+{
+    return (buffer_slot_t *) (((char *) header) - offsetof(buffer_slot_t, header));
+}
+
+static inline unsigned int slotPayloadCap(buffer_slot_t *slot)
+{
+    return slot->slab != NULL ? slot->slab->payload_cap : slot->payload_cap;
+}
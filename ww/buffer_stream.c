@@ -73,6 +73,44 @@ shift_buffer_t *bufferStreamRead(buffer_stream_t *self, size_t bytes)
     }
 }
 
+// the front of the stream without merging anything, at most max_bytes
+shift_buffer_t *bufferStreamReadChunk(buffer_stream_t *self, size_t max_bytes)
+{
+    assert(self->size > 0 && max_bytes > 0);
+
+    shift_buffer_t *container = queue_pull_front(&self->q);
+    if (bufLen(container) <= max_bytes)
+    {
+        self->size -= bufLen(container);
+        return container;
+    }
+    self->size -= max_bytes;
+
+    shift_buffer_t *slice = popBuffer(self->pool);
+    sliceBufferTo(slice, container, max_bytes);
+    queue_push_front(&self->q, container);
+    return slice;
+}
+
+void bufferStreamSkip(buffer_stream_t *self, size_t bytes)
+{
+    assert(self->size >= bytes);
+    self->size -= bytes;
+
+    while (bytes > 0)
+    {
+        shift_buffer_t *front = queue_pull_front(&self->q);
+        if (bufLen(front) > bytes)
+        {
+            shiftr(front, bytes);
+            queue_push_front(&self->q, front);
+            return;
+        }
+        bytes -= bufLen(front);
+        reuseBuffer(self->pool, front);
+    }
+}
+
 shift_buffer_t *bufferStreamIdealRead(buffer_stream_t *self)
 {
     assert(self->size > 0);
@@ -104,30 +142,27 @@ uint8_t bufferStreamViewByteAt(buffer_stream_t *self, size_t at)
 
 void bufferStreamViewBytesAt(buffer_stream_t *self, size_t at, uint8_t *buf, size_t len)
 {
-    size_t bufferstream_i = at;
-    assert(self->size >= (bufferstream_i + len) && self->size != 0);
-    unsigned int buf_i = 0;
+    assert(self->size >= (at + len) && self->size != 0);
+
     c_foreach(qi, queue, self->q)
     {
-
         shift_buffer_t *b    = *qi.ref;
         size_t          blen = bufLen(b);
-        
-        if (len - buf_i <= blen - bufferstream_i)
+
+        if (at >= blen)
         {
-            memcpy(buf + buf_i, ((char *) rawBuf(b)) + bufferstream_i, len - buf_i);
-            return;
+            at -= blen;
+            continue;
         }
 
-        while (bufferstream_i < blen)
+        const size_t take = (blen - at) < len ? (blen - at) : len;
+        memcpy(buf, ((uint8_t *) rawBuf(b)) + at, take);
+        buf += take;
+        len -= take;
+        at = 0;
+        if (len == 0)
         {
-            buf[buf_i++] = ((uint8_t *) rawBuf(b))[bufferstream_i++];
-            if (buf_i == len)
-            {
-                return;
-            }
+            return;
         }
-
-        bufferstream_i -= blen;
     }
 }
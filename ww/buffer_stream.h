@@ -12,6 +12,16 @@
     you can for example check byte index 1 or 5 of the buffers without concating them, then
     you'll be able to read only when your protocol is satisfied, the size you want
 
+    framed protocols should view their header (bufferStreamViewBytesAt), wait until the whole frame is in the
+    stream, skip the header and then either:
+
+        bufferStreamRead        the frame as 1 buffer, the queued buffers are merged (copied) when it spans them
+        bufferStreamReadChunk   the frame piece by piece, whole queued buffers are handed out as they are and only
+                                the buffer the frame ends in is sliced, use it when the next tunnel sees a stream
+
+    the pieces are never shallow copies, a piece owns its payload and the next tunnel may write into its left
+    space without touching the bytes still queued here
+
 
 */
 
@@ -33,6 +43,8 @@ void             destroyBufferStream(buffer_stream_t *self);
 void             bufferStreamPush(buffer_stream_t *self, shift_buffer_t *buf);
 shift_buffer_t  *bufferStreamRead(buffer_stream_t *self, size_t bytes);
 shift_buffer_t  *bufferStreamIdealRead(buffer_stream_t *self);
+shift_buffer_t  *bufferStreamReadChunk(buffer_stream_t *self, size_t max_bytes);
+void             bufferStreamSkip(buffer_stream_t *self, size_t bytes);
 uint8_t          bufferStreamViewByteAt(buffer_stream_t *self, size_t at);
 void             bufferStreamViewBytesAt(buffer_stream_t *self, size_t at, uint8_t *buf, size_t len);
 
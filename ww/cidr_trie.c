@@ -0,0 +1,155 @@
+#include "cidr_trie.h"
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+    kRootV4      = 0,
+    kRootV6      = 1,
+    kNoChild     = 0, // roots are never a child, so 0 can mean none
+    kInitialSize = 64
+};
+
+typedef struct cidr_node_s
+{
+    uint32_t child[2];
+    bool     terminal;
+
+} cidr_node_t;
+
+struct cidr_trie_s
+{
+    cidr_node_t *nodes;
+    uint32_t     count;
+    uint32_t     cap;
+};
+
+static inline unsigned int bitAt(const uint8_t *bytes, unsigned int i)
+{
+    return (bytes[i / 8] >> (7 - (i % 8))) & 0x1;
+}
+
+cidr_trie_t *newCidrTrie(void)
+{
+    cidr_trie_t *self = malloc(sizeof(cidr_trie_t));
+    *self             = (cidr_trie_t){.nodes = malloc(sizeof(cidr_node_t) * kInitialSize), .count = 2,
+                                      .cap = kInitialSize};
+    // the two roots
+    memset(self->nodes, 0, sizeof(cidr_node_t) * 2);
+    return self;
+}
+
+void destroyCidrTrie(cidr_trie_t *self)
+{
+    free(self->nodes);
+    free(self);
+}
+
+static uint32_t newNode(cidr_trie_t *self)
+{
+    if (self->count == self->cap)
+    {
+        self->cap *= 2;
+        self->nodes = realloc(self->nodes, sizeof(cidr_node_t) * self->cap);
+    }
+    self->nodes[self->count] = (cidr_node_t){0};
+    return self->count++;
+}
+
+bool insertCidrTrie(cidr_trie_t *self, const char *cidr)
+{
+    char         ip_part[INET6_ADDRSTRLEN] = {0};
+    const char  *slash                     = strchr(cidr, '/');
+    const size_t ip_len                    = slash ? (size_t) (slash - cidr) : strlen(cidr);
+    if (slash == NULL || ip_len >= sizeof(ip_part))
+    {
+        return false;
+    }
+    memcpy(ip_part, cidr, ip_len);
+
+    uint8_t      bytes[16];
+    uint32_t     node;
+    unsigned int max_prefix;
+    if (inet_pton(AF_INET, ip_part, bytes) == 1)
+    {
+        node       = kRootV4;
+        max_prefix = 32;
+    }
+    else if (inet_pton(AF_INET6, ip_part, bytes) == 1)
+    {
+        node       = kRootV6;
+        max_prefix = 128;
+    }
+    else
+    {
+        return false;
+    }
+
+    char *end    = NULL;
+    long  prefix = strtol(slash + 1, &end, 10);
+    if (end == slash + 1 || prefix < 0 || prefix > (long) max_prefix)
+    {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < (unsigned int) prefix; i++)
+    {
+        if (self->nodes[node].terminal)
+        {
+            // a shorter prefix already covers this one
+            return true;
+        }
+        const unsigned int bit = bitAt(bytes, i);
+        if (self->nodes[node].child[bit] == kNoChild)
+        {
+            const uint32_t child         = newNode(self); // may move nodes
+            self->nodes[node].child[bit] = child;
+        }
+        node = self->nodes[node].child[bit];
+    }
+    self->nodes[node].terminal = true;
+    return true;
+}
+
+bool matchCidrTrie(const cidr_trie_t *self, const sockaddr_u *addr)
+{
+    const uint8_t *bytes;
+    unsigned int   bits;
+    uint32_t       node;
+    if (addr->sa.sa_family == AF_INET)
+    {
+        bytes = (const uint8_t *) &addr->sin.sin_addr;
+        bits  = 32;
+        node  = kRootV4;
+    }
+    else if (addr->sa.sa_family == AF_INET6)
+    {
+        bytes = (const uint8_t *) &addr->sin6.sin6_addr;
+        bits  = 128;
+        node  = kRootV6;
+        if (IN6_IS_ADDR_V4MAPPED(&addr->sin6.sin6_addr))
+        {
+            bytes += 12;
+            bits = 32;
+            node = kRootV4;
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < bits; i++)
+    {
+        if (self->nodes[node].terminal)
+        {
+            return true;
+        }
+        node = self->nodes[node].child[bitAt(bytes, i)];
+        if (node == kNoChild)
+        {
+            return false;
+        }
+    }
+    return self->nodes[node].terminal;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "hsocket.h"
+#include <stdbool.h>
+
+/*
+    Cidr trie
+
+    a binary trie of ip prefixes ("1.2.3.0/24", "2001:db8::/32"), v4 and v6 prefixes live under separate
+    roots, used by the socket manager for the white and black lists of the listeners
+
+    a lookup walks at most 32 (or 128) bits of the address no matter how many prefixes are inserted, and
+    stops at the first (shortest) prefix that covers it, v4 mapped v6 addresses (::ffff:a.b.c.d, what a
+    dual stack listener sees for v4 clients) are looked up as v4
+
+    the trie is not thread safe for inserts, but lookups on a trie that is not changing anymore can run
+    on any number of threads
+*/
+
+typedef struct cidr_trie_s cidr_trie_t;
+
+cidr_trie_t *newCidrTrie(void);
+void         destroyCidrTrie(cidr_trie_t *self);
+
+// "ip/prefix", returns false if it could not be parsed
+bool insertCidrTrie(cidr_trie_t *self, const char *cidr);
+
+// true if any of the inserted prefixes covers the address
+bool matchCidrTrie(const cidr_trie_t *self, const sockaddr_u *addr);
@@ -0,0 +1,95 @@
+#ifndef HV_MPSC_QUEUE_H_
+#define HV_MPSC_QUEUE_H_
+
+/*
+ * mpsc_queue
+ * bounded lock-free ring, many producers (any thread) and a single consumer (the owner thread)
+ * FIFO: try_push, try_pop
+ *
+ * every cell carries a sequence number (Dmitry Vyukov's bounded queue), producers claim a position
+ * with a CAS on push_pos and publish the cell by bumping its sequence, the consumer owns pop_pos
+ *
+ * push fails when the ring is full, the caller decides what to do (see hloop_post_event)
+ */
+
+#include <assert.h>    // for assert
+#include <stdatomic.h> // for atomic_*
+#include <stddef.h>    // for NULL
+#include <stdint.h>    // for intptr_t
+
+#include "hbase.h" // for HV_ALLOC, HV_FREE
+
+#define MPSC_QUEUE_INIT_SIZE 1024
+
+#define MPSC_QUEUE_DECL(type, qtype) \
+struct qtype##_cell {\
+    atomic_size_t seq;\
+    type value;\
+};\
+\
+struct qtype {\
+    struct qtype##_cell* cells;\
+    size_t mask;\
+    size_t pop_pos;\
+    char _pad0[64];\
+    atomic_size_t push_pos;\
+    char _pad1[64];\
+};\
+typedef struct qtype qtype;\
+\
+static inline void qtype##_init(qtype* p, size_t size) {\
+    assert(size >= 2 && (size & (size - 1)) == 0);\
+    HV_ALLOC(p->cells, sizeof(struct qtype##_cell) * size);\
+    for (size_t i = 0; i < size; ++i) {\
+        atomic_init(&p->cells[i].seq, i);\
+    }\
+    p->mask = size - 1;\
+    p->pop_pos = 0;\
+    atomic_init(&p->push_pos, 0);\
+}\
+\
+static inline void qtype##_cleanup(qtype* p) {\
+    HV_FREE(p->cells);\
+    p->mask = 0;\
+    p->pop_pos = 0;\
+}\
+\
+/* any thread, returns 0 when the ring is full */\
+static inline int qtype##_try_push(qtype* p, const type* elem) {\
+    struct qtype##_cell* cell;\
+    size_t pos = atomic_load_explicit(&p->push_pos, memory_order_relaxed);\
+    for (;;) {\
+        cell = &p->cells[pos & p->mask];\
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);\
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;\
+        if (dif == 0) {\
+            if (atomic_compare_exchange_weak_explicit(&p->push_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {\
+                break;\
+            }\
+        }\
+        else if (dif < 0) {\
+            return 0;\
+        }\
+        else {\
+            pos = atomic_load_explicit(&p->push_pos, memory_order_relaxed);\
+        }\
+    }\
+    cell->value = *elem;\
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);\
+    return 1;\
+}\
+\
+/* consumer thread only, returns 0 when there is nothing published */\
+static inline int qtype##_try_pop(qtype* p, type* out) {\
+    struct qtype##_cell* cell = &p->cells[p->pop_pos & p->mask];\
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);\
+    if ((intptr_t)seq - (intptr_t)(p->pop_pos + 1) < 0) {\
+        return 0;\
+    }\
+    *out = cell->value;\
+    atomic_store_explicit(&cell->seq, p->pop_pos + p->mask + 1, memory_order_release);\
+    ++p->pop_pos;\
+    return 1;\
+}\
+
+#endif // HV_MPSC_QUEUE_H_
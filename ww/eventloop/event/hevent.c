@@ -103,6 +103,7 @@ void hio_ready(hio_t* io) {
     io->last_read_hrtime = io->last_write_hrtime = io->loop->cur_hrtime;
 
     io->read_flags = 0;
+    io->read_class_down = io->read_shrink_votes = 0;
     // write_queue
     io->write_bufsize = 0;
     io->max_write_bufsize = MAX_WRITE_BUFSIZE;
@@ -147,6 +148,8 @@ void hio_done(hio_t* io) {
     io->ready = 0;
 
     hio_del(io, HV_RDWR);
+    hio_batch_done(io);
+    hio_splice_done(io);
 
     // write_queue
     shift_buffer_t* buf = NULL;
@@ -540,6 +543,34 @@ void hio_set_max_write_bufsize(hio_t* io, uint32_t size) {
     io->max_write_bufsize = size;
 }
 
+#ifndef HIO_HAVE_MMSG
+void hio_set_batch(hio_t* io, unsigned int batch) {
+    (void)io;
+    (void)batch;
+}
+
+void hio_batch_done(hio_t* io) {
+    (void)io;
+}
+#endif
+
+#ifndef HIO_HAVE_SPLICE
+int hio_splice(hio_t* io1, hio_t* io2) {
+    (void)io1;
+    (void)io2;
+    return -1;
+}
+
+bool hio_splice_pending(hio_t* io) {
+    (void)io;
+    return false;
+}
+
+void hio_splice_done(hio_t* io) {
+    (void)io;
+}
+#endif
+
 size_t hio_write_bufsize(hio_t* io) {
     return io->write_bufsize;
 }
@@ -11,7 +11,9 @@
 #include "list.h"
 #include "heap.h"
 #include "queue.h"
+#include "mpsc_queue.h"
 #include "buffer_pool.h"
+#include <stdatomic.h>
 
 
 // #define HLOOP_READ_BUFSIZE          (1U << 15)  // 32K
@@ -26,6 +28,7 @@
 
 ARRAY_DECL(hio_t*, io_array)
 QUEUE_DECL(hevent_t, event_queue)
+MPSC_QUEUE_DECL(hevent_t, event_mpsc_queue)
 
 struct hloop_s {
     uint32_t                    flags;
@@ -57,11 +60,18 @@ struct hloop_s {
     uint32_t                    nios;
     // one loop per thread, so one readbuf per loop is OK.
     buffer_pool_t*              bufpool;
+    hloop_io_budget_t           io_budget;      // per wakeup limits of nio_read / nio_accept
     void*                       iowatcher;
     // custom_events
     int                         eventfds[2];
-    event_queue                 custom_events;
-    hhybridmutex_t                    custom_events_mutex;
+    event_mpsc_queue            custom_events_ring;     // lock-free path of hloop_post_event
+    atomic_bool                 custom_events_doorbell; // eventfd is written and the loop did not drain yet
+    atomic_bool                 custom_events_overflow; // ring was full, posts go to custom_events until drained
+    event_queue                 custom_events;          // overflow queue, guarded by custom_events_mutex
+    hhybridmutex_t              custom_events_mutex;
+#ifdef LOOP_TRACE
+    struct loop_trace_s*        trace;          // see loop_trace.h
+#endif
 };
 
 uint64_t hloop_next_event_id(void);
@@ -99,6 +109,13 @@ struct hperiod_s {
 
 QUEUE_DECL(shift_buffer_t*, write_queue)
 
+#if defined(OS_LINUX) && !defined(EVENT_IOCP)
+#define HIO_HAVE_MMSG 1 // recvmmsg/sendmmsg for datagram ios, see hio_set_batch
+#define HIO_HAVE_SPLICE 1 // kernel relay between two tcp ios, see hio_splice
+#endif
+struct hio_batch_s;
+struct hio_splice_s;
+
 // sizeof(struct hio_s)=416 on linux-x64
 struct hio_s {
     HEVENT_FIELDS
@@ -118,10 +135,6 @@ struct hio_s {
     hio_type_e  io_type;
     uint32_t    id; // fd cannot be used as unique identifier, so we provide an id
     int         fd;
-// #if defined(OS_LINUX) && defined(HAVE_PIPE)
-//     int         pfd_r; // pipe read file descriptor for splice, (empty by default)
-//     int         pfd_w; // pipe read file descriptor for splice, (empty by default)
-// #endif
     int         error;
     int         events;
     int         revents;
@@ -131,11 +144,17 @@ struct hio_s {
     uint64_t            last_write_hrtime;
     // read
     unsigned int        read_flags;
+    uint8_t             read_class_down;    // adaptive read sizing, buffer classes below the largest one (0: largest)
+    uint8_t             read_shrink_votes;  // reads in a row that would have fit the next smaller class
     // write
     struct write_queue  write_queue;
     // hrecursive_mutex_t  write_mutex; // lock write and write_queue
     uint32_t            write_bufsize;
     uint32_t            max_write_bufsize;
+    // batched datagram io (NULL if off)
+    struct hio_batch_s* batch;
+    // splice relay to another tcp io (NULL if off)
+    struct hio_splice_s* splice;
     // callbacks
     hread_cb    read_cb;
     hwrite_cb   write_cb;
@@ -166,6 +185,12 @@ struct hio_s {
     void*       hovlp;          // for iocp/overlapio
 #endif
 
+#ifdef EVENT_IO_URING
+    uint32_t    uring_gen;      // tags the armed poll, completions of older ones are dropped
+    int         uring_armed;    // events the armed poll waits for (0: none)
+    unsigned    uring_dirty :1; // queued for (re)arming before the next wait
+#endif
+
 };
 /*
  * hio lifeline:
@@ -182,6 +207,9 @@ struct hio_s {
 void hio_init(hio_t* io);
 void hio_ready(hio_t* io);
 void hio_done(hio_t* io);
+void hio_batch_done(hio_t* io); // flushes what is queued and frees the batch
+void hio_splice_done(hio_t* io); // closes the pipe and detaches the peer
+bool hio_splice_pending(hio_t* io); // the peer still has bytes in its pipe for this io
 void hio_free(hio_t* io);
 uint32_t hio_next_id(void);
 
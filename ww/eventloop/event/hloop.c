@@ -9,6 +9,7 @@
 #include "htime.h"
 #include "hsocket.h"
 #include "hthread.h"
+#include "loop_trace.h"
 
 #if defined(OS_UNIX) && HAVE_EVENTFD
 #include "sys/eventfd.h"
@@ -105,6 +106,14 @@ static int hloop_process_ios(hloop_t* loop, int timeout) {
     return nevents < 0 ? 0 : nevents;
 }
 
+#ifdef LOOP_TRACE
+static loop_trace_kind_e hloop_trace_kind(hevent_t* ev) {
+    if (ev->event_type & HEVENT_TYPE_TIMER) return kLoopTraceTimer;
+    if (ev->event_type == HEVENT_TYPE_IDLE) return kLoopTraceIdle;
+    return kLoopTraceIo;
+}
+#endif
+
 static int hloop_process_pendings(hloop_t* loop) {
     if (loop->npendings == 0) return 0;
 
@@ -118,7 +127,14 @@ static int hloop_process_pendings(hloop_t* loop) {
             next = cur->pending_next;
             if (cur->pending) {
                 if (cur->active && cur->cb) {
-                    cur->cb(cur);
+#ifdef LOOP_TRACE
+                    // the custom events the eventfd runs are traced one by one
+                    if (cur->event_type == HEVENT_TYPE_IO && ((hio_t*)cur)->fd == loop->eventfds[EVENTFDS_READ_INDEX]) {
+                        cur->cb(cur);
+                    }
+                    else
+#endif
+                    LOOP_TRACE_CALLBACK(loop, hloop_trace_kind(cur), cur->cb(cur));
                     ++ncbs;
                 }
                 cur->pending = 0;
@@ -172,6 +188,7 @@ int hloop_process_events(hloop_t* loop, int timeout_ms) {
     }
 
 process_timers:
+    LOOP_TRACE_ITERATION_BEGIN(loop);
     if (loop->ntimers) {
         ntimers = hloop_process_timers(loop);
     }
@@ -183,6 +200,7 @@ process_timers:
         }
     }
     int ncbs = hloop_process_pendings(loop);
+    LOOP_TRACE_ITERATION_END(loop, ncbs);
     printd("blocktime=%d nios=%d/%u ntimers=%d/%u nidles=%d/%u nactives=%d npendings=%d ncbs=%d\n", blocktime, nios, loop->nios, ntimers, loop->ntimers, nidles,
            loop->nidles, loop->nactives, npendings, ncbs);
     (void)nios;
@@ -197,38 +215,65 @@ static void hloop_stat_timer_cb(htimer_t* timer) {
           loop->nidles);
 }
 
-static void eventfd_read_cb(hio_t* io, shift_buffer_t* buf) {
-    hloop_t* loop = io->loop;
-    hevent_t* pev = NULL;
+#define CUSTOM_EVENTS_BUDGET MPSC_QUEUE_INIT_SIZE
+
+static void hloop_ring_doorbell(hloop_t* loop);
+
+// consumer side of hloop_post_event, runs on the loop thread only
+static void hloop_process_custom_events(hloop_t* loop) {
     hevent_t ev;
-    uint64_t count = bufLen(buf);
-#if defined(OS_UNIX) && HAVE_EVENTFD
-    assert(bufLen(buf) == sizeof(count));
-    readUI64(buf, &count);
-#endif
-    (void)count;
-    for (uint64_t i = 0; i < count; ++i) {
-        hhybridmutex_lock(&loop->custom_events_mutex);
-        if (event_queue_empty(&loop->custom_events)) {
-            goto unlock;
+    int budget = CUSTOM_EVENTS_BUDGET;
+    for (;;) {
+        while (event_mpsc_queue_try_pop(&loop->custom_events_ring, &ev)) {
+            if (ev.cb) {
+                LOOP_TRACE_CALLBACK(loop, kLoopTraceCustom, ev.cb(&ev));
+            }
+            if (--budget == 0) {
+                // let the other ios run, we will be woken up again for the rest
+                hloop_ring_doorbell(loop);
+                return;
+            }
         }
-        pev = event_queue_front(&loop->custom_events);
-        if (pev == NULL) {
-            goto unlock;
+        if (!atomic_load_explicit(&loop->custom_events_overflow, memory_order_acquire)) {
+            return;
         }
-        ev = *pev;
-        event_queue_pop_front(&loop->custom_events);
-        // NOTE: unlock before cb, avoid deadlock if hloop_post_event called in cb.
+        // the ring got full at some point, take the overflow queue, but drain the ring once more
+        // before running it since the ring may still hold events that were posted earlier
+        hhybridmutex_lock(&loop->custom_events_mutex);
+        event_queue overflow = loop->custom_events;
+        memset(&loop->custom_events, 0, sizeof(loop->custom_events));
         hhybridmutex_unlock(&loop->custom_events_mutex);
-        if (ev.cb) {
-            ev.cb(&ev);
+
+        while (event_mpsc_queue_try_pop(&loop->custom_events_ring, &ev)) {
+            if (ev.cb) {
+                LOOP_TRACE_CALLBACK(loop, kLoopTraceCustom, ev.cb(&ev));
+            }
+        }
+        for (int i = 0; i < event_queue_size(&overflow); ++i) {
+            hevent_t* pev = event_queue_data(&overflow) + i;
+            if (pev->cb) {
+                LOOP_TRACE_CALLBACK(loop, kLoopTraceCustom, pev->cb(pev));
+            }
+        }
+        if (overflow.maxsize != 0) {
+            event_queue_cleanup(&overflow);
+        }
+
+        hhybridmutex_lock(&loop->custom_events_mutex);
+        if (event_queue_empty(&loop->custom_events)) {
+            atomic_store_explicit(&loop->custom_events_overflow, false, memory_order_release);
         }
+        hhybridmutex_unlock(&loop->custom_events_mutex);
     }
+}
+
+static void eventfd_read_cb(hio_t* io, shift_buffer_t* buf) {
+    hloop_t* loop = io->loop;
+    // the counter value dose not matter, posts are coalesced and the queue is drained until empty
     reuseBuffer(io->loop->bufpool, buf);
-    return;
-unlock:
-    hhybridmutex_unlock(&loop->custom_events_mutex);
-    reuseBuffer(io->loop->bufpool, buf);
+    // rmw (not a plain store) so that we synchronize with the producer that rang, and see its event
+    atomic_exchange_explicit(&loop->custom_events_doorbell, false, memory_order_acq_rel);
+    hloop_process_custom_events(loop);
 }
 
 static int hloop_create_eventfds(hloop_t* loop) {
@@ -271,24 +316,12 @@ static void hloop_destroy_eventfds(hloop_t* loop) {
     loop->eventfds[0] = loop->eventfds[1] = -1;
 }
 
-void hloop_post_event(hloop_t* loop, hevent_t* ev) {
-    if (ev->loop == NULL) {
-        ev->loop = loop;
-    }
-    if (ev->event_type == 0) {
-        ev->event_type = HEVENT_TYPE_CUSTOM;
-    }
-    if (ev->event_id == 0) {
-        ev->event_id = hloop_next_event_id();
+// wakes the loop up, only the first post since the last drain writes to the eventfd
+static void hloop_ring_doorbell(hloop_t* loop) {
+    if (atomic_exchange_explicit(&loop->custom_events_doorbell, true, memory_order_acq_rel)) {
+        return;
     }
-
     int nwrite = 0;
-    hhybridmutex_lock(&loop->custom_events_mutex);
-    if (loop->eventfds[EVENTFDS_WRITE_INDEX] == -1) {
-        if (hloop_create_eventfds(loop) != 0) {
-            goto unlock;
-        }
-    }
 #if defined(OS_UNIX) && HAVE_EVENTFD
     uint64_t count = 1;
     nwrite = write(loop->eventfds[EVENTFDS_WRITE_INDEX], &count, sizeof(count));
@@ -299,14 +332,41 @@ void hloop_post_event(hloop_t* loop, hevent_t* ev) {
 #endif
     if (nwrite <= 0) {
         hloge("hloop_post_event failed!");
-        goto unlock;
+        atomic_store_explicit(&loop->custom_events_doorbell, false, memory_order_release);
     }
+}
+
+/*
+ * lock-free in the common case: the event is copied into the loop ring and the doorbell is rung,
+ * when the ring is full the event goes to the locked overflow queue, and every post keeps going there
+ * until the loop drained it, so that the events of 1 producer are never reordered
+ */
+void hloop_post_event(hloop_t* loop, hevent_t* ev) {
+    if (ev->loop == NULL) {
+        ev->loop = loop;
+    }
+    if (ev->event_type == 0) {
+        ev->event_type = HEVENT_TYPE_CUSTOM;
+    }
+    if (ev->event_id == 0) {
+        ev->event_id = hloop_next_event_id();
+    }
+    assert(loop->eventfds[EVENTFDS_WRITE_INDEX] != -1);
+
+    if (!atomic_load_explicit(&loop->custom_events_overflow, memory_order_acquire) &&
+        event_mpsc_queue_try_push(&loop->custom_events_ring, ev)) {
+        hloop_ring_doorbell(loop);
+        return;
+    }
+
+    hhybridmutex_lock(&loop->custom_events_mutex);
     if (loop->custom_events.maxsize == 0) {
         event_queue_init(&loop->custom_events, CUSTOM_EVENT_QUEUE_INIT_SIZE);
     }
     event_queue_push_back(&loop->custom_events, ev);
-unlock:
+    atomic_store_explicit(&loop->custom_events_overflow, true, memory_order_release);
     hhybridmutex_unlock(&loop->custom_events_mutex);
+    hloop_ring_doorbell(loop);
 }
 
 static void hloop_init(hloop_t* loop) {
@@ -338,7 +398,10 @@ static void hloop_init(hloop_t* loop) {
 
     // custom_events
     hhybridmutex_init(&loop->custom_events_mutex);
-    // NOTE: hloop_create_eventfds when hloop_post_event or hloop_run
+    event_mpsc_queue_init(&loop->custom_events_ring, MPSC_QUEUE_INIT_SIZE);
+    atomic_init(&loop->custom_events_doorbell, false);
+    atomic_init(&loop->custom_events_overflow, false);
+    // NOTE: hloop_create_eventfds at hloop_new, producers never create it
     loop->eventfds[0] = loop->eventfds[1] = -1;
 
     // NOTE: init start_time here, because htimer_add use it.
@@ -397,8 +460,37 @@ static void hloop_cleanup(hloop_t* loop) {
     hhybridmutex_lock(&loop->custom_events_mutex);
     hloop_destroy_eventfds(loop);
     event_queue_cleanup(&loop->custom_events);
+    event_mpsc_queue_cleanup(&loop->custom_events_ring);
     hhybridmutex_unlock(&loop->custom_events_mutex);
     hhybridmutex_destroy(&loop->custom_events_mutex);
+
+#ifdef LOOP_TRACE
+    destroyLoopTrace(loop->trace);
+    loop->trace = NULL;
+#endif
+}
+
+static hloop_io_budget_t s_default_io_budget = {
+    .read_bytes = HLOOP_DEFAULT_READ_BUDGET_BYTES,
+    .reads      = HLOOP_DEFAULT_READ_BUDGET_READS,
+    .accepts    = HLOOP_DEFAULT_ACCEPT_BUDGET,
+};
+
+void hloop_set_default_io_budget(hloop_io_budget_t budget) {
+    if (budget.read_bytes > 0) s_default_io_budget.read_bytes = budget.read_bytes;
+    if (budget.reads > 0) s_default_io_budget.reads = budget.reads;
+    if (budget.accepts > 0) s_default_io_budget.accepts = budget.accepts;
+}
+
+void hloop_set_io_budget(hloop_t* loop, hloop_io_budget_t budget) {
+    // an io always gets at least 1 read / accept per wakeup
+    loop->io_budget.read_bytes = budget.read_bytes > 0 ? budget.read_bytes : 1;
+    loop->io_budget.reads = budget.reads > 0 ? budget.reads : 1;
+    loop->io_budget.accepts = budget.accepts > 0 ? budget.accepts : 1;
+}
+
+hloop_io_budget_t hloop_io_budget(hloop_t* loop) {
+    return loop->io_budget;
 }
 
 hloop_t* hloop_new(int flags, buffer_pool_t* swimmingpool, long tid) {
@@ -408,6 +500,12 @@ hloop_t* hloop_new(int flags, buffer_pool_t* swimmingpool, long tid) {
     loop->flags |= flags;
     loop->bufpool = swimmingpool;
     loop->tid = tid;
+    loop->io_budget = s_default_io_budget;
+#ifdef LOOP_TRACE
+    loop->trace = newLoopTrace(tid);
+#endif
+    // before any other thread can post to this loop
+    hloop_create_eventfds(loop);
     // hlogd("hloop_new tid=%ld", loop->tid);
     return loop;
 }
@@ -437,18 +535,15 @@ int hloop_run(hloop_t* loop) {
     // loop->tid = hv_gettid();  tid is taken at hloop_create
     // hlogd("hloop_run tid=%ld", loop->tid);
 
-    if (loop->intern_nevents == 0) {
-        hhybridmutex_lock(&loop->custom_events_mutex);
-        if (loop->eventfds[EVENTFDS_WRITE_INDEX] == -1) {
-            hloop_create_eventfds(loop);
-        }
-        hhybridmutex_unlock(&loop->custom_events_mutex);
-
+    if (loop->eventfds[EVENTFDS_WRITE_INDEX] == -1) {
+        hloop_create_eventfds(loop);
+    }
 #ifdef DEBUG
+    if (_loop_debug_timer == NULL) {
         _loop_debug_timer = htimer_add(loop, hloop_stat_timer_cb, HLOOP_STAT_TIMEOUT, INFINITE);
         ++loop->intern_nevents;
-#endif
     }
+#endif
 
     while (loop->status != HLOOP_STATUS_STOP) {
         if (loop->status == HLOOP_STATUS_PAUSE) {
@@ -709,6 +804,8 @@ const char* hio_engine(void) {
     return "iocp";
 #elif defined(EVENT_PORT)
     return "evport";
+#elif defined(EVENT_IO_URING)
+    return "io_uring";
 #else
     return "noevent";
 #endif
@@ -755,7 +852,17 @@ void hio_attach(hloop_t* loop, hio_t* io) {
     hio_t* preio = __hio_get(loop, fd);
     if (preio != NULL && preio != io) {
         assert(preio->closed);
-        hio_free(preio);
+        if (preio->pending) {
+            // still in the pendings being processed (fd closed and reused in the same loop iteration),
+            // hloop_process_pendings frees it once it has passed it
+            HV_FREE(preio->localaddr);
+            HV_FREE(preio->peeraddr);
+            preio->destroy = 1;
+            EVENT_INACTIVE(preio);
+        }
+        else {
+            hio_free(preio);
+        }
     }
 
     io->loop = loop;
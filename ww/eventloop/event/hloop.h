@@ -166,6 +166,24 @@ HV_EXPORT uint32_t hloop_nactives(hloop_t* loop);
 HV_EXPORT buffer_pool_t* hloop_bufferpool(hloop_t* loop);
 
 
+// io budget: how much one io may do per wakeup before the loop moves on to the others,
+// nio_read keeps reading a readable io until it is drained, paused (hio_read_stop) or out of budget,
+// nio_accept keeps accepting until the backlog is empty or the budget is used
+typedef struct hloop_io_budget_s {
+    uint32_t read_bytes;    // bytes one io may read per wakeup
+    uint32_t reads;         // reads (datagrams) one io may do per wakeup
+    uint32_t accepts;       // connections a listener may accept per wakeup
+} hloop_io_budget_t;
+
+#define HLOOP_DEFAULT_READ_BUDGET_BYTES (256 * 1024)
+#define HLOOP_DEFAULT_READ_BUDGET_READS 16
+#define HLOOP_DEFAULT_ACCEPT_BUDGET     64
+
+// the budget of the loops created after this call, 0 fields keep their default
+HV_EXPORT void hloop_set_default_io_budget(hloop_io_budget_t budget);
+HV_EXPORT void hloop_set_io_budget(hloop_t* loop, hloop_io_budget_t budget);
+HV_EXPORT hloop_io_budget_t hloop_io_budget(hloop_t* loop);
+
 // userdata
 HV_EXPORT void hloop_set_userdata(hloop_t* loop, void* userdata);
 HV_EXPORT void* hloop_userdata(hloop_t* loop);
@@ -223,6 +241,8 @@ const char* hio_engine() {
     return  "iocp";
 #elif defined(EVENT_PORT)
     return  "evport";
+#elif defined(EVENT_IO_URING)
+    return  "io_uring";
 #else
     return  "noevent";
 #endif
@@ -282,6 +302,18 @@ typedef struct fifo_buf_s hio_readbuf_t;
 HV_EXPORT void hio_set_readbuf(hio_t* io, void* buf, size_t len);
 HV_EXPORT shift_buffer_t* hio_get_readbuf(hio_t* io);
 HV_EXPORT void hio_set_max_write_bufsize(hio_t* io, uint32_t size);
+// batched datagram io (linux only, no-op elsewhere), a readable udp io pulls up to batch datagrams with one
+// recvmmsg (read_cb is called for each, with peeraddr set to its sender), hio_write queues the datagram for
+// the current peeraddr and the queue is flushed with one sendmmsg when the fd becomes writable
+// batch <= 1 turns it off, the max is HIO_MAX_BATCH
+#define HIO_MAX_BATCH 64
+HV_EXPORT void hio_set_batch(hio_t* io, unsigned int batch);
+// splice relay (linux only), the bytes read from each of the two connected tcp ios are moved to the other one
+// inside the kernel (splice(2) through a pipe per direction), read_cb is no longer called for them and they must
+// not be written to after this, when the other side cannot take more the relay stops reading, a side that reaches
+// eof is closed once its pipe is drained, and closing one of them ends the relay
+// returns -1 (and changes nothing) if not possible: not linux, not tcp, different loops or a write is queued
+HV_EXPORT int hio_splice(hio_t* io1, hio_t* io2);
 // NOTE: hio_write is non-blocking, so there is a write queue inside hio_t to cache unwritten data and wait for writable.
 // @return current buffer size of write queue.
 HV_EXPORT size_t hio_write_bufsize(hio_t* io);
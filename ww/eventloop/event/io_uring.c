@@ -0,0 +1,408 @@
+#include "iowatcher.h"
+
+#ifdef EVENT_IO_URING
+#include "hplatform.h"
+#include "hdef.h"
+#include "hevent.h"
+#include "hlog.h"
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*
+ * io_uring as a readiness watcher (linux 5.13+, IORING_FEAT_EXT_ARG and multishot poll updates)
+ *
+ * every watched fd has one multishot IORING_OP_POLL_ADD armed with the events it wants, it stays armed and
+ * posts a completion on every wakeup of the fd, so an event costs no sqe, only changing the events does
+ *
+ * a multishot poll checks the fd when it is armed or updated and after that only fires on wakeups (edge
+ * triggered), nio reads until EAGAIN but stops early when the loop budget runs out or a batch is full, then it
+ * calls iowatcher_events_left and the fd is reported again on the next iteration without waiting
+ *
+ * a short stream read is taken as drained, but the fin may already wait behind the bytes it returned and its
+ * wakeup was the one that got us reading, so a fd that hung up is reported again until it is closed
+ *
+ * add/del only mark the fd dirty, iowatcher_poll_events updates the dirty fds and waits with a single
+ * io_uring_enter, so the HV_WRITE on/off churn of a busy worker costs no syscall at all (epoll_ctl each time)
+ *
+ * a fd that is no longer watched gets its poll removed right away: the poll holds a reference to the file, and
+ * the socket must really close when hio_close closes the fd
+ */
+
+#define URING_ENTRIES       256
+#define URING_CQ_ENTRIES    (URING_ENTRIES * 8)
+#define URING_UD_IGNORE     UINT64_MAX // completions nobody waits for (poll removals and updates)
+
+#include "array.h"
+ARRAY_DECL(int, dirty_fds)
+
+typedef struct uring_left_s {
+    int         fd;
+    uint32_t    id;     // of the io, the fd may be reused meanwhile
+    int         events;
+    bool        hup;    // until the io is closed
+} uring_left_t;
+ARRAY_DECL(uring_left_t, left_fds)
+
+typedef struct uring_ctx_s {
+    int                     ring_fd;
+    // submission queue
+    unsigned*               sq_head;
+    unsigned*               sq_tail;
+    unsigned*               sq_array;
+    unsigned                sq_mask;
+    unsigned                sq_entries;
+    unsigned                sq_ready;   // filled and not submitted yet
+    struct io_uring_sqe*    sqes;
+    // completion queue
+    unsigned*               cq_head;
+    unsigned*               cq_tail;
+    unsigned                cq_mask;
+    struct io_uring_cqe*    cqes;
+    // mappings
+    void*                   sq_ring;
+    size_t                  sq_ring_size;
+    void*                   cq_ring;
+    size_t                  cq_ring_size;
+    size_t                  sqes_size;
+    // fds to arm / re-arm before waiting
+    struct dirty_fds        dirty;
+    // fds that were not drained, reported again on the next wait
+    struct left_fds         left;
+} uring_ctx_t;
+
+// getevents: flush the completions, waits for min_complete of them (0: does not wait)
+static int uring_enter(uring_ctx_t* ctx, unsigned to_submit, bool getevents, unsigned min_complete, int timeout) {
+    unsigned flags = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    memset(&arg, 0, sizeof(arg));
+    if (getevents) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (min_complete > 0 && timeout >= 0) {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+        }
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    return (int)syscall(__NR_io_uring_enter, ctx->ring_fd, to_submit, min_complete, flags,
+                        getevents ? &arg : NULL, getevents ? sizeof(arg) : 0);
+}
+
+static void uring_submit(uring_ctx_t* ctx) {
+    while (ctx->sq_ready > 0) {
+        int ret = uring_enter(ctx, ctx->sq_ready, false, 0, 0);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            hloge("io_uring submit error: %s", strerror(errno));
+            return;
+        }
+        ctx->sq_ready -= ret;
+    }
+}
+
+static struct io_uring_sqe* uring_get_sqe(uring_ctx_t* ctx) {
+    unsigned tail = *ctx->sq_tail;
+    if (tail - __atomic_load_n(ctx->sq_head, __ATOMIC_ACQUIRE) == ctx->sq_entries) {
+        uring_submit(ctx);
+    }
+    unsigned index = tail & ctx->sq_mask;
+    struct io_uring_sqe* sqe = &ctx->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ctx->sq_array[index] = index;
+    __atomic_store_n(ctx->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ctx->sq_ready++;
+    return sqe;
+}
+
+static uint64_t uring_user_data(hio_t* io) {
+    return ((uint64_t)io->uring_gen << 32) | (uint32_t)io->fd;
+}
+
+static void uring_disarm(uring_ctx_t* ctx, hio_t* io) {
+    if (io->uring_armed == 0) {
+        return;
+    }
+    struct io_uring_sqe* sqe = uring_get_sqe(ctx);
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = uring_user_data(io);
+    sqe->user_data = URING_UD_IGNORE;
+    // the removed poll completes with -ECANCELED, the new generation makes it stale
+    io->uring_gen++;
+    io->uring_armed = 0;
+}
+
+static unsigned uring_poll_mask(hio_t* io) {
+    unsigned mask = 0;
+    if (io->events & HV_READ) {
+        mask |= POLLIN | POLLRDHUP;
+    }
+    if (io->events & HV_WRITE) {
+        mask |= POLLOUT;
+    }
+    return mask;
+}
+
+static void uring_arm(uring_ctx_t* ctx, hio_t* io) {
+    struct io_uring_sqe* sqe = uring_get_sqe(ctx);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = io->fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = uring_poll_mask(io);
+    sqe->user_data = uring_user_data(io);
+    io->uring_armed = io->events;
+}
+
+// the armed poll gets the new events, the kernel checks the fd again so a ready fd completes right away
+static void uring_update(uring_ctx_t* ctx, hio_t* io) {
+    struct io_uring_sqe* sqe = uring_get_sqe(ctx);
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = uring_user_data(io);
+    sqe->len = IORING_POLL_UPDATE_EVENTS | IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = uring_poll_mask(io);
+    // if the poll has just ended the update fails, the last completion of the poll arms it again
+    sqe->user_data = URING_UD_IGNORE;
+    io->uring_armed = io->events;
+}
+
+static void uring_mark_dirty(uring_ctx_t* ctx, hio_t* io) {
+    if (io->uring_dirty) {
+        return;
+    }
+    io->uring_dirty = 1;
+    if (ctx->dirty.size == ctx->dirty.maxsize) {
+        dirty_fds_double_resize(&ctx->dirty);
+    }
+    ctx->dirty.ptr[ctx->dirty.size++] = io->fd;
+}
+
+int iowatcher_init(hloop_t* loop) {
+    if (loop->iowatcher) return 0;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_CQ_ENTRIES;
+#ifdef IORING_SETUP_COOP_TASKRUN
+    // no interrupt to run completions, we collect them when we enter anyway
+    params.flags |= IORING_SETUP_COOP_TASKRUN;
+#endif
+    int ring_fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring_fd < 0 && errno == EINVAL) {
+        params.flags = IORING_SETUP_CQSIZE;
+        ring_fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    }
+    // IORING_FEAT_RSRC_TAGS came with 5.13, the same release as the multishot poll updates
+    if (ring_fd < 0 || !(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_RSRC_TAGS)) {
+        hlogf("io_uring is not usable on this kernel (%s), build with the epoll backend", strerror(errno));
+        exit(1);
+    }
+
+    uring_ctx_t* ctx;
+    HV_ALLOC_SIZEOF(ctx);
+    ctx->ring_fd = ring_fd;
+    ctx->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ctx->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ctx->sq_ring_size = ctx->cq_ring_size = MAX(ctx->sq_ring_size, ctx->cq_ring_size);
+    }
+    ctx->sq_ring = mmap(NULL, ctx->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                        IORING_OFF_SQ_RING);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ctx->cq_ring = ctx->sq_ring;
+    }
+    else {
+        ctx->cq_ring = mmap(NULL, ctx->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                            IORING_OFF_CQ_RING);
+    }
+    ctx->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ctx->sqes = mmap(NULL, ctx->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                     IORING_OFF_SQES);
+    if (ctx->sq_ring == MAP_FAILED || ctx->cq_ring == MAP_FAILED || ctx->sqes == MAP_FAILED) {
+        hlogf("io_uring mmap failed: %s", strerror(errno));
+        exit(1);
+    }
+
+    char* sq = (char*)ctx->sq_ring;
+    ctx->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ctx->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ctx->sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ctx->sq_entries = *(unsigned*)(sq + params.sq_off.ring_entries);
+    ctx->sq_array = (unsigned*)(sq + params.sq_off.array);
+    char* cq = (char*)ctx->cq_ring;
+    ctx->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ctx->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ctx->cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ctx->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    dirty_fds_init(&ctx->dirty, URING_ENTRIES);
+    left_fds_init(&ctx->left, URING_ENTRIES);
+    loop->iowatcher = ctx;
+    return 0;
+}
+
+int iowatcher_cleanup(hloop_t* loop) {
+    if (loop->iowatcher == NULL) return 0;
+    uring_ctx_t* ctx = (uring_ctx_t*)loop->iowatcher;
+    munmap(ctx->sqes, ctx->sqes_size);
+    if (ctx->cq_ring != ctx->sq_ring) {
+        munmap(ctx->cq_ring, ctx->cq_ring_size);
+    }
+    munmap(ctx->sq_ring, ctx->sq_ring_size);
+    close(ctx->ring_fd);
+    dirty_fds_cleanup(&ctx->dirty);
+    left_fds_cleanup(&ctx->left);
+    HV_FREE(loop->iowatcher);
+    return 0;
+}
+
+int iowatcher_add_event(hloop_t* loop, int fd, int events) {
+    if (loop->iowatcher == NULL) {
+        iowatcher_init(loop);
+    }
+    (void)events;
+    // io->events is updated by the caller, the poll is armed with whatever it is when we wait
+    uring_mark_dirty((uring_ctx_t*)loop->iowatcher, loop->ios.ptr[fd]);
+    return 0;
+}
+
+int iowatcher_del_event(hloop_t* loop, int fd, int events) {
+    uring_ctx_t* ctx = (uring_ctx_t*)loop->iowatcher;
+    if (ctx == NULL) return 0;
+    hio_t* io = loop->ios.ptr[fd];
+    if ((io->events & ~events) == 0) {
+        // not watched anymore, the fd may be closed right after this
+        if (io->uring_armed) {
+            uring_disarm(ctx, io);
+            uring_submit(ctx);
+        }
+        return 0;
+    }
+    uring_mark_dirty(ctx, io);
+    return 0;
+}
+
+static void uring_push_left(uring_ctx_t* ctx, hio_t* io, int events, bool hup) {
+    if (ctx->left.size == ctx->left.maxsize) {
+        left_fds_double_resize(&ctx->left);
+    }
+    ctx->left.ptr[ctx->left.size++] = (uring_left_t){.fd = io->fd, .id = io->id, .events = events, .hup = hup};
+}
+
+int iowatcher_events_left(hloop_t* loop, int fd, int events) {
+    uring_ctx_t* ctx = (uring_ctx_t*)loop->iowatcher;
+    if (ctx == NULL) return 0;
+    uring_push_left(ctx, loop->ios.ptr[fd], events, false);
+    return 0;
+}
+
+int iowatcher_poll_events(hloop_t* loop, int timeout) {
+    uring_ctx_t* ctx = (uring_ctx_t*)loop->iowatcher;
+    if (ctx == NULL) return 0;
+
+    for (size_t i = 0; i < ctx->dirty.size; ++i) {
+        hio_t* io = loop->ios.ptr[ctx->dirty.ptr[i]];
+        if (io == NULL) {
+            continue;
+        }
+        io->uring_dirty = 0;
+        if (io->uring_armed == io->events) {
+            continue;
+        }
+        if (io->uring_armed && io->events) {
+            uring_update(ctx, io);
+            continue;
+        }
+        uring_disarm(ctx, io);
+        if (io->events) {
+            uring_arm(ctx, io);
+        }
+    }
+    dirty_fds_clear(&ctx->dirty);
+
+    // nothing to wait for if some fds are still ready, the completions are still flushed
+    int ret = uring_enter(ctx, ctx->sq_ready, true, ctx->left.size > 0 ? 0 : 1, timeout);
+    if (ret < 0) {
+        if (errno != EINTR && errno != ETIME && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter");
+            return -errno;
+        }
+    }
+    else {
+        ctx->sq_ready -= MIN((unsigned)ret, ctx->sq_ready);
+    }
+
+    int nevents = 0;
+    unsigned head = *ctx->cq_head;
+    unsigned tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        struct io_uring_cqe* cqe = &ctx->cqes[head & ctx->cq_mask];
+        if (cqe->user_data == URING_UD_IGNORE) {
+            continue;
+        }
+        int fd = (int)(uint32_t)cqe->user_data;
+        uint32_t gen = (uint32_t)(cqe->user_data >> 32);
+        hio_t* io = fd < (int)loop->ios.maxsize ? loop->ios.ptr[fd] : NULL;
+        if (io == NULL || io->uring_gen != gen || io->uring_armed == 0) {
+            // a poll that was removed or belongs to a closed fd
+            continue;
+        }
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            // the poll has ended (an error, the cq was full), arm it again before the next wait
+            io->uring_armed = 0;
+            io->uring_gen++;
+            uring_mark_dirty(ctx, io);
+        }
+        int revents = cqe->res;
+        if (revents < 0) {
+            // let the read / write see the error
+            revents = POLLERR;
+        }
+        if (revents & (POLLIN | POLLRDHUP | POLLHUP | POLLERR)) {
+            io->revents |= HV_READ;
+        }
+        if ((revents & (POLLRDHUP | POLLHUP | POLLERR)) && (io->io_type & HIO_TYPE_SOCK_STREAM)) {
+            uring_push_left(ctx, io, HV_READ, true);
+        }
+        if (revents & (POLLOUT | POLLHUP | POLLERR)) {
+            io->revents |= HV_WRITE;
+        }
+        if (io->revents) {
+            ++nevents;
+            EVENT_PENDING(io);
+        }
+    }
+    __atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+
+    // the hung up ones are pushed again behind the ones taken now
+    const size_t nleft = ctx->left.size;
+    for (size_t i = 0; i < nleft; ++i) {
+        uring_left_t left = ctx->left.ptr[i];
+        hio_t* io = left.fd < (int)loop->ios.maxsize ? loop->ios.ptr[left.fd] : NULL;
+        if (io == NULL || io->id != left.id || io->closed) {
+            continue;
+        }
+        if (!(io->events & left.events)) {
+            // paused, resuming updates the poll and the kernel checks the fd again
+            continue;
+        }
+        if (left.hup) {
+            uring_push_left(ctx, io, left.events, true);
+        }
+        if (io->revents == 0) {
+            ++nevents;
+        }
+        io->revents |= io->events & left.events;
+        EVENT_PENDING(io);
+    }
+    ctx->left.size -= nleft;
+    memmove(ctx->left.ptr, ctx->left.ptr + nleft, ctx->left.size * sizeof(uring_left_t));
+    return nevents;
+}
+#endif
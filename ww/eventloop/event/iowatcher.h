@@ -10,6 +10,7 @@
     !defined(EVENT_KQUEUE) &&   \
     !defined(EVENT_IOCP) &&     \
     !defined(EVENT_PORT) &&     \
+    !defined(EVENT_IO_URING) && \
     !defined(EVENT_NOEVENT)
 #ifdef OS_WIN
   #if WITH_WEPOLL
@@ -35,5 +36,9 @@ int iowatcher_cleanup(hloop_t* loop);
 int iowatcher_add_event(hloop_t* loop, int fd, int events);
 int iowatcher_del_event(hloop_t* loop, int fd, int events);
 int iowatcher_poll_events(hloop_t* loop, int timeout);
+#ifdef EVENT_IO_URING
+// io_uring only reports wakeups, nio calls this when it stopped before the fd was drained
+int iowatcher_events_left(hloop_t* loop, int fd, int events);
+#endif
 
 #endif
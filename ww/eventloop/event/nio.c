@@ -7,6 +7,14 @@
 #include "herr.h"
 #include "hthread.h"
 
+#ifdef OS_UNIX
+#include <sys/uio.h>
+#define HIO_HAVE_WRITEV 1 // the write queue of a stream io drains with one sendmsg/writev
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#endif
+
 static void __connect_timeout_cb(htimer_t* timer) {
     hio_t* io = (hio_t*)timer->privdata;
     if (io) {
@@ -61,12 +69,25 @@ static void __close_cb(hio_t* io) {
     hio_close_cb(io);
 }
 
+// the fd may still be ready, a level triggered watcher reports it again anyway
+static void nio_events_left(hio_t* io, int events) {
+#ifdef EVENT_IO_URING
+    iowatcher_events_left(io->loop, io->fd, events);
+#else
+    (void)io;
+    (void)events;
+#endif
+}
+
 static void nio_accept(hio_t* io) {
     // printd("nio_accept listenfd=%d\n", io->fd);
-    int connfd = 0, err = 0, accept_cnt = 0;
+    int connfd = 0, err = 0;
+    uint32_t accept_cnt = 0;
     socklen_t addrlen;
     hio_t* connio = NULL;
-    while (accept_cnt++ < 3) {
+    // drains the backlog up to the budget of the loop, a syn flood does not take one wakeup per connection
+    const uint32_t budget = io->loop->io_budget.accepts;
+    while (accept_cnt++ < budget && !io->closed) {
         addrlen = sizeof(sockaddr_u);
         connfd = accept(io->fd, io->peeraddr, &addrlen);
         if (connfd < 0) {
@@ -89,6 +110,10 @@ static void nio_accept(hio_t* io) {
 
         __accept_cb(connio);
     }
+    // out of the budget, the backlog may not be empty
+    if (!io->closed) {
+        nio_events_left(io, HV_READ);
+    }
     return;
 
 accept_error:
@@ -123,7 +148,11 @@ static void nio_connect_event_cb(hevent_t* ev) {
     hio_t* io = (hio_t*)ev->userdata;
     uint32_t id = (uintptr_t)ev->privdata;
     if (io->id != id) return;
-    nio_connect(io);
+    // connect() returned 0, there is no error to pick up, and with TCP_FASTOPEN_CONNECT the syn is held until
+    // the first write so getpeername would fail (ENOTCONN), peeraddr is already the one we connected to
+    socklen_t addrlen = sizeof(sockaddr_u);
+    getsockname(io->fd, io->localaddr, &addrlen);
+    __connect_cb(io);
 }
 
 static int nio_connect_async(hio_t* io) {
@@ -151,7 +180,12 @@ static int __nio_read(hio_t* io, void* buf, int len) {
     case HIO_TYPE_UDP:
     case HIO_TYPE_IP: {
         socklen_t addrlen = sizeof(sockaddr_u);
-        nread = recvfrom(io->fd, buf, len, 0, io->peeraddr, &addrlen);
+        // datagram sockets are blocking (see hio_socket_init), nio_read reads them until EAGAIN
+        int flag = 0;
+#ifdef MSG_DONTWAIT
+        flag |= MSG_DONTWAIT;
+#endif
+        nread = recvfrom(io->fd, buf, len, flag, io->peeraddr, &addrlen);
     } break;
     default: nread = read(io->fd, buf, len); break;
     }
@@ -183,20 +217,386 @@ static int __nio_write(hio_t* io, const void* buf, int len) {
     return nwrite;
 }
 
+#ifdef HIO_HAVE_WRITEV
+// gathers up to IOV_MAX buffers from the front of the write queue into one call, *len is what it tried to write
+static int __nio_writev(hio_t* io, int* len) {
+    struct iovec iovs[IOV_MAX];
+    int count = write_queue_size(&io->write_queue);
+    if (count > IOV_MAX) {
+        count = IOV_MAX;
+    }
+    shift_buffer_t** bufs = write_queue_data(&io->write_queue);
+    *len = 0;
+    for (int i = 0; i < count; ++i) {
+        iovs[i].iov_base = rawBufMut(bufs[i]);
+        iovs[i].iov_len = bufLen(bufs[i]);
+        *len += (int)iovs[i].iov_len;
+    }
+    if (io->io_type == HIO_TYPE_TCP) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iovs;
+        msg.msg_iovlen = count;
+        int flag = 0;
+#ifdef MSG_NOSIGNAL
+        flag |= MSG_NOSIGNAL;
+#endif
+        return sendmsg(io->fd, &msg, flag);
+    }
+    return writev(io->fd, iovs, count);
+}
+#endif
+
+// drops the first nwrite bytes of the write queue, the buffer where it stops is shifted past what was written
+static void nio_write_consumed(hio_t* io, int nwrite) {
+    while (nwrite > 0) {
+        shift_buffer_t* buf = *write_queue_front(&io->write_queue);
+        int len = (int)bufLen(buf);
+        if (nwrite < len) {
+            shiftr(buf, nwrite);
+            return;
+        }
+        nwrite -= len;
+        reuseBuffer(io->loop->bufpool, buf);
+        write_queue_pop_front(&io->write_queue);
+    }
+}
+
+#ifdef HIO_HAVE_MMSG
+/*
+ * batched datagram io, see hio_set_batch
+ * in_*  : receive slots, the buffers are popped once and kept until a datagram lands in them
+ * out_* : datagrams queued by hio_write, each one keeps the peeraddr it was written for
+ */
+typedef struct hio_batch_s {
+    unsigned int    size;
+    unsigned int    out_count;
+    shift_buffer_t* in_bufs[HIO_MAX_BATCH];
+    struct mmsghdr  in_msgs[HIO_MAX_BATCH];
+    struct iovec    in_iovs[HIO_MAX_BATCH];
+    sockaddr_u      in_addrs[HIO_MAX_BATCH];
+    shift_buffer_t* out_bufs[HIO_MAX_BATCH];
+    struct mmsghdr  out_msgs[HIO_MAX_BATCH];
+    struct iovec    out_iovs[HIO_MAX_BATCH];
+    sockaddr_u      out_addrs[HIO_MAX_BATCH];
+} hio_batch_t;
+
+static void hio_handle_events(hio_t* io);
+
+static void nio_read_batch(hio_t* io) {
+    hio_batch_t* batch = io->batch;
+    for (unsigned int i = 0; i < batch->size; ++i) {
+        if (batch->in_bufs[i] == NULL) {
+            batch->in_bufs[i] = popBuffer(io->loop->bufpool);
+            if (WW_UNLIKELY(rCap(batch->in_bufs[i]) < 1024)) {
+                reserveBufSpace(batch->in_bufs[i], 1024);
+            }
+        }
+        batch->in_iovs[i].iov_base = rawBufMut(batch->in_bufs[i]);
+        batch->in_iovs[i].iov_len = rCap(batch->in_bufs[i]);
+        memset(&batch->in_msgs[i], 0, sizeof(struct mmsghdr));
+        batch->in_msgs[i].msg_hdr.msg_name = &batch->in_addrs[i];
+        batch->in_msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_u);
+        batch->in_msgs[i].msg_hdr.msg_iov = &batch->in_iovs[i];
+        batch->in_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int nrecv = recvmmsg(io->fd, batch->in_msgs, batch->size, MSG_DONTWAIT, NULL);
+    if (nrecv <= 0) {
+        int err = socket_errno();
+        if (nrecv < 0 && err != EAGAIN && err != EINTR && err != EMSGSIZE) {
+            io->error = err;
+        }
+        return;
+    }
+
+    // the callbacks may write, close or even free the batch, so take what was received out of it first
+    const bool full = (unsigned int)nrecv == batch->size;
+    shift_buffer_t* bufs[HIO_MAX_BATCH];
+    sockaddr_u addrs[HIO_MAX_BATCH];
+    unsigned int lens[HIO_MAX_BATCH];
+    int flags[HIO_MAX_BATCH];
+    for (int i = 0; i < nrecv; ++i) {
+        bufs[i] = batch->in_bufs[i];
+        addrs[i] = batch->in_addrs[i];
+        lens[i] = batch->in_msgs[i].msg_len;
+        flags[i] = batch->in_msgs[i].msg_hdr.msg_flags;
+        batch->in_bufs[i] = NULL;
+    }
+
+    const uint32_t id = io->id;
+    for (int i = 0; i < nrecv; ++i) {
+        if (io->closed || io->id != id || lens[i] == 0 || (flags[i] & MSG_TRUNC)) {
+            reuseBuffer(io->loop->bufpool, bufs[i]);
+            continue;
+        }
+        memcpy(io->peeraddr, &addrs[i], sizeof(sockaddr_u));
+        setLen(bufs[i], lens[i]);
+        __read_cb(io, bufs[i]);
+    }
+    if (full && !io->closed && io->id == id && (io->events & HV_READ)) {
+        nio_events_left(io, HV_READ);
+    }
+}
+
+// sends as much of the out queue as the socket takes, returns the number of datagrams sent
+static unsigned int nio_flush_batch(hio_t* io) {
+    hio_batch_t* batch = io->batch;
+    unsigned int nsent_total = 0;
+    while (batch->out_count > 0) {
+        for (unsigned int i = 0; i < batch->out_count; ++i) {
+            batch->out_iovs[i].iov_base = rawBufMut(batch->out_bufs[i]);
+            batch->out_iovs[i].iov_len = bufLen(batch->out_bufs[i]);
+            memset(&batch->out_msgs[i], 0, sizeof(struct mmsghdr));
+            batch->out_msgs[i].msg_hdr.msg_name = &batch->out_addrs[i];
+            batch->out_msgs[i].msg_hdr.msg_namelen = SOCKADDR_LEN(&batch->out_addrs[i]);
+            batch->out_msgs[i].msg_hdr.msg_iov = &batch->out_iovs[i];
+            batch->out_msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int nsent = sendmmsg(io->fd, batch->out_msgs, batch->out_count, MSG_DONTWAIT);
+        if (nsent < 0) {
+            int err = socket_errno();
+            if (err == EINTR) {
+                continue;
+            }
+            if (err == EAGAIN) {
+                break;
+            }
+            // the first datagram is the one that failed (unreachable, too big, ...), drop it and go on
+            io->error = err;
+            nsent = 1;
+        }
+        else {
+            nsent_total += nsent;
+        }
+        for (int i = 0; i < nsent; ++i) {
+            io->write_bufsize -= bufLen(batch->out_bufs[i]);
+            reuseBuffer(io->loop->bufpool, batch->out_bufs[i]);
+        }
+        batch->out_count -= nsent;
+        memmove(batch->out_bufs, batch->out_bufs + nsent, batch->out_count * sizeof(shift_buffer_t*));
+        memmove(batch->out_addrs, batch->out_addrs + nsent, batch->out_count * sizeof(sockaddr_u));
+    }
+    return nsent_total;
+}
+
+static int hio_write_batch(hio_t* io, shift_buffer_t* buf) {
+    hio_batch_t* batch = io->batch;
+    if (batch->out_count == batch->size) {
+        nio_flush_batch(io);
+        if (batch->out_count == batch->size) {
+            // socket buffer is full and so is the queue, this is udp, drop it
+            hlogd("batch queue full, datagram dropped");
+            reuseBuffer(io->loop->bufpool, buf);
+            return 0;
+        }
+    }
+    int len = (int)bufLen(buf);
+    batch->out_bufs[batch->out_count] = buf;
+    memcpy(&batch->out_addrs[batch->out_count], io->peeraddr, SOCKADDR_LEN(io->peeraddr));
+    batch->out_count += 1;
+    io->write_bufsize += len;
+    if (batch->out_count == 1) {
+        // flushed with one sendmmsg when the loop comes back to poll
+        hio_add(io, hio_handle_events, HV_WRITE);
+    }
+    return len;
+}
+#endif
+
+#ifdef HIO_HAVE_SPLICE
+/*
+ * splice relay, see hio_splice
+ * each io of the relay owns the pipe for the bytes read from it, they stay there until the peer takes them
+ */
+#define HIO_SPLICE_CHUNK (1U << 16) // default pipe capacity
+
+typedef struct hio_splice_s {
+    hio_t*      peer;
+    int         pipe_r;
+    int         pipe_w;
+    uint32_t    pending;        // bytes in the pipe
+    unsigned    read_blocked :1; // reading stopped because the peer could not take the pipe
+    unsigned    eof          :1; // read to the end, closed once the pipe is drained
+} hio_splice_t;
+
+static void hio_handle_events(hio_t* io);
+
+// moves the pipe of io to its peer, 1: drained, 0: peer would block (waits for HV_WRITE), -1: peer closed
+static int nio_splice_flush(hio_t* io) {
+    hio_splice_t* sp = io->splice;
+    hio_t* peer = sp->peer;
+    while (sp->pending > 0) {
+        ssize_t nwrite = splice(sp->pipe_r, NULL, peer->fd, NULL, sp->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (nwrite < 0) {
+            int err = socket_errno();
+            if (err == EINTR) {
+                continue;
+            }
+            if (err == EAGAIN) {
+                hio_add(peer, hio_handle_events, HV_WRITE);
+                return 0;
+            }
+            peer->error = err;
+            hio_close(peer);
+            return -1;
+        }
+        sp->pending -= (uint32_t)nwrite;
+        peer->last_write_hrtime = io->loop->cur_hrtime;
+    }
+    if (peer->close) {
+        // hio_close was waiting for this pipe
+        peer->close = 0;
+        hio_close(peer);
+        return -1;
+    }
+    return 1;
+}
+
+static void nio_splice_read(hio_t* io) {
+    hio_splice_t* sp = io->splice;
+    if (sp->peer == NULL) {
+        // the peer is gone, whoever owns this io closes it
+        hio_del(io, HV_READ);
+        return;
+    }
+    if (sp->pending > 0) {
+        int ret = nio_splice_flush(io);
+        if (ret < 0) {
+            return;
+        }
+        if (ret == 0) {
+            sp->read_blocked = 1;
+            hio_del(io, HV_READ);
+            return;
+        }
+    }
+    ssize_t nread = splice(io->fd, NULL, sp->pipe_w, NULL, HIO_SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (nread < 0) {
+        int err = socket_errno();
+        if (err == EAGAIN || err == EINTR) {
+            return;
+        }
+        io->error = err;
+        hio_close(io);
+        return;
+    }
+    if (nread == 0) {
+        hio_del(io, HV_READ);
+        if (sp->pending > 0) {
+            sp->eof = 1;
+            return;
+        }
+        hio_close(io);
+        return;
+    }
+    io->last_read_hrtime = io->loop->cur_hrtime;
+    sp->pending += (uint32_t)nread;
+    if (nio_splice_flush(io) == 0) {
+        // same as a line pause, no more reading until the peer is writable again
+        sp->read_blocked = 1;
+        hio_del(io, HV_READ);
+    }
+    else {
+        // the pipe may run out of slots before the socket runs out of bytes, a short splice is not drained
+        nio_events_left(io, HV_READ);
+    }
+}
+
+// io is writable, take the pipe of the peer
+static void nio_splice_write(hio_t* io) {
+    hio_t* src = io->splice->peer;
+    if (src == NULL) {
+        return;
+    }
+    hio_splice_t* sp = src->splice;
+    if (nio_splice_flush(src) <= 0) {
+        return;
+    }
+    if (sp->eof) {
+        hio_close(src);
+        return;
+    }
+    if (sp->read_blocked) {
+        sp->read_blocked = 0;
+        hio_add(src, hio_handle_events, HV_READ);
+    }
+}
+#endif
+
+/*
+ * adaptive read sizing (like the adaptive allocator of netty), a stream io reads into the buffer class that its
+ * recent reads needed, without asking the kernel (FIONREAD / MSG_PEEK) how much is waiting:
+ *   a read that fills the whole buffer steps one class up, more is probably waiting
+ *   READ_SHRINK_VOTES reads in a row that would have fit the next smaller class step one class down
+ * a new io starts at the largest class, so bulk transfers never notice, datagrams always get the largest class
+ * since a short buffer would truncate them
+ */
+#define READ_SHRINK_VOTES 2
+
+static unsigned int nio_read_class(hio_t* io, buffer_pool_t* pool) {
+    unsigned int largest = bufferPoolClassCount(pool) - 1;
+    if (!(io->io_type & HIO_TYPE_SOCK_STREAM) || io->read_class_down > largest) {
+        return largest;
+    }
+    return largest - io->read_class_down;
+}
+
+static void nio_read_adapt(hio_t* io, buffer_pool_t* pool, unsigned int class_index, unsigned int available, int nread) {
+    if (!(io->io_type & HIO_TYPE_SOCK_STREAM)) {
+        return;
+    }
+    if ((unsigned int)nread >= available) {
+        if (io->read_class_down > 0) {
+            io->read_class_down--;
+        }
+        io->read_shrink_votes = 0;
+    }
+    else if (class_index > 0 && (unsigned int)nread <= bufferPoolClassSize(pool, class_index - 1)) {
+        if (++io->read_shrink_votes >= READ_SHRINK_VOTES) {
+            io->read_class_down++;
+            io->read_shrink_votes = 0;
+        }
+    }
+    else {
+        io->read_shrink_votes = 0;
+    }
+}
+
 static void nio_read(hio_t* io) {
     // printd("nio_read fd=%d\n", io->fd);
     int nread = 0, err = 0;
-//  read:;
+#ifdef HIO_HAVE_MMSG
+    if (io->batch) {
+        nio_read_batch(io);
+        return;
+    }
+#endif
+#ifdef HIO_HAVE_SPLICE
+    if (io->splice) {
+        nio_splice_read(io);
+        return;
+    }
+#endif
+    // the io keeps reading until it is drained, paused or out of the budget of the loop, then the others get
+    // their turn, a level triggered watcher reports it again on the next iteration if anything is left
+    buffer_pool_t* pool = io->loop->bufpool;
+    const uint32_t id = io->id;
+    uint32_t budget_bytes = io->loop->io_budget.read_bytes;
+    uint32_t budget_reads = io->loop->io_budget.reads;
+read:;
 
     // #if defined(OS_LINUX) && defined(HAVE_PIPE)
     //     if(io->pfd_w){
     //         len = (1U << 20); // 1 MB
     //     }else
     // #endif
-    shift_buffer_t* buf = popBuffer(io->loop->bufpool);
+    unsigned int class_index = nio_read_class(io, pool);
+    shift_buffer_t* buf = popBufferOfClass(pool, class_index);
     unsigned int available = rCap(buf);
-    if (WW_UNLIKELY(available < 1024)) {
-        reserveBufSpace(buf, 1024);
+    if (WW_UNLIKELY(available < 512)) {
+        reserveBufSpace(buf, 512);
+        available = rCap(buf);
     }
     nread = __nio_read(io, rawBufMut(buf), available);
 
@@ -205,23 +605,23 @@ static void nio_read(hio_t* io) {
         err = socket_errno();
         if (err == EAGAIN || err == EINTR) {
             // goto read_done;
-            reuseBuffer(io->loop->bufpool, buf);
+            reuseBuffer(pool, buf);
             return;
         }
         else if (err == EMSGSIZE) {
             // ignore
-            reuseBuffer(io->loop->bufpool, buf);
+            reuseBuffer(pool, buf);
             return;
         }
         else {
             // perror("read");
-            reuseBuffer(io->loop->bufpool, buf);
+            reuseBuffer(pool, buf);
             io->error = err;
             goto read_error;
         }
     }
     if (nread == 0) {
-        reuseBuffer(io->loop->bufpool, buf);
+        reuseBuffer(pool, buf);
         goto disconnect;
     }
     // printf("%d \n",nread);
@@ -238,9 +638,31 @@ static void nio_read(hio_t* io) {
     // }
     // #endif
 
+    nio_read_adapt(io, pool, class_index, available, nread);
     setLen(buf, nread);
+    if (class_index > 0 && (unsigned int)nread <= bufferPoolClassSize(pool, 0)) {
+        // the bytes are copied to the smallest class, so whoever keeps them (a partial frame, a queued write)
+        // does not keep a large buffer for a few bytes
+        shift_buffer_t* small = popBufferOfClass(pool, 0);
+        setLen(small, nread);
+        memcpy(rawBufMut(small), rawBuf(buf), nread);
+        reuseBuffer(pool, buf);
+        buf = small;
+    }
     __read_cb(io, buf);
     // user consumed buffer
+
+    // a short stream read means the socket is drained, datagrams are read one by one until EAGAIN, anything
+    // else (the eventfd of the loop, pipes, files) may be blocking and is read once, the callback may have
+    // paused, closed or even replaced the io (a new fd with the same number)
+    budget_bytes = (uint32_t)nread < budget_bytes ? budget_bytes - (uint32_t)nread : 0;
+    if (io->id == id && !io->closed && (io->events & HV_READ) && (io->io_type & HIO_TYPE_SOCKET) &&
+        (!(io->io_type & HIO_TYPE_SOCK_STREAM) || (unsigned int)nread >= available)) {
+        if (--budget_reads > 0 && budget_bytes > 0) {
+            goto read;
+        }
+        nio_events_left(io, HV_READ);
+    }
     return;
 read_error:
 disconnect:
@@ -252,6 +674,23 @@ disconnect:
 static void nio_write(hio_t* io) {
     // printd("nio_write fd=%d\n", io->fd);
     int nwrite = 0, err = 0;
+#ifdef HIO_HAVE_MMSG
+    if (io->batch) {
+        if (nio_flush_batch(io) > 0) {
+            __write_cb(io);
+        }
+        if (io->batch && io->batch->out_count > 0) {
+            hio_add(io, hio_handle_events, HV_WRITE);
+        }
+        return;
+    }
+#endif
+#ifdef HIO_HAVE_SPLICE
+    if (io->splice) {
+        nio_splice_write(io);
+        return;
+    }
+#endif
     //
 write:
     if (write_queue_empty(&io->write_queue)) {
@@ -262,14 +701,23 @@ write:
         }
         return;
     }
-    shift_buffer_t* buf = *write_queue_front(&io->write_queue);
-    int len = (int)bufLen(buf);
-    // char* base = pbuf->base;
-    nwrite = __nio_write(io, rawBufMut(buf), len);
+    int len = 0;
+#ifdef HIO_HAVE_WRITEV
+    if (write_queue_size(&io->write_queue) > 1 && !(io->io_type & HIO_TYPE_SOCK_DGRAM)) {
+        nwrite = __nio_writev(io, &len);
+    }
+    else
+#endif
+    {
+        shift_buffer_t* buf = *write_queue_front(&io->write_queue);
+        len = (int)bufLen(buf);
+        nwrite = __nio_write(io, rawBufMut(buf), len);
+    }
     // printd("write retval=%d\n", nwrite);
     if (nwrite < 0) {
         err = socket_errno();
-        if (err == EAGAIN || err == EINTR) {
+        // EINPROGRESS: fast open socket still in handshake, wait for it to be writable
+        if (err == EAGAIN || err == EINTR || err == EINPROGRESS) {
 
             return;
         }
@@ -282,27 +730,13 @@ write:
     if (nwrite == 0) {
         goto disconnect;
     }
-    shiftr(buf, nwrite);
     io->write_bufsize -= nwrite;
-    if (nwrite == len) {
-        // NOTE: after write_cb, pbuf maybe invalid.
-        // HV_FREE(pbuf->base);
-        // #if defined(OS_LINUX) && defined(HAVE_PIPE)
-        //     if(io->pfd_w == 0)
-        //         HV_FREE(base);
-        // #else
-        reuseBuffer(io->loop->bufpool, buf);
-        // #endif
-        write_queue_pop_front(&io->write_queue);
-        __write_cb(io);
-
-        if (!io->closed) {
-            // write continue
-            goto write;
-        }
-    }
-    else {
-        __write_cb(io);
+    // NOTE: written buffers go back to the pool before write_cb, which may close the io
+    nio_write_consumed(io, nwrite);
+    __write_cb(io);
+    if (nwrite == len && !io->closed) {
+        // write continue
+        goto write;
     }
 
     return;
@@ -391,6 +825,11 @@ int hio_write(hio_t* io, shift_buffer_t* buf) {
         reuseBuffer(io->loop->bufpool, buf);
         return -1;
     }
+#ifdef HIO_HAVE_MMSG
+    if (io->batch) {
+        return hio_write_batch(io, buf);
+    }
+#endif
     int nwrite = 0, err = 0;
     //
     int len = (int)bufLen(buf);
@@ -400,7 +839,8 @@ int hio_write(hio_t* io, shift_buffer_t* buf) {
         // printd("write retval=%d\n", nwrite);
         if (nwrite < 0) {
             err = socket_errno();
-            if (err == EAGAIN || err == EINTR) {
+            // EINPROGRESS: the first write of a fast open socket that could not carry data in the syn
+            if (err == EAGAIN || err == EINTR || err == EINPROGRESS) {
                 nwrite = 0;
                 hlogd("try_write failed, enqueue!");
                 goto enqueue;
@@ -493,7 +933,7 @@ int hio_close(hio_t* io) {
 
         return 0;
     }
-    if (!write_queue_empty(&io->write_queue) && io->error == 0 && io->close == 0 && io->destroy == 0) {
+    if ((!write_queue_empty(&io->write_queue) || hio_splice_pending(io)) && io->error == 0 && io->close == 0 && io->destroy == 0) {
         io->close = 1;
 
         hlogd("write_queue not empty, close later.");
@@ -512,4 +952,123 @@ int hio_close(hio_t* io) {
     }
     return 0;
 }
+
+#ifdef HIO_HAVE_MMSG
+void hio_set_batch(hio_t* io, unsigned int batch) {
+    if (!(io->io_type & HIO_TYPE_SOCK_DGRAM)) {
+        return;
+    }
+    if (batch > HIO_MAX_BATCH) {
+        batch = HIO_MAX_BATCH;
+    }
+    if (batch <= 1) {
+        hio_batch_done(io);
+        return;
+    }
+    if (io->batch == NULL) {
+        HV_ALLOC_SIZEOF(io->batch);
+    }
+    else if (batch < io->batch->size) {
+        // keep the queued datagrams within the new size
+        nio_flush_batch(io);
+        if (io->batch->out_count > batch) {
+            batch = io->batch->out_count;
+        }
+        for (unsigned int i = batch; i < io->batch->size; ++i) {
+            if (io->batch->in_bufs[i]) {
+                reuseBuffer(io->loop->bufpool, io->batch->in_bufs[i]);
+                io->batch->in_bufs[i] = NULL;
+            }
+        }
+    }
+    io->batch->size = batch;
+}
+
+void hio_batch_done(hio_t* io) {
+    hio_batch_t* batch = io->batch;
+    if (batch == NULL) {
+        return;
+    }
+    nio_flush_batch(io);
+    for (unsigned int i = 0; i < batch->out_count; ++i) {
+        io->write_bufsize -= bufLen(batch->out_bufs[i]);
+        reuseBuffer(io->loop->bufpool, batch->out_bufs[i]);
+    }
+    for (unsigned int i = 0; i < HIO_MAX_BATCH; ++i) {
+        if (batch->in_bufs[i]) {
+            reuseBuffer(io->loop->bufpool, batch->in_bufs[i]);
+        }
+    }
+    io->batch = NULL;
+    HV_FREE(batch);
+}
+#endif
+
+#ifdef HIO_HAVE_SPLICE
+static hio_splice_t* hio_splice_new(void) {
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+        hloge("splice pipe creation failed: %s", strerror(errno));
+        return NULL;
+    }
+    hio_splice_t* sp = NULL;
+    HV_ALLOC_SIZEOF(sp);
+    sp->pipe_r = fds[0];
+    sp->pipe_w = fds[1];
+    return sp;
+}
+
+static void hio_splice_free(hio_splice_t* sp) {
+    close(sp->pipe_r);
+    close(sp->pipe_w);
+    HV_FREE(sp);
+}
+
+int hio_splice(hio_t* io1, hio_t* io2) {
+    if (io1->io_type != HIO_TYPE_TCP || io2->io_type != HIO_TYPE_TCP || io1->loop != io2->loop ||
+        io1->closed || io2->closed || io1->splice || io2->splice ||
+        !write_queue_empty(&io1->write_queue) || !write_queue_empty(&io2->write_queue)) {
+        return -1;
+    }
+    hio_splice_t* sp1 = hio_splice_new();
+    if (sp1 == NULL) {
+        return -1;
+    }
+    hio_splice_t* sp2 = hio_splice_new();
+    if (sp2 == NULL) {
+        hio_splice_free(sp1);
+        return -1;
+    }
+    sp1->peer = io2;
+    sp2->peer = io1;
+    io1->splice = sp1;
+    io2->splice = sp2;
+    return 0;
+}
+
+bool hio_splice_pending(hio_t* io) {
+    return io->splice && io->splice->peer && io->splice->peer->splice->pending > 0;
+}
+
+void hio_splice_done(hio_t* io) {
+    hio_splice_t* sp = io->splice;
+    if (sp == NULL) {
+        return;
+    }
+    hio_t* peer = sp->peer;
+    if (peer) {
+        // hand over what is left in the pipe, if the peer takes it right now
+        while (sp->pending > 0) {
+            ssize_t nwrite = splice(sp->pipe_r, NULL, peer->fd, NULL, sp->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (nwrite <= 0) {
+                break;
+            }
+            sp->pending -= (uint32_t)nwrite;
+        }
+        peer->splice->peer = NULL;
+    }
+    io->splice = NULL;
+    hio_splice_free(sp);
+}
+#endif
 #endif
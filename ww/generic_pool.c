@@ -15,6 +15,7 @@ void poolReCharge(generic_pool_t *pool)
         pool->available[i] = pool->create_item_handle(pool);
     }
     pool->len += increase;
+    pool->allocated += increase;
 #if defined(DEBUG) && defined(POOL_DEBUG)
     hlogd("BufferPool: allocated %d new buffers, %zu are in use", increase, pool->in_use);
 #endif
@@ -29,6 +30,7 @@ void poolShrink(generic_pool_t *pool)
         pool->destroy_item_handle(pool, pool->available[i]);
     }
     pool->len -= decrease;
+    pool->allocated -= decrease;
 
 #if defined(DEBUG) && defined(POOL_DEBUG)
     hlogd("BufferPool: freed %d buffers, %zu are in use", decrease, pool->in_use);
@@ -40,7 +42,8 @@ void poolShrink(generic_pool_t *pool)
 
 static void poolFirstCharge(generic_pool_t *pool)
 {
-    pool->len = pool->cap / 2;
+    pool->len       = pool->cap / 2;
+    pool->allocated = pool->len;
     for (size_t i = 0; i < pool->len; i++)
     {
         pool->available[i] = pool->create_item_handle(pool);
@@ -1,6 +1,7 @@
 #pragma once
 #include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
 #ifdef OS_LINUX
 #include <malloc.h>
 #endif
@@ -36,6 +37,9 @@ typedef void (*PoolItemDestroyHandle)(struct generic_pool_s *pool, pool_item_t *
     unsigned int          len;                                                                                         \
     unsigned int          cap;                                                                                         \
     unsigned int          free_threshould;                                                                             \
+    unsigned int          allocated;                                                                                   \
+    uint64_t              pops;                                                                                        \
+    uint64_t              misses;                                                                                      \
     atomic_size_t         in_use;                                                                                      \
     PoolItemCreateHandle  create_item_handle;                                                                          \
     PoolItemDestroyHandle destroy_item_handle;                                                                         \
@@ -46,6 +50,9 @@ typedef void (*PoolItemDestroyHandle)(struct generic_pool_s *pool, pool_item_t *
     unsigned int          len;                                                                                         \
     unsigned int          cap;                                                                                         \
     unsigned int          free_threshould;                                                                             \
+    unsigned int          allocated;                                                                                   \
+    uint64_t              pops;                                                                                        \
+    uint64_t              misses;                                                                                      \
     PoolItemCreateHandle  create_item_handle;                                                                          \
     PoolItemDestroyHandle destroy_item_handle;                                                                         \
     pool_item_t          *available[];
@@ -59,6 +66,15 @@ struct generic_pool_s
 
 typedef struct generic_pool_s generic_pool_t;
 
+// what the pool owns (available + handed out) and how often a pop found it empty, read by the metrics
+typedef struct pool_stats_s
+{
+    unsigned int available;
+    unsigned int allocated;
+    uint64_t     hits;
+    uint64_t     misses;
+} pool_stats_t;
+
 void poolReCharge(generic_pool_t *pool);
 void poolShrink(generic_pool_t *pool);
 
@@ -68,8 +84,10 @@ static inline pool_item_t *popPoolItem(generic_pool_t *pool)
     return pool->create_item_handle(pool);
 #endif
 
+    pool->pops += 1;
     if (pool->len <= 0)
     {
+        pool->misses += 1;
         poolReCharge(pool);
     }
 
@@ -98,6 +116,14 @@ static inline void reusePoolItem(generic_pool_t *pool, pool_item_t *b)
     pool->available[(pool->len)++] = b;
 }
 
+static inline pool_stats_t getPoolStats(generic_pool_t *pool)
+{
+    return (pool_stats_t){.available = pool->len,
+                          .allocated = pool->allocated,
+                          .hits      = pool->pops - pool->misses,
+                          .misses    = pool->misses};
+}
+
 generic_pool_t *newGenericPool(PoolItemCreateHandle create_h, PoolItemDestroyHandle destroy_h);
 generic_pool_t *newGenericPoolWithSize(unsigned long pool_width, PoolItemCreateHandle create_h,
                                        PoolItemDestroyHandle destroy_h);
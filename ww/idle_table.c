@@ -1,69 +1,204 @@
 #include "idle_table.h"
 #include "basic_types.h"
-#include "hdef.h"
 #include "hloop.h"
-#include "hmutex.h"
 #include "ww.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 enum
 {
-    kVecCap = 32
+    kVecCap          = 32,
+    kIdleTableTickMs = 1000,
+    kWheelBits       = 6,
+    kWheelSlots      = 1 << kWheelBits,
+    kWheelMask       = kWheelSlots - 1,
+    kWheelLevels     = 4 // 64, 64^2, 64^3 and 64^4 ticks
 };
 
-#define i_TYPE                    heapq_idles_t, struct idle_item_s *
-#define i_cmp                     -c_default_cmp                                // NOLINT
-#define idletable_less_func(x, y) ((*(x))->expire_at_ms < (*(y))->expire_at_ms) // NOLINT
-#define i_less                    idletable_less_func                           // NOLINT
-#include "stc/pque.h"
-
 #define i_TYPE hmap_idles_t, uint64_t, struct idle_item_s *
 #include "stc/hmap.h"
 
+// the part of the table that belongs to one worker, only that worker touches it
+typedef struct idle_wheel_s
+{
+    htimer_t    *timer;
+    hmap_idles_t hmap;
+    uint64_t     tick; // the current tick, the items of its slot expire as their deadline passes
+    size_t       count;
+    idle_item_t *slots[kWheelLevels][kWheelSlots];
+
+} idle_wheel_t;
+
 struct idle_table_s
 {
-    hloop_t       *loop;
-    htimer_t      *idle_handle;
-    heapq_idles_t  hqueue;
-    hmap_idles_t   hmap;
-    hhybridmutex_t mutex;
-    uint64_t       last_update_ms;
-    uintptr_t      memptr;
-} ATTR_ALIGNED_LINE_CACHE;
+    unsigned int  wheels_count;
+    idle_wheel_t *wheels[];
+};
 
-void idleCallBack(htimer_t *timer);
+static uint64_t expireTick(const idle_item_t *item)
+{
+    return item->expire_at_ms / kIdleTableTickMs;
+}
 
-idle_table_t *newIdleTable(hloop_t *loop)
+static void linkItem(idle_item_t **slot, idle_item_t *item)
 {
-    // assert(sizeof(struct idle_table_s) <= kCpuLineCacheSize); promotion to 128 bytes
-    int64_t memsize = (int64_t) sizeof(struct idle_table_s);
-    // ensure we have enough space to offset the allocation by line cache (for alignment)
-    MUSTALIGN2(memsize + ((kCpuLineCacheSize + 1) / 2), kCpuLineCacheSize);
-    memsize = ALIGN2(memsize + ((kCpuLineCacheSize + 1) / 2), kCpuLineCacheSize);
+    item->next = *slot;
+    if (item->next)
+    {
+        item->next->pprev = &(item->next);
+    }
+    *slot       = item;
+    item->pprev = slot;
+}
 
-    // check for overflow
-    if (memsize < (int64_t) sizeof(struct idle_table_s))
+static void unlinkItem(idle_item_t *item)
+{
+    *(item->pprev) = item->next;
+    if (item->next)
     {
-        fprintf(stderr, "buffer size out of range");
-        exit(1);
+        item->next->pprev = item->pprev;
     }
+    item->next  = NULL;
+    item->pprev = NULL;
+}
 
-    // allocate memory, placing idle_table_t at a line cache address boundary
-    uintptr_t ptr = (uintptr_t) malloc(memsize);
+// the level is picked by how far the deadline is, the slot by the deadline itself
+static void placeItem(idle_wheel_t *wheel, idle_item_t *item)
+{
+    uint64_t expire = expireTick(item);
+    if (expire < wheel->tick)
+    {
+        // already due, goes to the current slot
+        expire = wheel->tick;
+    }
+    uint64_t     delta = expire - wheel->tick;
+    unsigned int level = 0;
+    while (level < kWheelLevels - 1 && delta >= (1ULL << (kWheelBits * (level + 1))))
+    {
+        level++;
+    }
+    if (delta >= (1ULL << (kWheelBits * kWheelLevels)))
+    {
+        // too far, placed again when this slot comes up
+        expire = wheel->tick + (1ULL << (kWheelBits * kWheelLevels)) - 1;
+    }
+    linkItem(&(wheel->slots[level][(expire >> (kWheelBits * level)) & kWheelMask]), item);
+}
 
-    // align c to line cache boundary
-    MUSTALIGN2(ptr, kCpuLineCacheSize);
+// moves the items of the current slot of a level down, to where their deadline is now
+static void cascade(idle_wheel_t *wheel, unsigned int level)
+{
+    idle_item_t **slot = &(wheel->slots[level][(wheel->tick >> (kWheelBits * level)) & kWheelMask]);
+    idle_item_t  *item = *slot;
+    *slot              = NULL;
+    while (item)
+    {
+        idle_item_t *next = item->next;
+        placeItem(wheel, item);
+        item = next;
+    }
+}
 
-    idle_table_t *newtable = (idle_table_t *) ALIGN2(ptr, kCpuLineCacheSize); // NOLINT
+static void expireItem(idle_wheel_t *wheel, idle_item_t *item, uint64_t now)
+{
+    uint64_t old_expire_at_ms = item->expire_at_ms;
 
-    *newtable = (idle_table_t){.memptr         = ptr,
-                               .loop           = loop,
-                               .idle_handle    = htimer_add(loop, idleCallBack, 1000, INFINITE),
-                               .hqueue         = heapq_idles_t_with_capacity(kVecCap),
-                               .hmap           = hmap_idles_t_with_capacity(kVecCap),
-                               .last_update_ms = hloop_now_ms(loop)};
+    item->cb(item);
 
-    hhybridmutex_init(&(newtable->mutex));
-    hevent_set_userdata(newtable->idle_handle, newtable);
+    if (item->removed)
+    {
+        // the callback removed it
+        free(item);
+        return;
+    }
+    if (old_expire_at_ms != item->expire_at_ms && item->expire_at_ms > now)
+    {
+        placeItem(wheel, item);
+        return;
+    }
+    hmap_idles_t_erase_at(&(wheel->hmap), hmap_idles_t_find(&(wheel->hmap), item->hash));
+    wheel->count--;
+    free(item);
+}
+
+// expires the items of the current slot that are due, the rest wait for the next check
+static void runCurrentSlot(idle_wheel_t *wheel, uint64_t now)
+{
+    // the callbacks can remove any item, even the ones waiting in this list, what they add or keep
+    // goes to the slot again and is checked the next time
+    idle_item_t **slot = &(wheel->slots[0][wheel->tick & kWheelMask]);
+    idle_item_t  *due  = *slot;
+    *slot              = NULL;
+    if (due)
+    {
+        due->pprev = &due;
+    }
+    while (due)
+    {
+        idle_item_t *item = due;
+        unlinkItem(item);
+        if (item->expire_at_ms > now)
+        {
+            // not yet, or it was kept for longer after it was placed
+            placeItem(wheel, item);
+            continue;
+        }
+        expireItem(wheel, item, now);
+    }
+}
+
+static void onIdleTick(htimer_t *timer)
+{
+    idle_wheel_t  *wheel    = hevent_userdata(timer);
+    const uint64_t now      = hloop_now_ms(hevent_loop(timer));
+    const uint64_t now_tick = now / kIdleTableTickMs;
+
+    if (wheel->count == 0)
+    {
+        wheel->tick = now_tick;
+        return;
+    }
+    while (true)
+    {
+        runCurrentSlot(wheel, now);
+        if (wheel->tick >= now_tick)
+        {
+            break;
+        }
+        // the slot is empty, every deadline in it has passed
+        wheel->tick++;
+        if ((wheel->tick & kWheelMask) == 0)
+        {
+            for (unsigned int level = 1; level < kWheelLevels; level++)
+            {
+                cascade(wheel, level);
+                if (((wheel->tick >> (kWheelBits * level)) & kWheelMask) != 0)
+                {
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// runs on the worker, so the timer is added to its own loop
+static idle_wheel_t *newIdleWheel(uint8_t tid)
+{
+    idle_wheel_t *wheel = malloc(sizeof(idle_wheel_t));
+    memset(wheel, 0, sizeof(idle_wheel_t));
+    wheel->hmap  = hmap_idles_t_with_capacity(kVecCap);
+    wheel->tick  = hloop_now_ms(loops[tid]) / kIdleTableTickMs;
+    wheel->timer = htimer_add(loops[tid], onIdleTick, kIdleTableTickMs, INFINITE);
+    hevent_set_userdata(wheel->timer, wheel);
+    return wheel;
+}
+
+idle_table_t *newIdleTable(void)
+{
+    idle_table_t *newtable = malloc(sizeof(idle_table_t) + (sizeof(idle_wheel_t *) * workers_count));
+    memset(newtable, 0, sizeof(idle_table_t) + (sizeof(idle_wheel_t *) * workers_count));
+    newtable->wheels_count = workers_count;
     return newtable;
 }
 
@@ -72,8 +207,14 @@ idle_item_t *newIdleItem(idle_table_t *self, hash_t key, void *userdata, ExpireC
 {
     assert(self);
     assert(cb);
-    idle_item_t *item = malloc(sizeof(idle_item_t));
-    hhybridmutex_lock(&(self->mutex));
+    assert(tid < self->wheels_count);
+
+    if (self->wheels[tid] == NULL)
+    {
+        self->wheels[tid] = newIdleWheel(tid);
+    }
+    idle_wheel_t *wheel = self->wheels[tid];
+    idle_item_t  *item  = malloc(sizeof(idle_item_t));
 
     *item = (idle_item_t){.expire_at_ms = hloop_now_ms(loops[tid]) + age_ms,
                           .hash         = key,
@@ -82,143 +223,96 @@ idle_item_t *newIdleItem(idle_table_t *self, hash_t key, void *userdata, ExpireC
                           .cb           = cb,
                           .table        = self};
 
-    if (! hmap_idles_t_insert(&(self->hmap), item->hash, item).inserted)
+    if (! hmap_idles_t_insert(&(wheel->hmap), item->hash, item).inserted)
     {
         // hash is already in the table !
-        hhybridmutex_unlock(&(self->mutex));
         free(item);
         return NULL;
     }
-    heapq_idles_t_push(&(self->hqueue), item);
-    hhybridmutex_unlock(&(self->mutex));
+    wheel->count++;
+    placeItem(wheel, item);
     return item;
 }
+
 void keepIdleItemForAtleast(idle_table_t *self, idle_item_t *item, uint64_t age_ms)
 {
     if (item->removed)
     {
         return;
     }
-    item->expire_at_ms = self->last_update_ms + age_ms;
+    const uint64_t expire_at_ms = hloop_now_ms(loops[item->tid]) + age_ms;
 
-    hhybridmutex_lock(&(self->mutex));
-    heapq_idles_t_make_heap(&self->hqueue);
-    hhybridmutex_unlock(&(self->mutex));
+    if (expire_at_ms < item->expire_at_ms && item->pprev != NULL)
+    {
+        // sooner than the slot it waits in, so it can not wait for that slot
+        item->expire_at_ms = expire_at_ms;
+        unlinkItem(item);
+        placeItem(self->wheels[item->tid], item);
+        return;
+    }
+    item->expire_at_ms = expire_at_ms;
 }
+
 idle_item_t *getIdleItemByHash(uint8_t tid, idle_table_t *self, hash_t key)
 {
-    hhybridmutex_lock(&(self->mutex));
-
-    hmap_idles_t_iter find_result = hmap_idles_t_find(&(self->hmap), key);
-    if (find_result.ref == hmap_idles_t_end(&(self->hmap)).ref || find_result.ref->second->tid != tid)
+    assert(tid < self->wheels_count);
+    idle_wheel_t *wheel = self->wheels[tid];
+    if (wheel == NULL)
+    {
+        return NULL;
+    }
+    hmap_idles_t_iter find_result = hmap_idles_t_find(&(wheel->hmap), key);
+    if (find_result.ref == hmap_idles_t_end(&(wheel->hmap)).ref)
     {
-        hhybridmutex_unlock(&(self->mutex));
         return NULL;
     }
-    hhybridmutex_unlock(&(self->mutex));
     return (find_result.ref->second);
 }
 
 bool removeIdleItemByHash(uint8_t tid, idle_table_t *self, hash_t key)
 {
-    hhybridmutex_lock(&(self->mutex));
-    hmap_idles_t_iter find_result = hmap_idles_t_find(&(self->hmap), key);
-    if (find_result.ref == hmap_idles_t_end(&(self->hmap)).ref || find_result.ref->second->tid != tid)
+    assert(tid < self->wheels_count);
+    idle_wheel_t *wheel = self->wheels[tid];
+    if (wheel == NULL)
+    {
+        return false;
+    }
+    hmap_idles_t_iter find_result = hmap_idles_t_find(&(wheel->hmap), key);
+    if (find_result.ref == hmap_idles_t_end(&(wheel->hmap)).ref)
     {
-        hhybridmutex_unlock(&(self->mutex));
         return false;
     }
     idle_item_t *item = (find_result.ref->second);
-    hmap_idles_t_erase_at(&(self->hmap), find_result);
+    hmap_idles_t_erase_at(&(wheel->hmap), find_result);
+    wheel->count--;
     item->removed = true;
-    // heapq_idles_t_make_heap(&self->hqueue);
-
-    hhybridmutex_unlock(&(self->mutex));
-    return true;
-}
 
-static void beforeCloseCallBack(hevent_t *ev)
-{
-    idle_item_t *item = hevent_userdata(ev);
-    if (! item->removed)
-    {
-        if (item->expire_at_ms > hloop_now_ms(loops[item->tid]))
-        {
-            hhybridmutex_lock(&(item->table->mutex));
-            heapq_idles_t_push(&(item->table->hqueue), item);
-            hhybridmutex_unlock(&(item->table->mutex));
-            return;
-        }
-
-        uint64_t old_expire_at_ms = item->expire_at_ms;
-
-        item->cb(item);
-
-        if (old_expire_at_ms != item->expire_at_ms && item->expire_at_ms > hloop_now_ms(loops[item->tid]))
-        {
-            hhybridmutex_lock(&(item->table->mutex));
-            heapq_idles_t_push(&(item->table->hqueue), item);
-            hhybridmutex_unlock(&(item->table->mutex));
-        }
-        else
-        {
-            bool removal_result = removeIdleItemByHash(item->tid, item->table, item->hash);
-            assert(removal_result);
-            (void) removal_result;
-            free(item);
-        }
-    }
-    else
+    if (item->pprev == NULL)
     {
-        free(item);
+        // its callback is running, freed when it returns
+        return true;
     }
+    unlinkItem(item);
+    free(item);
+    return true;
 }
 
-void idleCallBack(htimer_t *timer)
+void destroyIdleTable(idle_table_t *self)
 {
-    idle_table_t  *self  = hevent_userdata(timer);
-    const uint64_t now   = hloop_now_ms(self->loop);
-    self->last_update_ms = now;
-    hhybridmutex_lock(&(self->mutex));
-
-    while (heapq_idles_t_size(&(self->hqueue)) > 0)
+    for (unsigned int i = 0; i < self->wheels_count; i++)
     {
-        idle_item_t *item = *heapq_idles_t_top(&(self->hqueue));
-
-        if (item->expire_at_ms <= now)
+        idle_wheel_t *wheel = self->wheels[i];
+        if (wheel == NULL)
         {
-            heapq_idles_t_pop(&(self->hqueue));
-
-            if (item->removed)
-            {
-                // already removed
-                free(item);
-            }
-            else
-            {
-                // destruction must happen on other thread
-                // hmap_idles_t_erase(&(self->hmap), item->hash);
-                hevent_t ev;
-                memset(&ev, 0, sizeof(ev));
-                ev.loop = loops[item->tid];
-                ev.cb   = beforeCloseCallBack;
-                hevent_set_userdata(&ev, item);
-                hloop_post_event(loops[item->tid], &ev);
-            }
+            continue;
         }
-        else
+        htimer_del(wheel->timer);
+        c_foreach(k, hmap_idles_t, wheel->hmap)
         {
-            break;
+            free(k.ref->second);
         }
+        hmap_idles_t_drop(&(wheel->hmap));
+        free(wheel);
     }
-    hhybridmutex_unlock(&(self->mutex));
-}
-
-void destroyIdleTable(idle_table_t *self)
-{
-    htimer_del(self->idle_handle);
-    heapq_idles_t_drop(&self->hqueue);
-    hmap_idles_t_drop(&self->hmap);
-    hhybridmutex_destroy(&self->mutex);
-    free((void *) (self->memptr)); // NOLINT
+    free(self);
 }
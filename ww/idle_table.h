@@ -5,7 +5,7 @@
 #include <stdint.h>
 
 /*
-    Thread safe idle table
+    Idle table
 
     What dose it mean "idle table?"
     in simple words, you put a object (idle_item) inside the table
@@ -14,18 +14,21 @@
     you also can keep updating the item timeout
 
     The time checking has no cost and won't syscall at all, and the checking is synced by the
-    eventloop which by default wakes up every 100 ms. (debug note: current idletable interval is set to 1s)
+    eventloop, the items are checked every kIdleTableTickMs (1s)
 
     idle item is a threadlocal item, it belongs to the thread that created it
     and other threads must not change , remove or do anything to it
     because of that, tid parameter is required in order to find the item
 
-    -- valgrind unfriendly, since we required 64byte alignment, so it says "possibly lost"
-       but the pointer is saved in "memptr" field inside the object
+    every worker has its own part of the table (a hashmap and a hierarchical timing wheel, created when
+    the worker puts its first item), so there is no lock and the callback runs on the worker that owns the
+    item, the calls for an item must be made on its thread
 
-    note that libhv timer is also not a real timer, but is a heap like timer
-    i didnt know this when i created the idle table but, this is still useful i believe and
-    has its own usecases
+    new / remove are O(1), keeping an item for longer only writes the new deadline, the item is moved to its
+    new place in the wheel when its old slot comes up (lazy), so refreshing an item on every packet is cheap
+
+    the callback can keep the item for longer (keepIdleItemForAtleast), otherwise the item is removed and
+    freed after the callback returns, removing an item frees it, do not use the pointer after that
 */
 
 struct idle_item_s;
@@ -45,9 +48,13 @@ struct idle_item_s
     uint64_t       expire_at_ms;
     uint8_t        tid;
     bool           removed;
+
+    // private
+    idle_item_t  *next;
+    idle_item_t **pprev; // NULL while the callback runs
 };
 
-idle_table_t *newIdleTable(hloop_t *loop);
+idle_table_t *newIdleTable(void);
 void          destroyIdleTable(idle_table_t *self);
 
 idle_item_t *newIdleItem(idle_table_t *self, hash_t key, void *userdata, ExpireCallBack cb, uint8_t tid,
@@ -0,0 +1,255 @@
+#include "loop_trace.h"
+
+#ifdef LOOP_TRACE
+
+#include "hthread.h"
+#include "htime.h"
+#include "loggers/core_logger.h"
+#include "managers/metrics_manager.h"
+#include "metrics.h"
+#include "ww.h"
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+    kLoopTraceRingMask = kLoopTraceRingSize - 1
+};
+
+_Static_assert((kLoopTraceRingSize & kLoopTraceRingMask) == 0, "the ring size must be a power of 2");
+
+_Thread_local loop_trace_t *loop_trace = NULL;
+
+// bumped by the signal handler, every loop compares it with the last one it dumped for
+static atomic_uint dump_requests;
+
+static void onDumpSignal(int signum)
+{
+    (void) signum;
+    atomic_fetch_add_explicit(&dump_requests, 1, memory_order_relaxed);
+}
+
+void installLoopTraceSignal(void)
+{
+#ifdef SIGUSR1
+    if (signal(SIGUSR1, onDumpSignal) == SIG_ERR)
+    {
+        LOGW("LoopTrace: could not set the SIGUSR1 handler, the trace can not be dumped");
+        return;
+    }
+    LOGI("LoopTrace: loops are traced, send SIGUSR1 to dump them (kill -USR1 %ld)", hv_getpid());
+#endif
+}
+
+loop_trace_t *newLoopTrace(long tid)
+{
+    loop_trace_t *trace = malloc(sizeof(loop_trace_t));
+    memset(trace, 0, sizeof(loop_trace_t));
+    trace->tid        = tid;
+    trace->node       = kLoopTraceNoNode;
+    trace->dumps_seen = atomic_load_explicit(&dump_requests, memory_order_relaxed);
+    return trace;
+}
+
+void destroyLoopTrace(loop_trace_t *trace)
+{
+    if (loop_trace == trace)
+    {
+        loop_trace = NULL;
+    }
+    free(trace);
+}
+
+const char *loopTraceKindName(loop_trace_kind_e kind)
+{
+    switch (kind)
+    {
+    case kLoopTraceIo:
+        return "io";
+    case kLoopTraceTimer:
+        return "timer";
+    case kLoopTraceIdle:
+        return "idle";
+    case kLoopTraceCustom:
+        return "custom";
+    case kLoopTraceIteration:
+        return "iteration";
+    default:
+        return "unknown";
+    }
+}
+
+// only the loops of the workers count into worker_metrics, the others (metrics thread, ...) have only the ring
+static worker_metrics_t *getTraceMetrics(loop_trace_t *trace)
+{
+    if (trace->tid < 0 || (unsigned long) trace->tid >= workers_count)
+    {
+        return NULL;
+    }
+    return getWorkerMetrics((uint8_t) trace->tid);
+}
+
+static void pushSpan(loop_trace_t *trace, uint64_t start_us, uint32_t duration_us, uint8_t kind, int16_t node)
+{
+    loop_trace_span_t *span = &(trace->ring[trace->head]);
+    span->start_us          = start_us;
+    span->duration_us       = duration_us;
+    span->kind              = kind;
+    span->node              = node;
+    trace->head             = (trace->head + 1) & kLoopTraceRingMask;
+    if (trace->count < kLoopTraceRingSize)
+    {
+        trace->count += 1;
+    }
+}
+
+static void updateSlowest(loop_trace_t *trace, worker_metrics_t *metrics, uint64_t packed)
+{
+    if (packed <= trace->slowest[kLoopTraceSlowest - 1])
+    {
+        return;
+    }
+    int i = kLoopTraceSlowest - 1;
+    while (i > 0 && trace->slowest[i - 1] < packed)
+    {
+        trace->slowest[i] = trace->slowest[i - 1];
+        i--;
+    }
+    trace->slowest[i] = packed;
+
+    if (metrics != NULL)
+    {
+        for (unsigned int r = 0; r < kLoopTraceSlowest; r++)
+        {
+            metricSet(&(metrics->slowest_callbacks[r]), trace->slowest[r]);
+        }
+    }
+}
+
+static void writeJsonString(FILE *f, const char *value)
+{
+    fputc('"', f);
+    for (const char *p = value; *p != '\0'; p++)
+    {
+        if (*p == '"' || *p == '\\')
+        {
+            fprintf(f, "\\%c", *p);
+        }
+        else if ((unsigned char) *p < 0x20)
+        {
+            fprintf(f, "\\u%04x", (unsigned int) (unsigned char) *p);
+        }
+        else
+        {
+            fputc(*p, f);
+        }
+    }
+    fputc('"', f);
+}
+
+static void writeSpanName(FILE *f, uint8_t kind, int16_t node)
+{
+    const char *node_name = node == kLoopTraceNoNode ? NULL : getMeteredNodeName((unsigned int) node);
+    writeJsonString(f, node_name != NULL ? node_name : loopTraceKindName(kind));
+}
+
+static void dumpLoopTrace(loop_trace_t *trace)
+{
+    const long pid = hv_getpid();
+    char       path[64];
+    snprintf(path, sizeof(path), "ww-trace-%ld-%ld.json", pid, trace->tid);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        LOGE("LoopTrace: could not open %s to dump the trace of loop %ld", path, trace->tid);
+        return;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":\"loop %ld\"}}", pid,
+            trace->tid, trace->tid);
+
+    // oldest first
+    for (uint32_t i = 0; i < trace->count; i++)
+    {
+        loop_trace_span_t *span = &(trace->ring[(trace->head - trace->count + i) & kLoopTraceRingMask]);
+        fprintf(f, ",\n{\"name\":");
+        writeSpanName(f, span->kind, span->node);
+        fprintf(f, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%u,\"pid\":%ld,\"tid\":%ld}",
+                loopTraceKindName(span->kind), (unsigned long long) span->start_us, span->duration_us, pid,
+                trace->tid);
+    }
+
+    // the slowest ones are probably not in the ring anymore
+    fprintf(f, "\n],\"otherData\":{");
+    for (unsigned int r = 0; r < kLoopTraceSlowest && trace->slowest[r] != 0; r++)
+    {
+        const int16_t node      = loopTraceSlowestNode(trace->slowest[r]);
+        const char   *node_name = node == kLoopTraceNoNode ? NULL : getMeteredNodeName((unsigned int) node);
+        char          entry[192];
+        snprintf(entry, sizeof(entry), "%u us %s %s", loopTraceSlowestDuration(trace->slowest[r]),
+                 loopTraceKindName(loopTraceSlowestKind(trace->slowest[r])), node_name != NULL ? node_name : "-");
+        fprintf(f, "%s\"slowest %u\":", r == 0 ? "" : ",", r + 1);
+        writeJsonString(f, entry);
+    }
+    fprintf(f, "}}\n");
+    fclose(f);
+
+    LOGI("LoopTrace: wrote %u spans of loop %ld to %s", trace->count, trace->tid, path);
+}
+
+void loopTraceIterationBegin(loop_trace_t *trace, uint64_t now_us)
+{
+    loop_trace                = trace;
+    trace->iteration_start_us = now_us;
+
+    const unsigned int requests = atomic_load_explicit(&dump_requests, memory_order_relaxed);
+    if (WW_UNLIKELY(requests != trace->dumps_seen))
+    {
+        trace->dumps_seen = requests;
+        dumpLoopTrace(trace);
+    }
+}
+
+void loopTraceIterationEnd(loop_trace_t *trace, int ncallbacks)
+{
+    // an iteration that only woke up to find nothing is not interesting
+    if (ncallbacks == 0)
+    {
+        return;
+    }
+    const uint64_t now_us   = gethrtime_us();
+    const uint64_t duration = now_us - trace->iteration_start_us;
+    pushSpan(trace, trace->iteration_start_us, (uint32_t) duration, kLoopTraceIteration, kLoopTraceNoNode);
+
+    worker_metrics_t *metrics = getTraceMetrics(trace);
+    if (metrics != NULL)
+    {
+        metricObserve(&(metrics->loop_busy), duration);
+    }
+}
+
+uint64_t loopTraceCallbackBegin(loop_trace_t *trace)
+{
+    trace->node = kLoopTraceNoNode;
+    return gethrtime_us();
+}
+
+void loopTraceCallbackEnd(loop_trace_t *trace, loop_trace_kind_e kind, uint64_t start_us)
+{
+    const uint32_t duration = (uint32_t) (gethrtime_us() - start_us);
+    pushSpan(trace, start_us, duration, (uint8_t) kind, trace->node);
+
+    worker_metrics_t *metrics = getTraceMetrics(trace);
+    if (metrics != NULL)
+    {
+        metricObserve(&(metrics->callbacks[kind]), duration);
+    }
+    updateSlowest(trace, metrics, loopTracePackSlowest(duration, (uint8_t) kind, trace->node));
+    trace->node = kLoopTraceNoNode;
+}
+
+#endif
@@ -0,0 +1,126 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Loop trace
+
+    optional instrumentation of hloop_process_events, it is only compiled with the cmake option LOOP_TRACE,
+    without it the hooks below are empty macros and nothing of this file ends up in the binary
+
+    every loop times each iteration (the busy part, after the poll returned) and every callback it runs
+    (io / timer / idle / custom event), a callback remembers the first metered node it entered (see
+    meterTunnel, nodes are only metered with metrics-port set), so a slow callback can be blamed on a node
+
+        histograms      per worker, in worker_metrics next to the loop lag (needs metrics-port), also the
+                        slowest callbacks seen so far with their node
+        trace           every loop keeps the last kLoopTraceRingSize spans in a ring, on SIGUSR1 each loop
+                        writes its ring to ww-trace-<pid>-<tid>.json (chrome trace format, open it in
+                        chrome://tracing or ui.perfetto.dev), the loop notices the signal on its next iteration
+
+    the ring belongs to the thread of the loop, nothing is shared but the counters in worker_metrics
+*/
+
+enum
+{
+    kLoopTraceRingSize = 8192,
+    kLoopTraceSlowest  = 8,
+    kLoopTraceNoNode   = -1
+};
+
+typedef enum
+{
+    kLoopTraceIo,
+    kLoopTraceTimer,
+    kLoopTraceIdle,
+    kLoopTraceCustom,
+    kLoopTraceKinds,
+    kLoopTraceIteration = kLoopTraceKinds // only in the ring, iterations have their own histogram
+
+} loop_trace_kind_e;
+
+#ifdef LOOP_TRACE
+
+struct hloop_s;
+
+typedef struct loop_trace_span_s
+{
+    uint64_t start_us;
+    uint32_t duration_us;
+    uint8_t  kind;
+    int16_t  node;
+
+} loop_trace_span_t;
+
+typedef struct loop_trace_s
+{
+    long              tid;
+    int16_t           node; // first metered node the running callback entered
+    uint32_t          head;
+    uint32_t          count;
+    unsigned int      dumps_seen;
+    uint64_t          iteration_start_us;
+    uint64_t          slowest[kLoopTraceSlowest]; // packed, slowest first
+    loop_trace_span_t ring[kLoopTraceRingSize];
+
+} loop_trace_t;
+
+extern _Thread_local loop_trace_t *loop_trace;
+
+loop_trace_t *newLoopTrace(long tid);
+void          destroyLoopTrace(loop_trace_t *trace);
+void          installLoopTraceSignal(void);
+void          loopTraceIterationBegin(loop_trace_t *trace, uint64_t now_us);
+void          loopTraceIterationEnd(loop_trace_t *trace, int ncallbacks);
+uint64_t      loopTraceCallbackBegin(loop_trace_t *trace);
+void          loopTraceCallbackEnd(loop_trace_t *trace, loop_trace_kind_e kind, uint64_t start_us);
+const char   *loopTraceKindName(loop_trace_kind_e kind);
+
+// the slowest callbacks are kept as one number each (duration | kind | node + 1), so a reader on another thread
+// never sees half of an entry, bigger means slower
+static inline uint64_t loopTracePackSlowest(uint32_t duration_us, uint8_t kind, int16_t node)
+{
+    return ((uint64_t) duration_us << 24) | ((uint64_t) kind << 16) | (uint16_t) (node + 1);
+}
+
+static inline uint32_t loopTraceSlowestDuration(uint64_t packed)
+{
+    return (uint32_t) (packed >> 24);
+}
+
+static inline uint8_t loopTraceSlowestKind(uint64_t packed)
+{
+    return (uint8_t) (packed >> 16);
+}
+
+static inline int16_t loopTraceSlowestNode(uint64_t packed)
+{
+    return (int16_t) ((int) (packed & 0xFFFF) - 1);
+}
+
+// called by the metered tunnels, cheap when the callback already has its node
+static inline void loopTraceEnterNode(uint8_t metrics_index)
+{
+    if (loop_trace != NULL && loop_trace->node == kLoopTraceNoNode)
+    {
+        loop_trace->node = (int16_t) metrics_index;
+    }
+}
+
+#define LOOP_TRACE_ITERATION_BEGIN(loop)           loopTraceIterationBegin((loop)->trace, (loop)->cur_hrtime)
+#define LOOP_TRACE_ITERATION_END(loop, ncallbacks) loopTraceIterationEnd((loop)->trace, (ncallbacks))
+#define LOOP_TRACE_CALLBACK(loop, kind, call)                                                                          \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        uint64_t trace_start_us = loopTraceCallbackBegin((loop)->trace);                                              \
+        call;                                                                                                          \
+        loopTraceCallbackEnd((loop)->trace, (kind), trace_start_us);                                                   \
+    } while (0)
+
+#else
+
+#define LOOP_TRACE_ITERATION_BEGIN(loop)           ((void) 0)
+#define LOOP_TRACE_ITERATION_END(loop, ncallbacks) ((void) 0)
+#define LOOP_TRACE_CALLBACK(loop, kind, call)      call
+
+#endif
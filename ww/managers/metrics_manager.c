@@ -0,0 +1,506 @@
+#include "metrics_manager.h"
+#include "buffer_pool.h"
+#include "generic_pool.h"
+#include "hloop.h"
+#include "hthread.h"
+#include "loggers/core_logger.h"
+#include "shiftbuffer.h"
+#include "ww.h"
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+    kMetricsPublishIntervalMs = 100,
+    kMetricsRequestMaxSize    = 4096,
+    kMetricsClientTimeoutMs   = 5000,
+    kMetricsThreadTid         = 1001
+};
+
+const uint64_t kMetricsHistogramBoundsUs[kMetricsHistogramBuckets - 1] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000};
+
+typedef struct metrics_publisher_s
+{
+    uint64_t last_tick_us;
+    uint8_t  tid;
+
+} metrics_publisher_t;
+
+typedef struct metrics_manager_s
+{
+    worker_metrics_t    *workers;
+    metrics_publisher_t *publishers;
+    const char          *node_names[kMetricsMaxNodes];
+    unsigned int         nodes_count;
+    char                *host;
+    int                  port;
+    hthread_t            thread;
+
+} metrics_manager_t;
+
+typedef struct metrics_text_s
+{
+    char  *data;
+    size_t len;
+    size_t cap;
+
+} metrics_text_t;
+
+static metrics_manager_t *state = NULL;
+
+static void countContext(context_t *c, metric_t *bytes, metric_t *contexts, node_metrics_t *node)
+{
+    metricAdd(contexts, 1);
+    if (c->payload != NULL)
+    {
+        metricAdd(bytes, bufLen(c->payload));
+    }
+    else if (c->init)
+    {
+        metricAdd(&(node->lines_opened), 1);
+    }
+    else if (c->fin)
+    {
+        metricAdd(&(node->lines_closed), 1);
+    }
+}
+
+static void meteredUpStream(tunnel_t *self, context_t *c)
+{
+#ifdef LOOP_TRACE
+    loopTraceEnterNode(self->metrics_index);
+#endif
+    node_metrics_t *node = &(state->workers[c->line->tid].nodes[self->metrics_index]);
+    countContext(c, &(node->bytes_up), &(node->contexts_up), node);
+    self->metered_up_stream(self, c);
+}
+
+static void meteredDownStream(tunnel_t *self, context_t *c)
+{
+#ifdef LOOP_TRACE
+    loopTraceEnterNode(self->metrics_index);
+#endif
+    node_metrics_t *node = &(state->workers[c->line->tid].nodes[self->metrics_index]);
+    countContext(c, &(node->bytes_down), &(node->contexts_down), node);
+    self->metered_down_stream(self, c);
+}
+
+void meterTunnel(tunnel_t *t, const char *node_name)
+{
+    assert(state != NULL);
+    if (state->nodes_count >= kMetricsMaxNodes)
+    {
+        LOGW("MetricsManager: more than %d nodes, node \"%s\" is not metered", kMetricsMaxNodes, node_name);
+        return;
+    }
+    t->metrics_index                      = (uint8_t) state->nodes_count;
+    state->node_names[state->nodes_count] = node_name;
+    state->nodes_count += 1;
+
+    t->metered_up_stream   = t->upStream;
+    t->metered_down_stream = t->downStream;
+    t->upStream            = meteredUpStream;
+    t->downStream          = meteredDownStream;
+}
+
+const char *getMeteredNodeName(unsigned int index)
+{
+    if (state == NULL || index >= state->nodes_count)
+    {
+        return NULL;
+    }
+    return state->node_names[index];
+}
+
+static void publishPool(pool_metrics_t *m, pool_stats_t stats)
+{
+    metricSet(&(m->available), stats.available);
+    metricSet(&(m->allocated), stats.allocated);
+    metricSet(&(m->hits), stats.hits);
+    metricSet(&(m->misses), stats.misses);
+}
+
+static void onPublishTick(htimer_t *timer)
+{
+    metrics_publisher_t *publisher = hevent_userdata(timer);
+    worker_metrics_t    *metrics   = &(state->workers[publisher->tid]);
+    const uint64_t       now_us    = hloop_now_hrtime(hevent_loop(timer));
+    const uint64_t       due_us    = publisher->last_tick_us + ((uint64_t) kMetricsPublishIntervalMs * 1000);
+
+    // the timer was due at due_us, anything after that the loop was busy with something else
+    metricObserve(&(metrics->loop_lag), now_us > due_us ? now_us - due_us : 0);
+    publisher->last_tick_us = now_us;
+
+    publishPool(&(metrics->buffer_pool), getBufferPoolStats(buffer_pools[publisher->tid]));
+    publishPool(&(metrics->context_pool), getPoolStats(context_pools[publisher->tid]));
+    publishPool(&(metrics->line_pool), getPoolStats(line_pools[publisher->tid]));
+}
+
+static void startPublisher(hevent_t *ev)
+{
+    metrics_publisher_t *publisher = hevent_userdata(ev);
+    hloop_t             *loop      = hevent_loop(ev);
+    publisher->last_tick_us        = hloop_now_hrtime(loop);
+
+    htimer_t *timer = htimer_add(loop, onPublishTick, kMetricsPublishIntervalMs, INFINITE);
+    hevent_set_userdata(timer, publisher);
+}
+
+static void textPrintf(metrics_text_t *text, const char *format, ...)
+{
+    while (true)
+    {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(text->data + text->len, text->cap - text->len, format, args);
+        va_end(args);
+        if (n < 0)
+        {
+            return;
+        }
+        if ((size_t) n < text->cap - text->len)
+        {
+            text->len += (size_t) n;
+            return;
+        }
+        text->cap  = (text->cap * 2) + (size_t) n;
+        text->data = realloc(text->data, text->cap);
+    }
+}
+
+// label values can hold anything the config had as a node name
+static void textLabel(metrics_text_t *text, const char *value)
+{
+    for (const char *p = value; *p != '\0'; p++)
+    {
+        switch (*p)
+        {
+        case '\\':
+            textPrintf(text, "\\\\");
+            break;
+        case '"':
+            textPrintf(text, "\\\"");
+            break;
+        case '\n':
+            textPrintf(text, "\\n");
+            break;
+        default:
+            textPrintf(text, "%c", *p);
+            break;
+        }
+    }
+}
+
+static void textHeader(metrics_text_t *text, const char *name, const char *type, const char *help)
+{
+    textPrintf(text, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static uint64_t sumNodeMetric(unsigned int node_index, size_t offset)
+{
+    uint64_t sum = 0;
+    for (unsigned int i = 0; i < workers_count; i++)
+    {
+        sum += metricGet((metric_t *) ((char *) &(state->workers[i].nodes[node_index]) + offset));
+    }
+    return sum;
+}
+
+static void renderNodeCounter(metrics_text_t *text, const char *name, size_t up_offset, size_t down_offset)
+{
+    for (unsigned int n = 0; n < state->nodes_count; n++)
+    {
+        textPrintf(text, "%s{node=\"", name);
+        textLabel(text, state->node_names[n]);
+        textPrintf(text, "\",direction=\"up\"} %llu\n", (unsigned long long) sumNodeMetric(n, up_offset));
+        textPrintf(text, "%s{node=\"", name);
+        textLabel(text, state->node_names[n]);
+        textPrintf(text, "\",direction=\"down\"} %llu\n", (unsigned long long) sumNodeMetric(n, down_offset));
+    }
+}
+
+static void renderNodes(metrics_text_t *text)
+{
+    textHeader(text, "ww_node_bytes_total", "counter", "Payload bytes that entered the node.");
+    renderNodeCounter(text, "ww_node_bytes_total", offsetof(node_metrics_t, bytes_up),
+                      offsetof(node_metrics_t, bytes_down));
+
+    textHeader(text, "ww_node_contexts_total", "counter", "Contexts that entered the node.");
+    renderNodeCounter(text, "ww_node_contexts_total", offsetof(node_metrics_t, contexts_up),
+                      offsetof(node_metrics_t, contexts_down));
+
+    textHeader(text, "ww_node_lines_total", "counter", "Lines that were opened through the node.");
+    for (unsigned int n = 0; n < state->nodes_count; n++)
+    {
+        textPrintf(text, "ww_node_lines_total{node=\"");
+        textLabel(text, state->node_names[n]);
+        textPrintf(text, "\"} %llu\n", (unsigned long long) sumNodeMetric(n, offsetof(node_metrics_t, lines_opened)));
+    }
+
+    textHeader(text, "ww_node_lines_open", "gauge", "Lines that are open through the node.");
+    for (unsigned int n = 0; n < state->nodes_count; n++)
+    {
+        const uint64_t opened = sumNodeMetric(n, offsetof(node_metrics_t, lines_opened));
+        const uint64_t closed = sumNodeMetric(n, offsetof(node_metrics_t, lines_closed));
+        textPrintf(text, "ww_node_lines_open{node=\"");
+        textLabel(text, state->node_names[n]);
+        textPrintf(text, "\"} %lld\n", (long long) (opened - closed));
+    }
+}
+
+static void renderPool(metrics_text_t *text, const char *name, size_t field_offset)
+{
+    static const struct
+    {
+        const char *label;
+        size_t      offset;
+    } pools[] = {{"buffer", offsetof(worker_metrics_t, buffer_pool)},
+                 {"context", offsetof(worker_metrics_t, context_pool)},
+                 {"line", offsetof(worker_metrics_t, line_pool)}};
+
+    for (unsigned int p = 0; p < sizeof(pools) / sizeof(pools[0]); p++)
+    {
+        for (unsigned int i = 0; i < workers_count; i++)
+        {
+            metric_t *m = (metric_t *) ((char *) &(state->workers[i]) + pools[p].offset + field_offset);
+            textPrintf(text, "%s{pool=\"%s\",worker=\"%u\"} %llu\n", name, pools[p].label, i,
+                       (unsigned long long) metricGet(m));
+        }
+    }
+}
+
+static void renderWorkers(metrics_text_t *text)
+{
+    textHeader(text, "ww_line_pauses_total", "counter", "Times a line end was paused (backpressure).");
+    for (unsigned int i = 0; i < workers_count; i++)
+    {
+        textPrintf(text, "ww_line_pauses_total{worker=\"%u\"} %llu\n", i,
+                   (unsigned long long) metricGet(&(state->workers[i].line_pauses)));
+    }
+
+    textHeader(text, "ww_pool_available", "gauge", "Items waiting in the pool.");
+    renderPool(text, "ww_pool_available", offsetof(pool_metrics_t, available));
+    textHeader(text, "ww_pool_allocated", "gauge", "Items the pool owns, waiting or handed out.");
+    renderPool(text, "ww_pool_allocated", offsetof(pool_metrics_t, allocated));
+    textHeader(text, "ww_pool_hits_total", "counter", "Items handed out from the pool.");
+    renderPool(text, "ww_pool_hits_total", offsetof(pool_metrics_t, hits));
+    textHeader(text, "ww_pool_misses_total", "counter", "Times the pool was empty and had to allocate.");
+    renderPool(text, "ww_pool_misses_total", offsetof(pool_metrics_t, misses));
+}
+
+static void renderHistogram(metrics_text_t *text, const char *name, const char *labels, metrics_histogram_t *h)
+{
+    uint64_t cumulative = 0;
+    for (unsigned int b = 0; b < kMetricsHistogramBuckets - 1; b++)
+    {
+        cumulative += metricGet(&(h->buckets[b]));
+        textPrintf(text, "%s_bucket{%s,le=\"%g\"} %llu\n", name, labels, (double) kMetricsHistogramBoundsUs[b] / 1e6,
+                   (unsigned long long) cumulative);
+    }
+    cumulative += metricGet(&(h->buckets[kMetricsHistogramBuckets - 1]));
+    textPrintf(text, "%s_bucket{%s,le=\"+Inf\"} %llu\n", name, labels, (unsigned long long) cumulative);
+    textPrintf(text, "%s_sum{%s} %g\n", name, labels, (double) metricGet(&(h->sum_us)) / 1e6);
+    textPrintf(text, "%s_count{%s} %llu\n", name, labels, (unsigned long long) metricGet(&(h->count)));
+}
+
+#ifdef LOOP_TRACE
+static void renderLoopTrace(metrics_text_t *text)
+{
+    textHeader(text, "ww_loop_busy_seconds", "histogram",
+               "Time a worker loop iteration spent running callbacks, from the poll returning to the next poll.");
+    for (unsigned int i = 0; i < workers_count; i++)
+    {
+        char labels[32];
+        snprintf(labels, sizeof(labels), "worker=\"%u\"", i);
+        renderHistogram(text, "ww_loop_busy_seconds", labels, &(state->workers[i].loop_busy));
+    }
+
+    textHeader(text, "ww_loop_callback_seconds", "histogram", "Time of a single callback of the worker loop.");
+    for (unsigned int i = 0; i < workers_count; i++)
+    {
+        for (unsigned int k = 0; k < kLoopTraceKinds; k++)
+        {
+            char labels[48];
+            snprintf(labels, sizeof(labels), "worker=\"%u\",kind=\"%s\"", i, loopTraceKindName(k));
+            renderHistogram(text, "ww_loop_callback_seconds", labels, &(state->workers[i].callbacks[k]));
+        }
+    }
+
+    textHeader(text, "ww_loop_slowest_callback_seconds", "gauge",
+               "The slowest callbacks of the worker loop so far, with the first node they entered.");
+    for (unsigned int i = 0; i < workers_count; i++)
+    {
+        for (unsigned int r = 0; r < kLoopTraceSlowest; r++)
+        {
+            const uint64_t packed = metricGet(&(state->workers[i].slowest_callbacks[r]));
+            if (packed == 0)
+            {
+                break;
+            }
+            const int16_t node      = loopTraceSlowestNode(packed);
+            const char   *node_name = node == kLoopTraceNoNode ? NULL : getMeteredNodeName((unsigned int) node);
+            textPrintf(text, "ww_loop_slowest_callback_seconds{worker=\"%u\",rank=\"%u\",kind=\"%s\",node=\"", i,
+                       r + 1, loopTraceKindName(loopTraceSlowestKind(packed)));
+            textLabel(text, node_name != NULL ? node_name : "");
+            textPrintf(text, "\"} %g\n", (double) loopTraceSlowestDuration(packed) / 1e6);
+        }
+    }
+}
+#endif
+
+static void renderLoops(metrics_text_t *text)
+{
+    textHeader(text, "ww_loop_lag_seconds", "histogram", "How late the worker loop ran a due timer.");
+    for (unsigned int i = 0; i < workers_count; i++)
+    {
+        char labels[32];
+        snprintf(labels, sizeof(labels), "worker=\"%u\"", i);
+        renderHistogram(text, "ww_loop_lag_seconds", labels, &(state->workers[i].loop_lag));
+    }
+#ifdef LOOP_TRACE
+    renderLoopTrace(text);
+#endif
+}
+
+char *renderMetrics(size_t *len)
+{
+    metrics_text_t text = {.data = malloc(16384), .len = 0, .cap = 16384};
+    renderNodes(&text);
+    renderWorkers(&text);
+    renderLoops(&text);
+    *len = text.len;
+    return text.data;
+}
+
+// one response per connection, the close waits for the write so nothing more is read meanwhile
+static void respond(hio_t *io, const char *status, const char *body, size_t body_len)
+{
+    hio_read_stop(io);
+
+    char header[256];
+    int  header_len = snprintf(header, sizeof(header),
+                               "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                               "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                               status, body_len);
+
+    shift_buffer_t *buf = popBuffer(hloop_bufferpool(hevent_loop(io)));
+    setLen(buf, (unsigned int) (header_len + body_len));
+    writeRaw(buf, header, (unsigned int) header_len);
+    memcpy(rawBufMut(buf) + header_len, body, body_len);
+    hio_write(io, buf);
+    hio_close(io);
+}
+
+static bool hasRequestEnd(const char *data, size_t len)
+{
+    for (size_t i = 3; i < len; i++)
+    {
+        if (data[i] == '\n' && data[i - 1] == '\r' && data[i - 2] == '\n' && data[i - 3] == '\r')
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void onMetricsRecv(hio_t *io, shift_buffer_t *buf)
+{
+    buffer_pool_t  *pool    = hloop_bufferpool(hevent_loop(io));
+    shift_buffer_t *request = hevent_userdata(io);
+    request                 = request == NULL ? buf : appendBufferMerge(pool, request, buf);
+    hevent_set_userdata(io, request);
+
+    const char  *data = rawBuf(request);
+    const size_t len  = bufLen(request);
+    if (! hasRequestEnd(data, len))
+    {
+        if (len > kMetricsRequestMaxSize)
+        {
+            hio_close(io);
+        }
+        return;
+    }
+
+    static const char kPath[] = "GET /metrics";
+    if (len > sizeof(kPath) - 1 && memcmp(data, kPath, sizeof(kPath) - 1) == 0 &&
+        (data[sizeof(kPath) - 1] == ' ' || data[sizeof(kPath) - 1] == '?'))
+    {
+        size_t body_len = 0;
+        char  *body     = renderMetrics(&body_len);
+        respond(io, "200 OK", body, body_len);
+        free(body);
+        return;
+    }
+    static const char kNotFound[] = "not found, the metrics are at /metrics\n";
+    respond(io, "404 Not Found", kNotFound, sizeof(kNotFound) - 1);
+}
+
+static void onMetricsClose(hio_t *io)
+{
+    shift_buffer_t *request = hevent_userdata(io);
+    if (request != NULL)
+    {
+        reuseBuffer(hloop_bufferpool(hevent_loop(io)), request);
+        hevent_set_userdata(io, NULL);
+    }
+}
+
+static void onMetricsAccept(hio_t *io)
+{
+    hevent_set_userdata(io, NULL);
+    hio_setcb_read(io, onMetricsRecv);
+    hio_setcb_close(io, onMetricsClose);
+    hio_set_read_timeout(io, kMetricsClientTimeoutMs);
+    hio_read(io);
+}
+
+static HTHREAD_ROUTINE(metrics_thread) // NOLINT
+{
+    (void) userdata;
+    hloop_t *loop = hloop_new(HLOOP_FLAG_AUTO_FREE, createSmallBufferPool(), kMetricsThreadTid);
+
+    if (hloop_create_tcp_server(loop, state->host, state->port, onMetricsAccept) == NULL)
+    {
+        LOGE("MetricsManager: could not listen on %s:%d, metrics are not served", state->host, state->port);
+        hloop_free(&loop);
+        return 0;
+    }
+    LOGI("MetricsManager: serving metrics on http://%s:%d/metrics", state->host, state->port);
+    hloop_run(loop);
+    LOGW("MetricsManager: eventloop finished!");
+    return 0;
+}
+
+void startMetricsManager(const char *host, int port)
+{
+    assert(state != NULL);
+    state->host   = strdup(host);
+    state->port   = port;
+    state->thread = hthread_create(metrics_thread, NULL);
+}
+
+struct worker_metrics_s *createMetricsManager(void)
+{
+    assert(state == NULL);
+    state = malloc(sizeof(metrics_manager_t));
+    memset(state, 0, sizeof(metrics_manager_t));
+
+    // one cache line aligned block per worker, no two workers write the same line
+    state->workers = aligned_alloc(kCpuLineCacheSize, sizeof(worker_metrics_t) * workers_count);
+    memset(state->workers, 0, sizeof(worker_metrics_t) * workers_count);
+
+    state->publishers = malloc(sizeof(metrics_publisher_t) * workers_count);
+    for (unsigned int i = 0; i < workers_count; i++)
+    {
+        state->publishers[i] = (metrics_publisher_t){.tid = (uint8_t) i};
+
+        hevent_t ev = {.loop = loops[i], .cb = startPublisher};
+        ev.userdata = &(state->publishers[i]);
+        hloop_post_event(loops[i], &ev);
+    }
+    return state->workers;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "metrics.h"
+#include "tunnel.h"
+#include <stddef.h>
+
+/*
+    Metrics manager
+
+    owns the per worker counters (worker_metrics), meters the nodes of the config and serves everything over
+    a local http endpoint in prometheus text format (GET /metrics), the endpoint runs on its own thread and
+    eventloop so it still answers when a worker is stuck
+
+    meterTunnel wraps the upStream / downStream of a node's tunnel, the wrappers count the context on the
+    worker of its line and call the real routine, nothing is counted for a node that is not metered
+
+    every worker publishes its pool numbers and samples its loop lag from a timer every
+    kMetricsPublishIntervalMs, so a scrape never touches a pool of another thread
+
+*/
+
+struct worker_metrics_s *createMetricsManager(void);
+void                     startMetricsManager(const char *host, int port);
+void                     meterTunnel(tunnel_t *t, const char *node_name);
+const char              *getMeteredNodeName(unsigned int index); // NULL if the index is not a metered node
+
+// the prometheus text of all workers summed, free() the result
+char *renderMetrics(size_t *len);
@@ -4,6 +4,7 @@
 #include "config_file.h"
 #include "library_loader.h"
 #include "loggers/core_logger.h"
+#include "metrics_manager.h"
 #include "node.h"
 #include "stc/common.h"
 #include "tunnel.h"
@@ -24,6 +25,7 @@ typedef struct node_manager_s
 {
     config_file_t *config_file;
     map_node_t     node_map;
+    unsigned int   chain_len; // longest chain seen by runNode, the lines need 1 state per index
 
 } node_manager_t;
 
@@ -36,6 +38,15 @@ void runNode(node_t *n1, size_t chain_index)
         LOGF("Node Map Failure: please check the graph");
         exit(1);
     }
+    if (chain_index >= kMaxChainLen || (n1->hash_next != 0 && chain_index + 1 >= kMaxChainLen))
+    {
+        LOGF("Node Map Failure: node (\"%s\") is deeper than %d nodes in its chain", n1->name, kMaxChainLen);
+        exit(1);
+    }
+    if (chain_index + 1 > state->chain_len)
+    {
+        state->chain_len = (unsigned int) chain_index + 1;
+    }
     if (n1->hash_next != 0)
     {
         node_t *n2 = getNode(n1->hash_next);
@@ -54,9 +65,18 @@ void runNode(node_t *n1, size_t chain_index)
             LOGF("NodeManager: node startup failure: node (\"%s\") create() returned NULL handle", n1->name);
             exit(1);
         }
+        if (worker_metrics != NULL)
+        {
+            meterTunnel(n1->instance, n1->name);
+        }
 
         n1->instance->chain_index = chain_index;
         chain(n1->instance, n2->instance);
+        // chain() moves a node that already ran right after this one
+        if (chain_index + 2 > state->chain_len)
+        {
+            state->chain_len = (unsigned int) chain_index + 2;
+        }
     }
     else
     {
@@ -69,6 +89,10 @@ void runNode(node_t *n1, size_t chain_index)
             LOGF("NodeManager: node startup failure: node (\"%s\") create() returned NULL handle", n1->name);
             exit(1);
         }
+        if (worker_metrics != NULL)
+        {
+            meterTunnel(n1->instance, n1->name);
+        }
         n1->instance->chain_index = chain_index;
     }
 }
@@ -257,6 +281,11 @@ static void startParsingFiles(void)
     cycleProcess();
     pathWalk();
     runNodes();
+    if (state->chain_len > 0)
+    {
+        setLineChainLen(state->chain_len);
+        LOGD("NodeManager: the longest chain has %u nodes, a line takes %zu bytes", state->chain_len, lineSize());
+    }
 }
 
 // static tunnel_t *getTunnel(hash_t hash_node_name)
@@ -0,0 +1,55 @@
+#include "payload_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+payload_pool_t *newPayloadPool(unsigned int owners_count, unsigned long pool_width, PoolItemCreateHandle create_h,
+                               PoolItemDestroyHandle destroy_h)
+{
+    const size_t memsize = sizeof(payload_pool_t) + (sizeof(payload_pool_owner_t) * owners_count) + kCpuLineCacheSize;
+
+    // the owners are placed on line cache boundaries, a return stack must not share a line with its neighbours
+    uintptr_t ptr = (uintptr_t) malloc(memsize);
+    if (ptr == 0)
+    {
+        fprintf(stderr, "PayloadPool: out of memory");
+        exit(1);
+    }
+    payload_pool_t *self = (payload_pool_t *) ALIGN2(ptr, kCpuLineCacheSize); // NOLINT
+    memset(self, 0, sizeof(payload_pool_t) + (sizeof(payload_pool_owner_t) * owners_count));
+    self->memptr       = (void *) ptr;
+    self->owners_count = owners_count;
+
+    for (unsigned int i = 0; i < owners_count; i++)
+    {
+        self->owners[i].pool = newGenericPoolWithSize(pool_width, create_h, destroy_h);
+        atomic_init(&(self->owners[i].returned), NULL);
+    }
+    return self;
+}
+
+void destroyPayloadPool(payload_pool_t *self)
+{
+    for (unsigned int i = 0; i < self->owners_count; i++)
+    {
+        generic_pool_t *pool     = self->owners[i].pool;
+        pool_item_t    *chains[] = {self->owners[i].taken,
+                                    atomic_exchange_explicit(&(self->owners[i].returned), NULL, memory_order_acquire)};
+        for (unsigned int c = 0; c < 2; c++)
+        {
+            pool_item_t *item = chains[c];
+            while (item != NULL)
+            {
+                pool_item_t *next = *(pool_item_t **) item;
+                pool->destroy_item_handle(pool, item);
+                item = next;
+            }
+        }
+        for (unsigned int k = 0; k < pool->len; k++)
+        {
+            pool->destroy_item_handle(pool, pool->available[k]);
+        }
+        free(pool);
+    }
+    free(self->memptr);
+}
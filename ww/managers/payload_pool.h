@@ -0,0 +1,74 @@
+#pragma once
+
+#include "generic_pool.h"
+#include "ww.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+    Payload pool
+
+    a pool for objects that are created on one thread and released on another (accept results and udp
+    payloads the socket manager hands to the workers, or back to the accept thread)
+
+    every thread that creates items (owner) has its own generic pool that only it pops from, so the pop
+    needs no lock, an item is always given back to the owner it came from, by pushing it on that owner's
+    return stack (lock-free, linked through the released items themselves)
+
+    the owner takes the whole return stack with one exchange when it has nothing left on hand, so the
+    return is batched, the taken chain is used up before the generic pool is touched again, the generic
+    pool only hands out fresh items, so under load a pool keeps as many items as were in flight at once
+
+    items must be at least the size of a pointer, the first bytes are overwritten while an item is
+    waiting on a return stack
+*/
+
+typedef struct payload_pool_owner_s
+{
+    generic_pool_t *pool;
+    pool_item_t    *taken; // chain of items taken back from the return stack, only the owner touches it
+    // items released by any thread, waiting for the owner to take them back
+    _Atomic(pool_item_t *) returned ATTR_ALIGNED_LINE_CACHE;
+
+} ATTR_ALIGNED_LINE_CACHE payload_pool_owner_t;
+
+typedef struct payload_pool_s
+{
+    void                *memptr;
+    unsigned int         owners_count;
+    payload_pool_owner_t owners[];
+
+} payload_pool_t;
+
+payload_pool_t *newPayloadPool(unsigned int owners_count, unsigned long pool_width, PoolItemCreateHandle create_h,
+                               PoolItemDestroyHandle destroy_h);
+void            destroyPayloadPool(payload_pool_t *self);
+
+// only the owner thread may pop from its own pool
+static inline pool_item_t *popPayloadPoolItem(payload_pool_t *self, unsigned int owner)
+{
+    payload_pool_owner_t *o = &(self->owners[owner]);
+    if (o->taken == NULL)
+    {
+        o->taken = atomic_exchange_explicit(&(o->returned), NULL, memory_order_acquire);
+        if (o->taken == NULL)
+        {
+            return popPoolItem(o->pool);
+        }
+    }
+    pool_item_t *item = o->taken;
+    o->taken          = *(pool_item_t **) item;
+    return item;
+}
+
+// any thread, owner is the one the item was popped from
+static inline void reusePayloadPoolItem(payload_pool_t *self, unsigned int owner, pool_item_t *item)
+{
+    payload_pool_owner_t *o    = &(self->owners[owner]);
+    pool_item_t          *head = atomic_load_explicit(&(o->returned), memory_order_relaxed);
+    do
+    {
+        *(pool_item_t **) item = head;
+    } while (! atomic_compare_exchange_weak_explicit(&(o->returned), &head, item, memory_order_release,
+                                                     memory_order_relaxed));
+}
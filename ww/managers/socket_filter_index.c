@@ -0,0 +1,173 @@
+#include "socket_filter_index.h"
+#include "cidr_trie.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+    kPortsCount = 65536
+};
+
+typedef struct index_entry_s
+{
+    const socket_filter_option_t *option;
+    void                         *userdata;
+
+} index_entry_t;
+
+// a range of ports that is covered by the same filters
+typedef struct port_segment_s
+{
+    index_entry_t *entries;
+    unsigned int   count;
+
+} port_segment_t;
+
+typedef struct protocol_index_s
+{
+    uint16_t       *port_segment; // 0 is the empty segment
+    port_segment_t *segments;
+    unsigned int    segments_count;
+
+} protocol_index_t;
+
+struct socket_filter_index_s
+{
+    index_entry_t   *entries;
+    unsigned int     count;
+    unsigned int     cap;
+    protocol_index_t tcp;
+    protocol_index_t udp;
+    bool             compiled;
+};
+
+socket_filter_index_t *newSocketFilterIndex(void)
+{
+    socket_filter_index_t *self = malloc(sizeof(socket_filter_index_t));
+    memset(self, 0, sizeof(socket_filter_index_t));
+    return self;
+}
+
+static void destroyProtocolIndex(protocol_index_t *pi)
+{
+    for (unsigned int i = 0; i < pi->segments_count; i++)
+    {
+        free(pi->segments[i].entries);
+    }
+    free(pi->segments);
+    free(pi->port_segment);
+}
+
+void destroySocketFilterIndex(socket_filter_index_t *self)
+{
+    destroyProtocolIndex(&self->tcp);
+    destroyProtocolIndex(&self->udp);
+    free(self->entries);
+    free(self);
+}
+
+void addSocketFilterToIndex(socket_filter_index_t *self, const socket_filter_option_t *option, void *userdata)
+{
+    assert(! self->compiled);
+    if (self->count == self->cap)
+    {
+        self->cap     = self->cap == 0 ? 8 : self->cap * 2;
+        self->entries = realloc(self->entries, sizeof(index_entry_t) * self->cap);
+    }
+    self->entries[self->count++] = (index_entry_t){.option = option, .userdata = userdata};
+}
+
+static inline bool coversPort(const socket_filter_option_t *option, enum socket_address_protocol protocol,
+                              unsigned int port)
+{
+    return option->protocol == protocol && option->port_min <= port && option->port_max >= port;
+}
+
+static void compileProtocol(socket_filter_index_t *self, enum socket_address_protocol protocol, protocol_index_t *pi)
+{
+    // the candidates can only change where a range starts or right after one ends
+    uint8_t     *boundary = calloc(kPortsCount + 1, 1);
+    unsigned int matching = 0;
+    for (unsigned int i = 0; i < self->count; i++)
+    {
+        const socket_filter_option_t *option = self->entries[i].option;
+        if (option->protocol == protocol && option->port_min <= option->port_max)
+        {
+            boundary[option->port_min]     = 1;
+            boundary[option->port_max + 1] = 1;
+            matching++;
+        }
+    }
+
+    pi->port_segment   = calloc(kPortsCount, sizeof(uint16_t));
+    pi->segments       = calloc((2 * matching) + 1, sizeof(port_segment_t));
+    pi->segments_count = 1;
+
+    uint16_t current = 0;
+    for (unsigned int port = 0; port < kPortsCount; port++)
+    {
+        if (boundary[port])
+        {
+            port_segment_t segment = {0};
+            for (unsigned int i = 0; i < self->count; i++)
+            {
+                if (coversPort(self->entries[i].option, protocol, port))
+                {
+                    segment.count++;
+                }
+            }
+            current = 0;
+            if (segment.count > 0)
+            {
+                segment.entries = malloc(sizeof(index_entry_t) * segment.count);
+                segment.count   = 0;
+                for (unsigned int i = 0; i < self->count; i++)
+                {
+                    if (coversPort(self->entries[i].option, protocol, port))
+                    {
+                        segment.entries[segment.count++] = self->entries[i];
+                    }
+                }
+                current                            = (uint16_t) pi->segments_count;
+                pi->segments[pi->segments_count++] = segment;
+            }
+        }
+        pi->port_segment[port] = current;
+    }
+    free(boundary);
+}
+
+void compileSocketFilterIndex(socket_filter_index_t *self)
+{
+    assert(! self->compiled);
+    compileProtocol(self, kSapTcp, &self->tcp);
+    compileProtocol(self, kSapUdp, &self->udp);
+    self->compiled = true;
+}
+
+void *findSocketFilterInIndex(const socket_filter_index_t *self, enum socket_address_protocol protocol,
+                              const sockaddr_u *peer_addr, uint16_t local_port)
+{
+    const protocol_index_t *pi = protocol == kSapTcp ? &self->tcp : &self->udp;
+    if (pi->port_segment == NULL)
+    {
+        return NULL;
+    }
+    const port_segment_t *segment = &pi->segments[pi->port_segment[local_port]];
+
+    for (unsigned int i = 0; i < segment->count; i++)
+    {
+        const socket_filter_option_t *option = segment->entries[i].option;
+        if (option->black_list_trie != NULL && matchCidrTrie(option->black_list_trie, peer_addr))
+        {
+            continue;
+        }
+        if (option->white_list_trie != NULL && ! matchCidrTrie(option->white_list_trie, peer_addr))
+        {
+            continue;
+        }
+        return segment->entries[i].userdata;
+    }
+    return NULL;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "basic_types.h"
+#include "socket_manager.h"
+#include <stdint.h>
+
+/*
+    Socket filter index
+
+    the acceptors registered on the socket manager compiled into a read only table, so finding the
+    filter of a new socket / udp payload takes no lock and does not scan every filter
+
+    every port points to the list of filters that cover it (already in priority order), a candidate is
+    taken if the peer is not in its black list and is in its white list (when it has one), both lists
+    are cidr tries
+
+    filters are added in priority order, then the index is compiled once, after that it is never
+    changed again and can be read from any thread
+*/
+
+typedef struct socket_filter_index_s socket_filter_index_t;
+
+socket_filter_index_t *newSocketFilterIndex(void);
+void                   destroySocketFilterIndex(socket_filter_index_t *self);
+
+// the option must stay valid (and unchanged) for the lifetime of the index
+void addSocketFilterToIndex(socket_filter_index_t *self, const socket_filter_option_t *option, void *userdata);
+void compileSocketFilterIndex(socket_filter_index_t *self);
+
+// returns the userdata of the first matching filter, or NULL
+void *findSocketFilterInIndex(const socket_filter_index_t *self, enum socket_address_protocol protocol,
+                              const sockaddr_u *peer_addr, uint16_t local_port);
@@ -1,16 +1,22 @@
 #include "socket_manager.h"
 #include "basic_types.h"
 #include "buffer_pool.h"
+#include "cidr_trie.h"
 #include "generic_pool.h"
 #include "hloop.h"
 #include "hmutex.h"
 #include "idle_table.h"
 #include "loggers/network_logger.h"
+#include "payload_pool.h"
+#include "socket_filter_index.h"
 #include "stc/common.h"
 #include "tunnel.h"
 #include "utils/procutils.h"
 #include "ww.h"
 #include <stdlib.h>
+#ifdef OS_LINUX
+#include <linux/filter.h>
+#endif
 
 typedef struct socket_filter_s
 {
@@ -31,28 +37,20 @@ typedef struct socket_filter_s
 #define SUPPORT_V6 false
 enum
 {
-    kSoOriginalDest  = 80,
-    kFilterLevels    = 4,
-    kAcceptThreadTid = 1000
+    kSoOriginalDest     = 80,
+    kFilterLevels       = 4,
+    kAcceptThreadTid    = 1000,
+    kFastOpenQueueLimit = 4096 // pending fast open requests (syn with data) a listener takes
 };
 
 typedef struct socket_manager_s
 {
-    filters_t filters[kFilterLevels];
-
-    struct
-    {
-        generic_pool_t *pool; /* holds udp_payload_t*/
-        hhybridmutex_t  mutex;
+    filters_t              filters[kFilterLevels];
+    socket_filter_index_t *filter_index; // compiled from filters by startSocketManager
 
-    } *udp_pools;
-
-    struct
-    {
-        generic_pool_t *pool; /* holds socket_accept_result_t*/
-        hhybridmutex_t  mutex;
-
-    } *tcp_pools;
+    // one owner per worker (tid) and the accept thread last, items go back to the thread that created them
+    payload_pool_t *udp_pools; /* holds udp_payload_t*/
+    payload_pool_t *tcp_pools; /* holds socket_accept_result_t*/
 
     hthread_t      accept_thread;
     hhybridmutex_t mutex;
@@ -63,6 +61,7 @@ typedef struct socket_manager_s
     bool     lsof_installed;
     bool     iptable_cleaned;
     bool     iptables_used;
+    bool     started;
 
 } socket_manager_state_t;
 
@@ -92,29 +91,32 @@ static void destroyUdpPayloadPoolHandle(struct generic_pool_s *pool, pool_item_t
     free(item);
 }
 
+// the pool owner index of the accept thread, the workers use their tid
+static inline uint8_t acceptThreadPoolOwner(void)
+{
+    return (uint8_t) workers_count;
+}
+
+// must be called on the thread of the owner, the caller fills the item (pool_owner too)
+static socket_accept_result_t *newSocketAcceptResult(uint8_t owner)
+{
+    return popPayloadPoolItem(state->tcp_pools, owner);
+}
+
 void destroySocketAcceptResult(socket_accept_result_t *sar)
 {
-    const uint8_t tid = sar->tid;
-    hhybridmutex_lock(&(state->tcp_pools[tid].mutex));
-    reusePoolItem(state->tcp_pools[tid].pool, sar);
-    hhybridmutex_unlock(&(state->tcp_pools[tid].mutex));
+    reusePayloadPoolItem(state->tcp_pools, sar->pool_owner, sar);
 }
 
-static udp_payload_t *newUpdPayload(uint8_t tid)
+// must be called on the thread of the owner, the caller fills the item (pool_owner too)
+static udp_payload_t *newUpdPayload(uint8_t owner)
 {
-    hhybridmutex_lock(&(state->udp_pools[tid].mutex));
-    udp_payload_t *item = popPoolItem(state->udp_pools[tid].pool);
-    hhybridmutex_unlock(&(state->udp_pools[tid].mutex));
-    return item;
+    return popPayloadPoolItem(state->udp_pools, owner);
 }
 
 void destroyUdpPayload(udp_payload_t *upl)
 {
-    const uint8_t tid = upl->tid;
-
-    hhybridmutex_lock(&(state->udp_pools[tid].mutex));
-    reusePoolItem(state->udp_pools[tid].pool, upl);
-    hhybridmutex_unlock(&(state->udp_pools[tid].mutex));
+    reusePayloadPoolItem(state->udp_pools, upl->pool_owner, upl);
 }
 
 static bool redirectPortRangeTcp(unsigned int pmin, unsigned int pmax, unsigned int to)
@@ -201,148 +203,29 @@ static void signalHandler(int signum)
     raise(signum);
 }
 
-int checkIPRange(bool ipver6, const struct in6_addr test_addr, const struct in6_addr base_addr,
-                 const struct in6_addr subnet_mask)
-{
-    struct in6_addr result_addr;
-
-    if (ipver6)
-    {
-        // IPv6 addresses
-        for (int i = 0; i < 16; i++)
-        {
-            result_addr.s6_addr[i] = base_addr.s6_addr[i] & subnet_mask.s6_addr[i];
-        }
-        if (memcmp(&test_addr, &result_addr, sizeof(struct in6_addr)) == 0)
-        {
-            return 1;
-        }
-        return 0;
-    }
-
-    // IPv4 addresses
-    uint32_t base_addr_32 = ntohl(*((uint32_t *) base_addr.s6_addr));
-    uint32_t test_addr_32 = ntohl(*((uint32_t *) test_addr.s6_addr));
-    uint32_t mask_addr32  = ntohl(*((uint32_t *) subnet_mask.s6_addr));
-
-    uint32_t result_addr32 = base_addr_32 & mask_addr32;
-
-    if ((test_addr_32 & mask_addr32) == result_addr32)
-    {
-        return 1;
-    }
-
-    return 0;
-}
-int parseIPWithSubnetMask(struct in6_addr *base_addr, const char *input, struct in6_addr *subnet_mask)
+static cidr_trie_t *parseAddressList(char **list, const char *name)
 {
-    char *slash;
-    char *ip_part;
-    char *subnet_part;
-    char  input_copy[strlen(input) + 1];
-    strcpy(input_copy, input);
-
-    slash = strchr(input_copy, '/');
-    if (slash == NULL)
-    {
-        fprintf(stderr, "Invalid input format.\n");
-        return -1;
-    }
-
-    *slash      = '\0';
-    ip_part     = input_copy;
-    subnet_part = slash + 1;
-
-    if (inet_pton(AF_INET, ip_part, base_addr) == 1)
+    cidr_trie_t *trie = newCidrTrie();
+    for (int i = 0; list[i] != NULL; i++)
     {
-        // IPv4 address
-        int prefix_length = atoi(subnet_part);
-        if (prefix_length < 0 || prefix_length > 32)
-        {
-            fprintf(stderr, "Invalid subnet mask length.\n");
-            return -1;
-        }
-        uint32_t mask;
-        if (sizeof(unsigned long long) == 8)
-        {
-            mask = htonl(0xFFFFFFFF &
-                         ((unsigned long long) 0x00000000FFFFFFFF << (unsigned long long) (32 - prefix_length)));
-        }
-        else
+        if (! insertCidrTrie(trie, list[i]))
         {
-            if (prefix_length > 0)
-            {
-                mask = htonl(0xFFFFFFFF & (0xFFFFFFFF << (32 - prefix_length)));
-            }
-            else
-            {
-                mask = 0;
-            }
-        }
-        struct in_addr mask_addr = {.s_addr = mask};
-        memcpy(subnet_mask, &mask_addr, 4);
-        // inet_ntop(AF_INET, &mask_addr, subnet_mask, INET_ADDRSTRLEN);
-    }
-    else if (inet_pton(AF_INET6, ip_part, base_addr) == 1)
-    {
-        // IPv6 address
-        int prefix_length = atoi(subnet_part);
-        if (prefix_length < 0 || prefix_length > 128)
-        {
-            fprintf(stderr, "Invalid subnet mask length.\n");
-            return -1;
-        }
-        int i;
-        for (i = 0; i < 16; i++)
-        {
-            int bits                     = prefix_length >= 8 ? 8 : prefix_length;
-            ((uint8_t *) subnet_mask)[i] = bits == 0 ? 0 : (0xFF << (8 - bits));
-            prefix_length -= bits;
+            LOGF("SocketManager: stopping due to %s address [%d] \"%s\" parse failure", name, i, list[i]);
+            exit(1);
         }
-        // struct in6_addr mask_addr;
-        // memcpy(&(subnet_mask->s6_addr), subnet_mask, 16);
-        // inet_ntop(AF_INET6, &mask_addr, subnet_mask, INET6_ADDRSTRLEN);
-    }
-    else
-    {
-        fprintf(stderr, "Invalid IP address.\n");
-        return -1;
     }
-
-    return 0;
+    return trie;
 }
 
-void parseWhiteListOption(socket_filter_option_t *option)
+bool registerSocketAcceptor(tunnel_t *tunnel, socket_filter_option_t option, onAccept cb)
 {
-    assert(option->white_list_raddr != NULL);
-
-    int   len = 0;
-    char *cur = NULL;
-
-    while ((cur = option->white_list_raddr[len]))
+    if (state->started)
     {
-        len++;
+        // workers read the filters without the lock once started
+        LOGE("SocketManager: acceptors must be registered before the socket manager starts");
+        return false;
     }
 
-    option->white_list_parsed_length = len;
-    option->white_list_parsed        = malloc(sizeof(option->white_list_parsed[0]) * len);
-    for (int i = 0; i < len; i++)
-    {
-        cur              = option->white_list_raddr[i];
-        int parse_result = parseIPWithSubnetMask(&(option->white_list_parsed[i].ip_bytes_buf), cur,
-                                                 &(option->white_list_parsed[i].mask_bytes_buf));
-
-        if (parse_result == -1)
-        {
-            LOGF("SocketManager: stopping due to whitelist address [%d] \"%s\" parse failure", i, cur);
-            exit(1);
-        }
-    }
-}
-
-void registerSocketAcceptor(tunnel_t *tunnel, socket_filter_option_t option, onAccept cb)
-{
-
     socket_filter_t *filter   = malloc(sizeof(socket_filter_t));
     unsigned int     pirority = 0;
     if (option.multiport_backend == kMultiportBackendNothing)
@@ -359,13 +242,18 @@ void registerSocketAcceptor(tunnel_t *tunnel, socket_filter_option_t option, onA
     }
     if (option.white_list_raddr != NULL)
     {
-        parseWhiteListOption(&option);
+        option.white_list_trie = parseAddressList(option.white_list_raddr, "whitelist");
+    }
+    if (option.black_list_raddr != NULL)
+    {
+        option.black_list_trie = parseAddressList(option.black_list_raddr, "blacklist");
     }
     *filter = (socket_filter_t){.tunnel = tunnel, .option = option, .cb = cb, .listen_io = NULL};
 
     hhybridmutex_lock(&(state->mutex));
     filters_t_push(&(state->filters[pirority]), filter);
     hhybridmutex_unlock(&(state->mutex));
+    return true;
 }
 
 static inline uint16_t getCurrentDistributeTid(void)
@@ -385,11 +273,10 @@ static void distributeSocket(void *io, socket_filter_t *filter, uint16_t local_p
 
     uint8_t tid = (uint8_t) getCurrentDistributeTid();
 
-    hhybridmutex_lock(&(state->tcp_pools[tid].mutex));
-    socket_accept_result_t *result = popPoolItem(state->tcp_pools[tid].pool);
-    hhybridmutex_unlock(&(state->tcp_pools[tid].mutex));
+    socket_accept_result_t *result = newSocketAcceptResult(acceptThreadPoolOwner());
 
     result->real_localport = local_port;
+    result->pool_owner     = acceptThreadPoolOwner();
 
     hloop_t *worker_loop = loops[tid];
     hevent_t ev          = (hevent_t){.loop = worker_loop, .cb = filter->cb};
@@ -411,80 +298,27 @@ static void noTcpSocketConsumerFound(hio_t *io)
     hio_close(io);
 }
 
-static bool checkIpIsWhiteList(sockaddr_u *addr, const socket_filter_option_t option)
+// lock free, the index is immutable once the socket manager is started
+static socket_filter_t *findFilter(enum socket_address_protocol protocol, sockaddr_u *paddr, uint16_t local_port)
 {
-    struct in6_addr test_addr = {0};
-    const bool      is_v4     = addr->sa.sa_family == AF_INET;
-    if (is_v4)
-    {
-        memcpy(&test_addr, &addr->sin.sin_addr, 4);
-
-        for (unsigned int i = 0; i < option.white_list_parsed_length; i++)
-        {
-
-            if (checkIPRange(false, test_addr, option.white_list_parsed[i].ip_bytes_buf,
-                             option.white_list_parsed[i].mask_bytes_buf))
-            {
-                return true;
-            }
-        }
-    }
-    else
-    {
-        memcpy(&test_addr, &addr->sin6.sin6_addr, 16);
-        for (unsigned int i = 0; i < option.white_list_parsed_length; i++)
-        {
-
-            if (checkIPRange(true, test_addr, option.white_list_parsed[i].ip_bytes_buf,
-                             option.white_list_parsed[i].mask_bytes_buf))
-            {
-                return true;
-            }
-        }
-    }
-
-    return false;
+    return findSocketFilterInIndex(state->filter_index, protocol, paddr, local_port);
 }
 
 static void distributeTcpSocket(hio_t *io, uint16_t local_port)
 {
-    hhybridmutex_lock(&(state->mutex));
-    sockaddr_u *paddr = (sockaddr_u *) hio_peeraddr(io);
+    socket_filter_t *filter = findFilter(kSapTcp, (sockaddr_u *) hio_peeraddr(io), local_port);
 
-    for (int ri = (kFilterLevels - 1); ri >= 0; ri--)
+    if (filter == NULL)
     {
-        c_foreach(k, filters_t, state->filters[ri])
-        {
-            socket_filter_t       *filter   = *(k.ref);
-            socket_filter_option_t option   = filter->option;
-            uint16_t               port_min = option.port_min;
-            uint16_t               port_max = option.port_max;
-
-            if (option.protocol != kSapTcp || port_min > local_port || port_max < local_port)
-            {
-                continue;
-            }
-            if (option.white_list_raddr != NULL)
-            {
-                if (! checkIpIsWhiteList(paddr, option))
-                {
-                    continue;
-                }
-            }
-
-            if (option.no_delay)
-            {
-                tcp_nodelay(hio_fd(io), 1);
-            }
-            hio_detach(io);
-            hhybridmutex_unlock(&(state->mutex));
-            distributeSocket(io, filter, local_port);
-            return;
-        }
+        noTcpSocketConsumerFound(io);
+        return;
     }
-
-    hhybridmutex_unlock(&(state->mutex));
-    noTcpSocketConsumerFound(io);
+    if (filter->option.no_delay)
+    {
+        tcp_nodelay(hio_fd(io), 1);
+    }
+    hio_detach(io);
+    distributeSocket(io, filter, local_port);
 }
 
 static void onAcceptTcpSinglePort(hio_t *io)
@@ -524,6 +358,25 @@ static multiport_backend_t getDefaultMultiPortBackend(void)
     return kMultiportBackendSockets;
 }
 
+// lets clients that have a cookie from us send their first data in the syn
+static void enableFastOpen(socket_filter_t *filter, int sockfd)
+{
+#ifdef TCP_FASTOPEN
+    if (! filter->option.fast_open)
+    {
+        return;
+    }
+    const int qlen = kFastOpenQueueLimit;
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN, (const char *) &qlen, sizeof(qlen)) != 0)
+    {
+        LOGW("SocketManager: could not enable fast open on FD:%x, error: %s", sockfd, strerror(errno));
+    }
+#else
+    (void) filter;
+    (void) sockfd;
+#endif
+}
+
 static void listenTcpMultiPortIptables(hloop_t *loop, socket_filter_t *filter, char *host, uint16_t port_min,
                                        uint8_t *ports_overlapped, uint16_t port_max)
 {
@@ -565,6 +418,7 @@ static void listenTcpMultiPortIptables(hloop_t *loop, socket_filter_t *filter, c
             LOGF("SocketManager: stopping due to null socket handle");
             exit(1);
         }
+        enableFastOpen(filter, hio_fd(filter->listen_io));
     }
     redirectPortRangeTcp(port_min, port_max, main_port);
     LOGI("SocketManager: listening on %s:[%u - %u] >> %d (%s)", host, port_min, port_max, main_port, "TCP");
@@ -592,6 +446,7 @@ static void listenTcpMultiPortSockets(hloop_t *loop, socket_filter_t *filter, ch
             LOGW("SocketManager: could not listen on %s:[%u] , skipped...", host, p, "TCP");
             continue;
         }
+        enableFastOpen(filter, hio_fd(filter->listen_ios[i]));
         i++;
         LOGI("SocketManager: listening on %s:[%u] (%s)", host, p, "TCP");
     }
@@ -612,6 +467,7 @@ static void listenTcpSinglePort(hloop_t *loop, socket_filter_t *filter, char *ho
         LOGF("SocketManager: stopping due to null socket handle");
         exit(1);
     }
+    enableFastOpen(filter, hio_fd(filter->listen_io));
 }
 static void listenTcp(hloop_t *loop, uint8_t *ports_overlapped)
 {
@@ -678,9 +534,9 @@ static void noUdpSocketConsumerFound(udp_payload_t *upl)
     char localaddrstr[SOCKADDR_STRLEN] = {0};
     char peeraddrstr[SOCKADDR_STRLEN]  = {0};
     LOGE("SocketManager: could not find consumer for Udp socket  [%s] <= [%s]",
-         SOCKADDR_STR(hio_localaddr(upl->sock->io), localaddrstr),
-         SOCKADDR_STR(hio_peeraddr(upl->sock->io), peeraddrstr));
+         SOCKADDR_STR(hio_localaddr(upl->sock->io), localaddrstr), SOCKADDR_STR(&upl->peer_addr, peeraddrstr));
 
+    reuseBuffer(hloop_bufferpool(hevent_loop(upl->sock->io)), upl->buf);
     destroyUdpPayload(upl);
 }
 
@@ -696,38 +552,14 @@ static void postPayload(udp_payload_t *pl, socket_filter_t *filter)
 }
 static void distributeUdpPayload(udp_payload_t *pl)
 {
-    hhybridmutex_lock(&(state->mutex));
-    sockaddr_u *paddr      = (sockaddr_u *) hio_peeraddr(pl->sock->io);
-    uint16_t    local_port = pl->real_localport;
-    for (int ri = (kFilterLevels - 1); ri >= 0; ri--)
-    {
-        c_foreach(k, filters_t, state->filters[ri])
-        {
+    socket_filter_t *filter = findFilter(kSapUdp, &pl->peer_addr, pl->real_localport);
 
-            socket_filter_t       *filter   = *(k.ref);
-            socket_filter_option_t option   = filter->option;
-            uint16_t               port_min = option.port_min;
-            uint16_t               port_max = option.port_max;
-
-            if (option.protocol != kSapUdp || port_min > local_port || port_max < local_port)
-            {
-                continue;
-            }
-            if (option.white_list_raddr != NULL)
-            {
-                if (! checkIpIsWhiteList(paddr, option))
-                {
-                    continue;
-                }
-            }
-            hhybridmutex_unlock(&(state->mutex));
-            postPayload(pl, filter);
-            return;
-        }
+    if (filter == NULL)
+    {
+        noUdpSocketConsumerFound(pl);
+        return;
     }
-
-    hhybridmutex_unlock(&(state->mutex));
-    noUdpSocketConsumerFound(pl);
+    postPayload(pl, filter);
 }
 static void onRecvFrom(hio_t *io, shift_buffer_t *buf)
 {
@@ -735,15 +567,14 @@ static void onRecvFrom(hio_t *io, shift_buffer_t *buf)
     uint16_t   local_port = sockaddr_port((sockaddr_u *) hio_localaddr(io));
     uint8_t    target_tid = local_port % workers_count;
 
-    hhybridmutex_lock(&(state->udp_pools[target_tid].mutex));
-    udp_payload_t *item = popPoolItem(state->udp_pools[target_tid].pool);
-    hhybridmutex_unlock(&(state->udp_pools[target_tid].mutex));
+    udp_payload_t *item = newUpdPayload(acceptThreadPoolOwner());
 
     *item = (udp_payload_t){.sock           = socket,
                             .buf            = buf,
                             .tid            = target_tid,
                             .peer_addr      = *(sockaddr_u *) hio_peeraddr(io),
-                            .real_localport = local_port};
+                            .real_localport = local_port,
+                            .pool_owner     = acceptThreadPoolOwner()};
 
     distributeUdpPayload(item);
 }
@@ -765,8 +596,9 @@ static void listenUdpSinglePort(hloop_t *loop, socket_filter_t *filter, char *ho
         exit(1);
     }
     udpsock_t *socket = malloc(sizeof(udpsock_t));
-    *socket           = (udpsock_t){.io = filter->listen_io, .table = newIdleTable(loop)};
+    *socket           = (udpsock_t){.io = filter->listen_io, .table = newIdleTable()};
     hevent_set_userdata(filter->listen_io, socket);
+    hio_set_batch(filter->listen_io, filter->option.udp_batch);
     hio_setcb_read(filter->listen_io, onRecvFrom);
     hio_read(filter->listen_io);
 }
@@ -818,23 +650,268 @@ static void listenUdp(hloop_t *loop, uint8_t *ports_overlapped)
 
 static void writeUdpThisLoop(hevent_t *ev)
 {
-    udp_payload_t *upl    = hevent_userdata(ev);
-    size_t         nwrite = hio_write(upl->sock->io, upl->buf);
+    udp_payload_t *upl = hevent_userdata(ev);
+    // the listen socket is shared by all peers, the destination is set right before the write
+    hio_set_peeraddr(upl->sock->io, &upl->peer_addr.sa, (int) sockaddr_len(&upl->peer_addr));
+    size_t nwrite = hio_write(upl->sock->io, upl->buf);
     (void) nwrite;
     destroyUdpPayload(upl);
 }
-void postUdpWrite(udpsock_t *socket_io, uint8_t tid_from, shift_buffer_t *buf)
+void postUdpWrite(udpsock_t *socket_io, uint8_t tid_from, const sockaddr_u *peer_addr, shift_buffer_t *buf)
 {
+    if (hevent_loop(socket_io->io) == loops[tid_from])
+    {
+        // the socket belongs to this worker (reuse port mode)
+        sockaddr_u dest = *peer_addr;
+        hio_set_peeraddr(socket_io->io, &dest.sa, (int) sockaddr_len(&dest));
+        hio_write(socket_io->io, buf);
+        return;
+    }
 
     udp_payload_t *item = newUpdPayload(tid_from);
 
-    *item = (udp_payload_t){.sock = socket_io, .buf = buf, .tid = tid_from};
+    *item = (udp_payload_t){
+        .sock = socket_io, .buf = buf, .tid = tid_from, .peer_addr = *peer_addr, .pool_owner = tid_from};
 
     hevent_t ev = (hevent_t){.loop = hevent_loop(socket_io->io), .userdata = item, .cb = writeUdpThisLoop};
 
     hloop_post_event(hevent_loop(socket_io->io), &ev);
 }
 
+/*
+    reuse port mode
+
+    instead of the accept thread, every worker gets its own listening socket for the port (SO_REUSEPORT),
+    the kernel spreads the connections / datagrams between them and the worker that accepted the socket
+    is the one that serves the line, no hloop_post_event and no filter lock on the way
+
+    the sockets are created here in tid order, so the index of a socket in the reuseport group is the tid
+    of its worker, the optional cpu steering program returns (cpu that received the packet % workers) as
+    that index, it only pays off when worker N runs on cpu N and the nic queues are spread the same way
+
+    udp peers stay on the same worker as long as the group does not change, since the kernel picks the
+    socket by the hash of the 4 tuple
+*/
+
+static bool usesReusePort(const socket_filter_option_t *option)
+{
+#ifdef OS_LINUX
+    return option->reuse_port && option->port_min == option->port_max;
+#else
+    (void) option;
+    return false;
+#endif
+}
+
+// the ports served by the workers are marked so that the accept thread skips them
+static void markReusePortPorts(enum socket_address_protocol protocol, uint8_t *ports_overlapped)
+{
+    for (int ri = (kFilterLevels - 1); ri >= 0; ri--)
+    {
+        c_foreach(k, filters_t, state->filters[ri])
+        {
+            socket_filter_option_t *option = &((*(k.ref))->option);
+            if (option->protocol == protocol && usesReusePort(option))
+            {
+                ports_overlapped[option->port_min] = 1;
+            }
+        }
+    }
+}
+
+#ifdef OS_LINUX
+
+typedef struct reuse_port_listener_s
+{
+    int                          fd;
+    enum socket_address_protocol protocol;
+    unsigned int                 udp_batch;
+
+} reuse_port_listener_t;
+
+static void onAcceptTcpReusePort(hio_t *io)
+{
+    hloop_t         *loop       = hevent_loop(io);
+    uint8_t          tid        = (uint8_t) hloop_tid(loop);
+    uint16_t         local_port = sockaddr_port((sockaddr_u *) hio_localaddr(io));
+    socket_filter_t *filter     = findFilter(kSapTcp, (sockaddr_u *) hio_peeraddr(io), local_port);
+
+    if (filter == NULL)
+    {
+        noTcpSocketConsumerFound(io);
+        return;
+    }
+    if (filter->option.no_delay)
+    {
+        tcp_nodelay(hio_fd(io), 1);
+    }
+
+    socket_accept_result_t *result = newSocketAcceptResult(tid);
+
+    *result     = (socket_accept_result_t){.io             = io,
+                                           .tunnel         = filter->tunnel,
+                                           .protocol       = kSapTcp,
+                                           .tid            = tid,
+                                           .real_localport = local_port,
+                                           .pool_owner     = tid};
+    hevent_t ev = (hevent_t){.loop = loop, .cb = filter->cb, .userdata = result};
+    filter->cb(&ev);
+}
+
+static void onRecvFromReusePort(hio_t *io, shift_buffer_t *buf)
+{
+    udpsock_t     *socket     = hevent_userdata(io);
+    hloop_t       *loop       = hevent_loop(io);
+    uint8_t        tid        = (uint8_t) hloop_tid(loop);
+    uint16_t       local_port = sockaddr_port((sockaddr_u *) hio_localaddr(io));
+    udp_payload_t *item       = newUpdPayload(tid);
+
+    *item = (udp_payload_t){.sock           = socket,
+                            .buf            = buf,
+                            .tid            = tid,
+                            .peer_addr      = *(sockaddr_u *) hio_peeraddr(io),
+                            .real_localport = local_port,
+                            .pool_owner     = tid};
+
+    socket_filter_t *filter = findFilter(kSapUdp, &item->peer_addr, local_port);
+    if (filter == NULL)
+    {
+        noUdpSocketConsumerFound(item);
+        return;
+    }
+    item->tunnel = filter->tunnel;
+    hevent_t ev  = (hevent_t){.loop = loop, .cb = filter->cb, .userdata = item};
+    filter->cb(&ev);
+}
+
+// runs on the worker that owns the socket
+static void startReusePortListener(hevent_t *ev)
+{
+    reuse_port_listener_t *listener = hevent_userdata(ev);
+    hio_t                 *io       = hio_get(ev->loop, listener->fd);
+
+    if (listener->protocol == kSapTcp)
+    {
+        hio_setcb_accept(io, onAcceptTcpReusePort);
+        hio_accept(io);
+    }
+    else
+    {
+        udpsock_t *socket = malloc(sizeof(udpsock_t));
+        *socket           = (udpsock_t){.io = io, .table = newIdleTable()};
+        hevent_set_userdata(io, socket);
+        hio_set_batch(io, listener->udp_batch);
+        hio_setcb_read(io, onRecvFromReusePort);
+        hio_read(io);
+    }
+    free(listener);
+}
+
+static int createReusePortSocket(const char *host, uint16_t port, int sock_type)
+{
+    sockaddr_u addr;
+    if (sockaddr_set_ipport(&addr, host, port) != 0)
+    {
+        return -1;
+    }
+    int sockfd = socket(addr.sa.sa_family, sock_type, 0);
+    if (sockfd < 0)
+    {
+        return -1;
+    }
+    so_reuseaddr(sockfd, 1);
+    so_reuseport(sockfd, 1);
+    if (addr.sa.sa_family == AF_INET6)
+    {
+        ip_v6only(sockfd, 0);
+    }
+    if (bind(sockfd, &addr.sa, sockaddr_len(&addr)) < 0 ||
+        (sock_type == SOCK_STREAM && listen(sockfd, SOMAXCONN) < 0))
+    {
+        closesocket(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+static bool attachCpuSteering(int sockfd)
+{
+    struct sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t) (SKF_AD_OFF + SKF_AD_CPU)}, // a = current cpu
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, workers_count},                      // a = a % workers
+        {BPF_RET | BPF_A, 0, 0, 0},                                           // socket index = a
+    };
+    struct sock_fprog prog = {.len = sizeof(code) / sizeof(code[0]), .filter = code};
+    return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == 0;
+}
+
+static void listenReusePortFilter(socket_filter_t *filter)
+{
+    socket_filter_option_t option    = filter->option;
+    const int              sock_type = option.protocol == kSapTcp ? SOCK_STREAM : SOCK_DGRAM;
+    const char            *proto_str = option.protocol == kSapTcp ? "TCP" : "UDP";
+
+    for (unsigned int tid = 0; tid < workers_count; tid++)
+    {
+        int sockfd = createReusePortSocket(option.host, option.port_min, sock_type);
+        if (sockfd < 0)
+        {
+            LOGF("SocketManager: could not listen on %s:[%u] (%s) with SO_REUSEPORT, error: %s", option.host,
+                 option.port_min, proto_str, strerror(errno));
+            exit(1);
+        }
+        if (sock_type == SOCK_STREAM)
+        {
+            enableFastOpen(filter, sockfd);
+        }
+        if (tid == 0 && option.reuse_port_cpu_steering && ! attachCpuSteering(sockfd))
+        {
+            LOGW("SocketManager: could not attach the cpu steering program on %s:[%u] (%s), error: %s",
+                 option.host, option.port_min, proto_str, strerror(errno));
+        }
+
+        reuse_port_listener_t *listener = malloc(sizeof(reuse_port_listener_t));
+        *listener = (reuse_port_listener_t){.fd = sockfd, .protocol = option.protocol, .udp_batch = option.udp_batch};
+
+        hevent_t ev = (hevent_t){.loop = loops[tid], .cb = startReusePortListener, .userdata = listener};
+        hloop_post_event(loops[tid], &ev);
+    }
+    LOGI("SocketManager: listening on %s:[%u] (%s) with %u SO_REUSEPORT sockets", option.host, option.port_min,
+         proto_str, workers_count);
+}
+#endif
+
+static void listenReusePort(void)
+{
+    uint8_t ports_overlapped[2][65536] = {{0}};
+    for (int ri = (kFilterLevels - 1); ri >= 0; ri--)
+    {
+        c_foreach(k, filters_t, state->filters[ri])
+        {
+            socket_filter_t *filter = *(k.ref);
+            if (! filter->option.reuse_port)
+            {
+                continue;
+            }
+            if (! usesReusePort(&(filter->option)))
+            {
+                LOGW("SocketManager: reuseport is only available for single port listeners on linux, %s:[%u - %u] "
+                     "uses the accept thread",
+                     filter->option.host, filter->option.port_min, filter->option.port_max);
+                continue;
+            }
+#ifdef OS_LINUX
+            uint8_t *ports = ports_overlapped[filter->option.protocol == kSapTcp ? 0 : 1];
+            if (ports[filter->option.port_min] == 0)
+            {
+                ports[filter->option.port_min] = 1;
+                listenReusePortFilter(filter);
+            }
+#endif
+        }
+    }
+}
+
 static HTHREAD_ROUTINE(accept_thread) // NOLINT
 {
     (void) userdata;
@@ -846,10 +923,12 @@ static HTHREAD_ROUTINE(accept_thread) // NOLINT
 
     {
         uint8_t ports_overlapped[65536] = {0};
+        markReusePortPorts(kSapTcp, ports_overlapped);
         listenTcp(loop, ports_overlapped);
     }
     {
         uint8_t ports_overlapped[65536] = {0};
+        markReusePortPorts(kSapUdp, ports_overlapped);
         listenUdp(loop, ports_overlapped);
     }
     hhybridmutex_unlock(&(state->mutex));
@@ -870,9 +949,26 @@ void setSocketManager(struct socket_manager_s *new_state)
     state = new_state;
 }
 
+static void compileFilters(void)
+{
+    state->filter_index = newSocketFilterIndex();
+    for (int ri = (kFilterLevels - 1); ri >= 0; ri--)
+    {
+        c_foreach(k, filters_t, state->filters[ri])
+        {
+            socket_filter_t *filter = *(k.ref);
+            addSocketFilterToIndex(state->filter_index, &(filter->option), filter);
+        }
+    }
+    compileSocketFilterIndex(state->filter_index);
+}
+
 void startSocketManager(void)
 {
     assert(state != NULL);
+    state->started = true;
+    compileFilters();
+    listenReusePort();
     // accept_thread(accept_thread_loop);
     state->accept_thread = hthread_create(accept_thread, NULL);
 }
@@ -889,22 +985,10 @@ socket_manager_state_t *createSocketManager(void)
 
     hhybridmutex_init(&state->mutex);
 
-    state->udp_pools = malloc(sizeof(*state->udp_pools) * workers_count);
-    memset(state->udp_pools, 0, sizeof(*state->udp_pools) * workers_count);
-
-    state->tcp_pools = malloc(sizeof(*state->tcp_pools) * workers_count);
-    memset(state->tcp_pools, 0, sizeof(*state->tcp_pools) * workers_count);
-
-    for (unsigned int i = 0; i < workers_count; ++i)
-    {
-        state->udp_pools[i].pool =
-            newGenericPoolWithSize((8) + ram_profile, allocUdpPayloadPoolHandle, destroyUdpPayloadPoolHandle);
-        hhybridmutex_init(&(state->udp_pools[i].mutex));
-
-        state->tcp_pools[i].pool =
-            newGenericPoolWithSize((8) + ram_profile, allocTcpResultObjectPoolHandle, destroyTcpResultObjectPoolHandle);
-        hhybridmutex_init(&(state->tcp_pools[i].mutex));
-    }
+    state->udp_pools = newPayloadPool(workers_count + 1, (8) + ram_profile, allocUdpPayloadPoolHandle,
+                                      destroyUdpPayloadPoolHandle);
+    state->tcp_pools = newPayloadPool(workers_count + 1, (8) + ram_profile, allocTcpResultObjectPoolHandle,
+                                      destroyTcpResultObjectPoolHandle);
 
     state->iptables_installed = checkCommandAvailable("iptables");
     state->lsof_installed     = checkCommandAvailable("lsof");
@@ -29,15 +29,15 @@ typedef struct socket_filter_option_s
     char                       **black_list_raddr;
     bool                         fast_open;
     bool                         no_delay;
+    unsigned int                 udp_batch; // datagrams per recvmmsg/sendmmsg, 0 or 1 means no batching
+    // every worker listens on the port with its own SO_REUSEPORT socket instead of the accept thread (linux)
+    bool                         reuse_port;
+    // with reuse_port, connections are steered to the worker with the tid equal to the cpu that received them
+    bool                         reuse_port_cpu_steering;
 
     // private
-    unsigned int white_list_parsed_length;
-    struct
-    {
-        struct in6_addr ip_bytes_buf;
-        struct in6_addr mask_bytes_buf;
-
-    } *white_list_parsed;
+    struct cidr_trie_s *white_list_trie;
+    struct cidr_trie_s *black_list_trie;
 
 } socket_filter_option_t;
 
@@ -50,6 +50,9 @@ typedef struct socket_accept_result_s
     uint8_t                      tid;
     uint16_t                     real_localport;
 
+    // private
+    uint8_t pool_owner;
+
 } socket_accept_result_t;
 
 typedef void (*onAccept)(hevent_t *ev);
@@ -72,6 +75,9 @@ typedef struct udp_payload_s
     uint16_t        real_localport;
     shift_buffer_t *buf;
 
+    // private
+    uint8_t pool_owner;
+
 } udp_payload_t;
 
 void destroyUdpPayload(udp_payload_t *);
@@ -80,5 +86,5 @@ struct socket_manager_s *getSocketManager(void);
 struct socket_manager_s *createSocketManager(void);
 void                     setSocketManager(struct socket_manager_s *state);
 void                     startSocketManager(void);
-void                     registerSocketAcceptor(tunnel_t *tunnel, socket_filter_option_t option, onAccept cb);
-void                     postUdpWrite(udpsock_t *socket_io,uint8_t tid_from, shift_buffer_t *buf);
+bool                     registerSocketAcceptor(tunnel_t *tunnel, socket_filter_option_t option, onAccept cb);
+void postUdpWrite(udpsock_t *socket_io, uint8_t tid_from, const sockaddr_u *peer_addr, shift_buffer_t *buf);
@@ -0,0 +1,111 @@
+#pragma once
+#include "loop_trace.h"
+#include "ww.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+    Metrics
+
+    every worker counts into its own worker_metrics_t, a counter is written only by the worker that owns it
+    (a relaxed load and store, no lock and no locked instruction) and read by the metrics thread with relaxed
+    loads, the workers are summed when the endpoint is scraped
+
+    worker_metrics is NULL when metrics are disabled (misc -> metrics-port in core.json), code that counts
+    outside the metered tunnels has to check it
+
+    per node counters are filled by the tunnel wrappers installed by the metrics manager (meterTunnel), pool
+    numbers and the loop lag are published by each worker from a timer on its own loop
+
+    histograms keep a count per bucket (not cumulative), the bounds are in kMetricsHistogramBoundsUs
+
+    with LOOP_TRACE the loops also record their busy time, callback times and slowest callbacks here
+    (see loop_trace.h)
+*/
+
+enum
+{
+    kMetricsMaxNodes         = 128,
+    kMetricsHistogramBuckets = 16 // the last one is +Inf
+};
+
+typedef _Atomic uint64_t metric_t;
+
+typedef struct metrics_histogram_s
+{
+    metric_t buckets[kMetricsHistogramBuckets];
+    metric_t sum_us;
+    metric_t count;
+
+} metrics_histogram_t;
+
+typedef struct node_metrics_s
+{
+    metric_t bytes_up;
+    metric_t bytes_down;
+    metric_t contexts_up;
+    metric_t contexts_down;
+    metric_t lines_opened;
+    metric_t lines_closed;
+
+} node_metrics_t;
+
+typedef struct pool_metrics_s
+{
+    metric_t available;
+    metric_t allocated;
+    metric_t hits;
+    metric_t misses;
+
+} pool_metrics_t;
+
+typedef struct worker_metrics_s
+{
+    metric_t            line_pauses;
+    pool_metrics_t      buffer_pool;
+    pool_metrics_t      context_pool;
+    pool_metrics_t      line_pool;
+    metrics_histogram_t loop_lag; // how late a timer of the loop fires, the loop was busy for that long
+#ifdef LOOP_TRACE
+    metrics_histogram_t loop_busy;                          // an iteration, from the poll returning to the next poll
+    metrics_histogram_t callbacks[kLoopTraceKinds];         // a single callback, by kind
+    metric_t            slowest_callbacks[kLoopTraceSlowest]; // packed, see loopTracePackSlowest
+#endif
+    node_metrics_t      nodes[kMetricsMaxNodes];
+
+} ATTR_ALIGNED_LINE_CACHE worker_metrics_t;
+
+extern const uint64_t kMetricsHistogramBoundsUs[kMetricsHistogramBuckets - 1];
+
+// only the owner worker calls these
+static inline void metricAdd(metric_t *m, uint64_t value)
+{
+    atomic_store_explicit(m, atomic_load_explicit(m, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static inline void metricSet(metric_t *m, uint64_t value)
+{
+    atomic_store_explicit(m, value, memory_order_relaxed);
+}
+
+static inline uint64_t metricGet(metric_t *m)
+{
+    return atomic_load_explicit(m, memory_order_relaxed);
+}
+
+static inline void metricObserve(metrics_histogram_t *h, uint64_t value_us)
+{
+    unsigned int i = 0;
+    while (i < kMetricsHistogramBuckets - 1 && value_us > kMetricsHistogramBoundsUs[i])
+    {
+        i++;
+    }
+    metricAdd(&(h->buckets[i]), 1);
+    metricAdd(&(h->sum_us), value_us);
+    metricAdd(&(h->count), 1);
+}
+
+static inline worker_metrics_t *getWorkerMetrics(uint8_t tid)
+{
+    return worker_metrics == NULL ? NULL : &(worker_metrics[tid]);
+}
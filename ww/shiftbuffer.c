@@ -1,4 +1,5 @@
 #include "shiftbuffer.h"
+#include "buffer_slab.h"
 #include "utils/mathutils.h"
 #include "ww.h"
 #include <assert.h> // for assert
@@ -9,38 +10,71 @@
 
 #define PREPADDING ((ram_profile >= kRamProfileS2Memory ? (1U << 11) : (1U << 8)) + 512)
 
-void destroyShiftBuffer(shift_buffer_t *self)
+// the thread that drops the last reference of a slot (payload owners and its header) gives it back
+static void dropSlotRef(atomic_uint *refc, unsigned int count)
 {
-    // if its a shallow then the underlying buffer survives
-    *(self->refc) -= 1;
+    if (atomic_fetch_sub_explicit(refc, count, memory_order_acq_rel) == count)
+    {
+        releaseBufferSlot(slotOfRefc(refc));
+    }
+}
 
-    if (*(self->refc) <= 0)
+static void dropPayload(atomic_uint *refc)
+{
+    dropSlotRef(refc, 1);
+}
+
+static void releaseHeader(shift_buffer_t *self)
+{
+    if (self->slot_header)
     {
-        free(self->pbuf - self->_offset);
-        free(self->refc);
+        dropSlotRef(&(slotOfHeader(self)->refc), kBufferSlotHeaderAlive);
+        return;
     }
     free(self);
 }
 
-shift_buffer_t *newShiftBuffer(unsigned int pre_cap)
+// the buffer moves to a new heap payload of real_cap bytes, the caller copies the data and drops the old one
+static void attachHeapPayload(shift_buffer_t *self, unsigned int real_cap)
+{
+    buffer_slot_t *slot = newHeapBufferSlot(real_cap, false);
+    self->refc          = &slot->refc;
+    self->pbuf          = (char *) slotPayload(slot);
+    self->full_cap      = real_cap;
+    self->_offset       = 0;
+}
+
+void destroyShiftBuffer(shift_buffer_t *self)
+{
+    // if its a shallow then the underlying buffer survives
+    dropPayload(self->refc);
+    releaseHeader(self);
+}
+
+unsigned int shiftBufferRealCap(unsigned int pre_cap)
 {
     if (pre_cap != 0 && pre_cap % 16 != 0)
     {
         pre_cap = (unsigned int) pow(2, ceil(log2((double) max(16, pre_cap))));
     }
+    return pre_cap + (PREPADDING);
+}
 
-    unsigned int real_cap = pre_cap + (PREPADDING);
+// header, refc and payload in 1 heap block
+shift_buffer_t *newShiftBuffer(unsigned int pre_cap)
+{
+    unsigned int real_cap = shiftBufferRealCap(pre_cap);
 
-    shift_buffer_t *self = malloc(sizeof(shift_buffer_t));
+    buffer_slot_t  *slot = newHeapBufferSlot(real_cap, true);
+    shift_buffer_t *self = &slot->header;
 
-    // todo (optimize) i think refc and pbuf could be in 1 malloc
-    *self         = (shift_buffer_t){.calc_len = 0,
-                                     ._offset  = 0,
-                                     .curpos   = PREPADDING,
-                                     .full_cap = real_cap,
-                                     .refc     = malloc(sizeof(self->refc[0])),
-                                     .pbuf     = malloc(real_cap)};
-    *(self->refc) = 1;
+    *self = (shift_buffer_t){.calc_len    = 0,
+                             ._offset     = 0,
+                             .curpos      = PREPADDING,
+                             .full_cap    = real_cap,
+                             .refc        = &slot->refc,
+                             .pbuf        = (char *) slotPayload(slot),
+                             .slot_header = true};
 
     if (real_cap > 0) // map the virtual memory page to physical memory
     {
@@ -55,11 +89,33 @@ shift_buffer_t *newShiftBuffer(unsigned int pre_cap)
     return self;
 }
 
+/*
+    header, refc and payload all come from 1 slab slot, no malloc at all
+    the slab pages are not touched here, they get mapped on first write
+*/
+shift_buffer_t *newShiftBufferInSlab(struct buffer_slab_allocator_s *allocator)
+{
+    assert(allocator->payload_cap > (PREPADDING));
+
+    buffer_slot_t  *slot = popBufferSlot(allocator);
+    shift_buffer_t *self = &slot->header;
+
+    *self = (shift_buffer_t){.calc_len    = 0,
+                             ._offset     = 0,
+                             .curpos      = PREPADDING,
+                             .full_cap    = allocator->payload_cap,
+                             .refc        = &slot->refc,
+                             .pbuf        = (char *) slotPayload(slot),
+                             .slot_header = true};
+    return self;
+}
+
 shift_buffer_t *newShallowShiftBuffer(shift_buffer_t *owner)
 {
-    *(owner->refc) += 1;
+    atomic_fetch_add_explicit(owner->refc, 1, memory_order_relaxed);
     shift_buffer_t *shallow = malloc(sizeof(shift_buffer_t));
     *shallow                = *owner;
+    shallow->slot_header    = false;
 
     return shallow;
 }
@@ -69,74 +125,69 @@ void reset(shift_buffer_t *self, unsigned int pre_cap)
 {
     assert(! isShallow(self));
 
-    if (pre_cap != 0 && pre_cap % 16 != 0)
+    unsigned int real_cap = shiftBufferRealCap(pre_cap);
+
+    // undo constrainLeft and constrainRight, the whole slot payload is ours again
+    self->pbuf -= self->_offset;
+    self->_offset  = 0;
+    self->full_cap = slotPayloadCap(slotOfRefc(self->refc));
+
+    // a header that lost its own payload (expand, slicing) takes it back if the size fits
+    if (self->slot_header)
     {
-        pre_cap = (unsigned int) pow(2, ceil(log2(((double) max(16, pre_cap)))));
+        buffer_slot_t *home = slotOfHeader(self);
+        if ((atomic_load_explicit(&home->refc, memory_order_acquire) & kShiftBufferRefcMask) == 0 &&
+            slotPayloadCap(home) == real_cap)
+        {
+            // nobody else owns the home payload, only this live header keeps the slot
+            dropPayload(self->refc);
+            atomic_fetch_add_explicit(&home->refc, 1, memory_order_relaxed);
+            self->refc     = &home->refc;
+            self->pbuf     = (char *) slotPayload(home);
+            self->full_cap = real_cap;
+        }
     }
 
-    unsigned int real_cap = pre_cap + (PREPADDING);
-
     if (self->full_cap != real_cap)
     {
-        free(self->pbuf - self->_offset);
-        self->pbuf     = malloc(real_cap);
-        self->full_cap = real_cap;
+        atomic_uint *old_refc = self->refc;
+        attachHeapPayload(self, real_cap);
+        dropPayload(old_refc);
         // memset(self->pbuf, 0, real_cap);
     }
     self->calc_len = 0;
-    self->_offset  = 0;
     self->curpos   = PREPADDING;
 }
 
 void unShallow(shift_buffer_t *self)
 {
-    if (*(self->refc) <= 1)
+    if (! isShallow(self))
     {
         // not a shallow
         assert(false);
         return;
     }
 
-    *(self->refc) -= 1;
-    self->refc    = malloc(sizeof(unsigned int));
-    *(self->refc) = 1;
-    char *old_buf = self->pbuf;
-    self->pbuf    = malloc(self->full_cap);
-    self->_offset = 0;
+    atomic_uint *old_refc = self->refc;
+    char        *old_buf  = self->pbuf;
+    attachHeapPayload(self, self->full_cap);
     memcpy(&(self->pbuf[self->curpos]), &(old_buf[self->curpos]), (self->calc_len));
+    dropPayload(old_refc);
 }
 
 void expand(shift_buffer_t *self, unsigned int increase)
 {
-    if (isShallow(self))
-    {
-        const unsigned int old_realcap = self->full_cap;
-        unsigned int       new_realcap = (unsigned int) pow(2, ceil(log2((old_realcap) + (increase * 2))));
-        // unShallow
-        *(self->refc) -= 1;
-        self->refc       = malloc(sizeof(unsigned int));
-        *(self->refc)    = 1;
-        char *old_buf    = self->pbuf;
-        self->pbuf       = malloc(new_realcap);
-        self->_offset    = 0;
-        unsigned int dif = (new_realcap - self->full_cap) / 2;
-        memcpy(&(self->pbuf[self->curpos + dif]), &(old_buf[self->curpos]), self->calc_len);
-        self->curpos += dif;
-        self->full_cap = new_realcap;
-    }
-    else
-    {
-        const unsigned int old_realcap = self->full_cap;
-        unsigned int       new_realcap = (unsigned int) pow(2, ceil(log2((old_realcap) + (increase * 2))));
-        char              *old_buf     = self->pbuf;
-        self->pbuf                     = malloc(new_realcap);
-        unsigned int dif               = (new_realcap - self->full_cap) / 2;
-        memcpy(&(self->pbuf[self->curpos + dif]), &(old_buf[self->curpos]), self->calc_len);
-        self->curpos += dif;
-        self->full_cap = new_realcap;
-        free(old_buf - self->_offset);
-        self->_offset = 0;
-    }
+    // a shallow gets its own payload here, otherwise the old one is given back
+    const unsigned int old_realcap = self->full_cap;
+    unsigned int       new_realcap = (unsigned int) pow(2, ceil(log2((old_realcap) + (increase * 2))));
+    atomic_uint       *old_refc    = self->refc;
+    char              *old_buf     = self->pbuf;
+
+    attachHeapPayload(self, new_realcap);
+    unsigned int dif = (new_realcap - old_realcap) / 2;
+    memcpy(&(self->pbuf[self->curpos + dif]), &(old_buf[self->curpos]), self->calc_len);
+    self->curpos += dif;
+    dropPayload(old_refc);
 }
 
 void concatBuffer(shift_buffer_t *restrict root, shift_buffer_t *restrict buf)
@@ -162,9 +213,14 @@ void sliceBufferTo(shift_buffer_t *restrict dest, shift_buffer_t *restrict sourc
         return;
     }
 
-    shift_buffer_t tmp = *source;
-    *source            = *dest;
-    *dest              = tmp;
+    // payloads are swapped, but each header stays where it was allocated
+    const bool     source_slot_header = source->slot_header;
+    const bool     dest_slot_header   = dest->slot_header;
+    shift_buffer_t tmp                = *source;
+    *source                           = *dest;
+    *dest                             = tmp;
+    source->slot_header               = source_slot_header;
+    dest->slot_header                 = dest_slot_header;
 
     setLen(source, total - bytes);
     memcpy(rawBufMut(source), &(((char *) rawBuf(dest))[bytes]), total - bytes);
@@ -175,33 +231,9 @@ shift_buffer_t *sliceBuffer(shift_buffer_t *self, unsigned int bytes)
 {
     assert(bytes <= bufLen(self));
 
+    // the payload swap of sliceBufferTo keeps each header in its own slot
     shift_buffer_t *newbuf = newShiftBuffer(self->full_cap / 2);
-
-    if (bytes <= bufLen(self) / 2)
-    {
-        setLen(newbuf, bytes);
-        memcpy(rawBufMut(newbuf), rawBuf(self), bytes);
-        shiftr(self, bytes);
-        return newbuf;
-    }
-
-    void        *tmp_pbuf   = self->pbuf;
-    void        *tmp_refc   = self->refc;
-    unsigned int tmp_offset = self->_offset;
-
-    self->refc    = newbuf->refc;
-    self->pbuf    = newbuf->pbuf;
-    self->_offset = newbuf->_offset;
-    *newbuf       = (struct shift_buffer_s){.calc_len = self->calc_len,
-                                            .curpos   = self->curpos,
-                                            .full_cap = self->full_cap,
-                                            .pbuf     = tmp_pbuf,
-                                            .refc     = tmp_refc,
-                                            ._offset  = tmp_offset};
-
-    memcpy(rawBufMut(self), &(((char *) rawBuf(newbuf))[bytes]), bufLen(newbuf) - bytes);
-    shiftr(self, bytes);
-    setLen(newbuf, bytes);
+    sliceBufferTo(newbuf, self, bytes);
     return newbuf;
 }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -24,22 +25,39 @@
     This buffer is supposed to be taken out of a pool (buffer_pool.h)
     and some of the other useful functions are defined there
 
+    a payload and its refcount always live in 1 buffer slot (buffer_slab.h), carved from a slab in slab mode
+    or a single heap block otherwise, a new buffer also keeps its header in the slot of its first payload,
+    so creating one costs 1 allocation (none in slab mode) and a shallow copy costs 1 (its header)
+
+    the refcount is atomic, a payload and its shallow copies may be dropped on different threads (a payload handed
+    to another worker), its top bit tells that the header of the slot is still alive (kBufferSlotHeaderAlive)
+
 
 */
 
 struct shift_buffer_s
 {
     char         *pbuf;
-    unsigned int *refc;
+    atomic_uint  *refc;
     unsigned int  calc_len;
     unsigned int  curpos;
     unsigned int  full_cap;
     unsigned int  _offset;
+    bool          slot_header; // this struct itself lives in a buffer slot, otherwise it was malloced alone
 };
 
 typedef struct shift_buffer_s shift_buffer_t;
 
+enum
+{
+    kShiftBufferRefcMask = 0x7FFFFFFF // the payload owners, the bit above is kBufferSlotHeaderAlive
+};
+
+struct buffer_slab_allocator_s;
+
 shift_buffer_t *newShiftBuffer(unsigned int pre_cap);
+shift_buffer_t *newShiftBufferInSlab(struct buffer_slab_allocator_s *allocator);
+unsigned int    shiftBufferRealCap(unsigned int pre_cap);
 shift_buffer_t *newShallowShiftBuffer(shift_buffer_t *owner);
 void            destroyShiftBuffer(shift_buffer_t *self);
 void            reset(shift_buffer_t *self, unsigned int cap);
@@ -52,7 +70,7 @@ shift_buffer_t *shallowSliceBuffer(shift_buffer_t *self, unsigned int bytes);
 
 static inline bool isShallow(shift_buffer_t *self)
 {
-    return (*(self->refc) > 1);
+    return (atomic_load_explicit(self->refc, memory_order_relaxed) & kShiftBufferRefcMask) > 1;
 }
 
 // caps mean how much memory we own to be able to shift left/right
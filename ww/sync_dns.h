@@ -1,6 +1,6 @@
 #pragma once
 #include "basic_types.h"
 
-// TODO (internal cache , prefer v4/6)
+// blocking getaddrinfo, the workers use the non blocking resolver of async_dns.h
 bool resolveContextSync(socket_context_t *s_ctx);
 
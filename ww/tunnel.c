@@ -39,7 +39,35 @@ tunnel_t *newTunnel(void)
 pool_item_t *allocLinePoolHandle(struct generic_pool_s *pool)
 {
     (void) pool;
-    return malloc(sizeof(line_t));
+    return malloc(lineSize());
+}
+
+/*
+    the pools were charged with lines of the previous length, the ones still in a pool are dropped and made again,
+    a line that is alive keeps its size, so it is only safe to shrink or to grow before any line is made
+
+    runs on the main thread before runMainThread starts the workers, the pools of every worker are still its own
+*/
+void setLineChainLen(unsigned int chain_len)
+{
+    assert(chain_len >= 1 && chain_len <= kMaxChainLen);
+    if (chain_len == line_chain_len)
+    {
+        return;
+    }
+    const bool grows = chain_len > line_chain_len;
+    (void) grows;
+    line_chain_len = chain_len;
+    for (unsigned int i = 0; i < workers_count; i++)
+    {
+        generic_pool_t *pool = line_pools[i];
+        assert(! grows || pool->allocated == pool->len);
+        while (pool->len > 0)
+        {
+            poolShrink(pool);
+        }
+        poolReCharge(pool);
+    }
 }
 void destroyLinePoolHandle(struct generic_pool_s *pool, pool_item_t *item)
 {
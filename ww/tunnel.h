@@ -3,6 +3,7 @@
 #include "buffer_pool.h"
 #include "generic_pool.h"
 #include "hloop.h"
+#include "metrics.h"
 #include "shiftbuffer.h"
 #include "ww.h"
 
@@ -100,6 +101,9 @@ typedef uint32_t line_refc_t;
     line holds all the info such as dest and src contexts, it also contains each tunnel per connection state
     in chains_state[(tunnel_index)]
 
+    chains_state is only as long as the longest chain of the running config (line_chain_len, set by the node
+    manager with setLineChainLen once every node is running), so the line pools hand out lines of that size
+
     a line only belongs to 1 thread, but it can cross the threads (if actually needed) using pipe line, easily
 
 */
@@ -111,6 +115,7 @@ typedef struct line_s
     const uint8_t    tid;
     bool             up_piped;
     bool             dw_piped;
+    uint8_t          auth_cur;
     void            *up_state;
     void            *dw_state;
     LineFlowSignal   up_pause_cb;
@@ -119,8 +124,7 @@ typedef struct line_s
     LineFlowSignal   dw_resume_cb;
     socket_context_t src_ctx;
     socket_context_t dest_ctx;
-    void            *chains_state[kMaxChainLen];
-    uint8_t          auth_cur;
+    void            *chains_state[]; // line_chain_len entries
 
 } line_t;
 
@@ -147,6 +151,13 @@ struct tunnel_s;
 
 typedef void (*TunnelFlowRoutine)(struct tunnel_s *, struct context_s *);
 
+/*
+    set only by the plain tcp socket adapters, the bytes of a line go to / come from one tcp socket untouched and this
+    returns the io of that socket (NULL if the tunnel has no state for the line), two of them chained directly can
+    relay with hio_splice
+*/
+typedef hio_t *(*TunnelTcpIoGetter)(struct tunnel_s *, struct line_s *);
+
 /*
     Tunnel is just a doubly linked list, it has its own state, per connection state is stored in line structure
     which later gets accessed by the chain_index which is fixed
@@ -160,7 +171,14 @@ typedef struct tunnel_s // 48
     TunnelFlowRoutine upStream;
     TunnelFlowRoutine downStream;
 
+    TunnelTcpIoGetter getTcpIo;
+
     uint8_t chain_index;
+
+    // private, set by meterTunnel when metrics are enabled, the wrappers count and call these
+    uint8_t           metrics_index;
+    TunnelFlowRoutine metered_up_stream;
+    TunnelFlowRoutine metered_down_stream;
 } tunnel_t;
 
 tunnel_t *newTunnel(void);
@@ -177,25 +195,31 @@ void      pipeTo(tunnel_t *self, line_t *l, uint8_t tid);
 // pool handles, instead of malloc / free for the generic pool
 pool_item_t *allocLinePoolHandle(struct generic_pool_s *pool);
 void         destroyLinePoolHandle(struct generic_pool_s *pool, pool_item_t *item);
+void         setLineChainLen(unsigned int chain_len);
+
+static inline size_t lineSize(void)
+{
+    return sizeof(line_t) + (sizeof(void *) * line_chain_len);
+}
 
 static inline line_t *newLine(uint8_t tid)
 {
     line_t *result = popPoolItem(line_pools[tid]);
 
     line_t newline = (line_t){
-        .tid          = tid,
-        .refc         = 1,
-        .auth_cur     = 0,
-        .alive        = true,
-        .chains_state = {0},
+        .tid      = tid,
+        .refc     = 1,
+        .auth_cur = 0,
+        .alive    = true,
         // to set a port we need to know the AF family, default v4
         .dest_ctx = (socket_context_t){.address.sa = (struct sockaddr){.sa_family = AF_INET, .sa_data = {0}}},
         .src_ctx  = (socket_context_t){.address.sa = (struct sockaddr){.sa_family = AF_INET, .sa_data = {0}}},
     };
     // there were no way because we declared tid as const, but im sure compiler will know what to do here
-    // forexample gcc has builtins 
+    // forexample gcc has builtins
     memcpy(result, &newline, sizeof(line_t));
-    
+    memset(result->chains_state, 0, sizeof(void *) * line_chain_len);
+
     return result;
 }
 
@@ -240,10 +264,20 @@ static inline void doneLineDownSide(line_t *l)
     l->dw_state = NULL;
 }
 
+static inline void countLinePause(line_t *l)
+{
+    worker_metrics_t *metrics = getWorkerMetrics(l->tid);
+    if (metrics)
+    {
+        metricAdd(&(metrics->line_pauses), 1);
+    }
+}
+
 static inline void pauseLineUpSide(line_t *l)
 {
     if (l->up_state)
     {
+        countLinePause(l);
         l->up_pause_cb(l->up_state);
     }
 }
@@ -252,6 +286,7 @@ static inline void pauseLineDownSide(line_t *l)
 {
     if (l->dw_state)
     {
+        countLinePause(l);
         l->dw_pause_cb(l->dw_state);
     }
 }
@@ -285,7 +320,7 @@ static inline void internalUnRefLine(line_t *l)
     assert(l->alive == false);
 
     // there should not be any conn-state alive at this point
-    for (size_t i = 0; i < kMaxChainLen; i++)
+    for (size_t i = 0; i < line_chain_len; i++)
     {
         assert(LSTATE_I(l, i) == NULL);
     }
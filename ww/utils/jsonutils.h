@@ -14,6 +14,11 @@ bool getStringFromJsonObject(char **dest, const cJSON *json_obj, const char *key
 bool getStringFromJsonObjectOrDefault(char **dest, const cJSON *json_obj, const char *key, const char *def);
 bool getStringFromJson(char **dest, const cJSON *json_str_node);
 
+// will allocate dest, a NULL terminated list of "ip/prefix" strings, dest stays NULL when the array is not given
+// returns false if an item is not a valid ip/prefix, the reason goes to the logger
+struct logger_s;
+bool getIpCidrListFromJsonObject(char ***dest, const cJSON *json_obj, const char *key, struct logger_s *logger);
+
 bool getPortFromJsonObject(uint16_t *dest_pmin, const cJSON *json_obj, uint16_t *dest_pmax, const char *key);
 
 
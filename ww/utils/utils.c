@@ -178,6 +178,41 @@ bool getStringFromJsonObjectOrDefault(char **dest, const cJSON *json_obj, const
     return true;
 }
 
+bool getIpCidrListFromJsonObject(char ***dest, const cJSON *json_obj, const char *key, struct logger_s *logger)
+{
+    assert(*dest == NULL);
+    const cJSON *jlist = cJSON_GetObjectItemCaseSensitive(json_obj, key);
+    if (! cJSON_IsArray(jlist) || cJSON_GetArraySize(jlist) <= 0)
+    {
+        return true;
+    }
+    const size_t len  = cJSON_GetArraySize(jlist);
+    char       **list = (char **) malloc(sizeof(char *) * (len + 1));
+    memset((void *) list, 0, sizeof(char *) * (len + 1));
+
+    int          i         = 0;
+    const cJSON *list_item = NULL;
+    cJSON_ArrayForEach(list_item, jlist)
+    {
+        if (! getStringFromJson(&(list[i]), list_item) || ! verifyIpCdir(list[i], logger))
+        {
+            if (logger && list[i] == NULL)
+            {
+                logger_print(logger, LOG_LEVEL_ERROR, "%s index %d : expected an \"ip/prefix\" string", key, i);
+            }
+            for (int k = 0; k <= i; k++)
+            {
+                free(list[k]);
+            }
+            free((void *) list);
+            return false;
+        }
+        i++;
+    }
+    *dest = list;
+    return true;
+}
+
 void sockAddrCopy(sockaddr_u *restrict dest, const sockaddr_u *restrict source)
 {
     if (source->sa.sa_family == AF_INET)
@@ -1,4 +1,5 @@
 #include "ww.h"
+#include "async_dns.h"
 #include "buffer_pool.h"
 #include "generic_pool.h"
 #include "hloop.h"
@@ -7,6 +8,8 @@
 #include "loggers/core_logger.h"
 #include "loggers/dns_logger.h"
 #include "loggers/network_logger.h"
+#include "loop_trace.h"
+#include "managers/metrics_manager.h"
 #include "managers/node_manager.h"
 #include "managers/socket_manager.h"
 #include "pipe_line.h"
@@ -19,14 +22,17 @@
 unsigned int             workers_count      = 0;
 hthread_t               *workers            = NULL;
 unsigned int             ram_profile        = 0;
+unsigned int             line_chain_len     = kMaxChainLen; // shrinks to the longest chain once the nodes run
 struct hloop_s         **loops              = NULL;
 struct buffer_pool_s   **buffer_pools       = NULL;
 struct generic_pool_s  **context_pools      = NULL;
 struct generic_pool_s  **line_pools         = NULL;
 struct generic_pool_s  **pipeline_msg_pools = NULL;
 struct generic_pool_s  **libhv_hio_pools    = NULL;
+struct dns_resolver_s  **dns_resolvers      = NULL;
 struct socket_manager_s *socekt_manager     = NULL;
 struct node_manager_s   *node_manager       = NULL;
+struct worker_metrics_s *worker_metrics     = NULL;
 logger_t                *core_logger        = NULL;
 logger_t                *network_logger     = NULL;
 logger_t                *dns_logger         = NULL;
@@ -36,14 +42,17 @@ struct ww_runtime_state_s
     unsigned int             workers_count;
     hthread_t               *workers;
     unsigned int             ram_profile;
+    unsigned int             line_chain_len;
     struct hloop_s         **loops;
     struct buffer_pool_s   **buffer_pools;
     struct generic_pool_s  **context_pools;
     struct generic_pool_s  **line_pools;
     struct generic_pool_s  **pipeline_msg_pools;
     struct generic_pool_s  **libhv_hio_pools;
+    struct dns_resolver_s  **dns_resolvers;
     struct socket_manager_s *socekt_manager;
     struct node_manager_s   *node_manager;
+    struct worker_metrics_s *worker_metrics;
     logger_t                *core_logger;
     logger_t                *network_logger;
     logger_t                *dns_logger;
@@ -54,14 +63,17 @@ void setWW(struct ww_runtime_state_s *state)
     workers_count      = state->workers_count;
     workers            = state->workers;
     ram_profile        = state->ram_profile;
+    line_chain_len     = state->line_chain_len;
     loops              = state->loops;
     buffer_pools       = state->buffer_pools;
     context_pools      = state->context_pools;
     line_pools         = state->line_pools;
     pipeline_msg_pools = state->pipeline_msg_pools;
     libhv_hio_pools    = state->libhv_hio_pools;
+    dns_resolvers      = state->dns_resolvers;
     socekt_manager     = state->socekt_manager;
     node_manager       = state->node_manager;
+    worker_metrics     = state->worker_metrics;
     setCoreLogger(state->core_logger);
     setNetworkLogger(state->network_logger);
     setDnsLogger(state->dns_logger);
@@ -77,14 +89,17 @@ struct ww_runtime_state_s *getWW(void)
     state->workers_count      = workers_count;
     state->workers            = workers;
     state->ram_profile        = ram_profile;
+    state->line_chain_len     = line_chain_len;
     state->loops              = loops;
     state->buffer_pools       = buffer_pools;
     state->context_pools      = context_pools;
     state->line_pools         = line_pools;
     state->pipeline_msg_pools = pipeline_msg_pools;
     state->libhv_hio_pools    = libhv_hio_pools;
+    state->dns_resolvers      = dns_resolvers;
     state->socekt_manager     = socekt_manager;
     state->node_manager       = node_manager;
+    state->worker_metrics     = worker_metrics;
     state->core_logger        = core_logger;
     state->network_logger     = network_logger;
     state->dns_logger         = dns_logger;
@@ -101,11 +116,28 @@ void idleFreeMem(htimer_t *timer)
 }
 #endif
 
+static HTHREAD_ROUTINE(worker_thread) // NOLINT
+{
+    hloop_t *loop = (hloop_t *) userdata;
+    hloop_run(loop);
+    hloop_free(&loop);
+
+    return 0;
+}
+
 // just because timer is considered "possibly lost" pointer
 htimer_t *trim_timer = NULL;
 
+/*
+    the worker threads start here, not in createWW, until then the main thread is the only one that touches the
+    per worker pools (the node manager resizes the lines of every worker once the nodes run, see setLineChainLen)
+*/
 _Noreturn void runMainThread(void)
 {
+    for (unsigned int i = 1; i < workers_count; ++i)
+    {
+        workers[i] = hthread_create(worker_thread, loops[i]);
+    }
 
 #if defined(OS_LINUX) && false
     trim_timer = htimer_add_period(loops[0], idleFreeMem, 2, 0, 0, 0, 0, INFINITE);
@@ -121,15 +153,6 @@ _Noreturn void runMainThread(void)
     exit(0);
 }
 
-static HTHREAD_ROUTINE(worker_thread) // NOLINT
-{
-    hloop_t *loop = (hloop_t *) userdata;
-    hloop_run(loop);
-    hloop_free(&loop);
-
-    return 0;
-}
-
 void createWW(const ww_construction_data_t init_data)
 {
     if (init_data.core_logger_data.log_file_path)
@@ -185,16 +208,31 @@ void createWW(const ww_construction_data_t init_data)
             newGenericPoolWithSize((32) + (2 * ram_profile), allocLinePoolHandle, destroyLinePoolHandle);
     }
 
-    loops      = (hloop_t **) malloc(sizeof(hloop_t *) * workers_count);
-    loops[0]   = hloop_new(HLOOP_FLAG_AUTO_FREE, buffer_pools[0], 0);
-    workers[0] = (hthread_t) NULL;
+    // every loop made from now on (workers, accept thread, ...) takes these
+    hloop_set_default_io_budget((hloop_io_budget_t){.read_bytes = init_data.read_budget_bytes,
+                                                    .reads      = init_data.read_budget_reads,
+                                                    .accepts    = init_data.accept_budget});
+
+    loops            = (hloop_t **) malloc(sizeof(hloop_t *) * workers_count);
+    dns_resolvers    = (struct dns_resolver_s **) malloc(sizeof(struct dns_resolver_s *) * workers_count);
+    loops[0]         = hloop_new(HLOOP_FLAG_AUTO_FREE, buffer_pools[0], 0);
+    dns_resolvers[0] = newDnsResolver(loops[0]);
+    workers[0]       = (hthread_t) NULL;
 
     for (unsigned int i = 1; i < workers_count; ++i)
     {
-        loops[i]   = hloop_new(HLOOP_FLAG_AUTO_FREE, buffer_pools[i], (uint8_t) i);
-        workers[i] = hthread_create(worker_thread, loops[i]);
+        loops[i]         = hloop_new(HLOOP_FLAG_AUTO_FREE, buffer_pools[i], (uint8_t) i);
+        dns_resolvers[i] = newDnsResolver(loops[i]);
+        workers[i]       = (hthread_t) NULL; // started by runMainThread
     }
 
     socekt_manager = createSocketManager();
     node_manager   = createNodeManager();
+    if (init_data.metrics)
+    {
+        worker_metrics = createMetricsManager();
+    }
+#ifdef LOOP_TRACE
+    installLoopTraceSignal();
+#endif
 }
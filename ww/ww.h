@@ -81,6 +81,10 @@ typedef struct
     logger_construction_data_t core_logger_data;
     logger_construction_data_t network_logger_data;
     logger_construction_data_t dns_logger_data;
+    bool                       metrics;
+    unsigned int               read_budget_bytes; // per wakeup limits of the loops (hloop_io_budget_t), 0: default
+    unsigned int               read_budget_reads;
+    unsigned int               accept_budget;
 
 } ww_construction_data_t;
 
@@ -91,14 +95,17 @@ _Noreturn void runMainThread(void);
 extern unsigned int             workers_count;
 extern hthread_t               *workers;
 extern unsigned int             ram_profile;
+extern unsigned int             line_chain_len;
 extern struct hloop_s         **loops;
 extern struct buffer_pool_s   **buffer_pools;
 extern struct generic_pool_s  **context_pools;
 extern struct generic_pool_s  **line_pools;
 extern struct generic_pool_s  **pipeline_msg_pools;
 extern struct generic_pool_s  **libhv_hio_pools;
+extern struct dns_resolver_s  **dns_resolvers;
 extern struct socket_manager_s *socket_disp_state;
 extern struct node_manager_s   *node_disp_state;
+extern struct worker_metrics_s *worker_metrics;
 extern struct logger_s         *core_logger;
 extern struct logger_s         *network_logger;
 extern struct logger_s         *dns_logger;